@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2006-07 The Kurupira Project
+ * 
+ * Kurupira is the legal property of its developers, whose names are not listed
+ * here. Please refer to the COPYRIGHT file.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+ * @file libkeys.c
+ * 
+ * Implementation of the cipher and MAC contexts kept for each direction of a
+ * session.
+ * 
+ * @version $Header$
+ * @ingroup libkeys
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#include <libfreedom/liblog.h>
+#include <util/util_crypto.h>
+
+#include "libkeys.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Number of bytes processed by the self test of a new context.
+ */
+#define TEST_LENGTH		64
+
+/*
+ * Largest block size of the hash functions used in HMAC.
+ */
+#define MAX_BLOCK_SIZE	128
+
+/*
+ * OpenSSL ciphers that implement the util cipher functions.
+ */
+static const struct {
+	char *name;
+	const EVP_CIPHER *(*cipher)(void);
+} ciphers[] = {
+	{"blowfish-cbc", EVP_bf_cbc},
+	{"aes128-cbc", EVP_aes_128_cbc},
+	{"aes192-cbc", EVP_aes_192_cbc},
+	{"aes256-cbc", EVP_aes_256_cbc},
+	{"3des-cbc", EVP_des_ede3_cbc},
+	{"cast128-cbc", EVP_cast5_cbc},
+	{NULL, NULL}
+};
+
+/*
+ * OpenSSL hash functions used by the util MAC functions.
+ */
+static const struct {
+	char *name;
+	const EVP_MD *(*hash)(void);
+} macs[] = {
+	{"sha1-mac", EVP_sha1},
+	{"md5-mac", EVP_md5},
+	{"ripemd160-mac", EVP_ripemd160},
+	{"sha256-mac", EVP_sha256},
+	{NULL, NULL}
+};
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Expands the cipher key in a new OpenSSL context, if the cipher function is
+ * known and gives the same results as the util function.
+ * 
+ * @param keys - the context being created.
+ */
+static void expand_cipher(libkeys_t *keys);
+
+/*
+ * Computes the HMAC pads in new OpenSSL hash states, if the MAC function is
+ * known and gives the same results as the util function.
+ * 
+ * @param keys - the context being created.
+ */
+static void expand_mac(libkeys_t *keys);
+
+/*
+ * Copies length bytes of data to a new buffer.
+ * 
+ * @param data - the bytes to be copied.
+ * @param length - the number of bytes.
+ * @return the new buffer, or NULL if errors occurred.
+ */
+static u_char *copy_bytes(u_char *data, int length);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+libkeys_t *libkeys_create(int layer, util_cipher_function_t *cipher, 
+		u_char *cipher_key, u_char *iv, util_mac_function_t *mac, 
+		u_char *mac_key, int way) {
+	libkeys_t *keys;
+
+	if (mac->length > EVP_MAX_MD_SIZE) {
+		liblog_error(layer, "mac %s is too long.", mac->name);
+		return NULL;
+	}
+
+	keys = (libkeys_t *)calloc(1, sizeof(libkeys_t));
+	if (keys == NULL) {
+		liblog_fatal(layer, "error in malloc: %s.", strerror(errno));
+		return NULL;
+	}
+
+	keys->layer = layer;
+	keys->cipher = cipher;
+	keys->mac = mac;
+	keys->way = way;
+	keys->cipher_key = copy_bytes(cipher_key, cipher->key_length);
+	keys->iv = copy_bytes(iv, cipher->iv_length);
+	keys->mac_key = copy_bytes(mac_key, mac->key_length);
+	if (keys->cipher_key == NULL || keys->iv == NULL || 
+			keys->mac_key == NULL) {
+		liblog_fatal(keys->layer, "error in malloc: %s.", strerror(errno));
+		libkeys_destroy(keys);
+		return NULL;
+	}
+
+	expand_cipher(keys);
+	expand_mac(keys);
+
+	liblog_debug(keys->layer, "crypto context created (cipher %s, mac %s).",
+			keys->cipher_context != NULL ? "expanded" : "raw",
+			keys->inner_context != NULL ? "expanded" : "raw");
+
+	return keys;
+}
+/******************************************************************************/
+void libkeys_destroy(libkeys_t *keys) {
+	if (keys == NULL) {
+		return;
+	}
+
+	EVP_CIPHER_CTX_free(keys->cipher_context);
+	EVP_MD_CTX_free(keys->inner_context);
+	EVP_MD_CTX_free(keys->outer_context);
+	EVP_MD_CTX_free(keys->mac_context);
+
+	if (keys->cipher_key != NULL) {
+		OPENSSL_cleanse(keys->cipher_key, keys->cipher->key_length);
+		free(keys->cipher_key);
+	}
+	if (keys->mac_key != NULL) {
+		OPENSSL_cleanse(keys->mac_key, keys->mac->key_length);
+		free(keys->mac_key);
+	}
+	free(keys->iv);
+	free(keys);
+}
+/******************************************************************************/
+void libkeys_cipher(libkeys_t *keys, u_char *out, u_char *in, 
+		int length) {
+	int written;
+
+	if (keys->cipher_context == NULL) {
+		keys->cipher->function(out, in, keys->cipher_key, keys->iv,
+				length, keys->way);
+		return;
+	}
+
+	/* Only the IV is reset, the key schedule is kept. */
+	EVP_CipherInit_ex(keys->cipher_context, NULL, NULL, NULL, keys->iv,
+			-1);
+	EVP_CipherUpdate(keys->cipher_context, out, &written, in, length);
+}
+/******************************************************************************/
+void libkeys_mac(libkeys_t *keys, u_char *out, u_char *in, 
+		int length) {
+	u_char inner[EVP_MAX_MD_SIZE];
+	unsigned int inner_length;
+
+	if (keys->inner_context == NULL) {
+		keys->mac->function(out, in, keys->mac_key, length);
+		return;
+	}
+
+	/* HMAC from the states after the pads, which were hashed once. */
+	EVP_MD_CTX_copy_ex(keys->mac_context, keys->inner_context);
+	EVP_DigestUpdate(keys->mac_context, in, length);
+	EVP_DigestFinal_ex(keys->mac_context, inner, &inner_length);
+	EVP_MD_CTX_copy_ex(keys->mac_context, keys->outer_context);
+	EVP_DigestUpdate(keys->mac_context, inner, inner_length);
+	EVP_DigestFinal_ex(keys->mac_context, inner, &inner_length);
+	memcpy(out, inner, keys->mac->length);
+}
+/******************************************************************************/
+int libkeys_mac_header(libkeys_t *keys, u_char *out, u_char *header,
+		int header_length, u_char *in, int length) {
+	u_char inner[EVP_MAX_MD_SIZE];
+	unsigned int inner_length;
+	u_char *joined;
+
+	if (keys->inner_context == NULL) {
+		/* The util function takes a single buffer. */
+		joined = (u_char *)malloc(header_length + length);
+		if (joined == NULL) {
+			liblog_fatal(keys->layer, "error in malloc: %s.", 
+					strerror(errno));
+			return LIBKEYS_ERROR;
+		}
+		memcpy(joined, header, header_length);
+		memcpy(&joined[header_length], in, length);
+		keys->mac->function(out, joined, keys->mac_key, 
+				header_length + length);
+		free(joined);
+		return LIBKEYS_OK;
+	}
+
+	EVP_MD_CTX_copy_ex(keys->mac_context, keys->inner_context);
+	EVP_DigestUpdate(keys->mac_context, header, header_length);
+	EVP_DigestUpdate(keys->mac_context, in, length);
+	EVP_DigestFinal_ex(keys->mac_context, inner, &inner_length);
+	EVP_MD_CTX_copy_ex(keys->mac_context, keys->outer_context);
+	EVP_DigestUpdate(keys->mac_context, inner, inner_length);
+	EVP_DigestFinal_ex(keys->mac_context, inner, &inner_length);
+	memcpy(out, inner, keys->mac->length);
+	return LIBKEYS_OK;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+void expand_cipher(libkeys_t *keys) {
+	const EVP_CIPHER *cipher;
+	u_char test[TEST_LENGTH];
+	u_char expected[TEST_LENGTH];
+	u_char iv[EVP_MAX_IV_LENGTH];
+	int i;
+
+	cipher = NULL;
+	for (i = 0; ciphers[i].name != NULL; i++) {
+		if (strcmp(ciphers[i].name, keys->cipher->name) == 0) {
+			cipher = ciphers[i].cipher();
+		}
+	}
+	if (cipher == NULL || EVP_CIPHER_iv_length(cipher) != 
+			keys->cipher->iv_length || 
+			keys->cipher->iv_length > EVP_MAX_IV_LENGTH ||
+			TEST_LENGTH % EVP_CIPHER_block_size(cipher) != 0) {
+		return;
+	}
+
+	keys->cipher_context = EVP_CIPHER_CTX_new();
+	if (keys->cipher_context == NULL ||
+			!EVP_CipherInit_ex(keys->cipher_context, cipher, NULL, NULL, 
+					NULL, keys->way == UTIL_WAY_ENCRYPTION) ||
+			!EVP_CIPHER_CTX_set_key_length(keys->cipher_context, 
+					keys->cipher->key_length) ||
+			!EVP_CipherInit_ex(keys->cipher_context, NULL, NULL, 
+					keys->cipher_key, keys->iv, -1) ||
+			!EVP_CIPHER_CTX_set_padding(keys->cipher_context, 0)) {
+		goto fallback_label;
+	}
+
+	/* The context is only used if it agrees with the util function. */
+	memset(test, 0x5a, TEST_LENGTH);
+	memcpy(iv, keys->iv, keys->cipher->iv_length);
+	keys->cipher->function(expected, test, keys->cipher_key, iv, 
+			TEST_LENGTH, keys->way);
+	libkeys_cipher(keys, test, test, TEST_LENGTH);
+	if (memcmp(test, expected, TEST_LENGTH) == 0) {
+		return;
+	}
+
+fallback_label:
+
+	liblog_warn(keys->layer, "can't expand cipher %s, using raw keys.",
+			keys->cipher->name);
+	EVP_CIPHER_CTX_free(keys->cipher_context);
+	keys->cipher_context = NULL;
+}
+/******************************************************************************/
+void expand_mac(libkeys_t *keys) {
+	const EVP_MD *hash;
+	u_char pad[MAX_BLOCK_SIZE];
+	u_char key[MAX_BLOCK_SIZE];
+	u_char test[TEST_LENGTH];
+	u_char expected[EVP_MAX_MD_SIZE];
+	u_char computed[EVP_MAX_MD_SIZE];
+	unsigned int key_length;
+	int block_size;
+	int i;
+
+	hash = NULL;
+	for (i = 0; macs[i].name != NULL; i++) {
+		if (strcmp(macs[i].name, keys->mac->name) == 0) {
+			hash = macs[i].hash();
+		}
+	}
+	if (hash == NULL || EVP_MD_block_size(hash) > MAX_BLOCK_SIZE ||
+			keys->mac->length > EVP_MD_size(hash)) {
+		return;
+	}
+	block_size = EVP_MD_block_size(hash);
+
+	keys->inner_context = EVP_MD_CTX_new();
+	keys->outer_context = EVP_MD_CTX_new();
+	keys->mac_context = EVP_MD_CTX_new();
+	if (keys->inner_context == NULL || keys->outer_context == NULL ||
+			keys->mac_context == NULL) {
+		goto fallback_label;
+	}
+
+	/* Keys longer than a block are hashed first (RFC 2104). */
+	memset(key, 0, block_size);
+	if (keys->mac->key_length > block_size) {
+		EVP_Digest(keys->mac_key, keys->mac->key_length, key, &key_length,
+				hash, NULL);
+	} else {
+		memcpy(key, keys->mac_key, keys->mac->key_length);
+	}
+
+	for (i = 0; i < block_size; i++) {
+		pad[i] = key[i] ^ 0x36;
+	}
+	if (!EVP_DigestInit_ex(keys->inner_context, hash, NULL) ||
+			!EVP_DigestUpdate(keys->inner_context, pad, block_size)) {
+		goto fallback_label;
+	}
+	for (i = 0; i < block_size; i++) {
+		pad[i] = key[i] ^ 0x5c;
+	}
+	if (!EVP_DigestInit_ex(keys->outer_context, hash, NULL) ||
+			!EVP_DigestUpdate(keys->outer_context, pad, block_size)) {
+		goto fallback_label;
+	}
+	OPENSSL_cleanse(key, sizeof(key));
+	OPENSSL_cleanse(pad, sizeof(pad));
+
+	/* The context is only used if it agrees with the util function. */
+	memset(test, 0xa5, TEST_LENGTH);
+	keys->mac->function(expected, test, keys->mac_key, TEST_LENGTH);
+	libkeys_mac(keys, computed, test, TEST_LENGTH);
+	if (memcmp(computed, expected, keys->mac->length) == 0) {
+		return;
+	}
+
+fallback_label:
+
+	OPENSSL_cleanse(key, sizeof(key));
+	OPENSSL_cleanse(pad, sizeof(pad));
+	liblog_warn(keys->layer, "can't expand mac %s, using raw keys.",
+			keys->mac->name);
+	EVP_MD_CTX_free(keys->inner_context);
+	EVP_MD_CTX_free(keys->outer_context);
+	EVP_MD_CTX_free(keys->mac_context);
+	keys->inner_context = NULL;
+	keys->outer_context = NULL;
+	keys->mac_context = NULL;
+}
+/******************************************************************************/
+u_char *copy_bytes(u_char *data, int length) {
+	u_char *copy;
+
+	/* Functions without key or IV still get a valid pointer. */
+	copy = (u_char *)malloc(length > 0 ? length : 1);
+	if (copy != NULL && length > 0) {
+		memcpy(copy, data, length);
+	}
+	return copy;
+}
+/******************************************************************************/
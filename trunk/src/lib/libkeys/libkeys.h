@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2006-07 The Kurupira Project
+ * 
+ * Kurupira is the legal property of its developers, whose names are not listed
+ * here. Please refer to the COPYRIGHT file.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+/**
+ * @defgroup libkeys libkeys, the expanded session keys library
+ */
+
+/**
+ * @file libkeys.h
+ * 
+ * Interface of the cipher and MAC contexts kept by the link and network
+ * layers for each direction of a session, so keys are expanded once and not
+ * for every packet.
+ * 
+ * @version $Header$
+ * @ingroup libkeys
+ */
+
+#ifndef _LIBKEYS_H_
+	#define _LIBKEYS_H_
+
+	#include <openssl/evp.h>
+
+	#include <util/util_crypto.h>
+
+	/**
+	 * Constant indicating success.
+	 */
+	#define LIBKEYS_OK		1
+
+	/**
+	 * Constant indicating error.
+	 */
+	#define LIBKEYS_ERROR	0
+
+	/**
+	 * Data type that stores the expanded keys of one direction of a session.
+	 * When the cipher or the MAC function has no OpenSSL counterpart, the raw
+	 * keys are kept and the util function is called for every packet.
+	 */
+	typedef struct {
+		/** Layer that owns the context, used in log messages. */
+		int layer;
+		/** Cipher function negotiated. */
+		util_cipher_function_t *cipher;
+		/** MAC function negotiated. */
+		util_mac_function_t *mac;
+		/** Expanded cipher key, or NULL if the util function is used. */
+		EVP_CIPHER_CTX *cipher_context;
+		/** Hash state after the inner HMAC pad, or NULL if the util function
+		 * is used. */
+		EVP_MD_CTX *inner_context;
+		/** Hash state after the outer HMAC pad. */
+		EVP_MD_CTX *outer_context;
+		/** Scratch hash state used to compute each MAC. */
+		EVP_MD_CTX *mac_context;
+		/** Raw cipher key. */
+		u_char *cipher_key;
+		/** Initialization vector. */
+		u_char *iv;
+		/** Raw MAC key. */
+		u_char *mac_key;
+		/** UTIL_WAY_ENCRYPTION or UTIL_WAY_DECRYPTION. */
+		int way;
+	} libkeys_t;
+
+	/**
+	 * Creates the context of one direction of a session, expanding the keys.
+	 * 
+	 * @param[in] layer     - layer that owns the context, for log messages.
+	 * @param[in] cipher    - cipher function negotiated.
+	 * @param[in] cipher_key - key of the cipher.
+	 * @param[in] iv        - initialization vector of the cipher.
+	 * @param[in] mac       - MAC function negotiated.
+	 * @param[in] mac_key   - key of the MAC.
+	 * @param[in] way       - UTIL_WAY_ENCRYPTION or UTIL_WAY_DECRYPTION.
+	 * @return the new context, or NULL if errors occurred.
+	 */
+	libkeys_t *libkeys_create(int layer, util_cipher_function_t *cipher, 
+			u_char *cipher_key, u_char *iv, util_mac_function_t *mac, 
+			u_char *mac_key, int way);
+
+	/**
+	 * Frees a context and clears the keys stored in it.
+	 * 
+	 * @param[in] keys      - the context, can be NULL.
+	 */
+	void libkeys_destroy(libkeys_t *keys);
+
+	/**
+	 * Encrypts or decrypts length bytes of in to out, which can be the same
+	 * buffer. The length must be a multiple of the cipher block size.
+	 * 
+	 * @param[in] keys      - context of the direction.
+	 * @param[out] out      - buffer that will receive the result.
+	 * @param[in] in        - data to be processed.
+	 * @param[in] length    - number of bytes to be processed.
+	 */
+	void libkeys_cipher(libkeys_t *keys, u_char *out, u_char *in, int length);
+
+	/**
+	 * Computes the MAC of length bytes of in.
+	 * 
+	 * @param[in] keys      - context of the direction.
+	 * @param[out] out      - buffer that will receive the MAC.
+	 * @param[in] in        - data to be authenticated.
+	 * @param[in] length    - number of bytes to be authenticated.
+	 */
+	void libkeys_mac(libkeys_t *keys, u_char *out, u_char *in, int length);
+
+	/**
+	 * Computes the MAC of header_length bytes of header followed by length
+	 * bytes of in, without joining them in one buffer when the MAC is
+	 * expanded.
+	 * 
+	 * @param[in] keys      - context of the direction.
+	 * @param[out] out      - buffer that will receive the MAC.
+	 * @param[in] header    - first part of the data to be authenticated.
+	 * @param[in] header_length - number of bytes in the header.
+	 * @param[in] in        - second part of the data to be authenticated.
+	 * @param[in] length    - number of bytes in the second part.
+	 * @return LIBKEYS_OK if no errors occurred, LIBKEYS_ERROR otherwise.
+	 */
+	int libkeys_mac_header(libkeys_t *keys, u_char *out, u_char *header,
+			int header_length, u_char *in, int length);
+
+#endif /* !_LIBKEYS_H_ */
@@ -46,7 +46,7 @@
  * Major version of the LLP protocol. Implementations with the same major version
  * are compatible.
  */
-#define LLP_MAJOR_VERSION 1
+#define LLP_MAJOR_VERSION 2
 
 /**
  * Minor version of the LLP protocol. Used to express minor changes that don't 
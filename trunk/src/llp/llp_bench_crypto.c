@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_bench_crypto.c Microbenchmark of the per-packet cryptography,
+ * 		comparing the util functions called with raw keys and the session
+ * 		contexts with expanded keys.
+ * @ingroup llp
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libfreedom/layers.h>
+#include <libfreedom/liblog.h>
+#include <util/util.h>
+#include <util/util_crypto.h>
+
+#include <libkeys.h>
+
+#include "llp.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/**
+ * Default number of packets processed.
+ */
+#define ITERATIONS		100000
+
+/**
+ * Length of the packets processed, a multiple of every cipher block size.
+ */
+#define PACKET_LENGTH	(LIBFREEDOM_FTU - LIBFREEDOM_FTU % 16)
+
+/**
+ * Default functions measured.
+ */
+#define DEFAULT_CIPHER	"blowfish-cbc"
+#define DEFAULT_MAC		"sha1-mac"
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Returns the time elapsed since a given instant, in seconds.
+ * 
+ * @param[in] start     - the instant.
+ * @return the time elapsed.
+ */
+static double elapsed(struct timespec *start);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+int main(int argc, char *argv[]) {
+	u_char key[EVP_MAX_KEY_LENGTH], iv[EVP_MAX_IV_LENGTH];
+	u_char mac_key[EVP_MAX_MD_SIZE];
+	u_char raw_packet[PACKET_LENGTH], context_packet[PACKET_LENGTH];
+	u_char raw_mac[EVP_MAX_MD_SIZE], context_mac[EVP_MAX_MD_SIZE];
+	struct timespec start;
+	double raw_time, context_time;
+	util_cipher_function_t *cipher;
+	util_mac_function_t *mac;
+	libkeys_t *keys;
+	int iterations;
+	int i;
+
+	iterations = (argc > 1 ? atoi(argv[1]) : ITERATIONS);
+	cipher = util_get_cipher(argc > 2 ? argv[2] : DEFAULT_CIPHER);
+	mac = util_get_mac(argc > 3 ? argv[3] : DEFAULT_MAC);
+	if (iterations <= 0 || cipher == NULL || mac == NULL ||
+			cipher->key_length > EVP_MAX_KEY_LENGTH ||
+			cipher->iv_length > EVP_MAX_IV_LENGTH ||
+			mac->key_length > EVP_MAX_MD_SIZE) {
+		fprintf(stderr, "usage: %s [iterations] [cipher] [mac]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (util_rand_bytes(key, cipher->key_length) == UTIL_ERROR ||
+			util_rand_bytes(iv, cipher->iv_length) == UTIL_ERROR ||
+			util_rand_bytes(mac_key, mac->key_length) == UTIL_ERROR ||
+			util_rand_bytes(raw_packet, PACKET_LENGTH) == UTIL_ERROR) {
+		fprintf(stderr, "error generating keys.\n");
+		return EXIT_FAILURE;
+	}
+	memcpy(context_packet, raw_packet, PACKET_LENGTH);
+
+	keys = libkeys_create(LAYER_LINK, cipher, key, iv, mac, mac_key, 
+			UTIL_WAY_ENCRYPTION);
+	if (keys == NULL) {
+		fprintf(stderr, "error creating crypto context.\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Both loops do what send_frame() does: MAC, then encryption in place. */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		mac->function(raw_mac, raw_packet, mac_key, PACKET_LENGTH);
+		cipher->function(raw_packet, raw_packet, key, iv, PACKET_LENGTH,
+				UTIL_WAY_ENCRYPTION);
+	}
+	raw_time = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		libkeys_mac(keys, context_mac, context_packet, PACKET_LENGTH);
+		libkeys_cipher(keys, context_packet, context_packet, PACKET_LENGTH);
+	}
+	context_time = elapsed(&start);
+
+	if (memcmp(raw_packet, context_packet, PACKET_LENGTH) != 0 ||
+			memcmp(raw_mac, context_mac, mac->length) != 0) {
+		fprintf(stderr, "contexts and util functions disagree.\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%s + %s, %d-byte packets\n", cipher->name, mac->name, 
+			PACKET_LENGTH);
+	printf("cipher context: %s, mac context: %s\n",
+			keys->cipher_context != NULL ? "expanded" : "raw",
+			keys->inner_context != NULL ? "expanded" : "raw");
+	printf("raw keys:       %10.2f us/packet\n", 
+			raw_time * 1000000 / iterations);
+	printf("contexts:       %10.2f us/packet\n", 
+			context_time * 1000000 / iterations);
+	printf("speedup:        %10.2fx\n", raw_time / context_time);
+
+	libkeys_destroy(keys);
+
+	return EXIT_SUCCESS;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+double elapsed(struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+			(now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+/******************************************************************************/
@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_bench_dh.c Microbenchmark of the key agreement computations,
+ * 		comparing the generic exponentiation, the fixed-base tables and the
+ * 		elliptic-curve key agreement.
+ * @ingroup llp
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/bn.h>
+
+#include <libfreedom/layers.h>
+#include <libfreedom/liblog.h>
+#include <util/util.h>
+
+#include "llp.h"
+#include "llp_packets.h"
+#include "llp_dh.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/**
+ * Default number of exponentiations measured.
+ */
+#define ITERATIONS		1000
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Computes (y = g^x mod p) the way it was done before the fixed-base tables:
+ * the prime and the context are created on every call. The 2048-bit MODP
+ * prime of RFC 3526 is used, which has the size of the LLP prime.
+ * 
+ * @param[out] y        - the result of the modular exponentiation.
+ * @param[in] x         - the exponent.
+ * @retval LLP_OK       - if no errors occurred.
+ * @retval LLP_ERROR    - otherwise.
+ */
+static int generic_compute_y(mpint y, mpint x);
+
+/*
+ * Returns the time elapsed since a given instant, in seconds.
+ * 
+ * @param[in] start     - the instant.
+ * @return the time elapsed.
+ */
+static double elapsed(struct timespec *start);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+int main(int argc, char *argv[]) {
+	u_char x[LLP_X_LENGTH], other_x[LLP_X_LENGTH];
+	u_char y[LLP_Y_LENGTH], other_y[LLP_Y_LENGTH];
+	u_char z[LLP_Z_LENGTH], other_z[LLP_Z_LENGTH];
+	struct timespec start;
+	double generic_time, table_time, curve_time;
+	llp_kex_function_t *curve;
+	int iterations;
+	int i;
+
+	iterations = (argc > 1 ? atoi(argv[1]) : ITERATIONS);
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* Without a key pool, every pair is computed on demand. */
+	if (llp_dh_initialize(0, 0) == LLP_ERROR) {
+		fprintf(stderr, "error initializing D&H engine.\n");
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		if (util_rand_mpint(x, LLP_X_LENGTH - MPINT_SIZE_LENGTH -
+				MPINT_SIGNAL_LENGTH) == UTIL_ERROR ||
+				generic_compute_y(y, x) == LLP_ERROR) {
+			fprintf(stderr, "error in generic exponentiation.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	generic_time = elapsed(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		if (llp_compute_dh_params(x, y) == LLP_ERROR) {
+			fprintf(stderr, "error in fixed-base exponentiation.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	table_time = elapsed(&start);
+
+	curve = llp_get_kex(LLP_KEX_ECDH_P256);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		if (curve->compute_params(other_x, other_y) == LLP_ERROR) {
+			fprintf(stderr, "error in elliptic-curve multiplication.\n");
+			return EXIT_FAILURE;
+		}
+	}
+	curve_time = elapsed(&start);
+
+	/* The secret uses a generic exponentiation, so both peers only agree if
+	 * the fixed-base tables are correct. */
+	if (llp_compute_dh_params(other_x, other_y) == LLP_ERROR ||
+			llp_compute_dh_secret(z, other_y, x) == LLP_ERROR ||
+			llp_compute_dh_secret(other_z, y, other_x) == LLP_ERROR ||
+			memcmp(z, other_z, MPINT_LENGTH(z) + MPINT_SIZE_LENGTH) != 0) {
+		fprintf(stderr, "key agreement failed.\n");
+		return EXIT_FAILURE;
+	}
+	if (curve->compute_params(other_x, other_y) == LLP_ERROR ||
+			curve->compute_params(x, y) == LLP_ERROR ||
+			curve->compute_secret(z, other_y, x) == LLP_ERROR ||
+			curve->compute_secret(other_z, y, other_x) == LLP_ERROR ||
+			memcmp(z, other_z, MPINT_LENGTH(z) + MPINT_SIZE_LENGTH) != 0) {
+		fprintf(stderr, "elliptic-curve key agreement failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("g^x generic:    %10.1f ops/s\n", iterations / generic_time);
+	printf("g^x fixed-base: %10.1f ops/s\n", iterations / table_time);
+	printf("speedup:        %10.2fx\n", generic_time / table_time);
+	printf("xG ecdh-p256:   %10.1f ops/s\n", iterations / curve_time);
+
+	llp_dh_finalize();
+
+	return EXIT_SUCCESS;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+int generic_compute_y(mpint y, mpint x) {
+	BIGNUM *y_bignum, *g_bignum, *x_bignum, *p_bignum;
+	BN_CTX *context;
+	int return_value;
+
+	return_value = LLP_ERROR;
+	y_bignum = BN_new();
+	g_bignum = BN_new();
+	x_bignum = BN_mpi2bn(x, MPINT_LENGTH(x) + MPINT_SIZE_LENGTH, NULL);
+	p_bignum = BN_get_rfc3526_prime_2048(NULL);
+	context = BN_CTX_new();
+
+	if (y_bignum == NULL || g_bignum == NULL || x_bignum == NULL ||
+			p_bignum == NULL || context == NULL) {
+		goto return_label;
+	}
+
+	BN_set_word(g_bignum, 2);
+	if (BN_mod_exp(y_bignum, g_bignum, x_bignum, p_bignum, context) &&
+			BN_bn2mpi(y_bignum, NULL) <= LLP_Y_LENGTH) {
+		BN_bn2mpi(y_bignum, y);
+		return_value = LLP_OK;
+	}
+
+return_label:
+
+	BN_free(y_bignum);
+	BN_free(g_bignum);
+	BN_free(x_bignum);
+	BN_free(p_bignum);
+	BN_CTX_free(context);
+	return return_value;
+}
+/******************************************************************************/
+double elapsed(struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+			(now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+/******************************************************************************/
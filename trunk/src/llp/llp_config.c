@@ -37,6 +37,13 @@
 #include <util/util_crypto.h>
 
 #include "llp_config.h"
+#include "llp_socket.h"
+#include "llp_workers.h"
+#include "llp_packets.h"
+#include "llp_sessions.h"
+#include "llp_queue.h"
+#include "llp_crypto.h"
+#include "llp_limits.h"
 #include "llp.h"
 
 /*============================================================================*/
@@ -89,6 +96,29 @@ static void set_min_connections(int min);
  */
 static void set_max_connections(int max);
 
+/**
+ * Sets the number of half-open sessions from which connection requests must
+ * echo a cookie.
+ * 
+ * @param[in] cookie_threshold - the new threshold, 0 to always require
+ * 		cookies and -1 to never require them.
+ */
+static void set_cookie_threshold(int cookie_threshold);
+
+/**
+ * Sets the number of handshake packets accepted from each source per second.
+ * 
+ * @param[in] handshake_rate_limit - the new rate, 0 for no limit.
+ */
+static void set_handshake_rate_limit(int handshake_rate_limit);
+
+/**
+ * Sets the number of data packets accepted from each source per second.
+ * 
+ * @param[in] data_rate_limit - the new rate, 0 for no limit.
+ */
+static void set_data_rate_limit(int data_rate_limit);
+
 /**
  * Configures the number of nodes that can be stored on cache.
  * 
@@ -103,6 +133,14 @@ static void set_cache_size(int size);
  */
 static void set_recent_nodes_file(char *file_name);
 
+/**
+ * Configures the name of the file containing the binary snapshot of the nodes
+ * cache.
+ * 
+ * @param[in] file_name - the file that stores the snapshot.
+ */
+static void set_nodes_snapshot_file(char *file_name);
+
 /**
  * Configures the name of the file containing hosts to connect at startup.
  * 
@@ -118,6 +156,117 @@ static void set_static_nodes_file(char *filename);
  */
 static void set_expiration_time(int time);
 
+/**
+ * Configures the maximum number of packets moved by a single socket call.
+ * 
+ * @param[in] size      - the new batch size, in packets.
+ */
+static void set_batch_size(int size);
+
+/**
+ * Configures the number of threads listening on the module port.
+ * 
+ * @param[in] listeners - the new number of listeners.
+ */
+static void set_listeners(int listeners);
+
+/**
+ * Configures the number of packet buffers preallocated.
+ * 
+ * @param[in] size      - the new pool size, in buffers.
+ */
+static void set_pool_size(int size);
+
+/**
+ * Configures the number of threads that perform handshake computations.
+ * 
+ * @param[in] workers   - the new number of crypto workers.
+ */
+static void set_crypto_workers(int workers);
+
+/**
+ * Configures the number of precomputed D&H key pairs.
+ * 
+ * @param[in] size      - the new key pool size, in pairs.
+ */
+static void set_dh_pool_size(int size);
+
+/**
+ * Configures the number of key pairs below which the key pool is refilled.
+ * 
+ * @param[in] watermark - the new refill watermark, in pairs.
+ */
+static void set_dh_pool_watermark(int watermark);
+
+/**
+ * Configures if the listeners run an event loop that also handles the timers
+ * and the node monitor, instead of one thread for each task.
+ * 
+ * @param[in] event_loop    - 1 to run the event loop, 0 otherwise.
+ */
+static void set_event_loop(int event_loop);
+
+/**
+ * Configures the time that datagrams written to a session wait to be packed
+ * with the next ones in a single LLP_DATA packet.
+ * 
+ * @param[in] coalesce_window - the new window, in milliseconds, or 0 to disable.
+ */
+static void set_coalesce_window(int coalesce_window);
+
+/**
+ * Configures the number of datagrams that each session send ring holds.
+ * 
+ * @param[in] send_queue_depth - the new depth, or 0 to send datagrams synchronously.
+ */
+static void set_send_queue_depth(int send_queue_depth);
+
+/**
+ * Configures the percentage of node selections made at random, ignoring the
+ * latency and reliability scores of the nodes.
+ * 
+ * @param[in] node_exploration - the new percentage, 100 for random selection.
+ */
+static void set_node_exploration(int node_exploration);
+
+/**
+ * Configures the number of received datagrams each session can hold until
+ * they are read by the upper layer.
+ * 
+ * @param[in] receive_queue_depth - the new depth.
+ */
+static void set_receive_queue_depth(int receive_queue_depth);
+
+/**
+ * Configures the time a receiver waits for room in a full receive ring when
+ * the receive policy is block.
+ * 
+ * @param[in] receive_queue_timeout - the new timeout, in milliseconds.
+ */
+static void set_receive_queue_timeout(int receive_queue_timeout);
+
+/**
+ * Configures the policy used to pad LLP_DATA packets.
+ * 
+ * @param[in] padding_policy - the new padding policy.
+ */
+static void set_padding_policy(int padding_policy);
+
+/**
+ * Configures the behaviour of llp_write() when a session send ring is full.
+ * 
+ * @param[in] send_queue_policy - the new policy.
+ */
+static void set_send_queue_policy(int send_queue_policy);
+
+/**
+ * Configures the behaviour of the receivers when a session receive ring is
+ * full.
+ * 
+ * @param[in] receive_queue_policy - the new policy.
+ */
+static void set_receive_queue_policy(int receive_queue_policy);
+
 /**
  * Configures a new list of ciphers do be used.
  * 
@@ -139,6 +288,13 @@ void set_hash_list(llp_function_list_t * hash_list);
  */
 void set_mac_list(llp_function_list_t * mac_list);
 
+/**
+ * Configures a new list of key agreement algorithms do be used.
+ * 
+ * @param[in]           - the new list of key agreement algorithms.
+ */
+void set_kex_list(llp_function_list_t * kex_list);
+
 /**
  * Handles an integer parameter found on the configuration file parsing process.
  *
@@ -165,6 +321,27 @@ static DOTCONF_CB(handle_hashes);
  */
 static DOTCONF_CB(handle_macs);
 
+/**
+ * Handles a list of key agreement algorithms found on the configuration file
+ * parsing.
+ */
+static DOTCONF_CB(handle_kexes);
+
+/**
+ * Handles the padding policy found on the configuration file parsing.
+ */
+static DOTCONF_CB(handle_padding);
+
+/**
+ * Handles the send ring policy found on the configuration file parsing.
+ */
+static DOTCONF_CB(handle_send_policy);
+
+/**
+ * Handles the receive ring policy found on the configuration file parsing.
+ */
+static DOTCONF_CB(handle_receive_policy);
+
 /**
  * Handles the errors found on file parsing.
  */
@@ -243,6 +420,19 @@ static int file_exists(const char *file_name);
  * Default maximum number of connections established.
  */
 #define DEFAULT_MAX_CONNECTIONS	100
+/**
+ * Default number of half-open sessions from which connection requests must
+ * echo a cookie.
+ */
+#define DEFAULT_COOKIE_THRESHOLD	16
+/**
+ * Default number of handshake packets accepted from each source per second.
+ */
+#define DEFAULT_HANDSHAKE_RATE_LIMIT	20
+/**
+ * Default number of data packets accepted from each source per second.
+ */
+#define DEFAULT_DATA_RATE_LIMIT	20000
 /**
  * Default number of nodes on cache.
  */
@@ -251,6 +441,66 @@ static int file_exists(const char *file_name);
  * Default expiration time for a session (1 day).
  */
 #define DEFAULT_EXPIRATION_TIME	(24*60*60)
+/**
+ * Default number of packets moved by a single socket call.
+ */
+#define DEFAULT_BATCH_SIZE		32
+/**
+ * Default number of threads listening on the module port.
+ */
+#define DEFAULT_LISTENERS		1
+/**
+ * Default number of packet buffers preallocated.
+ */
+#define DEFAULT_POOL_SIZE		256
+/**
+ * Default number of threads performing handshake computations.
+ */
+#define DEFAULT_CRYPTO_WORKERS	2
+/**
+ * Default number of precomputed D&H key pairs.
+ */
+#define DEFAULT_DH_POOL_SIZE	32
+/**
+ * Default number of key pairs below which the key pool is refilled.
+ */
+#define DEFAULT_DH_POOL_WATERMARK	8
+/**
+ * Default threading model (one thread for each task).
+ */
+#define DEFAULT_EVENT_LOOP	0
+/**
+ * Default coalescing window, in milliseconds (datagrams are sent at once).
+ */
+#define DEFAULT_COALESCE_WINDOW	0
+/**
+ * Default depth of the session send rings (datagrams are sent by the writer).
+ */
+#define DEFAULT_SEND_QUEUE_DEPTH	0
+/**
+ * Default percentage of node selections made at random.
+ */
+#define DEFAULT_NODE_EXPLORATION	10
+/**
+ * Default depth of the receive ring of each session.
+ */
+#define DEFAULT_RECEIVE_QUEUE_DEPTH	32
+/**
+ * Default time a blocked receiver waits for room in a receive ring, in ms.
+ */
+#define DEFAULT_RECEIVE_QUEUE_TIMEOUT	100
+/**
+ * Default padding policy (every packet padded to the FTU).
+ */
+#define DEFAULT_PADDING_POLICY	LLP_PADDING_FTU
+/**
+ * Default send ring policy (the writer waits for room in the ring).
+ */
+#define DEFAULT_SEND_QUEUE_POLICY	LLP_SEND_BLOCK
+/**
+ * Default receive ring policy (the new datagram is dropped).
+ */
+#define DEFAULT_RECEIVE_QUEUE_POLICY	LLP_RECEIVE_DROP_NEWEST
 /**
  * Default name of file containing nodes to always connect.
  */
@@ -259,6 +509,10 @@ static int file_exists(const char *file_name);
  * Default name of file containing recent nodes discovered.
  */
 #define DEFAULT_RECENT_NODES	"llp.recent"
+/**
+ * Default name of file containing the snapshot of the nodes cache.
+ */
+#define DEFAULT_NODES_SNAPSHOT	"llp.snapshot"
 /**
  * Default list of encryption algorithms.
  */
@@ -271,6 +525,10 @@ static int file_exists(const char *file_name);
  * Default list of MAC algorithms.
  */
 #define DEFAULT_MAC_LIST		{1, {"sha1-mac"}}
+/**
+ * Default list of key agreement algorithms.
+ */
+#define DEFAULT_KEX_LIST		{1, {LLP_KEX_MODP_2048}}
 
 /**
  * Configuration file name.
@@ -288,6 +546,18 @@ static int file_exists(const char *file_name);
  * Keyword used in configuration file to set the number of maximum connections.
  */
 #define MAX_CONNECTIONS_KEYWORD	"max_connections"
+/**
+ * Keyword that identifies the cookie threshold in the configuration file.
+ */
+#define COOKIE_THRESHOLD_KEYWORD	"cookie_threshold"
+/**
+ * Keyword that identifies the handshake rate limit in the configuration file.
+ */
+#define HANDSHAKE_RATE_LIMIT_KEYWORD	"handshake_rate_limit"
+/**
+ * Keyword that identifies the data rate limit in the configuration file.
+ */
+#define DATA_RATE_LIMIT_KEYWORD	"data_rate_limit"
 /**
  * Keyword used in configuration file to set the size of nodes cache.
  */
@@ -296,6 +566,67 @@ static int file_exists(const char *file_name);
  * Keyword used in configuration file to set the session expiration time.
  */
 #define	EXPIRATION_TIME_KEYWORD	"expiration_time"
+/**
+ * Keyword used in configuration file to set the socket batch size.
+ */
+#define BATCH_SIZE_KEYWORD		"batch_size"
+/**
+ * Keyword used in configuration file to set the number of listeners.
+ */
+#define LISTENERS_KEYWORD		"listeners"
+/**
+ * Keyword used in configuration file to set the number of packet buffers.
+ */
+#define POOL_SIZE_KEYWORD		"pool_size"
+/**
+ * Keyword used in configuration file to set the number of crypto workers.
+ */
+#define CRYPTO_WORKERS_KEYWORD	"crypto_workers"
+/**
+ * Keyword used in configuration file to set the number of precomputed D&H key
+ * pairs.
+ */
+#define DH_POOL_SIZE_KEYWORD	"dh_pool_size"
+/**
+ * Keyword used in configuration file to set the key pool refill watermark.
+ */
+#define DH_POOL_WATERMARK_KEYWORD	"dh_pool_watermark"
+/**
+ * Keyword used in configuration file to select the event loop.
+ */
+#define EVENT_LOOP_KEYWORD	"event_loop"
+/**
+ * Keyword used in configuration file to set the datagram coalescing window.
+ */
+#define COALESCE_WINDOW_KEYWORD	"coalesce_window"
+/**
+ * Keyword used in configuration file to set the depth of the send rings.
+ */
+#define SEND_QUEUE_DEPTH_KEYWORD	"send_queue_depth"
+/**
+ * Keyword used in configuration file to set the node exploration rate.
+ */
+#define NODE_EXPLORATION_KEYWORD	"node_exploration"
+/**
+ * Keyword used in configuration file to set the receive ring depth.
+ */
+#define RECEIVE_QUEUE_DEPTH_KEYWORD	"receive_queue_depth"
+/**
+ * Keyword used in configuration file to set the receive ring timeout.
+ */
+#define RECEIVE_QUEUE_TIMEOUT_KEYWORD	"receive_queue_timeout"
+/**
+ * Keyword used in configuration file to set the padding policy.
+ */
+#define PADDING_POLICY_KEYWORD	"padding_policy"
+/**
+ * Keyword used in configuration file to set the send ring policy.
+ */
+#define SEND_QUEUE_POLICY_KEYWORD	"send_queue_policy"
+/**
+ * Keyword used in configuration file to set the receive ring policy.
+ */
+#define RECEIVE_QUEUE_POLICY_KEYWORD	"receive_queue_policy"
 /**
  * Keyword used in configuration file to specify the name of the static nodes
  * file.
@@ -306,6 +637,11 @@ static int file_exists(const char *file_name);
  * file.
  */
 #define RECENT_NODES_FILE_KEYWORD	"recent_nodes_file"
+/**
+ * Keyword used in configuration file to specify the name of the nodes cache
+ * snapshot file.
+ */
+#define NODES_SNAPSHOT_FILE_KEYWORD	"nodes_snapshot_file"
 /**
  * Keyword used in configuration file to set the list of encryption algorithms.
  */
@@ -318,6 +654,11 @@ static int file_exists(const char *file_name);
  * Keyword used in configuration file to set the list of MAC algorithms.
  */
 #define MAC_LIST_KEYWORD		"mac_list"
+/**
+ * Keyword used in configuration file to set the list of key agreement
+ * algorithms.
+ */
+#define KEX_LIST_KEYWORD		"kex_list"
 
 /*@{ */
 /**
@@ -356,20 +697,60 @@ typedef struct {
 	int min_connections;
 	/** Maximum number of connections opened. */
 	int max_connections;
+	/** Half-open sessions from which connection requests must echo a cookie. */
+	int cookie_threshold;
+	/** Handshake packets accepted from each source per second. */
+	int handshake_rate_limit;
+	/** Data packets accepted from each source per second. */
+	int data_rate_limit;
 	/** Nodes cache size (in nodes). */
 	int cache_size;
 	/** Session expiration time (in seconds). */
 	int expiration_time;
+	/** Maximum number of packets moved by a single socket call. */
+	int batch_size;
+	/** Number of threads listening on the port. */
+	int listeners;
+	/** Number of packet buffers preallocated. */
+	int pool_size;
+	/** Number of threads performing handshake computations. */
+	int crypto_workers;
+	/** Number of precomputed D&H key pairs. */
+	int dh_pool_size;
+	/** Number of key pairs below which the key pool is refilled. */
+	int dh_pool_watermark;
+	/** Listeners run an event loop that also handles timers. */
+	int event_loop;
+	/** Milliseconds that datagrams wait to be packed in a single frame. */
+	int coalesce_window;
+	/** Datagrams that each session send ring holds. */
+	int send_queue_depth;
+	/** Percentage of node selections that ignore the node scores. */
+	int node_exploration;
+	/** Number of datagrams held by the receive ring of each session. */
+	int receive_queue_depth;
+	/** Time a blocked receiver waits for room in a receive ring, in ms. */
+	int receive_queue_timeout;
+	/** Policy used to pad LLP_DATA packets. */
+	int padding_policy;
+	/** Behaviour of llp_write() when a send ring is full. */
+	int send_queue_policy;
+	/** Behaviour of the receivers when a receive ring is full. */
+	int receive_queue_policy;
 	/** File used to obtain nodes that this node will always try to connect. */
 	char *static_nodes;
 	/** File used to obtain nodes that were recently received by this node. */
 	char *recent_nodes;
+	/** File used to save and restore the nodes cache quickly. */
+	char *nodes_snapshot;
 	/** Cipher algorithms list. */
 	llp_function_list_t cipher_list;
 	/** Hash functions list. */
 	llp_function_list_t hash_list;
 	/** MAC functions. */
 	llp_function_list_t mac_list;
+	/** Key agreement algorithms list. */
+	llp_function_list_t kex_list;
 } llp_config_t;
 
 /**
@@ -379,13 +760,34 @@ static const configoption_t options[] = {
 	{PORT_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
 	{MIN_CONNECTIONS_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
 	{MAX_CONNECTIONS_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{COOKIE_THRESHOLD_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{HANDSHAKE_RATE_LIMIT_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{DATA_RATE_LIMIT_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
 	{CACHE_SIZE_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
 	{EXPIRATION_TIME_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{BATCH_SIZE_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{LISTENERS_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{POOL_SIZE_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{CRYPTO_WORKERS_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{DH_POOL_SIZE_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{DH_POOL_WATERMARK_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{EVENT_LOOP_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{COALESCE_WINDOW_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{SEND_QUEUE_DEPTH_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{NODE_EXPLORATION_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{RECEIVE_QUEUE_DEPTH_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{RECEIVE_QUEUE_TIMEOUT_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{PADDING_POLICY_KEYWORD, ARG_STR, handle_padding, NULL, CTX_ALL},
+	{SEND_QUEUE_POLICY_KEYWORD, ARG_STR, handle_send_policy, NULL, CTX_ALL},
+	{RECEIVE_QUEUE_POLICY_KEYWORD, ARG_STR, handle_receive_policy, NULL,
+			CTX_ALL},
 	{STATIC_NODES_FILE_KEYWORD, ARG_STR, handle_file, NULL, CTX_ALL},
 	{RECENT_NODES_FILE_KEYWORD, ARG_STR, handle_file, NULL, CTX_ALL},
+	{NODES_SNAPSHOT_FILE_KEYWORD, ARG_STR, handle_file, NULL, CTX_ALL},
 	{CIPHER_LIST_KEYWORD, ARG_LIST, handle_ciphers, NULL, CTX_ALL},
 	{HASH_LIST_KEYWORD, ARG_LIST, handle_hashes, NULL, CTX_ALL},
 	{MAC_LIST_KEYWORD, ARG_LIST, handle_macs, NULL, CTX_ALL},
+	{KEX_LIST_KEYWORD, ARG_LIST, handle_kexes, NULL, CTX_ALL},
 	LAST_OPTION
 };
 
@@ -396,13 +798,33 @@ static const configoption_t options[] = {
 	DEFAULT_PORT,				\
 	DEFAULT_MIN_CONNECTIONS,	\
 	DEFAULT_MAX_CONNECTIONS,	\
+	DEFAULT_COOKIE_THRESHOLD,	\
+	DEFAULT_HANDSHAKE_RATE_LIMIT, \
+	DEFAULT_DATA_RATE_LIMIT,	\
 	DEFAULT_CACHE_SIZE,			\
 	DEFAULT_EXPIRATION_TIME,	\
+	DEFAULT_BATCH_SIZE,			\
+	DEFAULT_LISTENERS,			\
+	DEFAULT_POOL_SIZE,			\
+	DEFAULT_CRYPTO_WORKERS,		\
+	DEFAULT_DH_POOL_SIZE,		\
+	DEFAULT_DH_POOL_WATERMARK,	\
+	DEFAULT_EVENT_LOOP,			\
+	DEFAULT_COALESCE_WINDOW,	\
+	DEFAULT_SEND_QUEUE_DEPTH,	\
+	DEFAULT_NODE_EXPLORATION,	\
+	DEFAULT_RECEIVE_QUEUE_DEPTH, \
+	DEFAULT_RECEIVE_QUEUE_TIMEOUT, \
+	DEFAULT_PADDING_POLICY,		\
+	DEFAULT_SEND_QUEUE_POLICY,	\
+	DEFAULT_RECEIVE_QUEUE_POLICY,	\
 	DEFAULT_STATIC_NODES,		\
 	DEFAULT_RECENT_NODES,		\
+	DEFAULT_NODES_SNAPSHOT,		\
 	DEFAULT_CIPHER_LIST,		\
 	DEFAULT_HASH_LIST,			\
-	DEFAULT_MAC_LIST			\
+	DEFAULT_MAC_LIST,			\
+	DEFAULT_KEX_LIST			\
 }
 
 /**
@@ -422,8 +844,25 @@ static llp_config_t current_config = DEFAULT_CONFIG;
 static char *cipher_string = NULL;
 static char *hash_string = NULL;
 static char *mac_string = NULL;
+static char *kex_string = NULL;
 /*@} */
 
+/**
+ * Names of the padding policies, indexed by policy.
+ */
+static char *padding_names[] = {NULL, "buckets", "jitter", "ftu"};
+
+/**
+ * Names of the send ring policies, indexed by policy.
+ */
+static char *send_policy_names[] = {NULL, "block", "drop", "error"};
+
+/**
+ * Names of the receive ring policies, indexed by policy.
+ */
+static char *receive_policy_names[] = 
+		{NULL, "drop-newest", "drop-oldest", "block"};
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/
@@ -461,12 +900,15 @@ int llp_configure(char *config_name) {
 	cipher_string = get_function_string(&current_config.cipher_list);
 	hash_string = get_function_string(&current_config.hash_list);
 	mac_string = get_function_string(&current_config.mac_list);
+	kex_string = get_function_string(&current_config.kex_list);
 
 	liblog_debug(LAYER_LINK, "cipher_string: %s.", cipher_string);
 	liblog_debug(LAYER_LINK, "hash_string: %s.", hash_string);
 	liblog_debug(LAYER_LINK, "mac_string: %s.", mac_string);
+	liblog_debug(LAYER_LINK, "kex_string: %s.", kex_string);
 
-	if (cipher_string == NULL || hash_string == NULL || mac_string == NULL) {
+	if (cipher_string == NULL || hash_string == NULL || mac_string == NULL ||
+			kex_string == NULL) {
 		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
 		return LLP_ERROR;
 	}
@@ -482,8 +924,9 @@ void llp_unconfigure() {
 	free(cipher_string);
 	free(hash_string);
 	free(mac_string);
+	free(kex_string);
 
-	cipher_string = hash_string = mac_string = NULL;
+	cipher_string = hash_string = mac_string = kex_string = NULL;
 }
 
 /******************************************************************************/
@@ -506,7 +949,7 @@ util_cipher_function_t *llp_search_cipher(char *ciphers) {
 	while (token != NULL) {
 		for (i = 0; i < current_config.cipher_list.size; i++) {
 			if (strcmp(token, current_config.cipher_list.list[i]) == 0) {
-				function = util_get_cipher(token);
+				function = llp_get_cipher(token);
 				free(ciphers_copy);
 				return function;
 			}
@@ -587,6 +1030,40 @@ util_mac_function_t *llp_search_mac(char *macs) {
 	return NULL;
 }
 
+/******************************************************************************/
+llp_kex_function_t *llp_search_kex(char *kexes) {
+	int i;
+	char *kexes_copy;
+	char *token;
+	llp_kex_function_t *function;
+
+	/* We duplicate the string, because strtok is destructive. */
+	kexes_copy = (char *)malloc(strlen(kexes) + 1);
+	if (kexes_copy == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return NULL;
+	}
+
+	memcpy(kexes_copy, kexes, strlen(kexes) + 1);
+
+	token = strtok((char *)kexes_copy, ";");
+	while (token != NULL) {
+		for (i = 0; i < current_config.kex_list.size; i++) {
+			if (strcmp(token, current_config.kex_list.list[i]) == 0) {
+				function = llp_get_kex(token);
+				free(kexes_copy);
+				return function;
+			}
+		}
+		token = strtok(NULL, ";");
+	}
+
+	free(kexes_copy);
+
+	liblog_error(LAYER_LINK, "no key agreement negotiated: %s.", kexes);
+	return NULL;
+}
+
 /******************************************************************************/
 int llp_get_port() {
 	return current_config.port;
@@ -602,6 +1079,21 @@ int llp_get_max_connections() {
 	return current_config.max_connections;
 }
 
+/******************************************************************************/
+int llp_get_cookie_threshold() {
+	return current_config.cookie_threshold;
+}
+
+/******************************************************************************/
+int llp_get_handshake_rate_limit() {
+	return current_config.handshake_rate_limit;
+}
+
+/******************************************************************************/
+int llp_get_data_rate_limit() {
+	return current_config.data_rate_limit;
+}
+
 /******************************************************************************/
 int llp_get_cache_size() {
 	return current_config.cache_size;
@@ -612,11 +1104,119 @@ int llp_get_expiration_time() {
 	return current_config.expiration_time;
 }
 
+/******************************************************************************/
+int llp_get_batch_size() {
+	return current_config.batch_size;
+}
+
+/******************************************************************************/
+int llp_get_listeners() {
+	return current_config.listeners;
+}
+
+/******************************************************************************/
+int llp_get_pool_size() {
+	return current_config.pool_size;
+}
+
+/******************************************************************************/
+int llp_get_crypto_workers() {
+	return current_config.crypto_workers;
+}
+
+/******************************************************************************/
+int llp_get_dh_pool_size() {
+	return current_config.dh_pool_size;
+}
+
+/******************************************************************************/
+int llp_get_dh_pool_watermark() {
+	return current_config.dh_pool_watermark;
+}
+
+/******************************************************************************/
+int llp_get_event_loop() {
+	return current_config.event_loop;
+}
+
+/******************************************************************************/
+int llp_get_coalesce_window() {
+	return current_config.coalesce_window;
+}
+
+/******************************************************************************/
+int llp_get_send_queue_depth() {
+	return current_config.send_queue_depth;
+}
+
+/******************************************************************************/
+int llp_get_node_exploration() {
+	return current_config.node_exploration;
+}
+
+/******************************************************************************/
+int llp_get_receive_queue_depth() {
+	return current_config.receive_queue_depth;
+}
+
+/******************************************************************************/
+int llp_get_receive_queue_timeout() {
+	return current_config.receive_queue_timeout;
+}
+
+/******************************************************************************/
+int llp_get_padding_policy() {
+	return current_config.padding_policy;
+}
+
+/******************************************************************************/
+int llp_get_send_queue_policy() {
+	return current_config.send_queue_policy;
+}
+
+/******************************************************************************/
+int llp_get_receive_queue_policy() {
+	return current_config.receive_queue_policy;
+}
+
+/******************************************************************************/
+char *llp_get_receive_policy_name(int policy) {
+	if (policy < LLP_RECEIVE_DROP_NEWEST || policy > LLP_RECEIVE_BLOCK) {
+		return NULL;
+	}
+	return receive_policy_names[policy];
+}
+
+/******************************************************************************/
+char *llp_get_padding_name(int policy) {
+	if (policy < LLP_PADDING_BUCKETS || policy > LLP_PADDING_FTU) {
+		return NULL;
+	}
+	return padding_names[policy];
+}
+
+/******************************************************************************/
+int llp_negotiate_padding(int policy) {
+	/* Policies are ordered, the stricter of both peers is used. */
+	if (policy < LLP_PADDING_BUCKETS || policy > LLP_PADDING_FTU) {
+		return LLP_PADDING_FTU;
+	}
+	if (policy < current_config.padding_policy) {
+		return current_config.padding_policy;
+	}
+	return policy;
+}
+
 /******************************************************************************/
 char *llp_get_recent_nodes_file() {
 	return current_config.recent_nodes;
 }
 
+/******************************************************************************/
+char *llp_get_nodes_snapshot_file() {
+	return current_config.nodes_snapshot;
+}
+
 /******************************************************************************/
 char *llp_get_static_nodes_file() {
 	return current_config.static_nodes;
@@ -637,6 +1237,11 @@ int llp_get_mac_string(char *string, int max) {
 	return copy_function_string(string, max, mac_string);
 }
 
+/******************************************************************************/
+int llp_get_kex_string(char *string, int max) {
+	return copy_function_string(string, max, kex_string);
+}
+
 /*============================================================================*/
 /* Private functions implementations.                                         */
 /*============================================================================*/
@@ -655,6 +1260,21 @@ void set_max_connections(int max_connections) {
 	current_config.max_connections = max_connections;
 }
 
+/******************************************************************************/
+void set_cookie_threshold(int cookie_threshold) {
+	current_config.cookie_threshold = cookie_threshold;
+}
+
+/******************************************************************************/
+void set_handshake_rate_limit(int handshake_rate_limit) {
+	current_config.handshake_rate_limit = handshake_rate_limit;
+}
+
+/******************************************************************************/
+void set_data_rate_limit(int data_rate_limit) {
+	current_config.data_rate_limit = data_rate_limit;
+}
+
 /******************************************************************************/
 void set_cache_size(int cache_size) {
 	current_config.cache_size = cache_size;
@@ -662,12 +1282,17 @@ void set_cache_size(int cache_size) {
 
 /******************************************************************************/
 void set_static_nodes_file(char *filename) {
-	replace_string(&current_config.recent_nodes, filename);
+	replace_string(&current_config.static_nodes, filename);
 }
 
 /******************************************************************************/
 void set_recent_nodes_file(char *filename) {
-	replace_string(&current_config.static_nodes, filename);
+	replace_string(&current_config.recent_nodes, filename);
+}
+
+/******************************************************************************/
+void set_nodes_snapshot_file(char *filename) {
+	replace_string(&current_config.nodes_snapshot, filename);
 }
 
 /******************************************************************************/
@@ -675,6 +1300,81 @@ void set_expiration_time(int expiration_time) {
 	current_config.expiration_time = expiration_time;
 }
 
+/******************************************************************************/
+void set_batch_size(int batch_size) {
+	current_config.batch_size = batch_size;
+}
+
+/******************************************************************************/
+void set_listeners(int listeners) {
+	current_config.listeners = listeners;
+}
+
+/******************************************************************************/
+void set_pool_size(int pool_size) {
+	current_config.pool_size = pool_size;
+}
+
+/******************************************************************************/
+void set_crypto_workers(int crypto_workers) {
+	current_config.crypto_workers = crypto_workers;
+}
+
+/******************************************************************************/
+void set_dh_pool_size(int dh_pool_size) {
+	current_config.dh_pool_size = dh_pool_size;
+}
+
+/******************************************************************************/
+void set_dh_pool_watermark(int dh_pool_watermark) {
+	current_config.dh_pool_watermark = dh_pool_watermark;
+}
+
+/******************************************************************************/
+void set_event_loop(int event_loop) {
+	current_config.event_loop = event_loop;
+}
+
+/******************************************************************************/
+void set_coalesce_window(int coalesce_window) {
+	current_config.coalesce_window = coalesce_window;
+}
+
+/******************************************************************************/
+void set_send_queue_depth(int send_queue_depth) {
+	current_config.send_queue_depth = send_queue_depth;
+}
+
+/******************************************************************************/
+void set_node_exploration(int node_exploration) {
+	current_config.node_exploration = node_exploration;
+}
+
+/******************************************************************************/
+void set_receive_queue_depth(int receive_queue_depth) {
+	current_config.receive_queue_depth = receive_queue_depth;
+}
+
+/******************************************************************************/
+void set_receive_queue_timeout(int receive_queue_timeout) {
+	current_config.receive_queue_timeout = receive_queue_timeout;
+}
+
+/******************************************************************************/
+void set_padding_policy(int padding_policy) {
+	current_config.padding_policy = padding_policy;
+}
+
+/******************************************************************************/
+void set_send_queue_policy(int send_queue_policy) {
+	current_config.send_queue_policy = send_queue_policy;
+}
+
+/******************************************************************************/
+void set_receive_queue_policy(int receive_queue_policy) {
+	current_config.receive_queue_policy = receive_queue_policy;
+}
+
 /******************************************************************************/
 void set_cipher_list(llp_function_list_t * cipher_list) {
 	copy_removing_duplicates(&(current_config.cipher_list), cipher_list);
@@ -685,6 +1385,11 @@ void set_hash_list(llp_function_list_t * hash_list) {
 	copy_removing_duplicates(&(current_config.hash_list), hash_list);
 }
 
+/******************************************************************************/
+void set_kex_list(llp_function_list_t * kex_list) {
+	copy_removing_duplicates(&(current_config.kex_list), kex_list);
+}
+
 /******************************************************************************/
 void set_mac_list(llp_function_list_t * mac_list) {
 	copy_removing_duplicates(&(current_config.mac_list), mac_list);
@@ -711,6 +1416,24 @@ DOTCONF_CB(handle_int) {
 		return NULL;
 	}
 
+	if (strcmp(cmd->name, COOKIE_THRESHOLD_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "cookie_threshold parameter found.");
+		set_cookie_threshold(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, HANDSHAKE_RATE_LIMIT_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "handshake_rate_limit parameter found.");
+		set_handshake_rate_limit(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, DATA_RATE_LIMIT_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "data_rate_limit parameter found.");
+		set_data_rate_limit(cmd->data.value);
+		return NULL;
+	}
+
 	if (strcmp(cmd->name, CACHE_SIZE_KEYWORD) == 0) {
 		liblog_debug(LAYER_LINK, "cache_size parameter found.");
 		set_cache_size(cmd->data.value);
@@ -723,6 +1446,78 @@ DOTCONF_CB(handle_int) {
 		return NULL;
 	}
 
+	if (strcmp(cmd->name, BATCH_SIZE_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "batch_size parameter found.");
+		set_batch_size(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, LISTENERS_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "listeners parameter found.");
+		set_listeners(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, POOL_SIZE_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "pool_size parameter found.");
+		set_pool_size(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, CRYPTO_WORKERS_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "crypto_workers parameter found.");
+		set_crypto_workers(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, DH_POOL_SIZE_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "dh_pool_size parameter found.");
+		set_dh_pool_size(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, DH_POOL_WATERMARK_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "dh_pool_watermark parameter found.");
+		set_dh_pool_watermark(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, EVENT_LOOP_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "event_loop parameter found.");
+		set_event_loop(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, COALESCE_WINDOW_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "coalesce_window parameter found.");
+		set_coalesce_window(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, SEND_QUEUE_DEPTH_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "send_queue_depth parameter found.");
+		set_send_queue_depth(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, NODE_EXPLORATION_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "node_exploration parameter found.");
+		set_node_exploration(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, RECEIVE_QUEUE_DEPTH_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "receive_queue_depth parameter found.");
+		set_receive_queue_depth(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, RECEIVE_QUEUE_TIMEOUT_KEYWORD) == 0) {
+		liblog_debug(LAYER_LINK, "receive_queue_timeout parameter found.");
+		set_receive_queue_timeout(cmd->data.value);
+		return NULL;
+	}
+
 	return NULL;
 }
 
@@ -735,11 +1530,17 @@ DOTCONF_CB(handle_file) {
 	}
 
 	if (strcmp(cmd->name, STATIC_NODES_FILE_KEYWORD) == 0) {
-		liblog_debug(LAYER_DAEMON, "recent_nodes_file parameter found.");
+		liblog_debug(LAYER_DAEMON, "static_nodes_file parameter found.");
 		set_static_nodes_file(cmd->data.str);
 		return NULL;
 	}
 
+	if (strcmp(cmd->name, NODES_SNAPSHOT_FILE_KEYWORD) == 0) {
+		liblog_debug(LAYER_DAEMON, "nodes_snapshot_file parameter found.");
+		set_nodes_snapshot_file(cmd->data.str);
+		return NULL;
+	}
+
 	return NULL;
 }
 
@@ -763,7 +1564,7 @@ DOTCONF_CB(handle_ciphers) {
 	/* Checking if functions specified are supported. */
 	list.size = 0;
 	for (i = 0; i < size; i++) {
-		if (util_get_cipher(cmd->data.list[i]) != NULL) {
+		if (llp_get_cipher(cmd->data.list[i]) != NULL) {
 			strncpy(list.list[list.size++], cmd->data.list[i], LLP_FUNCTION_MAX_LENGTH);
 		}
 	}
@@ -843,6 +1644,90 @@ DOTCONF_CB(handle_macs) {
 	return NULL;
 }
 
+/******************************************************************************/
+DOTCONF_CB(handle_kexes) {
+	int i;
+	int size;
+	llp_function_list_t list;
+
+	/* Dotconf only uses 16 arguments in lists, leaving in cmd->data[15]
+	 * the unparsed rest of the string. So we use the first 15 arguments and 
+	 * ignore the rest of them. */
+	if (cmd->arg_count == CFG_VALUES) {
+		liblog_warn(LAYER_LINK, "too much key agreements listed in"
+				"configuration parameter, using the first 15 specified.");
+		size = cmd->arg_count - 1;
+	} else {
+		size = cmd->arg_count;
+	}
+
+	/* Checking if algorithms specified are supported. */
+	list.size = 0;
+	for (i = 0; i < size; i++) {
+		if (llp_get_kex(cmd->data.list[i]) != NULL) {
+			strncpy(list.list[list.size++], cmd->data.list[i], LLP_FUNCTION_MAX_LENGTH);
+		}
+	}
+	/* Copying the default key agreement. */
+	if (list.size > 0) {
+		strncpy(list.list[list.size++], default_config.kex_list.list[0], LLP_FUNCTION_MAX_LENGTH);
+	}
+	set_kex_list(&list);
+
+	return NULL;
+}
+
+/******************************************************************************/
+DOTCONF_CB(handle_padding) {
+	int i;
+
+	for (i = LLP_PADDING_BUCKETS; i <= LLP_PADDING_FTU; i++) {
+		if (strcmp(cmd->data.str, padding_names[i]) == 0) {
+			liblog_debug(LAYER_LINK, "padding_policy parameter found.");
+			set_padding_policy(i);
+			return NULL;
+		}
+	}
+	liblog_warn(LAYER_LINK, "padding policy not supported: %s.",
+			cmd->data.str);
+
+	return NULL;
+}
+
+/******************************************************************************/
+DOTCONF_CB(handle_send_policy) {
+	int i;
+
+	for (i = LLP_SEND_BLOCK; i <= LLP_SEND_ERROR; i++) {
+		if (strcmp(cmd->data.str, send_policy_names[i]) == 0) {
+			liblog_debug(LAYER_LINK, "send_queue_policy parameter found.");
+			set_send_queue_policy(i);
+			return NULL;
+		}
+	}
+	liblog_warn(LAYER_LINK, "send queue policy not supported: %s.",
+			cmd->data.str);
+
+	return NULL;
+}
+
+/******************************************************************************/
+DOTCONF_CB(handle_receive_policy) {
+	int i;
+
+	for (i = LLP_RECEIVE_DROP_NEWEST; i <= LLP_RECEIVE_BLOCK; i++) {
+		if (strcmp(cmd->data.str, receive_policy_names[i]) == 0) {
+			liblog_debug(LAYER_LINK, "receive_queue_policy parameter found.");
+			set_receive_queue_policy(i);
+			return NULL;
+		}
+	}
+	liblog_warn(LAYER_LINK, "receive queue policy not supported: %s.",
+			cmd->data.str);
+
+	return NULL;
+}
+
 /******************************************************************************/
 FUNC_ERRORHANDLER(handle_error) {
 
@@ -888,8 +1773,11 @@ int check_sanity() {
 		return_value = CONFIG_NOT_SANE;
 	}
 
-	if (current_config.max_connections <= 0 || current_config.max_connections >= 255) {
-		liblog_error(LAYER_LINK, "max_connections must be a positive integer between 1 and 255.");
+	if (current_config.max_connections <= 0 ||
+			current_config.max_connections > LLP_MAX_SESSIONS) {
+		liblog_error(LAYER_LINK, 
+				"max_connections must be a positive integer between 1 and %d.",
+				LLP_MAX_SESSIONS);
 		current_config.max_connections = DEFAULT_MAX_CONNECTIONS;
 		return_value = CONFIG_NOT_SANE;
 	}
@@ -901,6 +1789,30 @@ int check_sanity() {
 		return_value = CONFIG_NOT_SANE;
 	}
 
+	if (current_config.cookie_threshold < -1) {
+		liblog_error(LAYER_LINK, "cookie_threshold must be -1 or greater.");
+		current_config.cookie_threshold = DEFAULT_COOKIE_THRESHOLD;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.handshake_rate_limit < 0 ||
+			current_config.handshake_rate_limit > LLP_MAX_RATE_LIMIT) {
+		liblog_error(LAYER_LINK, 
+				"handshake_rate_limit must be between 0 and %d.",
+				LLP_MAX_RATE_LIMIT);
+		current_config.handshake_rate_limit = DEFAULT_HANDSHAKE_RATE_LIMIT;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.data_rate_limit < 0 ||
+			current_config.data_rate_limit > LLP_MAX_RATE_LIMIT) {
+		liblog_error(LAYER_LINK, 
+				"data_rate_limit must be between 0 and %d.",
+				LLP_MAX_RATE_LIMIT);
+		current_config.data_rate_limit = DEFAULT_DATA_RATE_LIMIT;
+		return_value = CONFIG_NOT_SANE;
+	}
+
 	if (current_config.expiration_time <= ONE_MINUTE) {
 		liblog_error(LAYER_LINK, "session expiration time too small.");
 		current_config.expiration_time = DEFAULT_EXPIRATION_TIME;
@@ -913,6 +1825,119 @@ int check_sanity() {
 		return_value = CONFIG_NOT_SANE;
 	}
 
+	if (current_config.batch_size < 1 ||
+			current_config.batch_size > LLP_MAX_BATCH_SIZE) {
+		liblog_error(LAYER_LINK, "batch_size must be between 1 and %d.",
+				LLP_MAX_BATCH_SIZE);
+		current_config.batch_size = DEFAULT_BATCH_SIZE;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.listeners < 1 ||
+			current_config.listeners > LLP_MAX_LISTENERS) {
+		liblog_error(LAYER_LINK, "listeners must be between 1 and %d.",
+				LLP_MAX_LISTENERS);
+		current_config.listeners = DEFAULT_LISTENERS;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.pool_size < 1) {
+		liblog_error(LAYER_LINK, "pool size too small.");
+		current_config.pool_size = DEFAULT_POOL_SIZE;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.crypto_workers < 0 ||
+			current_config.crypto_workers > LLP_MAX_WORKERS) {
+		liblog_error(LAYER_LINK, "crypto workers must be between 0 and %d.",
+				LLP_MAX_WORKERS);
+		current_config.crypto_workers = DEFAULT_CRYPTO_WORKERS;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.dh_pool_size < 0) {
+		liblog_error(LAYER_LINK, "D&H pool size can't be negative.");
+		current_config.dh_pool_size = DEFAULT_DH_POOL_SIZE;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.dh_pool_size > 0 &&
+			(current_config.dh_pool_watermark < 1 ||
+			current_config.dh_pool_watermark > current_config.dh_pool_size)) {
+		liblog_error(LAYER_LINK,
+				"D&H pool watermark must be between 1 and the pool size.");
+		current_config.dh_pool_watermark = current_config.dh_pool_size;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.event_loop != 0 && current_config.event_loop != 1) {
+		liblog_error(LAYER_LINK, "event_loop must be 0 or 1.");
+		current_config.event_loop = DEFAULT_EVENT_LOOP;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.coalesce_window < 0 ||
+			current_config.coalesce_window >= LLP_TIME_TICK) {
+		liblog_error(LAYER_LINK,
+				"coalesce_window must be between 0 and %d.", LLP_TIME_TICK - 1);
+		current_config.coalesce_window = DEFAULT_COALESCE_WINDOW;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.send_queue_depth < 0 ||
+			current_config.send_queue_depth > LLP_MAX_SEND_QUEUE_DEPTH) {
+		liblog_error(LAYER_LINK, "send_queue_depth must be between 0 and %d.",
+				LLP_MAX_SEND_QUEUE_DEPTH);
+		current_config.send_queue_depth = DEFAULT_SEND_QUEUE_DEPTH;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.node_exploration < 0 ||
+			current_config.node_exploration > 100) {
+		liblog_error(LAYER_LINK, "node_exploration must be between 0 and 100.");
+		current_config.node_exploration = DEFAULT_NODE_EXPLORATION;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.receive_queue_depth < 1 ||
+			current_config.receive_queue_depth > LLP_MAX_RECEIVE_QUEUE_DEPTH) {
+		liblog_error(LAYER_LINK, 
+				"receive_queue_depth must be between 1 and %d.",
+				LLP_MAX_RECEIVE_QUEUE_DEPTH);
+		current_config.receive_queue_depth = DEFAULT_RECEIVE_QUEUE_DEPTH;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.receive_queue_timeout < 0 ||
+			current_config.receive_queue_timeout > LLP_MAX_RECEIVE_QUEUE_TIMEOUT) {
+		liblog_error(LAYER_LINK, 
+				"receive_queue_timeout must be between 0 and %d.",
+				LLP_MAX_RECEIVE_QUEUE_TIMEOUT);
+		current_config.receive_queue_timeout = DEFAULT_RECEIVE_QUEUE_TIMEOUT;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.padding_policy < LLP_PADDING_BUCKETS ||
+			current_config.padding_policy > LLP_PADDING_FTU) {
+		liblog_error(LAYER_LINK, "padding_policy is invalid.");
+		current_config.padding_policy = DEFAULT_PADDING_POLICY;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.send_queue_policy < LLP_SEND_BLOCK ||
+			current_config.send_queue_policy > LLP_SEND_ERROR) {
+		liblog_error(LAYER_LINK, "send_queue_policy is invalid.");
+		current_config.send_queue_policy = DEFAULT_SEND_QUEUE_POLICY;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.receive_queue_policy < LLP_RECEIVE_DROP_NEWEST ||
+			current_config.receive_queue_policy > LLP_RECEIVE_BLOCK) {
+		liblog_error(LAYER_LINK, "receive_queue_policy is invalid.");
+		current_config.receive_queue_policy = DEFAULT_RECEIVE_QUEUE_POLICY;
+		return_value = CONFIG_NOT_SANE;
+	}
+
 	if (file_exists(current_config.recent_nodes) == FILE_NOT_PRESENT) {
 		liblog_error(LAYER_LINK, "file not found. (%s)", current_config.recent_nodes);
 		current_config.recent_nodes = DEFAULT_RECENT_NODES;
@@ -944,6 +1969,12 @@ int check_sanity() {
 		return_value = CONFIG_NOT_SANE;
 	}
 
+	if (current_config.kex_list.size <= 0) {
+		liblog_error(LAYER_LINK, "kex_list is invalid.");
+		memcpy(&current_config.kex_list, &default_config.kex_list, sizeof(llp_function_list_t));
+		return_value = CONFIG_NOT_SANE;
+	}
+
 	return return_value;
 }
 
@@ -31,6 +31,8 @@
  
 #include <util/util_crypto.h>
 
+#include "llp_dh.h"
+
 /**
  * Reads the configuration file looking for parameter definitions.
  * 
@@ -77,6 +79,17 @@ util_hash_function_t *llp_search_hash(char *hashes);
  */
 util_mac_function_t *llp_search_mac(char *macs);
 
+/**
+ * Returns the first key agreement algorithm available locally matching the
+ * list of key agreement algorithms.
+ * 
+ * @param[in] kexes		- list of algorithm names, separated with semicolons or
+ * 		a single algorithm name
+ * @retval NULL			- if no algorithms are available
+ * @return a pointer to the algorithm.
+ */
+llp_kex_function_t *llp_search_kex(char *kexes);
+
 /**
  * Returns the current port.
  * 
@@ -98,6 +111,29 @@ int llp_get_min_connections();
  */
 int llp_get_max_connections();
 
+/**
+ * Returns the number of half-open sessions from which connection requests must
+ * echo a cookie before any session is reserved to them.
+ * 
+ * @return the cookie threshold, 0 if cookies are always required and -1 if they
+ * 		are never required.
+ */
+int llp_get_cookie_threshold();
+
+/**
+ * Returns the number of handshake packets accepted from each source per second.
+ * 
+ * @return the rate limit, 0 if there is no limit.
+ */
+int llp_get_handshake_rate_limit();
+
+/**
+ * Returns the number of data packets accepted from each source per second.
+ * 
+ * @return the rate limit, 0 if there is no limit.
+ */
+int llp_get_data_rate_limit();
+
 /**
  * Returns the nodes cache capacity (in nodes).
  * 
@@ -112,6 +148,148 @@ int llp_get_cache_size();
  */
 int llp_get_expiration_time();
 
+/**
+ * Returns the maximum number of packets received or sent by a single socket
+ * call.
+ * 
+ * @return the current socket batch size, in packets.
+ */
+int llp_get_batch_size();
+
+/**
+ * Returns the number of threads listening on the module port, each one with
+ * its own socket.
+ * 
+ * @return the current number of listeners.
+ */
+int llp_get_listeners();
+
+/**
+ * Returns the number of packet buffers preallocated in the pool.
+ * 
+ * @return the current pool size, in buffers.
+ */
+int llp_get_pool_size();
+
+/**
+ * Returns the number of threads that perform the Diffie & Hellman computations
+ * of the handshake. Zero means the listeners perform them.
+ * 
+ * @return the current number of crypto workers.
+ */
+int llp_get_crypto_workers();
+
+/**
+ * Returns the number of precomputed Diffie & Hellman key pairs. Zero means key
+ * pairs are computed on demand.
+ * 
+ * @return the current key pool size, in pairs.
+ */
+int llp_get_dh_pool_size();
+
+/**
+ * Returns the number of key pairs below which the key pool is refilled.
+ * 
+ * @return the current refill watermark, in pairs.
+ */
+int llp_get_dh_pool_watermark();
+
+/**
+ * Returns if the listeners run an event loop that also handles the timers and
+ * the node monitor.
+ * 
+ * @return 1 if the event loop is used, 0 otherwise.
+ */
+int llp_get_event_loop();
+
+/**
+ * Returns the time that datagrams written to a session wait to be packed with
+ * the next ones in a single LLP_DATA packet.
+ * 
+ * @return the current coalescing window in milliseconds, 0 if disabled.
+ */
+int llp_get_coalesce_window();
+
+/**
+ * Returns the number of datagrams that each session send ring holds. Datagrams
+ * are sent synchronously by the writer when it is 0.
+ * 
+ * @return the current send ring depth.
+ */
+int llp_get_send_queue_depth();
+
+/**
+ * Returns the percentage of node selections made at random, ignoring the
+ * latency and reliability scores of the nodes.
+ * 
+ * @return the current exploration percentage.
+ */
+int llp_get_node_exploration();
+
+/**
+ * Returns the number of received datagrams each session can hold until they
+ * are read by the upper layer.
+ * 
+ * @return the depth of the receive ring of each session.
+ */
+int llp_get_receive_queue_depth();
+
+/**
+ * Returns the time a receiver waits for room in a full receive ring when the
+ * receive policy is block.
+ * 
+ * @return the timeout in milliseconds.
+ */
+int llp_get_receive_queue_timeout();
+
+/**
+ * Returns the policy used to pad LLP_DATA packets.
+ * 
+ * @return one of the LLP_PADDING_* policies.
+ */
+int llp_get_padding_policy();
+
+/**
+ * Returns the behaviour of llp_write() when a session send ring is full.
+ * 
+ * @return one of the LLP_SEND_* policies.
+ */
+int llp_get_send_queue_policy();
+
+/**
+ * Returns the behaviour of the receivers when a session receive ring is full.
+ * 
+ * @return one of the LLP_RECEIVE_* policies.
+ */
+int llp_get_receive_queue_policy();
+
+/**
+ * Returns the name of the given receive ring policy.
+ * 
+ * @param policy one of the LLP_RECEIVE_* policies.
+ * @return the name of the policy, or NULL if the policy is unknown.
+ */
+char *llp_get_receive_policy_name(int policy);
+
+/**
+ * Returns the name of the given padding policy.
+ * 
+ * @param[in] policy	- one of the LLP_PADDING_* policies.
+ * @retval NULL			- if the policy is unknown
+ * @return the name of the policy.
+ */
+char *llp_get_padding_name(int policy);
+
+/**
+ * Negotiates the padding policy of a session with the policy advertised by the
+ * other peer. The stricter of both policies is used, an unknown policy is
+ * handled as LLP_PADDING_FTU.
+ * 
+ * @param[in] policy	- the policy advertised by the other peer.
+ * @return the padding policy of the session.
+ */
+int llp_negotiate_padding(int policy);
+
 /**
  * Returns the name of the file that contains addresses and ports of nodes to be
  * stored on cache and will be persistent between executions.
@@ -128,6 +306,14 @@ char *llp_get_static_nodes_file();
  */
 char *llp_get_recent_nodes_file();
 
+/**
+ * Returns the name of the file that this module will use to save a binary
+ * snapshot of the nodes cache, loaded quickly at startup.
+ * 
+ * @return the name of file containing the nodes cache snapshot.
+ */
+char *llp_get_nodes_snapshot_file();
+
 /**
  * Fills a string containing all cipher functions supported. The string must be
  * pre-allocated, and the parameter max controls the maximum number of bytes
@@ -170,4 +356,18 @@ int llp_get_hash_string(char *string, int max);
  */
 int llp_get_mac_string(char *string, int max);
 
+/**
+ * Fills a string containing all key agreement algorithms supported. The string
+ * must be pre-allocated, and the parameter max controls the maximum number of
+ * bytes that can be written in string, including the terminating \\0. If the
+ * string capacity is not enough to store the amount of data needed, an error
+ * is returned.
+ * 
+ * @param[out] string 	- array that will store the key agreement string.
+ * @param[in] max 		- maximum number of bytes that can be written in string.
+ * @retval LLP_ERROR	- if the string capacity is not enough
+ * @return the number of bytes written in string.
+ */
+int llp_get_kex_string(char *string, int max);
+
 #endif /* !_LLP_CONFIG_H_ */
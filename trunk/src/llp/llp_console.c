@@ -48,6 +48,13 @@
 #include "llp_packets.h"
 #include "llp_handshake.h"
 #include "llp_data.h"
+#include "llp_info.h"
+#include "llp_pool.h"
+#include "llp_workers.h"
+#include "llp_dh.h"
+#include "llp_config.h"
+#include "llp_queue.h"
+#include "llp_limits.h"
 
 /*============================================================================*/
 /* Local data definitions.                                                    */
@@ -67,6 +74,7 @@
 #define COMMAND_ALGORITHMS  9
 #define COMMAND_DH_PARAMS  	10
 #define COMMAND_STATISTICS	11
+#define COMMAND_QUEUES		12
 
 /*
  * All available commands to llp module.
@@ -82,6 +90,8 @@ static command_t commands[] = {
 			"[keys <session_id>]. Show session keys."},
 	{COMMAND_STATISTICS, "statistics", 
 			"[statistics]. Show sessions statistics."},
+	{COMMAND_QUEUES, "queues", 
+			"[queues]. Show sessions receive queues."},
 	{COMMAND_CONNECT, "connect", 
 			"[connect <ip> <port>]. Establish a new session to other host."},
 	{COMMAND_DISCONNECT, "disconnect", 
@@ -170,6 +180,12 @@ static void console_print_sessions(char *out_buffer, int buffer_len,
 static void console_print_statistics(char *out_buffer, int buffer_len, 
 		char *args);
 
+/*
+ * Execute COMMAND_QUEUES command.
+ */
+static void console_print_queues(char *out_buffer, int buffer_len, 
+		char *args);
+
 /*
  * Execute COMMAND_KEYS command.
  */
@@ -244,6 +260,9 @@ void console_execute_command(char *out_buffer, int buffer_len,
 		case COMMAND_STATISTICS:
 			console_print_statistics(out_buffer, buffer_len, args);
 			break;
+		case COMMAND_QUEUES:
+			console_print_queues(out_buffer, buffer_len, args);
+			break;
 		case COMMAND_ALGORITHMS:
 			console_print_algorithms(out_buffer, buffer_len, args);
 			break;
@@ -286,8 +305,8 @@ void console_print_sessions(char *out_buffer, int buffer_len, char *args) {
 			"Foreign Address",
 			"State",
 			"Timeout",
-			"Silent");
-	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+			"Keep-alive");
+	for (i = 0; i < llp_get_sessions_count(); i++) {
 
 		llp_lock_session(i);
 
@@ -300,8 +319,8 @@ void console_print_sessions(char *out_buffer, int buffer_len, char *args) {
 					inet_ntoa(ip),
 					ntohs(llp_sessions[i].address.sin_port),
 					llp_states[llp_sessions[i].state],
-					(llp_sessions[i].timeout*LLP_TIME_TICK)/1000,
-					(llp_sessions[i].silence*LLP_TIME_TICK)/1000);
+					(llp_get_timer(i, LLP_TIMER_TIMEOUT)*LLP_TIME_TICK)/1000,
+					(llp_get_timer(i, LLP_TIMER_SILENCE)*LLP_TIME_TICK)/1000);
 		}
 		
 		llp_unlock_session(i);
@@ -313,27 +332,98 @@ void console_print_statistics(char *out_buffer, int buffer_len, char *args) {
 	struct in_addr ip;
 	
 	out_buffer[0] = '\0';
-	console_printf(out_buffer, buffer_len, "%-10s %-10s %-10s %-10s\n", 
+	console_printf(out_buffer, buffer_len, 
+			"%-10s %-10s %-10s %-10s %-12s %-12s %-6s %-8s\n", 
 			"Local #",
 			"Foreign #",
 			"Sent",
-			"Recv");
-	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+			"Recv",
+			"Payload",
+			"Padding",
+			"Queue",
+			"Dropped");
+	for (i = 0; i < llp_get_sessions_count(); i++) {
 
 		llp_lock_session(i);
 
 		if (llp_sessions[i].state == LLP_STATE_ESTABLISHED) {
 			ip = llp_sessions[i].address.sin_addr;
 			console_printf(out_buffer, buffer_len, 
-					"%-10d %-10d %-10d %-10d\n", 
+					"%-10d %-10d %-10d %-10d %-12ld %-12ld %-6d %-8ld\n", 
 					i,
 					llp_sessions[i].foreign_session,
 					llp_sessions[i].packets_sent,
-					llp_sessions[i].packets_received);
+					llp_sessions[i].packets_received,
+					llp_sessions[i].payload_bytes,
+					llp_sessions[i].padding_bytes,
+					llp_sessions[i].send_count,
+					llp_sessions[i].send_dropped);
 		}
 		
 		llp_unlock_session(i);
 	}
+	console_printf(out_buffer, buffer_len, 
+			"\nPackets per socket call: %.2f received, %.2f sent\n",
+			llp_get_receive_batch_average(),
+			llp_get_send_batch_average());
+	console_printf(out_buffer, buffer_len, 
+			"Buffer pool: %ld hits, %ld misses, %d high-water\n",
+			llp_get_pool_hits(),
+			llp_get_pool_misses(),
+			llp_get_pool_high_water());
+	console_printf(out_buffer, buffer_len, 
+			"Handshake jobs pending: %d\n",
+			llp_get_pending_jobs());
+	console_printf(out_buffer, buffer_len, 
+			"D&H key pool: %d pairs, %ld times empty\n",
+			llp_get_dh_pool_depth(),
+			llp_get_dh_pool_empty());
+	console_printf(out_buffer, buffer_len, 
+			"Rate limits per source: %d handshake, %d data packets/s\n",
+			llp_get_handshake_rate_limit(),
+			llp_get_data_rate_limit());
+	console_printf(out_buffer, buffer_len, "Packets dropped on receive:");
+	for (i = 0; i < LLP_DROP_REASONS; i++) {
+		console_printf(out_buffer, buffer_len, "%s %ld %s",
+				(i == 0 ? "" : ","),
+				llp_get_drops(i),
+				llp_get_drop_reason_name(i));
+	}
+	console_printf(out_buffer, buffer_len, "\n");
+}
+/******************************************************************************/
+void console_print_queues(char *out_buffer, int buffer_len, char *args) {
+	int i;
+	llp_queue_stats_t stats;
+	
+	out_buffer[0] = '\0';
+	console_printf(out_buffer, buffer_len, 
+			"Receive policy: %s, timeout %d ms\n\n",
+			llp_get_receive_policy_name(llp_get_receive_queue_policy()),
+			llp_get_receive_queue_timeout());
+	console_printf(out_buffer, buffer_len, 
+			"%-10s %-6s %-6s %-10s %-10s %-10s %-10s\n", 
+			"Local #",
+			"Depth",
+			"Length",
+			"Enqueued",
+			"Dequeued",
+			"Dropped",
+			"High-water");
+	for (i = 0; i < llp_get_sessions_count(); i++) {
+		llp_get_queue_stats(i, &stats);
+		if (stats.enqueued > 0 || stats.dropped > 0) {
+			console_printf(out_buffer, buffer_len, 
+					"%-10d %-6d %-6d %-10ld %-10ld %-10ld %-10d\n", 
+					i,
+					stats.depth,
+					stats.length,
+					stats.enqueued,
+					stats.dequeued,
+					stats.dropped,
+					stats.high_water);
+		}
+	}
 }
 /******************************************************************************/
 void console_print_algorithms(char *out_buffer, int buffer_len, char *args) {
@@ -342,23 +432,25 @@ void console_print_algorithms(char *out_buffer, int buffer_len, char *args) {
 	console_printf(out_buffer, buffer_len, "%-8s %-10s %s\n", 
 			"Local #",
 			"Foreign #",
-			"cipher(block size):hash:mac(length)");
+			"cipher(block size):hash:mac(length):kex:padding");
 			
-	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+	for (i = 0; i < llp_get_sessions_count(); i++) {
 		
 		llp_lock_session(i);
 		
 		if (llp_sessions[i].state == LLP_STATE_ESTABLISHED) {
 			ip = llp_sessions[i].address.sin_addr;
 			console_printf(out_buffer, buffer_len, 
-					"%-8d %-10d   %s(%d):%s:%s(%d)\n", 
+					"%-8d %-10d   %s(%d):%s:%s(%d):%s:%s\n", 
 					i, 
 					llp_sessions[i].foreign_session,
 					llp_sessions[i].cipher->name,
 					llp_sessions[i].cipher->block_size,
 					llp_sessions[i].hash->name,
 					llp_sessions[i].mac->name,
-					llp_sessions[i].mac->length);
+					llp_sessions[i].mac->length,
+					llp_sessions[i].kex->name,
+					llp_get_padding_name(llp_sessions[i].padding));
 		}
 		
 		llp_unlock_session(i);
@@ -376,7 +468,8 @@ void console_print_dh_params(char *out_buffer, int buffer_len, char *args) {
 	}
 
 	session = strtol(tok, &endptr, 10);
-	if (*tok=='\0' || *endptr!='\0') {
+	if (*tok=='\0' || *endptr!='\0' || session < 0 ||
+			session >= llp_get_sessions_count()) {
 		return;
 	}
 
@@ -430,7 +523,8 @@ void console_print_keys(char *out_buffer, int buffer_len, char *args) {
 	}
 
 	session = strtol(tok, &endptr, 10);
-	if (*tok=='\0' || *endptr!='\0') {
+	if (*tok=='\0' || *endptr!='\0' || session < 0 ||
+			session >= llp_get_sessions_count()) {
 		return;
 	}
 	
@@ -522,7 +616,8 @@ void console_disconnect(char *out_buffer, int buffer_len, char *args) {
 	}
 
 	session = strtol(tok, &endptr, 10);
-	if (*tok=='\0' || *endptr!='\0') {
+	if (*tok=='\0' || *endptr!='\0' || session < 0 ||
+			session >= llp_get_sessions_count()) {
 		return;
 	}
 	
@@ -545,7 +640,8 @@ void console_close_session(char *out_buffer, int buffer_len, char *args) {
 	}
 
 	session = strtol(tok, &endptr, 10);
-	if (*tok=='\0' || *endptr!='\0') {
+	if (*tok=='\0' || *endptr!='\0' || session < 0 ||
+			session >= llp_get_sessions_count()) {
 		return;
 	}
 	
@@ -565,7 +661,8 @@ void console_write_data(char *out_buffer, int buffer_len, char *args) {
 	}
 
 	session = strtol(tok, &endptr, 10);
-	if (*tok=='\0' || *endptr!='\0') {
+	if (*tok=='\0' || *endptr!='\0' || session < 0 ||
+			session >= llp_get_sessions_count()) {
 		return;
 	}
 
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_cookies.c Implementation of the stateless cookies used to answer
+ * 		connection requests when the node is under load.
+ * @ingroup llp
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
+
+#include <libfreedom/layers.h>
+#include <libfreedom/liblog.h>
+#include <util/util.h>
+
+#include "llp.h"
+#include "llp_timers.h"
+#include "llp_cookies.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Length of the secrets, in bytes.
+ */
+#define SECRET_LENGTH	32
+
+/*
+ * Secret used to create new cookies.
+ */
+static u_char current_secret[SECRET_LENGTH];
+
+/*
+ * Secret replaced by the current one, still accepted.
+ */
+static u_char previous_secret[SECRET_LENGTH];
+
+/*
+ * Instant the current secret was created, in milliseconds.
+ */
+static long secret_time;
+
+/*
+ * Lock that protects the secrets.
+ */
+static pthread_mutex_t secrets_mutex;
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Replaces the current secret, if it has expired. Must be called with the
+ * secrets locked.
+ * 
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+static int rotate_secrets();
+
+/*
+ * Computes the cookie of a peer with the given secret.
+ * 
+ * @param secret - the secret.
+ * @param peer - address of the peer.
+ * @param session - session number in the peer.
+ * @param cookie - buffer that will receive the cookie.
+ */
+static void compute_cookie(u_char *secret, struct sockaddr_in *peer, 
+		u_short session, u_char *cookie);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+int llp_cookies_initialize() {
+
+	if (pthread_mutex_init(&secrets_mutex, NULL) > 0) {
+		liblog_error(LAYER_LINK, "error allocating mutex: %s.",
+				strerror(errno));
+		return LLP_ERROR;
+	}
+
+	/* Both secrets are random, cookies are never valid before creation. */
+	if (util_rand_bytes(current_secret, SECRET_LENGTH) == LLP_ERROR ||
+			util_rand_bytes(previous_secret, SECRET_LENGTH) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating cookie secrets.");
+		pthread_mutex_destroy(&secrets_mutex);
+		return LLP_ERROR;
+	}
+	secret_time = llp_get_clock();
+
+	liblog_debug(LAYER_LINK, "cookie secrets initialized.");
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_cookies_finalize() {
+
+	OPENSSL_cleanse(current_secret, SECRET_LENGTH);
+	OPENSSL_cleanse(previous_secret, SECRET_LENGTH);
+	pthread_mutex_destroy(&secrets_mutex);
+
+	liblog_debug(LAYER_LINK, "cookie secrets cleared.");
+}
+/******************************************************************************/
+int llp_create_cookie(struct sockaddr_in *peer, u_short session, 
+		u_char *cookie) {
+
+	pthread_mutex_lock(&secrets_mutex);
+	if (rotate_secrets() == LLP_ERROR) {
+		pthread_mutex_unlock(&secrets_mutex);
+		return LLP_ERROR;
+	}
+	compute_cookie(current_secret, peer, session, cookie);
+	pthread_mutex_unlock(&secrets_mutex);
+
+	return LLP_OK;
+}
+/******************************************************************************/
+int llp_verify_cookie(struct sockaddr_in *peer, u_short session,
+		u_char *cookie) {
+	u_char expected[LLP_COOKIE_LENGTH];
+	int return_value;
+
+	pthread_mutex_lock(&secrets_mutex);
+	if (rotate_secrets() == LLP_ERROR) {
+		pthread_mutex_unlock(&secrets_mutex);
+		return LLP_ERROR;
+	}
+
+	return_value = LLP_ERROR;
+	compute_cookie(current_secret, peer, session, expected);
+	if (CRYPTO_memcmp(expected, cookie, LLP_COOKIE_LENGTH) == 0) {
+		return_value = LLP_OK;
+	} else {
+		compute_cookie(previous_secret, peer, session, expected);
+		if (CRYPTO_memcmp(expected, cookie, LLP_COOKIE_LENGTH) == 0) {
+			return_value = LLP_OK;
+		}
+	}
+	pthread_mutex_unlock(&secrets_mutex);
+
+	return return_value;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+int rotate_secrets() {
+	long now;
+
+	now = llp_get_clock();
+	if (now - secret_time < LLP_COOKIE_SECRET_LIFETIME) {
+		return LLP_OK;
+	}
+
+	/* After a long idle period both secrets are replaced. */
+	if (now - secret_time < 2 * LLP_COOKIE_SECRET_LIFETIME) {
+		memcpy(previous_secret, current_secret, SECRET_LENGTH);
+	} else if (util_rand_bytes(previous_secret, SECRET_LENGTH) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating cookie secret.");
+		return LLP_ERROR;
+	}
+	if (util_rand_bytes(current_secret, SECRET_LENGTH) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating cookie secret.");
+		return LLP_ERROR;
+	}
+	secret_time = now;
+
+	liblog_debug(LAYER_LINK, "cookie secret rotated.");
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void compute_cookie(u_char *secret, struct sockaddr_in *peer, 
+		u_short session, u_char *cookie) {
+	u_char data[sizeof(peer->sin_addr.s_addr) + sizeof(peer->sin_port) +
+			sizeof(u_short)];
+	u_char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_length;
+	int offset;
+
+	/* The address and port as received, in network byte order. */
+	offset = 0;
+	memcpy(&data[offset], &peer->sin_addr.s_addr, 
+			sizeof(peer->sin_addr.s_addr));
+	offset += sizeof(peer->sin_addr.s_addr);
+	memcpy(&data[offset], &peer->sin_port, sizeof(peer->sin_port));
+	offset += sizeof(peer->sin_port);
+	data[offset++] = (u_char)(session >> 8);
+	data[offset++] = (u_char)session;
+
+	HMAC(EVP_sha256(), secret, SECRET_LENGTH, data, offset, digest, 
+			&digest_length);
+	memcpy(cookie, digest, LLP_COOKIE_LENGTH);
+}
+/******************************************************************************/
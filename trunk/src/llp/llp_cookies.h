@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_cookies.h Headers of the stateless cookies used to answer
+ * 		connection requests when the node is under load.
+ * @ingroup llp
+ */
+
+#ifndef _LLP_COOKIES_H_
+#define _LLP_COOKIES_H_
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "llp_packets.h"
+
+/**
+ * Time a secret is used to create new cookies, in milliseconds. Cookies are
+ * accepted while their secret is the current or the previous one.
+ */
+#define LLP_COOKIE_SECRET_LIFETIME	30000
+
+/**
+ * Initializes the secrets used to create cookies.
+ * 
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_cookies_initialize();
+
+/**
+ * Clears the secrets used to create cookies.
+ */
+void llp_cookies_finalize();
+
+/**
+ * Creates the cookie of a connection request, bound to the address of the
+ * peer and to the session number it sent.
+ * 
+ * @param peer address of the peer trying to connect.
+ * @param session session number in the peer.
+ * @param cookie buffer with LLP_COOKIE_LENGTH bytes that will receive the
+ * 		cookie.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_create_cookie(struct sockaddr_in *peer, u_short session, 
+		u_char *cookie);
+
+/**
+ * Verifies a cookie echoed by a peer.
+ * 
+ * @param peer address of the peer trying to connect.
+ * @param session session number in the peer.
+ * @param cookie the cookie echoed, with LLP_COOKIE_LENGTH bytes.
+ * @return LLP_OK if the cookie was created by this node for the peer and is
+ * 		still valid, LLP_ERROR otherwise.
+ */
+int llp_verify_cookie(struct sockaddr_in *peer, u_short session,
+		u_char *cookie);
+
+#endif /* !_LLP_COOKIES_H_ */
@@ -47,6 +47,13 @@
 #include "llp_threads.h"
 #include "llp_info.h"
 #include "llp_queue.h"
+#include "llp_packets.h"
+#include "llp_pool.h"
+#include "llp_workers.h"
+#include "llp_dh.h"
+#include "llp_timers.h"
+#include "llp_cookies.h"
+#include "llp_limits.h"
  
 /*============================================================================*/
 /* Private data definitions.                                                   */
@@ -82,10 +89,30 @@ int link_initialize(char *config_file) {
 		return LINK_ERROR;
 	}
 
-	if (llp_create_socket(llp_get_port()) == LLP_ERROR) {
+	if (llp_limits_initialize() == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error initializing rate limits.");
+		return LINK_ERROR;
+	}
+
+	if (llp_create_socket(llp_get_port(), llp_get_listeners()) == LLP_ERROR) {
 		return LINK_ERROR;	
 	}
 
+	if (llp_pool_initialize(llp_get_pool_size()) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error initializing pool.");
+		return LINK_ERROR;
+	}
+
+	if (llp_packets_initialize() == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error initializing packets.");
+		return LINK_ERROR;
+	}
+
+	if (llp_timers_initialize() == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error initializing timing wheel.");
+		return LINK_ERROR;
+	}
+
 	if (llp_sessions_initialize() == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error initializing sessions.");
 		return LINK_ERROR;
@@ -100,12 +127,28 @@ int link_initialize(char *config_file) {
 		liblog_error(LAYER_LINK, "error initializing nodes.");
 		return LINK_ERROR;
 	}
+
+	if (llp_cookies_initialize() == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error initializing cookies.");
+		return LINK_ERROR;
+	}
 	
 	if (llp_queue_initialize() == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error initializing queue.");
 		return LINK_ERROR;
 	}
 	
+	if (llp_dh_initialize(llp_get_dh_pool_size(),
+			llp_get_dh_pool_watermark()) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error initializing D&H key pool.");
+		return LINK_ERROR;
+	}
+
+	if (llp_workers_initialize(llp_get_crypto_workers()) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error initializing workers.");
+		return LINK_ERROR;
+	}
+
 	if (llp_create_threads() == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error creating threads.");
 		return LINK_ERROR;
@@ -121,10 +164,17 @@ void link_finalize() {
 	llp_close_socket();	
 	
 	llp_destroy_threads();
+	llp_workers_finalize();
+	llp_dh_finalize();
 	llp_queue_finalize();
 	llp_sessions_finalize();
+	llp_timers_finalize();
 	llp_nodes_finalize();
+	llp_cookies_finalize();
 	llp_info_finalize();
+	llp_packets_finalize();
+	llp_pool_finalize();
+	llp_limits_finalize();
 	llp_unconfigure();
 	
 	liblog_debug(LAYER_LINK, "llp module finalized.");
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_crypto.c Implementation of the cipher and MAC contexts kept by
+ * 		each session.
+ * @ingroup llp
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <openssl/evp.h>
+#include <openssl/crypto.h>
+
+#include <libfreedom/layers.h>
+#include <libfreedom/liblog.h>
+#include <util/util_crypto.h>
+
+#include "llp.h"
+#include "llp_crypto.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * AEAD suites implemented by LLP. The IV derived in the handshake is the base
+ * of the nonces, and the block size of one lets the padding policies choose
+ * any length.
+ */
+static struct {
+	util_cipher_function_t suite;
+	const EVP_CIPHER *(*cipher)(void);
+} aead_suites[] = {
+	{{.name = "aes128-gcm", .key_length = 16, .iv_length = 12, 
+			.block_size = 1, .function = NULL}, EVP_aes_128_gcm},
+	{{.name = "aes256-gcm", .key_length = 32, .iv_length = 12, 
+			.block_size = 1, .function = NULL}, EVP_aes_256_gcm},
+	{{.name = "chacha20-poly1305", .key_length = 32, .iv_length = 12, 
+			.block_size = 1, .function = NULL}, EVP_chacha20_poly1305},
+	{{.name = NULL}, NULL}
+};
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Expands the key of an AEAD suite in a new OpenSSL context.
+ * 
+ * @param crypto - the context being created.
+ * @param key - key of the suite.
+ * @param way - UTIL_WAY_ENCRYPTION or UTIL_WAY_DECRYPTION.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+static int expand_aead(llp_crypto_t *crypto, u_char *key, int way);
+
+/*
+ * Builds the nonce of an AEAD packet, XORing the big endian packet counter
+ * into the last bytes of the IV.
+ * 
+ * @param crypto - the context of the session direction.
+ * @param nonce - buffer that will receive the nonce.
+ * @param counter - the big endian packet counter.
+ */
+static void build_nonce(llp_crypto_t *crypto, u_char *nonce, u_char *counter);
+
+/*
+ * Reads the big endian packet counter of an AEAD trailer.
+ * 
+ * @param trailer - the trailer received.
+ * @return the packet counter.
+ */
+static uint64_t read_counter(u_char *trailer);
+
+/*
+ * Checks if a packet counter is new and inside the replay window.
+ * 
+ * @param crypto - the context of the incoming direction.
+ * @param counter - the packet counter received.
+ * @return LLP_OK if the counter may be accepted, LLP_ERROR otherwise.
+ */
+static int check_replay(llp_crypto_t *crypto, uint64_t counter);
+
+/*
+ * Marks a packet counter as accepted, sliding the replay window if needed.
+ * 
+ * @param crypto - the context of the incoming direction.
+ * @param counter - the packet counter of an authentic frame.
+ */
+static void update_replay(llp_crypto_t *crypto, uint64_t counter);
+
+/*
+ * Copies length bytes of data to a new buffer.
+ * 
+ * @param data - the bytes to be copied.
+ * @param length - the number of bytes.
+ * @return the new buffer, or NULL if errors occurred.
+ */
+static u_char *copy_bytes(u_char *data, int length);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+llp_crypto_t *llp_create_crypto(util_cipher_function_t *cipher, 
+		u_char *cipher_key, u_char *iv, util_mac_function_t *mac, 
+		u_char *mac_key, int way) {
+	llp_crypto_t *crypto;
+
+	crypto = (llp_crypto_t *)calloc(1, sizeof(llp_crypto_t));
+	if (crypto == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return NULL;
+	}
+	crypto->cipher = cipher;
+
+	if (!llp_is_aead(cipher)) {
+		crypto->keys = libkeys_create(LAYER_LINK, cipher, cipher_key, iv, mac,
+				mac_key, way);
+		if (crypto->keys == NULL) {
+			llp_destroy_crypto(crypto);
+			return NULL;
+		}
+		return crypto;
+	}
+
+	/* The suite authenticates the frames, the MAC key is not used. */
+	crypto->iv = copy_bytes(iv, cipher->iv_length);
+	if (crypto->iv == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		llp_destroy_crypto(crypto);
+		return NULL;
+	}
+	if (expand_aead(crypto, cipher_key, way) == LLP_ERROR) {
+		llp_destroy_crypto(crypto);
+		return NULL;
+	}
+	liblog_debug(LAYER_LINK, "crypto context created (aead %s).", 
+			cipher->name);
+
+	return crypto;
+}
+/******************************************************************************/
+util_cipher_function_t *llp_get_cipher(char *name) {
+	int i;
+
+	for (i = 0; aead_suites[i].suite.name != NULL; i++) {
+		if (strcmp(aead_suites[i].suite.name, name) == 0) {
+			return &aead_suites[i].suite;
+		}
+	}
+	return util_get_cipher(name);
+}
+/******************************************************************************/
+int llp_is_aead(util_cipher_function_t *cipher) {
+	int i;
+
+	for (i = 0; aead_suites[i].suite.name != NULL; i++) {
+		if (cipher == &aead_suites[i].suite) {
+			return 1;
+		}
+	}
+	return 0;
+}
+/******************************************************************************/
+void llp_destroy_crypto(llp_crypto_t *crypto) {
+	if (crypto == NULL) {
+		return;
+	}
+
+	libkeys_destroy(crypto->keys);
+	EVP_CIPHER_CTX_free(crypto->aead_context);
+	free(crypto->iv);
+	free(crypto);
+}
+/******************************************************************************/
+int llp_crypto_trailer_length(llp_crypto_t *crypto) {
+	if (crypto->aead) {
+		return LLP_AEAD_COUNTER_LENGTH + LLP_AEAD_TAG_LENGTH;
+	}
+	return crypto->keys->mac->length;
+}
+/******************************************************************************/
+int llp_crypto_seal(llp_crypto_t *crypto, u_char *header, int header_length,
+		u_char *content, int length, u_char *trailer) {
+	u_char nonce[EVP_MAX_IV_LENGTH];
+	int written;
+	int i;
+
+	if (!crypto->aead) {
+		/* MAC of the plaintext, then encryption. */
+		libkeys_mac(crypto->keys, trailer, content, length);
+		libkeys_cipher(crypto->keys, content, content, length);
+		return LLP_OK;
+	}
+
+	/* A nonce is never reused with the same key. */
+	for (i = LLP_AEAD_COUNTER_LENGTH - 1; i >= 0; i--) {
+		trailer[i] = (u_char)(crypto->counter >> 
+				(8 * (LLP_AEAD_COUNTER_LENGTH - 1 - i)));
+	}
+	crypto->counter++;
+	build_nonce(crypto, nonce, trailer);
+
+	if (!EVP_CipherInit_ex(crypto->aead_context, NULL, NULL, NULL, nonce,
+					-1) ||
+			!EVP_CipherUpdate(crypto->aead_context, NULL, &written, header,
+					header_length) ||
+			!EVP_CipherUpdate(crypto->aead_context, content, &written, 
+					content, length) ||
+			!EVP_CipherFinal_ex(crypto->aead_context, content + written, 
+					&written) ||
+			!EVP_CIPHER_CTX_ctrl(crypto->aead_context, 
+					EVP_CTRL_AEAD_GET_TAG, LLP_AEAD_TAG_LENGTH, 
+					&trailer[LLP_AEAD_COUNTER_LENGTH])) {
+		liblog_error(LAYER_LINK, "error sealing frame.");
+		return LLP_ERROR;
+	}
+	return LLP_OK;
+}
+/******************************************************************************/
+int llp_crypto_open(llp_crypto_t *crypto, u_char *header, int header_length,
+		u_char *content, int length, u_char *trailer) {
+	u_char computed[EVP_MAX_MD_SIZE];
+	u_char nonce[EVP_MAX_IV_LENGTH];
+	uint64_t counter;
+	int written;
+
+	if (!crypto->aead) {
+		/* Decryption, then MAC of the plaintext. */
+		libkeys_cipher(crypto->keys, content, content, length);
+		libkeys_mac(crypto->keys, computed, content, length);
+		if (CRYPTO_memcmp(computed, trailer, crypto->keys->mac->length) != 0) {
+			return LLP_ERROR;
+		}
+		return LLP_OK;
+	}
+
+	/* Replays are dropped before any decryption. */
+	counter = read_counter(trailer);
+	if (check_replay(crypto, counter) == LLP_ERROR) {
+		liblog_debug(LAYER_LINK, "replayed frame, packet dropped.");
+		return LLP_ERROR;
+	}
+
+	/* The tag is checked in the same pass that decrypts the content. */
+	build_nonce(crypto, nonce, trailer);
+	if (!EVP_CipherInit_ex(crypto->aead_context, NULL, NULL, NULL, nonce,
+					-1) ||
+			!EVP_CipherUpdate(crypto->aead_context, NULL, &written, header,
+					header_length) ||
+			!EVP_CipherUpdate(crypto->aead_context, content, &written, 
+					content, length) ||
+			!EVP_CIPHER_CTX_ctrl(crypto->aead_context, 
+					EVP_CTRL_AEAD_SET_TAG, LLP_AEAD_TAG_LENGTH, 
+					&trailer[LLP_AEAD_COUNTER_LENGTH]) ||
+			EVP_CipherFinal_ex(crypto->aead_context, content + written, 
+					&written) <= 0) {
+		return LLP_ERROR;
+	}
+
+	/* Only authentic frames move the window. */
+	update_replay(crypto, counter);
+	return LLP_OK;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+u_char *copy_bytes(u_char *data, int length) {
+	u_char *copy;
+
+	/* Functions without key or IV still get a valid pointer. */
+	copy = (u_char *)malloc(length > 0 ? length : 1);
+	if (copy != NULL && length > 0) {
+		memcpy(copy, data, length);
+	}
+	return copy;
+}
+/******************************************************************************/
+int expand_aead(llp_crypto_t *crypto, u_char *key, int way) {
+	const EVP_CIPHER *cipher;
+	int i;
+
+	cipher = NULL;
+	for (i = 0; aead_suites[i].suite.name != NULL; i++) {
+		if (crypto->cipher == &aead_suites[i].suite) {
+			cipher = aead_suites[i].cipher();
+		}
+	}
+
+	/* The key is expanded once, each packet only sets its nonce. */
+	crypto->aead_context = EVP_CIPHER_CTX_new();
+	if (cipher == NULL || crypto->aead_context == NULL ||
+			crypto->cipher->iv_length < LLP_AEAD_COUNTER_LENGTH ||
+			crypto->cipher->iv_length > EVP_MAX_IV_LENGTH ||
+			!EVP_CipherInit_ex(crypto->aead_context, cipher, NULL, NULL, 
+					NULL, way == UTIL_WAY_ENCRYPTION) ||
+			!EVP_CIPHER_CTX_ctrl(crypto->aead_context, 
+					EVP_CTRL_AEAD_SET_IVLEN, crypto->cipher->iv_length, NULL) ||
+			!EVP_CipherInit_ex(crypto->aead_context, NULL, NULL, 
+					key, NULL, -1)) {
+		liblog_error(LAYER_LINK, "can't expand aead suite %s.", 
+				crypto->cipher->name);
+		return LLP_ERROR;
+	}
+	crypto->aead = 1;
+	crypto->counter = 0;
+	crypto->highest = 0;
+	crypto->window = 0;
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void build_nonce(llp_crypto_t *crypto, u_char *nonce, u_char *counter) {
+	int offset;
+	int i;
+
+	memcpy(nonce, crypto->iv, crypto->cipher->iv_length);
+	offset = crypto->cipher->iv_length - LLP_AEAD_COUNTER_LENGTH;
+	for (i = 0; i < LLP_AEAD_COUNTER_LENGTH; i++) {
+		nonce[offset + i] ^= counter[i];
+	}
+}
+/******************************************************************************/
+uint64_t read_counter(u_char *trailer) {
+	uint64_t counter;
+	int i;
+
+	counter = 0;
+	for (i = 0; i < LLP_AEAD_COUNTER_LENGTH; i++) {
+		counter = (counter << 8) | trailer[i];
+	}
+	return counter;
+}
+/******************************************************************************/
+int check_replay(llp_crypto_t *crypto, uint64_t counter) {
+	uint64_t distance;
+
+	if (counter > crypto->highest) {
+		return LLP_OK;
+	}
+
+	distance = crypto->highest - counter;
+	if (distance >= LLP_REPLAY_WINDOW ||
+			(crypto->window & ((uint64_t)1 << distance)) != 0) {
+		return LLP_ERROR;
+	}
+	return LLP_OK;
+}
+/******************************************************************************/
+void update_replay(llp_crypto_t *crypto, uint64_t counter) {
+	uint64_t shift;
+
+	if (counter > crypto->highest) {
+		shift = counter - crypto->highest;
+		crypto->window = (shift >= LLP_REPLAY_WINDOW ? 0 :
+				crypto->window << shift);
+		crypto->highest = counter;
+		crypto->window |= 1;
+	} else {
+		crypto->window |= (uint64_t)1 << (crypto->highest - counter);
+	}
+}
+/******************************************************************************/
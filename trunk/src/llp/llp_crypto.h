@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_crypto.h Headers of the cipher and MAC contexts kept by each
+ * 		session, so keys are expanded once and not for every packet.
+ * @ingroup llp
+ */
+
+#ifndef _LLP_CRYPTO_H_
+#define _LLP_CRYPTO_H_
+
+#include <stdint.h>
+
+#include <openssl/evp.h>
+
+#include <util/util_crypto.h>
+
+#include <libkeys.h>
+
+/**
+ * Length of the packet counter sent in the trailer of AEAD frames.
+ */
+#define LLP_AEAD_COUNTER_LENGTH		8
+
+/**
+ * Length of the authentication tag sent in the trailer of AEAD frames.
+ */
+#define LLP_AEAD_TAG_LENGTH			16
+
+/**
+ * Number of packet counters, below the highest one accepted, tracked to
+ * detect replayed AEAD frames.
+ */
+#define LLP_REPLAY_WINDOW			64
+
+/**
+ * Data type that stores the keys of one direction of a session. AEAD suites
+ * are handled here, any other cipher and MAC pair by the libkeys contexts.
+ */
+typedef struct {
+	/** Cipher function negotiated. */
+	util_cipher_function_t *cipher;
+	/** Cipher and MAC contexts, or NULL if the cipher is an AEAD suite. */
+	libkeys_t *keys;
+	/** Expanded key of the AEAD suite, or NULL if libkeys is used. */
+	EVP_CIPHER_CTX *aead_context;
+	/** Initialization vector, the base of the AEAD nonces. */
+	u_char *iv;
+	/** 1 if the cipher is an AEAD suite, which also authenticates, 0 
+	 * otherwise. */
+	int aead;
+	/** Counter of the next packet sealed, combined with the IV to build the
+	 * nonce of AEAD suites. */
+	uint64_t counter;
+	/** Highest packet counter opened. */
+	uint64_t highest;
+	/** Counters opened in the replay window, bit i set if highest - i was
+	 * already accepted. */
+	uint64_t window;
+} llp_crypto_t;
+
+/**
+ * Returns the cipher function with the given name, looking first at the AEAD
+ * suites implemented by LLP and then at the util library.
+ * 
+ * @param name name of the cipher.
+ * @return the cipher function, or NULL if it isn't supported.
+ */
+util_cipher_function_t *llp_get_cipher(char *name);
+
+/**
+ * Tells if a cipher function is one of the AEAD suites.
+ * 
+ * @param cipher the cipher function.
+ * @return 1 if the cipher is an AEAD suite, 0 otherwise.
+ */
+int llp_is_aead(util_cipher_function_t *cipher);
+
+/**
+ * Creates the context of one direction of a session, expanding the keys.
+ * 
+ * @param cipher cipher function negotiated.
+ * @param cipher_key key of the cipher.
+ * @param iv initialization vector of the cipher.
+ * @param mac MAC function negotiated.
+ * @param mac_key key of the MAC.
+ * @param way UTIL_WAY_ENCRYPTION or UTIL_WAY_DECRYPTION.
+ * @return the new context, or NULL if errors occurred.
+ */
+llp_crypto_t *llp_create_crypto(util_cipher_function_t *cipher, 
+		u_char *cipher_key, u_char *iv, util_mac_function_t *mac, 
+		u_char *mac_key, int way);
+
+/**
+ * Frees a context and clears the keys stored in it.
+ * 
+ * @param crypto the context, can be NULL.
+ */
+void llp_destroy_crypto(llp_crypto_t *crypto);
+
+/**
+ * Returns the number of bytes that follow the encrypted content of a frame:
+ * the MAC, or the packet counter and the tag of AEAD suites.
+ * 
+ * @param crypto context of the session direction.
+ * @return the length of the trailer.
+ */
+int llp_crypto_trailer_length(llp_crypto_t *crypto);
+
+/**
+ * Encrypts the content of a frame in place and writes its trailer. AEAD
+ * suites also authenticate the header, in a single pass.
+ * 
+ * @param crypto context of the outgoing direction.
+ * @param header header of the frame, sent in the clear.
+ * @param header_length number of bytes in the header.
+ * @param content content to be encrypted.
+ * @param length number of bytes in the content.
+ * @param trailer buffer that will receive the trailer.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_crypto_seal(llp_crypto_t *crypto, u_char *header, int header_length,
+		u_char *content, int length, u_char *trailer);
+
+/**
+ * Decrypts the content of a frame in place and checks its trailer. AEAD
+ * frames whose counter was already accepted, or is older than the replay
+ * window, are rejected.
+ * 
+ * @param crypto context of the incoming direction.
+ * @param header header of the frame, received in the clear.
+ * @param header_length number of bytes in the header.
+ * @param content content to be decrypted.
+ * @param length number of bytes in the content.
+ * @param trailer trailer received after the content.
+ * @return LLP_OK if the frame is authentic, LLP_ERROR otherwise.
+ */
+int llp_crypto_open(llp_crypto_t *crypto, u_char *header, int header_length,
+		u_char *content, int length, u_char *trailer);
+
+#endif /* !_LLP_CRYPTO_H_ */
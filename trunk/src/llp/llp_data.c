@@ -50,6 +50,9 @@
 #include "llp_sessions.h"
 #include "llp_info.h"
 #include "llp_queue.h"
+#include "llp_pool.h"
+#include "llp_config.h"
+#include "llp_threads.h"
 
 /*============================================================================*/
 /* Private data definitions.                                                  */
@@ -60,20 +63,69 @@
  */
 #define MAX_CHAR			255
 
+/**
+ * Sizes of the buckets used by the LLP_PADDING_BUCKETS and
+ * LLP_PADDING_JITTER policies, in bytes of padded content. Contents bigger
+ * than the last bucket are padded to the FTU.
+ */
+static const int buckets[] = {64, 256, 1024};
+
+/**
+ * Number of padding buckets.
+ */
+#define BUCKETS		(sizeof(buckets) / sizeof(int))
+
+/**
+ * Length of the header of each datagram in a LLP_DATAGRAMS packet.
+ */
+#define RECORD_HEADER_LENGTH	sizeof(u_short)
+
+/**
+ * Maximum length of a LLP_DATAGRAMS packet, including its type.
+ */
+#define COALESCED_MAX_LENGTH	(LIBFREEDOM_FTU + sizeof(u_char))
+
 /*============================================================================*/
 /* Private functions prototypes.                                              */
 /*============================================================================*/
 
 /**
- * Sends an LLP_DATA packet, given its contents.
+ * Computes the number of padding bytes placed before the content of a
+ * LLP_DATA packet, following the padding policy of the session.
  * 
  * @param[in] session 	- the session used to send the packet.
- * @param[in] data 		- the data to encapsulate in a LLP_DATA packet.
- * @param[in] length 	- the length of data in bytes.
+ * @param[in] length 	- the length of the content in bytes.
+ * @param[out] padding_length - the padding length in bytes.
+ * @retval LLP_OK 		- if no errors occurred
+ * @retval LLP_ERROR	- if the content is too big to be sent
+ */
+static int compute_padding(int session, int length, u_short *padding_length);
+
+/**
+ * Takes a buffer for an LLP_DATA packet carrying length bytes of content. The
+ * content must be written at the returned position, which leaves headroom for
+ * the packet header and padding, and tailroom for the length trailer and MAC.
+ * 
+ * @param[in] session 	- the session used to send the packet.
+ * @param[in] length 	- the length of the content in bytes.
+ * @param[out] content 	- position where the content must be written.
+ * @retval NULL 		- if the content is too big or no buffer is available
+ * @return the buffer of the packet.
+ */
+static u_char *open_frame(int session, int length, u_char **content);
+
+/**
+ * Completes and sends an LLP_DATA packet taken with open_frame(). The header,
+ * padding and trailer are written around the content, the MAC is appended and
+ * the content is encrypted in place. The buffer is always released.
+ * 
+ * @param[in] session 	- the session used to send the packet.
+ * @param[in] frame 	- the buffer of the packet.
+ * @param[in] length 	- the length of the content in bytes.
  * @retval LLP_OK 		- if no errors occurred
  * @retval LLP_ERROR	- otherwise
  */
-static int send_data(int session, u_char *data, int length);
+static int send_frame(int session, u_char *frame, int length);
 
 /**
  * Sends an LLP_DATAGRAM packet.
@@ -86,6 +138,64 @@ static int send_data(int session, u_char *data, int length);
  */
 static int send_datagram(int session, u_char *datagram, int length);
 
+/**
+ * Sends a datagram written by the upper layer, packing it with the next ones
+ * if coalescing is enabled. Must be called with the session locked.
+ * 
+ * @param[in] session 	- the session used to send the datagram.
+ * @param[in] datagram 	- the data to encapsulate.
+ * @param[in] length 	- the length of data in bytes.
+ * @retval LLP_OK 		- if no errors occurred
+ * @retval LLP_ERROR	- otherwise
+ */
+static int write_datagram(int session, u_char *datagram, int length);
+
+/**
+ * Copies a datagram to the send ring of the session, to be sent later by the
+ * sender thread. When the ring is full the configured send queue policy is
+ * applied. Must be called with the session locked.
+ * 
+ * @param[in] session 	- the session used to send the datagram.
+ * @param[in] datagram 	- the data to encapsulate.
+ * @param[in] length 	- the length of data in bytes.
+ * @retval LLP_OK 		- if no errors occurred
+ * @retval LLP_ERROR	- if the datagram was refused
+ */
+static int queue_datagram(int session, u_char *datagram, int length);
+
+/**
+ * Sends all datagrams in the send ring of the session. Must be called with the
+ * session locked.
+ * 
+ * @param[in] session 	- the session used to send the datagrams.
+ * @retval LLP_OK 		- if no errors occurred
+ * @retval LLP_ERROR	- if some datagram could not be sent
+ */
+static int send_queued(int session);
+
+/**
+ * Packs a datagram with the ones waiting to be sent by the session. The
+ * datagrams already waiting are sent first if the new one does not fit.
+ * Must be called with the session locked.
+ * 
+ * @param[in] session 	- the session used to send the datagram.
+ * @param[in] datagram 	- the data to encapsulate.
+ * @param[in] length 	- the length of data in bytes.
+ * @retval LLP_OK 		- if no errors occurred
+ * @retval LLP_ERROR	- otherwise
+ */
+static int coalesce_datagram(int session, u_char *datagram, int length);
+
+/**
+ * Sends the datagrams waiting in the session, in a single LLP_DATAGRAMS
+ * packet. Must be called with the session locked.
+ * 
+ * @param[in] session 	- the session used to send the packet.
+ * @retval LLP_OK 		- if no errors occurred or no datagram was waiting
+ * @retval LLP_ERROR	- otherwise
+ */
+static int send_coalesced(int session);
+
 /**
  * Sends a packet with a LLP_CLOSE_* pattern.
  * 
@@ -138,23 +248,26 @@ static int send_hunt_result(int session,
  * Sends an LLP_KEEP_ALIVE packet.
  * 
  * @param session[in] 	- the session used to send the packet.
+ * @param flag[in] 		- LLP_KEEP_ALIVE_PROBE or LLP_KEEP_ALIVE_ECHO.
  * @retval LLP_OK 		- if no errors occurred
  * @retval LLP_ERROR	- otherwise
  */
-static int send_keep_alive(int session);
+static int send_keep_alive(int session, int flag);
 
 /**
- * Handles the encrypted portion of the packet.
+ * Handles the encrypted portion of the packet. The content is decrypted in
+ * place.
  * 
- * @param[in] content 	- the encrypted portion of the LLP_DATA packet.
+ * @param[in] header 	- the header of the LLP_DATA packet.
+ * @param[in,out] content - the encrypted portion of the LLP_DATA packet.
  * @param[in] length 	- the length of the encrypted content, in bytes.
- * @param[in] mac 		- the LLP_DATA plaintext's MAC value.
+ * @param[in] trailer 	- the MAC, or the counter and tag of AEAD suites.
  * @param[in] session 	- the session that the packet was received.
  * @retval LLP_OK 		- if no errors occurred
  * @retval LLP_ERROR	- otherwise
  */ 
-static int handle_encrypted_content(u_char *content, int length, u_char *mac,
-	int session);
+static int handle_encrypted_content(u_char *header, u_char *content, 
+	int length, u_char *trailer, int session);
 
 /**
  * Handles the packet carried inside the LLP_DATA packet.
@@ -178,6 +291,17 @@ static int handle_content(u_char *content, int length, int session);
  */
 static int handle_datagram(u_char *content, int length, int session);
 
+/**
+ * Handles a LLP_DATAGRAMS packet, enqueuing each datagram carried.
+ * 
+ * @param[in] content 	- the content of the packet, after its type.
+ * @param[in] length 	- the length of content in bytes.
+ * @param[in] session 	- the session that received this packet.
+ * @retval LLP_OK 		- if no errors occurred
+ * @retval LLP_ERROR	- otherwise
+ */
+static int handle_datagrams(u_char *content, int length, int session);
+
 /**
  * Handles the process of verify the authenticity of a LLP_CLOSE_REQUEST packet
  * or LLP_CLOSE_OK packet.
@@ -263,13 +387,13 @@ static inline int parse_hunt_result(llp_data_p *packet, u_char *data,
 
 int llp_handle_data(u_char *packet_data, int packet_length) {
 	int content_length;
-	int mac_length;
+	int trailer_length;
 	int session;
 	int offset;
 	int return_value;
 	llp_packet_p packet;
-	u_char *content = NULL;
-	u_char *mac = NULL;
+	u_char *content;
+	u_char *trailer;
 	
 	/* Reading beginning of packet. */
 	/* No need to use safe reading functions, because llp_listen_socket discards
@@ -277,9 +401,13 @@ int llp_handle_data(u_char *packet_data, int packet_length) {
 	 * could harm the parser behavior. */
 	offset = 0;
 	util_read_byte(&packet.type, &offset, packet_data);
-	util_read_byte(&packet.llp_data.session, &offset, packet_data);
+	util_read_uint16(&packet.llp_data.session, &offset, packet_data);
 
 	session = packet.llp_data.session;
+	if (session >= llp_get_sessions_count()) {
+		liblog_debug(LAYER_LINK, "invalid session, packet dropped.");
+		return LLP_ERROR;
+	}
 
 	llp_lock_session(session);
 	switch(llp_sessions[session].state) {
@@ -293,35 +421,33 @@ int llp_handle_data(u_char *packet_data, int packet_length) {
 			goto return_label;
 	}
 
-	/* Calculating lengths before using them */
-	mac_length = llp_sessions[session].mac->length;
-	content_length = packet_length - mac_length - sizeof(u_short);
-	
-	/* Check if this packet is too small to be valid. */
-	if (content_length < sizeof(u_char) + sizeof(u_short)) {
-		/* Packet is smaller than an LLP_KEEP_ALIVE packet. */
+	if (llp_sessions[session].crypto_in == NULL) {
+		liblog_error(LAYER_LINK, "session has no keys, packet dropped.");
 		return_value = LLP_ERROR;
 		goto return_label;
 	}
-	
-	/* Allocating memory for packet. */
-	content = (u_char *)malloc(content_length);
-	mac = (u_char *)malloc(mac_length);
-	if (content == NULL || mac == NULL) {
-		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+
+	/* Check if this packet is too small to be valid, before computing any
+	 * length from it. The sizes are cast so short packets are not promoted
+	 * to huge unsigned lengths. */
+	trailer_length = llp_crypto_trailer_length(llp_sessions[session].crypto_in);
+	if (packet_length < (int)LLP_DATA_HEADER_LENGTH + trailer_length +
+			(int)(sizeof(u_char) + sizeof(u_short))) {
+		/* Packet is smaller than an LLP_KEEP_ALIVE packet. */
+		liblog_debug(LAYER_LINK, "data packet is too small, packet dropped.");
 		return_value = LLP_ERROR;
 		goto return_label;
 	}
+	content_length = packet_length - trailer_length -
+			(int)LLP_DATA_HEADER_LENGTH;
 	
-	/* Reading rest of packet. */
-	/* No nead to use safe reading functions, because the lengths are
-	 * computed using the packet length. */
-	util_read_bytes(content, &offset, packet_data, content_length);
-	util_read_bytes(mac, &offset, packet_data, mac_length);
+	/* The content and the trailer are used where they were received. */
+	content = &packet_data[offset];
+	trailer = &packet_data[offset + content_length];
 	
 	/* Handle the content. */
-	if (handle_encrypted_content(content, content_length, mac, session)
-			== LLP_ERROR) {
+	if (handle_encrypted_content(packet_data, content, content_length, trailer,
+			session) == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error handling data content.");
 		return_value = LLP_ERROR;
 		goto return_label;
@@ -334,7 +460,7 @@ int llp_handle_data(u_char *packet_data, int packet_length) {
 	 * if a LLP_CLOSE_OK packet is not received, the timeouts threads will
 	 * close it automatically. */
 	if (llp_sessions[session].state != LLP_STATE_CLOSE_WAIT) {
-		llp_sessions[session].timeout = LLP_T_TIMEOUT;
+		llp_set_timer(session, LLP_TIMER_TIMEOUT, LLP_T_TIMEOUT);
 	}
 
 	return_value = LLP_OK;
@@ -342,8 +468,6 @@ int llp_handle_data(u_char *packet_data, int packet_length) {
 return_label:
 	
 	llp_unlock_session(session);
-	free(content);
-	free(mac);
 
 	return return_value;
 }
@@ -353,7 +477,8 @@ int llp_keep_session_alive(int session) {
 	
 	llp_lock_session(session);
 	if (llp_sessions[session].state == LLP_STATE_ESTABLISHED) {
-		return_value = send_keep_alive(session);
+		llp_sessions[session].probe_time = llp_get_clock();
+		return_value = send_keep_alive(session, LLP_KEEP_ALIVE_PROBE);
 	} else {
 		liblog_error(LAYER_LINK, "the session is not established.");
 		return_value = LLP_ERROR;
@@ -399,6 +524,9 @@ int llp_disconnect(int session) {
 		llp_unlock_session(session);
 		return LLP_ERROR;
 	} 		
+	/* Datagrams written before the disconnection go first. */
+	send_queued(session);
+	send_coalesced(session);
 	return_value = send_close_request(session);
 	llp_unlock_session(session);
 	
@@ -428,7 +556,11 @@ int llp_write(int session, u_char *data, int length) {
 
 	llp_lock_session(session);
 	if (llp_sessions[session].state == LLP_STATE_ESTABLISHED) {
-		return_value = send_datagram(session, data, length);
+		if (llp_get_send_queue_depth() > 0) {
+			return_value = queue_datagram(session, data, length);
+		} else {
+			return_value = write_datagram(session, data, length);
+		}
 	} else {
 		liblog_error(LAYER_LINK, "the session is not established.");
 		return_value = LLP_ERROR;
@@ -438,6 +570,38 @@ int llp_write(int session, u_char *data, int length) {
 	return return_value;
 }
 /******************************************************************************/
+int llp_send_coalesced() {
+	int session;
+	int return_value = 0;
+
+	while ((session = llp_take_from_list(LLP_LIST_COALESCING)) != LLP_ERROR) {
+		llp_lock_session(session);
+		if (llp_sessions[session].coalesced != NULL &&
+				send_coalesced(session) == LLP_OK) {
+			return_value++;
+		}
+		llp_unlock_session(session);
+	}
+
+	return return_value;
+}
+/******************************************************************************/
+int llp_send_queued() {
+	int session;
+	int return_value = 0;
+
+	while ((session = llp_take_from_list(LLP_LIST_SENDING)) != LLP_ERROR) {
+		llp_lock_session(session);
+		if (llp_sessions[session].send_count > 0) {
+			send_queued(session);
+			return_value++;
+		}
+		llp_unlock_session(session);
+	}
+
+	return return_value;
+}
+/******************************************************************************/
 int llp_hunt_valid(int session) {
 	struct timeval time;
 	struct timezone timezone;
@@ -461,109 +625,150 @@ int llp_hunt_valid(int session) {
 /* Private functions implementations.                                         */
 /*============================================================================*/
 
-int send_data(int session, u_char *data, int length) {
+int compute_padding(int session, int length, u_short *padding_length) {
+	int block_size;
+	int maximum;
+	int total;
+	u_char jitter;
+	unsigned int i;
+
+	if (llp_sessions[session].encrypted == LLP_SESSION_NOT_ENCRYPTED) {
+		*padding_length = 0;
+		return LLP_OK;
+	}
+
+	if (length > LIBFREEDOM_FTU + sizeof(u_char)) {
+		liblog_error(LAYER_LINK, 
+				"can't send packet with more than FTU bytes: (%d>FTU)", 
+				length);
+		return LLP_ERROR;
+	}
+
+	/* Largest padded content, used by the LLP_PADDING_FTU policy. */
+	block_size = llp_sessions[session].cipher->block_size;
+	maximum = LLP_MIN_PADDING_LENGTH + sizeof(u_char) + LIBFREEDOM_FTU
+			+ sizeof(u_short);
+	if (maximum % block_size != 0) {
+		maximum += block_size - (maximum % block_size);
+	}
+
+	/* The type of the packet is already in the content. */
+	total = LLP_MIN_PADDING_LENGTH + length + sizeof(u_short);
+	switch (llp_sessions[session].padding) {
+		case LLP_PADDING_BUCKETS:
+		case LLP_PADDING_JITTER:
+			for (i = 0; i < BUCKETS && buckets[i] < total; i++);
+			total = (i < BUCKETS ? buckets[i] : maximum);
+			if (llp_sessions[session].padding == LLP_PADDING_JITTER) {
+				if (util_rand_bytes(&jitter, sizeof(u_char)) == LLP_ERROR) {
+					liblog_error(LAYER_LINK, "error generating padding.");
+					return LLP_ERROR;
+				}
+				/* Up to a quarter of the bucket size. */
+				total += (jitter * (total / 4)) / (MAX_CHAR + 1);
+			}
+			break;
+		default:
+			total = maximum;
+			break;
+	}
+	if (total % block_size != 0) {
+		total += block_size - (total % block_size);
+	}
+	if (total > maximum) {
+		total = maximum;
+	}
+	*padding_length = total - length - sizeof(u_short);
+
+	return LLP_OK;
+}
+/******************************************************************************/
+u_char *open_frame(int session, int length, u_char **content) {
+	u_short padding_length;
+	u_char *frame;
+
+	if (compute_padding(session, length, &padding_length) == LLP_ERROR) {
+		return NULL;
+	}
+
+	if (llp_sessions[session].crypto_out == NULL) {
+		liblog_error(LAYER_LINK, "session has no keys.");
+		return NULL;
+	}
+
+	/* Header, padding, content, padding length and trailer. */
+	if (LLP_DATA_HEADER_LENGTH + padding_length + length + sizeof(u_short) 
+			+ llp_crypto_trailer_length(llp_sessions[session].crypto_out) 
+			> LLP_BUFFER_LENGTH) {
+		liblog_error(LAYER_LINK, "packet with %d bytes is too big.", length);
+		return NULL;
+	}
+
+	frame = llp_get_buffer();
+	if (frame == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return NULL;
+	}
+
+	/* The padding may be random, so it is kept in the place of the session
+	 * identifier until send_frame() writes the header. */
+	UTIL_WRITE_START(frame)
+	UTIL_WRITE_SEEK(sizeof(u_char))
+	UTIL_WRITE_UINT16(padding_length)
+	*content = &frame[LLP_DATA_HEADER_LENGTH + padding_length];
+
+	return frame;
+}
+/******************************************************************************/
+int send_frame(int session, u_char *frame, int length) {
 	int offset;
-	int packet_length;
 	int content_length;
-	int mac_length;
 	int return_value;
-	u_char *mac;
-	u_char *padding;
-	u_char *packet;
 	u_char *content;
-	u_char *plain_content;
 	u_short padding_length;
 
 	liblog_debug(LAYER_LINK, "sending data by session %d.", session);
-	
-	if (llp_sessions[session].encrypted == LLP_SESSION_NOT_ENCRYPTED) {
-		padding_length = 0;
-	} else {
-		if (length > LIBFREEDOM_FTU + sizeof(u_char)) {
-			liblog_error(LAYER_LINK, 
-					"can't send packet with more than FTU bytes: (%d>FTU)", 
-					length);
-			return LLP_ERROR;
-		}
-		/* Computing padding length. */
-		padding_length = LLP_MIN_PADDING_LENGTH + sizeof(u_char) 
-				+ LIBFREEDOM_FTU + sizeof(u_short);
-		if (padding_length % llp_sessions[session].cipher->block_size != 0) {
-			padding_length = padding_length 
-					+ llp_sessions[session].cipher->block_size
-					- (padding_length%llp_sessions[session].cipher->block_size);	
-		}
-		/* The type of the packet is already in data. */
-		padding_length = padding_length - length - sizeof(u_short) ;
-	}
-	
-	/* Determining the MAC length. */
-	mac_length = llp_sessions[session].mac->length;
-	
-	/* Determining content length. */
+
+	offset = sizeof(u_char);
+	util_read_uint16(&padding_length, &offset, frame);
 	content_length = padding_length + length + sizeof(u_short);
-	
-	/* Determining the packet_size. */
-	packet_length = 2*sizeof(u_char) + content_length + mac_length;
 
-	liblog_debug(LAYER_LINK, "padding will be %d bytes long and packet will be "
-			"%d bytes long.", padding_length, packet_length);
+	/* Constructing LLP_DATA packet around the content. */
+	UTIL_WRITE_START(frame)
+	UTIL_WRITE_BYTE (LLP_DATA)
+	UTIL_WRITE_UINT16(llp_sessions[session].foreign_session)
+	content = &frame[UTIL_WRITE_END];
 
-	/* Allocating buffers. */
-	packet = (u_char*)malloc(packet_length);
-	padding = (u_char*)malloc(padding_length);
-	plain_content = (u_char*)malloc(content_length);
-	mac = (u_char*)malloc(mac_length);
-	
-	if (packet == NULL || plain_content == NULL || mac == NULL ||
-			padding == NULL) {
-		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+	/* Generating padding in the headroom. */
+	if (util_rand_bytes(content, padding_length) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating padding.");
 		return_value = LLP_ERROR;
 		goto return_label;
 	}
-	
-	/* Generating padding. */
-	if (util_rand_bytes(padding, padding_length) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating padding.");
+	UTIL_WRITE_SEEK(padding_length + length)
+	UTIL_WRITE_UINT16(padding_length)
+
+	/* Encrypting content in place, with the MAC or tag in the tailroom. */
+	if (llp_crypto_seal(llp_sessions[session].crypto_out, frame, 
+			LLP_DATA_HEADER_LENGTH, content, content_length, 
+			&frame[UTIL_WRITE_END]) == LLP_ERROR) {
 		return_value = LLP_ERROR;
 		goto return_label;
 	}
-	
-	/* Constructing content. */
-	offset = 0;
-	util_rand_bytes(padding, padding_length);
-	util_write_bytes (plain_content, &offset, padding, padding_length);
-	util_write_bytes (plain_content, &offset, data, length);
-	util_write_uint16(plain_content, &offset, padding_length);
-	
-	/* Generating MAC of the plaintext content. */
-	llp_sessions[session].mac->function(mac, plain_content,
-			llp_sessions[session].mac_out_key, content_length);
-	
-	/* Constructing LLP_DATA packet. */
-	UTIL_WRITE_START(packet)
-	UTIL_WRITE_BYTE (LLP_DATA)
-	UTIL_WRITE_BYTE (llp_sessions[session].foreign_session)
-
-	/* Placing encrypted content in packet. */
-	content = &packet[UTIL_WRITE_END]; 	/* Address to content be placed. */
-	UTIL_WRITE_SEEK(content_length)		/* Skipping the content field. */
+	UTIL_WRITE_SEEK(llp_crypto_trailer_length(llp_sessions[session].crypto_out))
 
-	/* Writing MAC on packet. */
-	UTIL_WRITE_BYTES (mac, mac_length)
-	
-	/* Encrypting content */
-	llp_sessions[session].cipher->function(content, plain_content, 
-			llp_sessions[session].cipher_out_key,
-			llp_sessions[session].cipher_out_iv, content_length,
-			UTIL_WAY_ENCRYPTION);
+	liblog_debug(LAYER_LINK, "padding is %d bytes long and packet is "
+			"%d bytes long.", padding_length, UTIL_WRITE_END);
 			
 	return_value = LLP_OK;
 	
 	/* Sending packet. */
-	llp_sessions[session].silence = 0;
+	llp_set_timer(session, LLP_TIMER_SILENCE, LLP_T_SILENT);
 	llp_sessions[session].packets_sent++;
-	if (llp_send_session_packet(session, packet, offset) == LLP_ERROR) {
+	llp_sessions[session].payload_bytes += length;
+	llp_sessions[session].padding_bytes += padding_length;
+	if (llp_send_session_packet(session, frame, UTIL_WRITE_END) 
+			== LLP_ERROR) {
 		liblog_debug(LAYER_LINK, "error sending packet.");
 		return_value = LLP_ERROR;
 	}
@@ -572,70 +777,250 @@ int send_data(int session, u_char *data, int length) {
 
 return_label:
 	
-	free(packet);
-	free(plain_content);
-	free(mac);
-	free(padding);
+	llp_free_buffer(frame);
 	return return_value;
 }
 /******************************************************************************/
 int send_datagram(int session, u_char *datagram, int length) {
-	u_char *packet;
+	u_char *frame;
+	u_char *content;
 	
 	liblog_debug(LAYER_LINK, "sending packet LLP_DATAGRAM.");
 
-	packet = (u_char *)malloc(sizeof(u_char) + length);
-	if (packet == NULL) {
-		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+	frame = open_frame(session, sizeof(u_char) + length, &content);
+	if (frame == NULL) {
+		liblog_error(LAYER_LINK, "error sending packet.");
 		return LLP_ERROR;
 	}
 
 	/* Constructing packet. */
-	UTIL_WRITE_START(packet)
+	UTIL_WRITE_START(content)
 	UTIL_WRITE_BYTE (LLP_DATAGRAM);
 	UTIL_WRITE_BYTES(datagram, length);
 
 	/* Sending packet. */
-	if (send_data(session, packet, UTIL_WRITE_END) == LLP_ERROR) {
-		free(packet);
+	if (send_frame(session, frame, UTIL_WRITE_END) == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error sending packet.");
 		return LLP_ERROR;
 	}
 
-	free(packet);
-
 	return LLP_OK;	
-	
+}
+/******************************************************************************/
+int write_datagram(int session, u_char *datagram, int length) {
+
+	if (llp_get_coalesce_window() > 0) {
+		return coalesce_datagram(session, datagram, length);
+	}
+	return send_datagram(session, datagram, length);
+}
+/******************************************************************************/
+int queue_datagram(int session, u_char *datagram, int length) {
+	int depth;
+	llp_send_slot_t *slot;
+
+	/* Too big datagrams are refused now, while the writer can know it. */
+	if (length > LIBFREEDOM_FTU) {
+		liblog_error(LAYER_LINK, 
+				"can't send packet with more than FTU bytes: (%d>FTU)", 
+				length);
+		return LLP_ERROR;
+	}
+
+	depth = llp_get_send_queue_depth();
+	if (llp_sessions[session].send_ring == NULL) {
+		llp_sessions[session].send_ring = 
+				(llp_send_slot_t *)malloc(depth * sizeof(llp_send_slot_t));
+		if (llp_sessions[session].send_ring == NULL) {
+			liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+			return LLP_ERROR;
+		}
+		llp_sessions[session].send_head = 0;
+		llp_sessions[session].send_count = 0;
+	}
+
+	if (llp_sessions[session].send_count == depth) {
+		switch (llp_get_send_queue_policy()) {
+			case LLP_SEND_BLOCK:
+				/* The writer waits doing the work of the sender thread. */
+				if (send_queued(session) == LLP_ERROR) {
+					liblog_error(LAYER_LINK, "error sending queued datagrams.");
+				}
+				break;
+			case LLP_SEND_DROP:
+				slot = &llp_sessions[session].send_ring[
+						llp_sessions[session].send_head];
+				llp_free_buffer(slot->data);
+				llp_sessions[session].send_head = 
+						(llp_sessions[session].send_head + 1) % depth;
+				llp_sessions[session].send_count--;
+				llp_sessions[session].send_dropped++;
+				break;
+			default:
+				llp_sessions[session].send_dropped++;
+				liblog_debug(LAYER_LINK, "send ring full, datagram refused.");
+				return LLP_ERROR;
+		}
+	}
+
+	slot = &llp_sessions[session].send_ring[(llp_sessions[session].send_head 
+			+ llp_sessions[session].send_count) % depth];
+	slot->data = llp_get_buffer();
+	if (slot->data == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+	memcpy(slot->data, datagram, length);
+	slot->length = length;
+	llp_sessions[session].send_count++;
+
+	/* The sender thread only sleeps when no session has datagrams. */
+	if (llp_add_to_list(LLP_LIST_SENDING, session)) {
+		llp_wake_sender();
+	}
+
+	return LLP_OK;
+}
+/******************************************************************************/
+int send_queued(int session) {
+	int return_value;
+	llp_send_slot_t *slot;
+
+	return_value = LLP_OK;
+	while (llp_sessions[session].send_count > 0) {
+		slot = &llp_sessions[session].send_ring[
+				llp_sessions[session].send_head];
+		if (write_datagram(session, slot->data, slot->length) == LLP_ERROR) {
+			return_value = LLP_ERROR;
+		}
+		llp_free_buffer(slot->data);
+		llp_sessions[session].send_head = (llp_sessions[session].send_head + 1)
+				% llp_get_send_queue_depth();
+		llp_sessions[session].send_count--;
+	}
+
+	return return_value;
+}
+/******************************************************************************/
+int coalesce_datagram(int session, u_char *datagram, int length) {
+	u_char *coalesced;
+
+	/* Datagrams too big to be packed are sent alone, after the ones waiting
+	 * to keep them in order. */
+	if (sizeof(u_char) + RECORD_HEADER_LENGTH + length 
+			> COALESCED_MAX_LENGTH) {
+		if (send_coalesced(session) == LLP_ERROR) {
+			return LLP_ERROR;
+		}
+		return send_datagram(session, datagram, length);
+	}
+
+	if (llp_sessions[session].coalesced != NULL &&
+			llp_sessions[session].coalesced_length + RECORD_HEADER_LENGTH 
+			+ length > COALESCED_MAX_LENGTH) {
+		if (send_coalesced(session) == LLP_ERROR) {
+			return LLP_ERROR;
+		}
+	}
+
+	if (llp_sessions[session].coalesced == NULL) {
+		coalesced = llp_get_buffer();
+		if (coalesced == NULL) {
+			liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+			return LLP_ERROR;
+		}
+		coalesced[0] = LLP_DATAGRAMS;
+		llp_sessions[session].coalesced = coalesced;
+		llp_sessions[session].coalesced_length = sizeof(u_char);
+		llp_sessions[session].coalesced_count = 0;
+
+		/* The window starts with the first session holding datagrams. */
+		if (llp_add_to_list(LLP_LIST_COALESCING, session)) {
+			llp_wake_coalescer();
+		}
+	}
+
+	/* Appending the datagram record. */
+	coalesced = llp_sessions[session].coalesced;
+	UTIL_WRITE_START(&coalesced[llp_sessions[session].coalesced_length])
+	UTIL_WRITE_UINT16(length)
+	UTIL_WRITE_BYTES(datagram, length)
+	llp_sessions[session].coalesced_length += UTIL_WRITE_END;
+	llp_sessions[session].coalesced_count++;
+
+	return LLP_OK;
+}
+/******************************************************************************/
+int send_coalesced(int session) {
+	int length;
+	int return_value;
+	u_char *coalesced;
+	u_char *frame;
+	u_char *content;
+
+	coalesced = llp_sessions[session].coalesced;
+	if (coalesced == NULL) {
+		return LLP_OK;
+	}
+	length = llp_sessions[session].coalesced_length;
+	llp_sessions[session].coalesced = NULL;
+
+	/* A lone datagram does not need the record header. */
+	if (llp_sessions[session].coalesced_count == 1) {
+		return_value = send_datagram(session, 
+				&coalesced[sizeof(u_char) + RECORD_HEADER_LENGTH],
+				length - sizeof(u_char) - RECORD_HEADER_LENGTH);
+		goto return_label;
+	}
+
+	liblog_debug(LAYER_LINK, "sending packet LLP_DATAGRAMS with %d datagrams.",
+			llp_sessions[session].coalesced_count);
+
+	frame = open_frame(session, length, &content);
+	if (frame == NULL) {
+		liblog_error(LAYER_LINK, "error sending packet.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+	memcpy(content, coalesced, length);
+
+	/* Sending packet. */
+	return_value = send_frame(session, frame, length);
+	if (return_value == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error sending packet.");
+	}
+
+return_label:
+
+	llp_free_buffer(coalesced);
+	return return_value;
 }
 /******************************************************************************/
 int send_close(int session, u_char type) {
 	int hash_length;
-	u_char *packet;
+	u_char *frame;
+	u_char *content;
 	
 	liblog_debug(LAYER_LINK, "sending packet LLP_CLOSE, with type %d.", type);
 
 	hash_length = llp_sessions[session].hash->length;
-	packet = (u_char *)malloc(sizeof(u_char) + hash_length);
-	if (packet == NULL) {
-		free(packet);
-		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+	frame = open_frame(session, sizeof(u_char) + hash_length, &content);
+	if (frame == NULL) {
+		liblog_error(LAYER_LINK, "error sending packet.");
 		return LLP_ERROR;
 	}
 	
 	/* Constructing packet. */
-	UTIL_WRITE_START(packet)
+	UTIL_WRITE_START(content)
 	UTIL_WRITE_BYTE (type);
 	UTIL_WRITE_BYTES(llp_sessions[session].verifier, hash_length);
 	
 	/* Sending packet. */
-	if (send_data(session, packet, UTIL_WRITE_END) == LLP_ERROR) {
-		free(packet);
+	if (send_frame(session, frame, UTIL_WRITE_END) == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error sending packet.");
 		return LLP_ERROR;
 	}
 
-	free(packet);
-
 	return LLP_OK;
 }
 /******************************************************************************/
@@ -648,17 +1033,24 @@ int send_close_request(int session) {
 }
 /******************************************************************************/
 int send_node_hunt(int session) {
-	u_char packet[sizeof(u_char)];
+	u_char *frame;
+	u_char *content;
 	
 	liblog_debug(LAYER_LINK, "sending packet LLP_NODE_HUNT.");
 
+	frame = open_frame(session, sizeof(u_char), &content);
+	if (frame == NULL) {
+		liblog_error(LAYER_LINK, "error sending packet.");
+		return LLP_ERROR;
+	}
+
 	/* Constructing packet. */
-	UTIL_WRITE_START(packet)
+	UTIL_WRITE_START(content)
 	UTIL_WRITE_BYTE (LLP_NODE_HUNT);
 	liblog_debug(LAYER_LINK, "packet constructed.");
 
 	/* Sending packet. */
-	if (send_data(session, packet, UTIL_WRITE_END) == LLP_ERROR) {
+	if (send_frame(session, frame, UTIL_WRITE_END) == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error sending packet.");
 		return LLP_ERROR;
 	}
@@ -668,12 +1060,20 @@ int send_node_hunt(int session) {
 /******************************************************************************/
 int send_hunt_result(int session, struct sockaddr_in *addresses, int number) {
 	int i;
-	u_char packet[LLP_HUNT_RESULT_MAX_LENGTH];
+	u_char *frame;
+	u_char *content;
 	
 	liblog_debug(LAYER_LINK, "sending packet LLP_HUNT_RESULT.");
 
+	frame = open_frame(session,
+			2*sizeof(u_char) + number * LLP_ADDRESS_INET_LENGTH, &content);
+	if (frame == NULL) {
+		liblog_error(LAYER_LINK, "error sending packet.");
+		return LLP_ERROR;
+	}
+
 	/* Constructing packet. */
-	UTIL_WRITE_START(packet);
+	UTIL_WRITE_START(content);
 	UTIL_WRITE_BYTE(LLP_HUNT_RESULT);
 	UTIL_WRITE_BYTE(number);
 	for (i = 0; i < number; i++) {
@@ -686,7 +1086,7 @@ int send_hunt_result(int session, struct sockaddr_in *addresses, int number) {
 	}
 
 	/* Sending packet. */
-	if (send_data(session, packet, UTIL_WRITE_END) == LLP_ERROR) {
+	if (send_frame(session, frame, UTIL_WRITE_END) == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error sending packet.");
 		return LLP_ERROR;
 	}
@@ -694,17 +1094,25 @@ int send_hunt_result(int session, struct sockaddr_in *addresses, int number) {
 	return LLP_OK;
 }
 /******************************************************************************/
-int send_keep_alive(int session) {
-	u_char packet[sizeof(u_char)];
+int send_keep_alive(int session, int flag) {
+	u_char *frame;
+	u_char *content;
 	
 	liblog_debug(LAYER_LINK, "sending packet LLP_KEEP_ALIVE.");
 
+	frame = open_frame(session, 2 * sizeof(u_char), &content);
+	if (frame == NULL) {
+		liblog_error(LAYER_LINK, "error sending packet.");
+		return LLP_ERROR;
+	}
+
 	/* Constructing packet. */
-	UTIL_WRITE_START(packet);
+	UTIL_WRITE_START(content);
 	UTIL_WRITE_BYTE(LLP_KEEP_ALIVE);
+	UTIL_WRITE_BYTE(flag);
 
 	/* Sending packet. */
-	if (send_data(session, packet, UTIL_WRITE_END) == LLP_ERROR) {
+	if (send_frame(session, frame, UTIL_WRITE_END) == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error sending packet.");
 		return LLP_ERROR;
 	}
@@ -712,52 +1120,32 @@ int send_keep_alive(int session) {
 	return LLP_OK;	
 }
 /******************************************************************************/
-int handle_encrypted_content(u_char *encrypted, int length,
-		u_char *mac, int session) {
+int handle_encrypted_content(u_char *header, u_char *encrypted, int length,
+		u_char *trailer, int session) {
 	int offset;
-	int return_value;
-	u_char *plain_content;
-	u_char *real_mac;
 	llp_data_p packet;
 	
-	plain_content = (u_char*)malloc(length);
-	real_mac = (u_char *)malloc(llp_sessions[session].mac->length);
-	if (plain_content == NULL || real_mac == NULL) {
-		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
-		return_value = LLP_ERROR;
-		goto return_label;
+	/* Decrypting content in place and checking the MAC or tag. */
+	if (llp_crypto_open(llp_sessions[session].crypto_in, header, 
+			LLP_DATA_HEADER_LENGTH, encrypted, length, trailer) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "MAC mismatch. packet dropped.");
+		return LLP_ERROR;
 	}
-
-	/* Decrypting content. */
-	llp_sessions[session].cipher->function(plain_content, encrypted, 
-			llp_sessions[session].cipher_in_key,
-			llp_sessions[session].cipher_in_iv, length, UTIL_WAY_DECRYPTION);
-			
+	
+	liblog_debug(LAYER_LINK, "MAC is correct.");
+	
 	/* Read the data after decryption. */
 	offset = length - sizeof(u_short);
-	util_read_uint16(&packet.padding_length, &offset, plain_content);
+	util_read_uint16(&packet.padding_length, &offset, encrypted);
 
-	llp_sessions[session].mac->function(real_mac, plain_content,
-			llp_sessions[session].mac_in_key, length);
-
-	if (memcmp(mac, real_mac, llp_sessions[session].mac->length) != 0) {
-		/* MAC mismatch, drop packet. */
-		liblog_error(LAYER_LINK, "MAC mismatch. packet dropped.");
-		return_value = LLP_ERROR;
-		goto return_label;
+	/* The padding length comes from the peer, it must be checked. */
+	if (packet.padding_length > length - sizeof(u_short) - sizeof(u_char)) {
+		liblog_error(LAYER_LINK, "invalid padding length. packet dropped.");
+		return LLP_ERROR;
 	}
 	
-	liblog_debug(LAYER_LINK, "MAC is correct.");
-	
-	return_value = handle_content(&plain_content[packet.padding_length],
+	return handle_content(&encrypted[packet.padding_length],
 			length - packet.padding_length - sizeof(u_short), session);
-			
-return_label:
-	
-	free(plain_content);
-	free(real_mac);
-	
-	return return_value;
 }
 /******************************************************************************/
 int handle_content(u_char *content,	int length, int session) {
@@ -772,6 +1160,9 @@ int handle_content(u_char *content,	int length, int session) {
 		case LLP_DATAGRAM:
 			liblog_debug(LAYER_LINK, "LLP_DATAGRAM received.");
 			return handle_datagram(&content[1], length-1, session);
+		case LLP_DATAGRAMS:
+			liblog_debug(LAYER_LINK, "LLP_DATAGRAMS received.");
+			return handle_datagrams(&content[1], length-1, session);
 		case LLP_CLOSE_REQUEST:
 			liblog_debug(LAYER_LINK, "LLP_CLOSE_REQUEST received.");
 			return handle_close_request(content, length, session);
@@ -799,6 +1190,32 @@ int handle_datagram(u_char *content, int length, int session) {
 	return llp_enqueue_datagram(session, content, length);
 }
 /******************************************************************************/
+int handle_datagrams(u_char *content, int length, int session) {
+	int offset;
+	u_short record_length;
+
+	offset = 0;
+	while (offset < length) {
+		/* Record lengths come from the peer, they must be checked. */
+		if (offset + RECORD_HEADER_LENGTH > length) {
+			liblog_error(LAYER_LINK, "truncated datagram, packet dropped.");
+			return LLP_ERROR;
+		}
+		util_read_uint16(&record_length, &offset, content);
+		if (offset + record_length > length) {
+			liblog_error(LAYER_LINK, "truncated datagram, packet dropped.");
+			return LLP_ERROR;
+		}
+		if (llp_enqueue_datagram(session, &content[offset], record_length)
+				== LLP_ERROR) {
+			return LLP_ERROR;
+		}
+		offset += record_length;
+	}
+
+	return LLP_OK;
+}
+/******************************************************************************/
 int handle_closing(u_char *content, int length, int session) {
 	llp_data_p packet;
 	int hash_length;
@@ -840,7 +1257,7 @@ int handle_close_request(u_char *content, int length, int session) {
 	 * counting. */
 	if (llp_sessions[session].state != LLP_STATE_TIME_WAIT) {
 		llp_sessions[session].state = LLP_STATE_TIME_WAIT;
-		llp_sessions[session].timeout = LLP_T_TIMEOUT;
+		llp_set_timer(session, LLP_TIMER_TIMEOUT, LLP_T_TIMEOUT);
 		llp_set_node_inactive(session);
 	}
 
@@ -926,7 +1343,24 @@ int handle_hunt_result(u_char *content, int length, int session) {
 }
 /******************************************************************************/
 int handle_keep_alive(u_char *content, int length, int session) {
-	llp_sessions[session].timeout = LLP_T_TIMEOUT;
+	llp_set_timer(session, LLP_TIMER_TIMEOUT, LLP_T_TIMEOUT);
+
+	/* Peers that send the bare type byte do not echo probes. */
+	if (length < 2 * sizeof(u_char)) {
+		return LLP_OK;
+	}
+
+	if (content[1] == LLP_KEEP_ALIVE_PROBE) {
+		return send_keep_alive(session, LLP_KEEP_ALIVE_ECHO);
+	}
+
+	if (content[1] == LLP_KEEP_ALIVE_ECHO && 
+			llp_sessions[session].probe_time != 0) {
+		llp_set_node_rtt(session, LLP_RTT_KEEP_ALIVE, 
+				llp_get_clock() - llp_sessions[session].probe_time);
+		llp_sessions[session].probe_time = 0;
+	}
+
 	return LLP_OK;
 }
 /******************************************************************************/
@@ -96,6 +96,21 @@ int llp_write(int session, u_char *data, int length);
  */
 int llp_flush();
 
+/**
+ * Sends the datagrams coalesced by all sessions, one LLP_DATAGRAMS packet for
+ * each session.
+ * 
+ * @return the number of packets sent.
+ */
+int llp_send_coalesced();
+
+/**
+ * Sends the datagrams waiting in the send rings of all sessions.
+ * 
+ * @return the number of sessions served.
+ */
+int llp_send_queued();
+
 /*
  * Registers a function to treat session closing events.
  * 
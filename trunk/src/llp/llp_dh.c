@@ -26,6 +26,17 @@
  */
 
 #include <sys/types.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include <pthread.h>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/obj_mac.h>
 
 #include <libfreedom/layers.h>
 #include <libfreedom/layer_link.h>
@@ -47,6 +58,38 @@
  */
 #define LLP_GROUP_GENERATOR	2
 
+/**
+ * Number of exponent bits consumed by each fixed-base table.
+ */
+#define WINDOW_BITS		4
+
+/**
+ * Number of entries in each fixed-base table.
+ */
+#define WINDOW_ENTRIES	(1 << WINDOW_BITS)
+
+/**
+ * Maximum size in bits of the random exponents generated.
+ */
+#define EXPONENT_BITS	\
+	(8 * (LLP_X_LENGTH - MPINT_SIZE_LENGTH - MPINT_SIGNAL_LENGTH))
+
+/**
+ * Number of fixed-base tables needed to cover an exponent.
+ */
+#define WINDOWS			((EXPONENT_BITS + WINDOW_BITS - 1) / WINDOW_BITS)
+
+/**
+ * Size in bytes of each fixed-base table entry, the size of the prime.
+ */
+#define ENTRY_LENGTH	\
+	(LLP_Y_LENGTH - MPINT_SIZE_LENGTH - MPINT_SIGNAL_LENGTH)
+
+/**
+ * Number of 64-bit words of each fixed-base table entry.
+ */
+#define ENTRY_WORDS		(ENTRY_LENGTH / sizeof(uint64_t))
+
 /*
  * Prime number used in Diffie & Hellman modular exponentiation caculations.
  * It is the 2048 bit MODP group (id 14), specified in RFC 3526.
@@ -88,65 +131,336 @@ static u_char prime[] = {
 		0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
 };
 
+/*
+ * The prime converted to a BIGNUM.
+ */
+static BIGNUM *p_bignum = NULL;
+
+/*
+ * Montgomery context of the prime, shared by all threads.
+ */
+static BN_MONT_CTX *montgomery = NULL;
+
+/*
+ * Fixed-base tables, in Montgomery form and big endian. Entry powers[i][j]
+ * stores g^(j * 2^(i * WINDOW_BITS)) mod p, so g^x is the product of one entry
+ * of each table.
+ */
+static uint64_t powers[WINDOWS][WINDOW_ENTRIES][ENTRY_WORDS];
+
+/*
+ * Curve used by the elliptic-curve key agreement.
+ */
+static EC_GROUP *curve = NULL;
+
+/*
+ * Key used to store the BN_CTX of each thread.
+ */
+static pthread_key_t context_key;
+
+/**
+ * Data type that stores a precomputed Diffie & Hellman key pair.
+ */
+typedef struct {
+	/** Random exponent. */
+	u_char x[LLP_X_LENGTH];
+	/** Result of g^x mod p. */
+	u_char y[LLP_Y_LENGTH];
+} key_pair_t;
+
+/*
+ * Stack of precomputed key pairs.
+ */
+static key_pair_t *key_pool = NULL;
+
+/*@{ */
+/**
+ * Capacity of the key pool and number of pairs currently stored.
+ */
+static int key_pool_size = 0;
+static int key_pool_depth = 0;
+/*@} */
+
+/*
+ * Number of pairs below which the generator starts refilling the pool.
+ */
+static int key_pool_watermark = 0;
+
+/*
+ * Number of times a pair was requested while the pool was empty.
+ */
+static long key_pool_empty = 0;
+
+/*
+ * Lock used to access the key pool.
+ */
+static pthread_mutex_t key_pool_mutex;
+
+/*
+ * Condition variable signaled when the pool drops below the watermark.
+ */
+static pthread_cond_t key_pool_condition;
+
+/*
+ * Thread that refills the key pool.
+ */
+static pthread_t generator_thread;
+
+static int finish_execution = 0;
+
 /*============================================================================*/
 /* Private functions prototypes.                                              */
 /*============================================================================*/
 
+/*
+ * Converts the prime, creates its Montgomery context and fills the fixed-base
+ * tables.
+ * 
+ * @retval LLP_OK       - if no errors occurred.
+ * @retval LLP_ERROR    - otherwise.
+ */
+static int create_engine();
+
+/*
+ * Frees the structures allocated by create_engine().
+ */
+static void destroy_engine();
+
+/*
+ * Returns the BN_CTX of the calling thread, creating it if needed.
+ * 
+ * @return the context, or NULL if it could not be allocated.
+ */
+static BN_CTX *get_context();
+
+/*
+ * Frees the BN_CTX of an exiting thread.
+ * 
+ * @param[in] context   - the context of the thread.
+ */
+static void free_context(void *context);
+
 /*
  * Computes (y = g^x mod p), with values for g and p fixed.
  */
 static int compute_y(mpint y, mpint x);
 
+/*
+ * Generates a random scalar x and computes the point y = xG of the curve.
+ * 
+ * @param[out] x        - the random scalar generated.
+ * @param[out] y        - the point, in uncompressed form.
+ * @retval LLP_OK       - if no errors occurred.
+ * @retval LLP_ERROR    - otherwise.
+ */
+static int compute_ec_params(mpint x, mpint y);
+
+/*
+ * Computes the shared secret of the elliptic-curve key agreement, the x
+ * coordinate of the point xY.
+ * 
+ * @param[out] z        - the shared secret.
+ * @param[in] y         - the point received from the peer.
+ * @param[in] x         - the local random scalar.
+ * @retval LLP_OK       - if no errors occurred.
+ * @retval LLP_ERROR    - otherwise.
+ */
+static int compute_ec_secret(mpint z, mpint y, mpint x);
+
+/*
+ * Generates a new random exponent x and computes y = g^x mod p.
+ * 
+ * @param[out] x        - the random exponent generated.
+ * @param[out] y        - the result of the modular exponentiation.
+ * @retval LLP_OK       - if no errors occurred.
+ * @retval LLP_ERROR    - otherwise.
+ */
+static int generate_key_pair(mpint x, mpint y);
+
+/*
+ * Function executed by the thread that keeps the key pool filled. The thread
+ * runs with idle priority, so the pool is refilled when the node has nothing
+ * better to do.
+ */
+static void *run_generator();
+
+/*
+ * Key agreement algorithms supported.
+ */
+static llp_kex_function_t kex_functions[] = {
+	{LLP_KEX_MODP_2048, llp_compute_dh_params, llp_compute_dh_secret},
+	{LLP_KEX_ECDH_P256, compute_ec_params, compute_ec_secret}
+};
+
+/*
+ * Number of key agreement algorithms supported.
+ */
+#define KEX_FUNCTIONS	(sizeof(kex_functions) / sizeof(llp_kex_function_t))
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/	   
 
-int llp_compute_dh_params(mpint x, mpint y) {
+int llp_dh_initialize(int size, int watermark) {
 
-	/* Exponent x is a string of pseudo-random bytes. */
-	if (util_rand_mpint(x, LLP_X_LENGTH - MPINT_SIZE_LENGTH -
-			MPINT_SIGNAL_LENGTH) == UTIL_ERROR) {
-		liblog_error(LAYER_LINK, "error generating random exponent.");
+	if (create_engine() == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error creating D&H engine.");
 		return LLP_ERROR;
-	};
-	liblog_debug(LAYER_LINK, "random exponent generated.");
+	}
 
-	/* Computing (y = g^x mod p)	for Diffie & Hellman. */
-	if (compute_y(y, x) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error computing y parameter.");
+	if (pthread_mutex_init(&key_pool_mutex, NULL)) {
+		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
 		return LLP_ERROR;
 	}
-	liblog_debug(LAYER_LINK, "y parameter computed.");
+
+	if (pthread_cond_init(&key_pool_condition, NULL)) {
+		liblog_error(LAYER_LINK, "error creating condition variable: %s.",
+				strerror(errno));
+		return LLP_ERROR;
+	}
+
+	key_pool_size = size;
+	key_pool_watermark = watermark;
+	key_pool_depth = 0;
+	key_pool_empty = 0;
+	finish_execution = 0;
+
+	/* Without a pool, every key pair is computed on demand. */
+	if (key_pool_size == 0) {
+		return LLP_OK;
+	}
+
+	key_pool = (key_pair_t *)malloc(key_pool_size * sizeof(key_pair_t));
+	if (key_pool == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		key_pool_size = 0;
+		return LLP_ERROR;
+	}
+
+	if (pthread_create(&generator_thread, NULL, run_generator, NULL)) {
+		liblog_error(LAYER_LINK, "error creating thread: %s.", strerror(errno));
+		free(key_pool);
+		key_pool = NULL;
+		key_pool_size = 0;
+		return LLP_ERROR;
+	}
+
+	liblog_debug(LAYER_LINK, "D&H key pool created with %d pairs.", size);
 
 	return LLP_OK;
 }
 /******************************************************************************/
+void llp_dh_finalize() {
+
+	if (key_pool_size > 0) {
+		pthread_mutex_lock(&key_pool_mutex);
+		finish_execution = 1;
+		pthread_cond_signal(&key_pool_condition);
+		pthread_mutex_unlock(&key_pool_mutex);
+
+		pthread_join(generator_thread, NULL);
+
+		/* Exponents are secret, they must not stay in memory. */
+		memset(key_pool, 0, key_pool_size * sizeof(key_pair_t));
+		free(key_pool);
+		key_pool = NULL;
+		key_pool_size = 0;
+	}
+
+	pthread_mutex_destroy(&key_pool_mutex);
+	pthread_cond_destroy(&key_pool_condition);
+
+	destroy_engine();
+}
+/******************************************************************************/
+int llp_compute_dh_params(mpint x, mpint y) {
+	key_pair_t *pair;
+
+	pthread_mutex_lock(&key_pool_mutex);
+	if (key_pool_depth > 0) {
+		/* Each pair is handed out only once. */
+		pair = &key_pool[--key_pool_depth];
+		memcpy(x, pair->x, LLP_X_LENGTH);
+		memcpy(y, pair->y, LLP_Y_LENGTH);
+		memset(pair->x, 0, LLP_X_LENGTH);
+		if (key_pool_depth < key_pool_watermark) {
+			pthread_cond_signal(&key_pool_condition);
+		}
+		pthread_mutex_unlock(&key_pool_mutex);
+		return LLP_OK;
+	}
+	if (key_pool_size > 0) {
+		key_pool_empty++;
+		pthread_cond_signal(&key_pool_condition);
+	}
+	pthread_mutex_unlock(&key_pool_mutex);
+
+	return generate_key_pair(x, y);
+}
+/******************************************************************************/
+llp_kex_function_t *llp_get_kex(char *name) {
+	unsigned int i;
+
+	for (i = 0; i < KEX_FUNCTIONS; i++) {
+		if (strcmp(kex_functions[i].name, name) == 0) {
+			return &kex_functions[i];
+		}
+	}
+	return NULL;
+}
+/******************************************************************************/
+int llp_get_dh_pool_depth() {
+	int return_value;
+
+	pthread_mutex_lock(&key_pool_mutex);
+	return_value = key_pool_depth;
+	pthread_mutex_unlock(&key_pool_mutex);
+
+	return return_value;
+}
+/******************************************************************************/
+long llp_get_dh_pool_empty() {
+	long return_value;
+
+	pthread_mutex_lock(&key_pool_mutex);
+	return_value = key_pool_empty;
+	pthread_mutex_unlock(&key_pool_mutex);
+
+	return return_value;
+}
+/******************************************************************************/
 int llp_compute_dh_secret(mpint z, mpint y, mpint x) {
-	BIGNUM *z_bignum, *y_bignum, *x_bignum, *p_bignum;
-	BN_CTX *context = NULL;
+	BIGNUM *z_bignum, *y_bignum, *x_bignum;
+	BN_CTX *context;
 	int length;
 	int return_value;
 	
+	context = get_context();
+	if (context == NULL) {
+		return LLP_ERROR;
+	}
+
 	return_value = LLP_OK;
 	z_bignum = BN_new();
 	y_bignum = BN_mpi2bn(y, MPINT_LENGTH(y) + MPINT_SIZE_LENGTH, NULL);
 	x_bignum = BN_mpi2bn(x, MPINT_LENGTH(x) + MPINT_SIZE_LENGTH, NULL);
 	
-	p_bignum = BN_mpi2bn(prime, MPINT_LENGTH(prime) + MPINT_SIZE_LENGTH, NULL);
-	
-	if (z_bignum == NULL || y_bignum == NULL || x_bignum == NULL ||
-			p_bignum == NULL) {
+	if (z_bignum == NULL || y_bignum == NULL || x_bignum == NULL) {
 		liblog_error(LAYER_LINK, "error allocating BIGNUMs.");
 		return_value = LLP_ERROR;
 		goto return_label;
 	}
 	
-	/* Creating the context. */
-	context = BN_CTX_new();
-	BN_CTX_init(context);
+	/* The base comes from the network, so the exponent must not leak. */
+	BN_set_flags(x_bignum, BN_FLG_CONSTTIME);
 
 	/* Computing y_in^x mod p. */
-	BN_mod_exp(z_bignum, y_bignum, x_bignum, p_bignum, context);
+	if (!BN_mod_exp_mont(z_bignum, y_bignum, x_bignum, p_bignum, context,
+			montgomery)) {
+		liblog_error(LAYER_LINK, "error computing z.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
 	length = BN_bn2mpi(z_bignum, NULL);
 	if (length > LLP_Z_LENGTH) {
 		liblog_error(LAYER_LINK, "computed z is too large.");
@@ -159,45 +473,197 @@ int llp_compute_dh_secret(mpint z, mpint y, mpint x) {
 
 return_label:
 
-	BN_free(z_bignum);
+	BN_clear_free(z_bignum);
 	BN_free(y_bignum);
-	BN_free(x_bignum);
-	BN_free(p_bignum);
-	BN_CTX_free(context);	
+	BN_clear_free(x_bignum);
 	return return_value;
 }
 /*============================================================================*/
 /* Private functions implementations.                                         */
 /*============================================================================*/	   
 
+int create_engine() {
+	BIGNUM *base, *entry;
+	BN_CTX *context;
+	int i, j;
+	int return_value;
+
+	if (pthread_key_create(&context_key, free_context)) {
+		liblog_error(LAYER_LINK, "error creating thread key: %s.",
+				strerror(errno));
+		return LLP_ERROR;
+	}
+
+	return_value = LLP_OK;
+	base = BN_new();
+	entry = BN_new();
+	p_bignum = BN_mpi2bn(prime, MPINT_LENGTH(prime) + MPINT_SIZE_LENGTH, NULL);
+	montgomery = BN_MONT_CTX_new();
+	curve = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
+	context = get_context();
+
+	if (base == NULL || entry == NULL || p_bignum == NULL ||
+			montgomery == NULL || curve == NULL || context == NULL) {
+		liblog_error(LAYER_LINK, "error allocating BIGNUMs.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+
+	/* Setting base = g, in Montgomery form. */
+	if (!BN_MONT_CTX_set(montgomery, p_bignum, context) ||
+			!BN_set_word(base, LLP_GROUP_GENERATOR) ||
+			!BN_to_montgomery(base, base, montgomery, context)) {
+		liblog_error(LAYER_LINK, "error creating Montgomery context.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+
+	for (i = 0; i < WINDOWS; i++) {
+		/* Entry zero is 1 and each entry is the previous one times the base
+		 * of the table. */
+		if (!BN_one(entry) ||
+				!BN_to_montgomery(entry, entry, montgomery, context)) {
+			return_value = LLP_ERROR;
+			goto return_label;
+		}
+		for (j = 0; j < WINDOW_ENTRIES; j++) {
+			if ((j > 0 && !BN_mod_mul_montgomery(entry, entry, base,
+					montgomery, context)) ||
+					BN_bn2binpad(entry, (u_char *)powers[i][j],
+					ENTRY_LENGTH) < 0) {
+				return_value = LLP_ERROR;
+				goto return_label;
+			}
+		}
+
+		/* The base of the next table is base^(2^WINDOW_BITS). */
+		if (!BN_mod_mul_montgomery(base, entry, base, montgomery, context)) {
+			return_value = LLP_ERROR;
+			goto return_label;
+		}
+	}
+
+	liblog_debug(LAYER_LINK, "D&H fixed-base tables computed.");
+
+return_label:
+
+	if (return_value == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error computing fixed-base tables.");
+		destroy_engine();
+	}
+	BN_free(entry);
+	BN_free(base);
+	return return_value;
+}
+/******************************************************************************/
+void destroy_engine() {
+	BN_CTX *context;
+
+	BN_MONT_CTX_free(montgomery);
+	montgomery = NULL;
+	EC_GROUP_free(curve);
+	curve = NULL;
+	BN_free(p_bignum);
+	p_bignum = NULL;
+
+	/* The destructor only runs for exiting threads, so the context of the
+	 * calling thread is released here. */
+	context = (BN_CTX *)pthread_getspecific(context_key);
+	if (context != NULL) {
+		BN_CTX_free(context);
+		pthread_setspecific(context_key, NULL);
+	}
+	pthread_key_delete(context_key);
+}
+/******************************************************************************/
+BN_CTX *get_context() {
+	BN_CTX *context;
+
+	context = (BN_CTX *)pthread_getspecific(context_key);
+	if (context == NULL) {
+		context = BN_CTX_new();
+		if (context == NULL) {
+			liblog_error(LAYER_LINK, "error allocating BN_CTX.");
+			return NULL;
+		}
+		pthread_setspecific(context_key, context);
+	}
+	return context;
+}
+/******************************************************************************/
+void free_context(void *context) {
+	BN_CTX_free((BN_CTX *)context);
+}
+/******************************************************************************/
 int compute_y(mpint y, mpint x) {
 	/* Bignum representations. */
-	BIGNUM  *y_bignum, *g_bignum, *x_bignum, *p_bignum;
-	BN_CTX *context = NULL;
+	BIGNUM  *y_bignum, *x_bignum, *entry_bignum;
+	BN_CTX *context;
+	uint64_t entry[ENTRY_WORDS];
+	uint64_t mask;
+	int i, j, k, digit;
 	int length;
 	int return_value;
 	
+	context = get_context();
+	if (context == NULL) {
+		return LLP_ERROR;
+	}
+
 	return_value = LLP_OK;
 	y_bignum = BN_new();
-	g_bignum = BN_new();
+	entry_bignum = BN_new();
 	x_bignum = BN_mpi2bn(x, MPINT_LENGTH(x) + MPINT_SIZE_LENGTH, NULL);
-	p_bignum = BN_mpi2bn(prime, MPINT_LENGTH(prime) + MPINT_SIZE_LENGTH, NULL);
 
-	if (y_bignum == NULL || g_bignum == NULL || x_bignum == NULL ||
-			p_bignum == NULL) {
+	if (y_bignum == NULL || entry_bignum == NULL || x_bignum == NULL) {
 		liblog_error(LAYER_LINK, "error allocating BIGNUMs.");
 		return_value = LLP_ERROR;
 		goto return_label;
 	}
 
-	BN_set_word(g_bignum, LLP_GROUP_GENERATOR);
+	if (BN_num_bits(x_bignum) > WINDOWS * WINDOW_BITS) {
+		/* Exponents wider than the tables use a generic exponentiation. */
+		if (!BN_mod_exp_mont_word(y_bignum, LLP_GROUP_GENERATOR, x_bignum,
+				p_bignum, context, montgomery)) {
+			return_value = LLP_ERROR;
+			goto return_label;
+		}
+	} else {
+		/* Computing (g^x mod p) as a product of table entries. */
+		if (BN_bin2bn((u_char *)powers[0][0], ENTRY_LENGTH, y_bignum)
+				== NULL) {
+			return_value = LLP_ERROR;
+			goto return_label;
+		}
+		for (i = 0; i < WINDOWS; i++) {
+			digit = 0;
+			for (j = WINDOW_BITS - 1; j >= 0; j--) {
+				digit = (digit << 1) |
+						BN_is_bit_set(x_bignum, i * WINDOW_BITS + j);
+			}
 
-	/* Creating the context. */
-	context = BN_CTX_new();
-	BN_CTX_init(context);
-		
-	/* Computing (g^x mod p). */
-	BN_mod_exp(y_bignum, g_bignum, x_bignum, p_bignum, context);
+			/* Every entry is read and every digit multiplied, so neither the
+			 * memory accessed nor the time taken depend on the exponent. */
+			memset(entry, 0, ENTRY_LENGTH);
+			for (j = 0; j < WINDOW_ENTRIES; j++) {
+				mask = 0 - (uint64_t)(((unsigned int)(j ^ digit) - 1) >> 31);
+				for (k = 0; k < ENTRY_WORDS; k++) {
+					entry[k] |= powers[i][j][k] & mask;
+				}
+			}
+			if (BN_bin2bn((u_char *)entry, ENTRY_LENGTH, entry_bignum)
+					== NULL ||
+					!BN_mod_mul_montgomery(y_bignum, y_bignum, entry_bignum,
+					montgomery, context)) {
+				return_value = LLP_ERROR;
+				goto return_label;
+			}
+		}
+		if (!BN_from_montgomery(y_bignum, y_bignum, montgomery, context)) {
+			return_value = LLP_ERROR;
+			goto return_label;
+		}
+	}
 
 	length = BN_bn2mpi(y_bignum, NULL);
 	if (length > LLP_Y_LENGTH) {
@@ -211,11 +677,201 @@ int compute_y(mpint y, mpint x) {
 
 return_label:
 
+	OPENSSL_cleanse(entry, ENTRY_LENGTH);
 	BN_free(y_bignum);
-	BN_free(g_bignum);
-	BN_free(x_bignum);
-	BN_free(p_bignum);
-	BN_CTX_free(context);	
+	BN_clear_free(entry_bignum);
+	BN_clear_free(x_bignum);
+	return return_value;
+}
+/******************************************************************************/
+int compute_ec_params(mpint x, mpint y) {
+	BIGNUM *x_bignum, *y_bignum;
+	EC_POINT *point;
+	BN_CTX *context;
+	u_char octets[LLP_Y_LENGTH];
+	size_t length;
+	int return_value;
+
+	context = get_context();
+	if (context == NULL) {
+		return LLP_ERROR;
+	}
+
+	return_value = LLP_OK;
+	x_bignum = BN_new();
+	y_bignum = BN_new();
+	point = EC_POINT_new(curve);
+
+	if (x_bignum == NULL || y_bignum == NULL || point == NULL) {
+		liblog_error(LAYER_LINK, "error allocating BIGNUMs.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+
+	/* The scalar x is chosen uniformly in [1, n - 1]. */
+	do {
+		if (!BN_rand_range(x_bignum, EC_GROUP_get0_order(curve))) {
+			liblog_error(LAYER_LINK, "error generating random scalar.");
+			return_value = LLP_ERROR;
+			goto return_label;
+		}
+	} while (BN_is_zero(x_bignum));
+	BN_set_flags(x_bignum, BN_FLG_CONSTTIME);
+
+	/* Computing y = xG and converting it to a string of octets. */
+	length = 0;
+	if (EC_POINT_mul(curve, point, x_bignum, NULL, NULL, context)) {
+		length = EC_POINT_point2oct(curve, point,
+				POINT_CONVERSION_UNCOMPRESSED, octets, sizeof(octets), context);
+	}
+	if (length == 0) {
+		liblog_error(LAYER_LINK, "error computing y parameter.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+
+	/* The leading octet is never zero, so the mpint keeps all octets. */
+	if (BN_bin2bn(octets, length, y_bignum) == NULL ||
+			BN_bn2mpi(y_bignum, NULL) > LLP_Y_LENGTH) {
+		liblog_error(LAYER_LINK, "computed y is too large.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+	BN_bn2mpi(y_bignum, y);
+	BN_bn2mpi(x_bignum, x);
+
+return_label:
+
+	BN_clear_free(x_bignum);
+	BN_free(y_bignum);
+	EC_POINT_free(point);
+	return return_value;
+}
+/******************************************************************************/
+int compute_ec_secret(mpint z, mpint y, mpint x) {
+	BIGNUM *z_bignum, *y_bignum, *x_bignum;
+	EC_POINT *peer, *shared;
+	BN_CTX *context;
+	u_char octets[LLP_Y_LENGTH];
+	int length;
+	int return_value;
+
+	context = get_context();
+	if (context == NULL) {
+		return LLP_ERROR;
+	}
+
+	return_value = LLP_OK;
+	z_bignum = BN_new();
+	y_bignum = BN_mpi2bn(y, MPINT_LENGTH(y) + MPINT_SIZE_LENGTH, NULL);
+	x_bignum = BN_mpi2bn(x, MPINT_LENGTH(x) + MPINT_SIZE_LENGTH, NULL);
+	peer = EC_POINT_new(curve);
+	shared = EC_POINT_new(curve);
+
+	if (z_bignum == NULL || y_bignum == NULL || x_bignum == NULL ||
+			peer == NULL || shared == NULL) {
+		liblog_error(LAYER_LINK, "error allocating BIGNUMs.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+	BN_set_flags(x_bignum, BN_FLG_CONSTTIME);
+
+	/* Decoding the point checks that it lies on the curve. */
+	length = BN_num_bytes(y_bignum);
+	if (length > (int)sizeof(octets) || BN_bn2bin(y_bignum, octets) != length ||
+			!EC_POINT_oct2point(curve, peer, octets, length, context)) {
+		liblog_error(LAYER_LINK, "received y is not a point of the curve.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+
+	/* Computing xY and keeping its x coordinate. */
+	if (!EC_POINT_mul(curve, shared, NULL, peer, x_bignum, context) ||
+			EC_POINT_is_at_infinity(curve, shared) ||
+			!EC_POINT_get_affine_coordinates(curve, shared, z_bignum, NULL,
+			context)) {
+		liblog_error(LAYER_LINK, "error computing z.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+	if (BN_bn2mpi(z_bignum, NULL) > LLP_Z_LENGTH) {
+		liblog_error(LAYER_LINK, "computed z is too large.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+	BN_bn2mpi(z_bignum, z);
+
+return_label:
+
+	BN_clear_free(z_bignum);
+	BN_free(y_bignum);
+	BN_clear_free(x_bignum);
+	EC_POINT_free(peer);
+	EC_POINT_clear_free(shared);
+	return return_value;
+}
+/******************************************************************************/
+int generate_key_pair(mpint x, mpint y) {
+
+	/* Exponent x is a string of pseudo-random bytes. */
+	if (util_rand_mpint(x, LLP_X_LENGTH - MPINT_SIZE_LENGTH -
+			MPINT_SIGNAL_LENGTH) == UTIL_ERROR) {
+		liblog_error(LAYER_LINK, "error generating random exponent.");
+		return LLP_ERROR;
+	};
+	liblog_debug(LAYER_LINK, "random exponent generated.");
+
+	/* Computing (y = g^x mod p)	for Diffie & Hellman. */
+	if (compute_y(y, x) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error computing y parameter.");
+		return LLP_ERROR;
+	}
+	liblog_debug(LAYER_LINK, "y parameter computed.");
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void *run_generator() {
+	struct sched_param parameters;
+	u_char x[LLP_X_LENGTH];
+	u_char y[LLP_Y_LENGTH];
+
+	/* Refilling the pool must not steal time from packet handling. */
+	memset(&parameters, 0, sizeof(parameters));
+	if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &parameters)) {
+		liblog_warn(LAYER_LINK, "could not lower generator priority.");
+	}
+
+	pthread_mutex_lock(&key_pool_mutex);
+	while (1) {
+		while (key_pool_depth >= key_pool_watermark && !finish_execution) {
+			pthread_cond_wait(&key_pool_condition, &key_pool_mutex);
+		}
+		if (finish_execution) {
+			break;
+		}
+
+		/* Once triggered, the pool is filled up to its capacity. */
+		while (key_pool_depth < key_pool_size && !finish_execution) {
+			pthread_mutex_unlock(&key_pool_mutex);
+			if (generate_key_pair(x, y) == LLP_ERROR) {
+				pthread_mutex_lock(&key_pool_mutex);
+				break;
+			}
+			pthread_mutex_lock(&key_pool_mutex);
+			if (key_pool_depth < key_pool_size) {
+				memcpy(key_pool[key_pool_depth].x, x, LLP_X_LENGTH);
+				memcpy(key_pool[key_pool_depth].y, y, LLP_Y_LENGTH);
+				key_pool_depth++;
+			}
+		}
+		liblog_debug(LAYER_LINK, "D&H key pool refilled.");
+	}
+	pthread_mutex_unlock(&key_pool_mutex);
+
+	memset(x, 0, LLP_X_LENGTH);
+	pthread_exit(NULL);
+
 	return LLP_OK;
 }
 /******************************************************************************/
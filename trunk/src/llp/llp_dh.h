@@ -27,10 +27,52 @@
 #ifndef _LLP_DH_H_
 #define _LLP_DH_H_
 
+#include <util/util.h>
+
+/**
+ * Name of the Diffie & Hellman key agreement over the 2048-bit MODP group.
+ */
+#define LLP_KEX_MODP_2048	"modp-2048"
+
+/**
+ * Name of the elliptic-curve Diffie & Hellman key agreement over NIST P-256.
+ */
+#define LLP_KEX_ECDH_P256	"ecdh-p256"
+
+/**
+ * Data type that describes a key agreement algorithm. Private values, public
+ * values and shared secrets are all stored as mpints, so public values of
+ * different algorithms have different lengths on the wire.
+ */
+typedef struct {
+	/** Name used to negotiate the algorithm. */
+	char *name;
+	/** Generates the private value x and the public value y sent to peers. */
+	int (*compute_params)(mpint x, mpint y);
+	/** Computes the shared secret z from the public value y of the peer. */
+	int (*compute_secret)(mpint z, mpint y, mpint x);
+} llp_kex_function_t;
+
+/**
+ * Creates the pool of precomputed key pairs and the thread that refills it.
+ * 
+ * @param size - number of key pairs kept in the pool. If zero, key pairs are
+ * 		always computed on demand.
+ * @param watermark - number of key pairs below which the pool is refilled.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_dh_initialize(int size, int watermark);
+
+/**
+ * Stops the refilling thread and destroys the pool of precomputed key pairs.
+ */
+void llp_dh_finalize();
+
 /**
  * Computes the part of the Diffie & Hellman key agreement that is sent to the 
  * connecting peer. The parameter y_out must be LLP_Y_LENGTH bytes long and x 
- * will be initialized to contain a random exponent.
+ * will be initialized to contain a random exponent. The pair is taken from the
+ * pool of precomputed key pairs when it is not empty.
  * 
  * @param x - random exponent used in computation.
  * @param y - address of a already allocated mpint that will store the result.
@@ -50,4 +92,26 @@ int llp_compute_dh_params(mpint x, mpint y);
  */
 int llp_compute_dh_secret(mpint z, mpint y, mpint x);
 
+/**
+ * Returns the key agreement algorithm with the given name.
+ * 
+ * @param name - the algorithm name.
+ * @return the algorithm, or NULL if it is not supported.
+ */
+llp_kex_function_t *llp_get_kex(char *name);
+
+/**
+ * Returns the number of precomputed key pairs available.
+ * 
+ * @return the current depth of the key pool.
+ */
+int llp_get_dh_pool_depth();
+
+/**
+ * Returns how many times a key pair was requested while the pool was empty.
+ * 
+ * @return the number of pool misses.
+ */
+long llp_get_dh_pool_empty();
+
 #endif /* !_LLP_DH_H_ */
@@ -45,6 +45,8 @@
 #include "llp_nodes.h"
 #include "llp_info.h"
 #include "llp_dh.h"
+#include "llp_workers.h"
+#include "llp_cookies.h"
 #include "llp.h"
 
 /*============================================================================*/
@@ -76,6 +78,52 @@ static int compute_verifier(int session);
  */
 static int create_keys(int session);
 
+/*
+ * Checks if the node has so many half-open sessions that new connection
+ * requests must echo a cookie.
+ * 
+ * @return 1 if a cookie is required, 0 otherwise.
+ */
+static int cookie_required();
+
+/*
+ * Reserves a session to a parsed LLP_CONNECTION_REQUEST and leaves the
+ * Diffie & Hellman computations to a worker.
+ * 
+ * @param packet - the connection request.
+ * @param peer - peer trying to connect.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+static int accept_connection_request(llp_packet_p *packet,
+		struct sockaddr_in *peer);
+
+/*
+ * Worker job that completes the handling of a LLP_CONNECTION_REQUEST packet:
+ * generates the Diffie & Hellman parameters and answers with a
+ * LLP_CONNECTION_OK packet.
+ * 
+ * @param session - the session being connected.
+ */
+static void complete_connection_request(int session);
+
+/*
+ * Worker job that completes the handling of a LLP_CONNECTION_OK packet:
+ * computes the Diffie & Hellman secret and the session keys, answers with a
+ * LLP_KEY_EXCHANGE packet and establishes the session.
+ * 
+ * @param session - the session being connected.
+ */
+static void complete_connection_ok(int session);
+
+/*
+ * Worker job that completes the handling of a LLP_KEY_EXCHANGE packet:
+ * computes the Diffie & Hellman secret and the session keys and establishes
+ * the session.
+ * 
+ * @param session - the session being connected.
+ */
+static void complete_key_exchange(int session);
+
 /*
  * Checks if the remote and local protocol versions are compatible.
  * 
@@ -85,13 +133,15 @@ static int create_keys(int session);
  */
 static int verify_versions(u_char remote_major, u_char remote_minor);
 
-/**
- * Sends a LLP_CONNECTION_REQUEST packet.
+/*
+ * Sends a LLP_CONNECTION_REQUEST packet. If a cookie is given, the request is
+ * sent inside a LLP_COOKIE_ECHO packet.
  * 
  * @param session - the session to send the packet.
+ * @param cookie - cookie received from the peer, NULL if none.
  * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
  */
-static inline int send_connection_request(int session);
+static inline int send_connection_request(int session, u_char *cookie);
 
 /*
  * Sends a LLP_CONNECTION_OK packet, trying to connect to the port specified in
@@ -110,6 +160,15 @@ static inline int send_connection_ok(int session);
  */
 static inline int send_key_exchange(int session);
 
+/*
+ * Sends a LLP_COOKIE packet to a peer trying to connect.
+ * 
+ * @param peer - peer trying to connect.
+ * @param session - session number in the peer.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+static int send_cookie(struct sockaddr_in *peer, u_short session);
+
 /*
  * Reads the contents of a LLP_CONNECTION_REQUEST into packet.
  * 
@@ -143,14 +202,23 @@ static inline int parse_connection_ok(llp_packet_p *packet, u_char *packet_data,
 static int parse_key_exchange(llp_packet_p *packet, u_char *packet_data,
 		int packet_length);
 
+/*
+ * Reads the contents of a LLP_COOKIE into packet.
+ * 
+ * @param packet - packet representing the parsed data.
+ * @param packet_data - data to parse.
+ * @param packet_length - length of the packet buffer, in bytes.
+ * @return LLP_OK if no parsing errors occurred, LLP_ERROR otherwise.
+ */
+static int parse_cookie(llp_packet_p *packet, u_char *packet_data,
+		int packet_length);
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/
 
 int llp_handle_connection_request(u_char *packet_data, int packet_length,
 		struct sockaddr_in *peer) {
-	int session;
-	int return_value;
 	llp_packet_p packet;
 
 	/* Seeing if the new connection won't trespass the connection limit. */
@@ -170,89 +238,14 @@ int llp_handle_connection_request(u_char *packet_data, int packet_length,
 			packet.llp_connection_request.minor_version) == LLP_ERROR) {
 		return LLP_ERROR;
 	}
-	
-	/* Checking if this node is already connected. */
-	if (llp_get_session_by_address(peer) != LLP_ERROR) {
-		liblog_error(LAYER_LINK, "node already connected.");
-		return LLP_ERROR;
-	}
-
-	/* Reserving a session to this connection. */
-	session = llp_get_free_session(LLP_STATE_BEING_CONNECTED);
-	if (session == LLP_ERROR) {
-		liblog_warn(LAYER_LINK, "no free sessions available.");
-		return LLP_ERROR;
-	}
-	liblog_debug(LAYER_LINK, "using session: %d.", session);
-	
-	llp_lock_session(session);
-
-	/* Fill up the session info. */
-	/* The port is extracted from the packet header. */
-	memcpy(&llp_sessions[session].address, peer, sizeof(struct sockaddr_in));
-	llp_sessions[session].foreign_session =
-			packet.llp_connection_request.session;
-	llp_sessions[session].cipher = 
-			llp_cipher_search(packet.llp_connection_request.ciphers);
-	llp_sessions[session].hash =
-			llp_hash_search(packet.llp_connection_request.hashes);
-	llp_sessions[session].mac =
-			llp_mac_search(packet.llp_connection_request.macs);
-	memcpy(llp_sessions[session].h_in, packet.llp_connection_request.h,
-			LLP_H_LENGTH);	
-
-	/* Functions received don't support even the defaults. */
-	if (llp_sessions[session].cipher == NULL ||
-			llp_sessions[session].hash == NULL ||
-			llp_sessions[session].mac == NULL) {
-		liblog_error(LAYER_LINK,
-				"received functions not supported, packet dropped.");
-		return_value = LLP_ERROR;
-		goto return_label;
-	}
-	liblog_debug(LAYER_LINK, "received functions are supported.");
-	
-	llp_sessions[session].encrypted = (
-			strncmp(llp_sessions[session].cipher->name, UTIL_NULL_CIPHER,
-			strlen(UTIL_NULL_CIPHER)) == 0 ?
-			LLP_SESSION_NOT_ENCRYPTED : LLP_SESSION_ENCRYPTED);
-
-	liblog_debug(LAYER_LINK, "session %d is now in BEING_CONNECTED state.",
-			session);
 
-	/* Generating Diffie & Hellman parameters. */
-	if (llp_compute_dh_params(llp_sessions[session].x,
-			llp_sessions[session].y_out) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating D&H parameters.");
-		return_value = LLP_ERROR;
-		goto return_label;
-	}
-	
-	/* Generatin h_out parameter. */
-	if (util_rand_bytes(llp_sessions[session].h_out, LLP_H_LENGTH)
-			== UTIL_ERROR) {
-		liblog_error(LAYER_LINK, "error generating h parameter.");
-		return_value = LLP_ERROR;
-		goto return_label;		
-	};
-	
-	/* Send request packet. */
-	if (send_connection_ok(session) == LLP_ERROR) {
-		return_value = LLP_ERROR;
-		goto return_label;
+	/* Under load, no state is kept until the peer proves its address. */
+	if (cookie_required()) {
+		liblog_debug(LAYER_LINK, "node under load, answering with a cookie.");
+		return send_cookie(peer, packet.llp_connection_request.session);
 	}
-	liblog_debug(LAYER_LINK, "LLP_CONNECTION_OK packet sent.");
 
-	return_value = LLP_OK;
-
-return_label:
-
-	if (return_value == LLP_ERROR) {
-		llp_close_session(session);
-	}
-	llp_unlock_session(session);
-
-	return return_value;
+	return accept_connection_request(&packet, peer);
 }
 /******************************************************************************/
 int llp_handle_connection_ok(u_char *packet_data, int packet_length) {
@@ -267,100 +260,68 @@ int llp_handle_connection_ok(u_char *packet_data, int packet_length) {
 	} 
 
 	session = packet.llp_connection_ok.session_dst;
+	if (session >= llp_get_sessions_count()) {
+		liblog_debug(LAYER_LINK, "invalid session, packet dropped.");
+		return LLP_ERROR;
+	}
 	llp_lock_session(session);
+
+	/* Only one answer is accepted for each connection request. */
+	if (llp_sessions[session].state != LLP_STATE_CONNECTING ||
+			llp_sessions[session].job_pending) {
+		liblog_debug(LAYER_LINK, "unexpected LLP_CONNECTION_OK, packet dropped.");
+		llp_unlock_session(session);
+		return LLP_ERROR;
+	}
+
+	/* The request was answered, the handshake round trip is known. */
+	llp_set_node_rtt(session, LLP_RTT_HANDSHAKE,
+			llp_get_clock() - llp_sessions[session].probe_time);
+	llp_sessions[session].probe_time = 0;
 	
 	/* Fill up the session info. */
-	llp_sessions[session].state = LLP_STATE_ESTABLISHED;
 	llp_sessions[session].foreign_session = packet.llp_connection_ok.session_src;
-	llp_sessions[session].timeout = LLP_T_TIMEOUT;
-	llp_sessions[session].silence = 0;
-	llp_sessions[session].hunt_time = 0;
-	llp_sessions[session].alive = 0;
-	llp_sessions[session].error = LLP_OK;
 	llp_sessions[session].cipher =
-			llp_cipher_search(packet.llp_connection_ok.cipher);
-	llp_sessions[session].hash = llp_hash_search(packet.llp_connection_ok.hash);
-	llp_sessions[session].mac = llp_mac_search(packet.llp_connection_ok.mac);	
-	llp_sessions[session].encrypted = (
-			strncmp(llp_sessions[session].cipher->name, UTIL_NULL_CIPHER,
-			strlen(UTIL_NULL_CIPHER)) == 0 ?
-			LLP_SESSION_NOT_ENCRYPTED : LLP_SESSION_ENCRYPTED);
+			llp_search_cipher(packet.llp_connection_ok.cipher);
+	llp_sessions[session].hash = llp_search_hash(packet.llp_connection_ok.hash);
+	llp_sessions[session].mac = llp_search_mac(packet.llp_connection_ok.mac);	
+	llp_sessions[session].kex = llp_search_kex(packet.llp_connection_ok.kex);
+	llp_sessions[session].padding =
+			llp_negotiate_padding(packet.llp_connection_ok.padding);
 	memcpy(llp_sessions[session].h_in, packet.llp_connection_ok.h,
 			LLP_H_LENGTH);
 	memcpy(llp_sessions[session].y_in, packet.llp_connection_ok.y,
 			LLP_Y_LENGTH);
 
-	/* Setting node state in nodes cache. */
-	llp_set_node_active(&llp_sessions[session].address, session);
-	
-	/* Correcting number of active sessions. */
-	llp_add_active_sessions_counter(1);
-	
-	liblog_debug(LAYER_LINK, "session %d is now in ESTABLISHED state.",
-			session);
-
 	/* Functions received don't support even the defaults. */
 	if (llp_sessions[session].cipher == NULL ||
 			llp_sessions[session].hash == NULL ||
-			llp_sessions[session].mac == NULL) {
+			llp_sessions[session].mac == NULL ||
+			llp_sessions[session].kex == NULL) {
 		liblog_error(LAYER_LINK,
 				"received function not supported, packet dropped.");
-		return_value = LLP_ERROR;
-		goto return_label;		
+		llp_close_session(session);
+		llp_unlock_session(session);
+		return LLP_ERROR;
 	}
 	liblog_debug(LAYER_LINK, "received functions are supported.");
 
-	if (llp_compute_dh_params(llp_sessions[session].x,
-			llp_sessions[session].y_out) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating D&H parameters.");
-		return_value = LLP_ERROR;
-		goto return_label;		
-	}
-	
-	/* Computing Diffie & Hellman shared secret z. */
-	if (llp_compute_dh_secret(llp_sessions[session].z, 
-			llp_sessions[session].y_in, llp_sessions[session].x) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating D&H secret.");
-		return_value = LLP_ERROR;
-		goto return_label;				
-	}
-	
-	/* Compute verifier. */
-	if (compute_verifier(session) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating verifier.");
-		return_value = LLP_ERROR;
-		goto return_label;				
-	}
-
-	/* Create all the keys. */
-	if (create_keys(session) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating session keys.");
-		return_value = LLP_ERROR;
-		goto return_label;				
-	};
-	
-	/* Send key exchange packet. */
-	if (send_key_exchange(session) == LLP_ERROR) {
-		return_value = LLP_ERROR;
-		goto return_label;		
-	}
-	liblog_debug(LAYER_LINK, "LLP_KEY_EXCHANGE packet sent.");
+	llp_sessions[session].encrypted = (
+			strncmp(llp_sessions[session].cipher->name, UTIL_NULL_CIPHER,
+			strlen(UTIL_NULL_CIPHER)) == 0 ?
+			LLP_SESSION_NOT_ENCRYPTED : LLP_SESSION_ENCRYPTED);
 
+	/* Diffie & Hellman computations are left to a worker. */
+	llp_sessions[session].job_pending = 1;
 	llp_unlock_session(session);
 
-	/* Calling the registered callback function. */
-	if (connect_handler != NULL) {
-		connect_handler(session);
-	}
-
-	return_value = LLP_OK;
-
-return_label:
-
+	return_value = llp_submit_job(complete_connection_ok, session);
 	if (return_value == LLP_ERROR) {
+		llp_lock_session(session);
+		llp_finish_job(session);
 		llp_close_session(session);
+		llp_unlock_session(session);
 	}
-	llp_unlock_session(session);
 
 	return return_value;
 }
@@ -378,67 +339,117 @@ int llp_handle_key_exchange(u_char *packet_data, int packet_length) {
 	liblog_debug(LAYER_LINK, "packet successfuly parsed.");	
 	
 	session = packet.llp_key_exchange.session;
+	if (session >= llp_get_sessions_count()) {
+		liblog_debug(LAYER_LINK, "invalid session, packet dropped.");
+		return LLP_ERROR;
+	}
 	llp_lock_session(session);
+
+	/* The key exchange must answer an LLP_CONNECTION_OK already sent. */
+	if (llp_sessions[session].state != LLP_STATE_BEING_CONNECTED ||
+			llp_sessions[session].job_pending) {
+		liblog_debug(LAYER_LINK, "unexpected LLP_KEY_EXCHANGE, packet dropped.");
+		llp_unlock_session(session);
+		return LLP_ERROR;
+	}
 	
-	/* Updating the session info. */
-	llp_sessions[session].state = LLP_STATE_ESTABLISHED;
-	llp_sessions[session].timeout = LLP_T_TIMEOUT;
-	llp_sessions[session].alive = 0;
-	llp_sessions[session].error = LLP_OK;
 	memcpy(llp_sessions[session].y_in, packet.llp_key_exchange.y,
 			LLP_Y_LENGTH);
 
-	/* Adding node to cache. */
-	llp_add_node_to_cache(&llp_sessions[session].address);
-	llp_set_node_active(&llp_sessions[session].address, session);
-	
-	/* Correcting number of active sessions. */
-	llp_add_active_sessions_counter(1);
-	
-	/* Computing Diffie & Hellman shared secret z. */
-	if (llp_compute_dh_secret(llp_sessions[session].z, 
-			llp_sessions[session].y_in,	llp_sessions[session].x) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating D&H secret.");
-		return_value = LLP_ERROR;
-		goto return_label;						
+	/* Diffie & Hellman computations are left to a worker. */
+	llp_sessions[session].job_pending = 1;
+	llp_unlock_session(session);
+
+	return_value = llp_submit_job(complete_key_exchange, session);
+	if (return_value == LLP_ERROR) {
+		llp_lock_session(session);
+		llp_finish_job(session);
+		llp_close_session(session);
+		llp_unlock_session(session);
 	}
-	liblog_debug(LAYER_LINK, "D&H secret z computed.");
-	
-	/* Compute verifier. */
-	if (compute_verifier(session) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating verifier.");
-		return_value = LLP_ERROR;
-		goto return_label;				
+
+	return return_value;
+}
+/******************************************************************************/
+int llp_handle_cookie(u_char *packet_data, int packet_length,
+		struct sockaddr_in *peer) {
+	int session;
+	int return_value;
+	llp_packet_p packet;
+
+	if (parse_cookie(&packet, packet_data, packet_length) == LLP_ERROR) {
+		liblog_debug(LAYER_LINK, "packet format corrupted.");
+		return LLP_ERROR;
 	}
 
-	/* Create all the keys. */
-	if (create_keys(session) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error generating session keys.");
-		return_value = LLP_ERROR;
-		goto return_label;						
-	};
-	liblog_debug(LAYER_LINK, "keys created.");
-	
-	liblog_debug(LAYER_LINK, "session %d is now in ESTABLISHED state.",
-			session);
-	
+	session = packet.llp_cookie.session;
+	if (session >= llp_get_sessions_count()) {
+		liblog_debug(LAYER_LINK, "invalid session, packet dropped.");
+		return LLP_ERROR;
+	}
+	llp_lock_session(session);
+
+	/* Only the peer contacted may ask for a cookie, and only once. */
+	if (llp_sessions[session].state != LLP_STATE_CONNECTING ||
+			llp_sessions[session].job_pending ||
+			llp_sessions[session].cookie_echoed ||
+			llp_sessions[session].address.sin_addr.s_addr !=
+					peer->sin_addr.s_addr ||
+			llp_sessions[session].address.sin_port != peer->sin_port) {
+		liblog_debug(LAYER_LINK, "unexpected LLP_COOKIE, packet dropped.");
+		llp_unlock_session(session);
+		return LLP_ERROR;
+	}
+
+	llp_sessions[session].cookie_echoed = 1;
+	return_value = send_connection_request(session, packet.llp_cookie.cookie);
 	llp_unlock_session(session);
 
-	/* Calling the registered callback function. */
-	if (connect_handler != NULL) {
-		connect_handler(session);
+	return return_value;
+}
+/******************************************************************************/
+int llp_handle_cookie_echo(u_char *packet_data, int packet_length,
+		struct sockaddr_in *peer) {
+	llp_packet_p packet;
+	u_char *cookie;
+	u_char *request;
+	int request_length;
+
+	/* Seeing if the new connection won't trespass the connection limit. */
+	if (llp_get_active_sessions_counter() >= llp_get_max_connections()) {
+		liblog_warn(LAYER_LINK, "maximum number of connections reached.");
+		return LLP_ERROR;
 	}
 
-	return_value = LLP_OK;
+	if (packet_length <= 1 + LLP_COOKIE_LENGTH) {
+		liblog_debug(LAYER_LINK, "packet format corrupted.");
+		return LLP_ERROR;
+	}
+	cookie = &packet_data[1];
+	request = &packet_data[1 + LLP_COOKIE_LENGTH];
+	request_length = packet_length - 1 - LLP_COOKIE_LENGTH;
 
-return_label:
+	if (parse_connection_request(&packet, request, request_length)
+			== LLP_ERROR || packet.type != LLP_CONNECTION_REQUEST) {
+		liblog_debug(LAYER_LINK, "packet format corrupted.");
+		return LLP_ERROR;
+	}
 
-	if (return_value == LLP_ERROR) {
-		llp_close_session(session);
+	/* Verifying protocol versions. */
+	if (verify_versions(packet.llp_connection_request.major_version,
+			packet.llp_connection_request.minor_version) == LLP_ERROR) {
+		return LLP_ERROR;
 	}
-	llp_unlock_session(session);
 
-	return return_value;
+	/* The cookie binds the request to the address it was sent to. */
+	if (llp_verify_cookie(peer, packet.llp_connection_request.session,
+			cookie) == LLP_ERROR) {
+		liblog_debug(LAYER_LINK, "invalid cookie, packet dropped.");
+		return LLP_ERROR;
+	}
+	liblog_debug(LAYER_LINK, "cookie verified.");
+
+	return accept_connection_request(&packet, peer);
 }
 /******************************************************************************/
 int llp_connect_to(struct sockaddr_in *address) {
@@ -482,29 +493,26 @@ int llp_connect_to(struct sockaddr_in *address) {
 	llp_sessions[session].address.sin_port = address->sin_port;
 	memcpy(&llp_sessions[session].address.sin_addr, &address->sin_addr,
 			sizeof(struct in_addr));
-	llp_sessions[session].timeout = LLP_T_TIMEOUT;
+	llp_set_timer(session, LLP_TIMER_TIMEOUT, LLP_T_TIMEOUT);
 	liblog_debug(LAYER_LINK, "session %d is now in CONNECTING state.",
 			session);
 	
 	/* Adding node to cache. */
 	llp_add_node_to_cache(&llp_sessions[session].address);
 	llp_set_node_connecting(&llp_sessions[session].address, session);
-	return_value = send_connection_request(session);
+	llp_sessions[session].probe_time = llp_get_clock();
+	/* The session is closed by send_connection_request() if it fails. */
+	return_value = send_connection_request(session, NULL);
 	
 	llp_unlock_session(session);
 	
-	if (return_value == LLP_ERROR) {
-		llp_close_session(session);
-		return LLP_ERROR;
-	}
-	
-	return LLP_OK;
+	return return_value;
 }
 /******************************************************************************/
 int llp_connect_any() {
 	struct sockaddr_in address;
 	
-	if (llp_get_nodes_from_cache(1, &address) == LLP_ERROR)
+	if (llp_get_inactive_node(&address) == LLP_ERROR)
 		return LLP_ERROR;
 	return llp_connect_to(&address);
 }
@@ -559,6 +567,201 @@ int compute_verifier(int session) {
 	return LLP_OK;
 }
 /******************************************************************************/
+void complete_connection_request(int session) {
+	int return_value;
+
+	llp_lock_session(session);
+	llp_finish_job(session);
+
+	/* The session may have timed out while the job was queued. */
+	if (llp_sessions[session].state != LLP_STATE_BEING_CONNECTED) {
+		llp_unlock_session(session);
+		return;
+	}
+
+	/* Generating Diffie & Hellman parameters. */
+	if (llp_sessions[session].kex->compute_params(llp_sessions[session].x,
+			llp_sessions[session].y_out) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating D&H parameters.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+	
+	/* Generatin h_out parameter. */
+	if (util_rand_bytes(llp_sessions[session].h_out, LLP_H_LENGTH)
+			== UTIL_ERROR) {
+		liblog_error(LAYER_LINK, "error generating h parameter.");
+		return_value = LLP_ERROR;
+		goto return_label;		
+	};
+	
+	/* Send request packet. */
+	if (send_connection_ok(session) == LLP_ERROR) {
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
+	liblog_debug(LAYER_LINK, "LLP_CONNECTION_OK packet sent.");
+
+	return_value = LLP_OK;
+
+return_label:
+
+	if (return_value == LLP_ERROR) {
+		llp_close_session(session);
+	}
+	llp_unlock_session(session);
+}
+/******************************************************************************/
+void complete_connection_ok(int session) {
+	int return_value;
+
+	llp_lock_session(session);
+	llp_finish_job(session);
+
+	/* The session may have timed out while the job was queued. */
+	if (llp_sessions[session].state != LLP_STATE_CONNECTING) {
+		llp_unlock_session(session);
+		return;
+	}
+
+	if (llp_sessions[session].kex->compute_params(llp_sessions[session].x,
+			llp_sessions[session].y_out) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating D&H parameters.");
+		return_value = LLP_ERROR;
+		goto return_label;		
+	}
+	
+	/* Computing Diffie & Hellman shared secret z. */
+	if (llp_sessions[session].kex->compute_secret(llp_sessions[session].z,
+			llp_sessions[session].y_in, llp_sessions[session].x) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating D&H secret.");
+		return_value = LLP_ERROR;
+		goto return_label;				
+	}
+	
+	/* Compute verifier. */
+	if (compute_verifier(session) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating verifier.");
+		return_value = LLP_ERROR;
+		goto return_label;				
+	}
+
+	/* Create all the keys. */
+	if (create_keys(session) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating session keys.");
+		return_value = LLP_ERROR;
+		goto return_label;				
+	};
+	
+	/* Send key exchange packet. */
+	if (send_key_exchange(session) == LLP_ERROR) {
+		return_value = LLP_ERROR;
+		goto return_label;		
+	}
+	liblog_debug(LAYER_LINK, "LLP_KEY_EXCHANGE packet sent.");
+
+	/* The session is only established when the keys are ready. */
+	llp_sessions[session].state = LLP_STATE_ESTABLISHED;
+	llp_set_timer(session, LLP_TIMER_TIMEOUT, LLP_T_TIMEOUT);
+	llp_set_timer(session, LLP_TIMER_SILENCE, LLP_T_SILENT);
+	llp_set_timer(session, LLP_TIMER_EXPIRATION,
+			llp_get_expiration_time() * LLP_TIME_TICKS_PER_SECOND);
+	llp_sessions[session].hunt_time = 0;
+	llp_sessions[session].error = LLP_OK;
+
+	/* Setting node state in nodes cache. */
+	llp_set_node_active(&llp_sessions[session].address, session);
+	
+	/* Correcting number of active sessions. */
+	llp_add_active_sessions_counter(1);
+	
+	liblog_debug(LAYER_LINK, "session %d is now in ESTABLISHED state.",
+			session);
+
+	return_value = LLP_OK;
+
+return_label:
+
+	if (return_value == LLP_ERROR) {
+		llp_close_session(session);
+	}
+	llp_unlock_session(session);
+
+	/* Calling the registered callback function. */
+	if (return_value == LLP_OK && connect_handler != NULL) {
+		connect_handler(session);
+	}
+}
+/******************************************************************************/
+void complete_key_exchange(int session) {
+	int return_value;
+
+	llp_lock_session(session);
+	llp_finish_job(session);
+
+	/* The session may have timed out while the job was queued. */
+	if (llp_sessions[session].state != LLP_STATE_BEING_CONNECTED) {
+		llp_unlock_session(session);
+		return;
+	}
+	
+	/* Computing Diffie & Hellman shared secret z. */
+	if (llp_sessions[session].kex->compute_secret(llp_sessions[session].z,
+			llp_sessions[session].y_in,	llp_sessions[session].x) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating D&H secret.");
+		return_value = LLP_ERROR;
+		goto return_label;						
+	}
+	liblog_debug(LAYER_LINK, "D&H secret z computed.");
+	
+	/* Compute verifier. */
+	if (compute_verifier(session) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating verifier.");
+		return_value = LLP_ERROR;
+		goto return_label;				
+	}
+
+	/* Create all the keys. */
+	if (create_keys(session) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error generating session keys.");
+		return_value = LLP_ERROR;
+		goto return_label;						
+	};
+	liblog_debug(LAYER_LINK, "keys created.");
+
+	/* The session is only established when the keys are ready. */
+	llp_sessions[session].state = LLP_STATE_ESTABLISHED;
+	llp_set_timer(session, LLP_TIMER_TIMEOUT, LLP_T_TIMEOUT);
+	llp_set_timer(session, LLP_TIMER_SILENCE, LLP_T_SILENT);
+	llp_set_timer(session, LLP_TIMER_EXPIRATION,
+			llp_get_expiration_time() * LLP_TIME_TICKS_PER_SECOND);
+	llp_sessions[session].error = LLP_OK;
+
+	/* Adding node to cache. */
+	llp_add_node_to_cache(&llp_sessions[session].address);
+	llp_set_node_active(&llp_sessions[session].address, session);
+	
+	/* Correcting number of active sessions. */
+	llp_add_active_sessions_counter(1);
+	
+	liblog_debug(LAYER_LINK, "session %d is now in ESTABLISHED state.",
+			session);
+
+	return_value = LLP_OK;
+
+return_label:
+
+	if (return_value == LLP_ERROR) {
+		llp_close_session(session);
+	}
+	llp_unlock_session(session);
+
+	/* Calling the registered callback function. */
+	if (return_value == LLP_OK && connect_handler != NULL) {
+		connect_handler(session);
+	}
+}
+/******************************************************************************/
 int create_keys(int session) {
 	u_char *cipher_key;
 	u_char *cipher_iv;
@@ -659,6 +862,24 @@ int create_keys(int session) {
 		return_value = LLP_ERROR;
 		goto return_label;
 	}
+
+	/* Keys are expanded once, and reused by every packet. */
+	llp_destroy_crypto(llp_sessions[session].crypto_in);
+	llp_destroy_crypto(llp_sessions[session].crypto_out);
+	llp_sessions[session].crypto_in = llp_create_crypto(
+			llp_sessions[session].cipher, llp_sessions[session].cipher_in_key,
+			llp_sessions[session].cipher_in_iv, llp_sessions[session].mac,
+			llp_sessions[session].mac_in_key, UTIL_WAY_DECRYPTION);
+	llp_sessions[session].crypto_out = llp_create_crypto(
+			llp_sessions[session].cipher, llp_sessions[session].cipher_out_key,
+			llp_sessions[session].cipher_out_iv, llp_sessions[session].mac,
+			llp_sessions[session].mac_out_key, UTIL_WAY_ENCRYPTION);
+	if (llp_sessions[session].crypto_in == NULL ||
+			llp_sessions[session].crypto_out == NULL) {
+		liblog_error(LAYER_LINK, "error creating crypto contexts.");
+		return_value = LLP_ERROR;
+		goto return_label;
+	}
 	
 	return_value = LLP_OK;
 
@@ -667,7 +888,95 @@ return_label:
 	free(cipher_key);
 	free(cipher_iv);
 	free(mac_key);
-	return LLP_ERROR;
+	return return_value;
+}
+/******************************************************************************/
+int cookie_required() {
+	int threshold;
+	int half_open;
+
+	threshold = llp_get_cookie_threshold();
+	if (threshold < 0) {
+		return 0;
+	}
+
+	half_open = llp_get_used_sessions_count() -
+			llp_get_active_sessions_counter();
+	return (half_open >= threshold);
+}
+/******************************************************************************/
+int accept_connection_request(llp_packet_p *packet, struct sockaddr_in *peer) {
+	int session;
+	int return_value;
+
+	/* Checking if this node is already connected. */
+	if (llp_get_session_by_address(peer) != LLP_ERROR) {
+		liblog_error(LAYER_LINK, "node already connected.");
+		return LLP_ERROR;
+	}
+
+	/* Reserving a session to this connection. */
+	session = llp_get_free_session(LLP_STATE_BEING_CONNECTED);
+	if (session == LLP_ERROR) {
+		liblog_warn(LAYER_LINK, "no free sessions available.");
+		return LLP_ERROR;
+	}
+	liblog_debug(LAYER_LINK, "using session: %d.", session);
+	
+	llp_lock_session(session);
+
+	/* Fill up the session info. */
+	/* The port is extracted from the packet header. */
+	memcpy(&llp_sessions[session].address, peer, sizeof(struct sockaddr_in));
+	llp_sessions[session].foreign_session =
+			packet->llp_connection_request.session;
+	llp_sessions[session].cipher = 
+			llp_search_cipher(packet->llp_connection_request.ciphers);
+	llp_sessions[session].hash =
+			llp_search_hash(packet->llp_connection_request.hashes);
+	llp_sessions[session].mac =
+			llp_search_mac(packet->llp_connection_request.macs);
+	llp_sessions[session].kex =
+			llp_search_kex(packet->llp_connection_request.kexes);
+	llp_sessions[session].padding =
+			llp_negotiate_padding(packet->llp_connection_request.padding);
+	memcpy(llp_sessions[session].h_in, packet->llp_connection_request.h,
+			LLP_H_LENGTH);	
+
+	/* Functions received don't support even the defaults. */
+	if (llp_sessions[session].cipher == NULL ||
+			llp_sessions[session].hash == NULL ||
+			llp_sessions[session].mac == NULL ||
+			llp_sessions[session].kex == NULL) {
+		liblog_error(LAYER_LINK,
+				"received functions not supported, packet dropped.");
+		llp_close_session(session);
+		llp_unlock_session(session);
+		return LLP_ERROR;
+	}
+	liblog_debug(LAYER_LINK, "received functions are supported.");
+	
+	llp_sessions[session].encrypted = (
+			strncmp(llp_sessions[session].cipher->name, UTIL_NULL_CIPHER,
+			strlen(UTIL_NULL_CIPHER)) == 0 ?
+			LLP_SESSION_NOT_ENCRYPTED : LLP_SESSION_ENCRYPTED);
+
+	liblog_debug(LAYER_LINK, "session %d is now in BEING_CONNECTED state.",
+			session);
+
+	/* Diffie & Hellman computations are left to a worker. */
+	llp_sessions[session].job_pending = 1;
+	llp_unlock_session(session);
+
+	return_value = llp_submit_job(complete_connection_request, session);
+	if (return_value == LLP_ERROR) {
+		llp_lock_session(session);
+		llp_finish_job(session);
+		llp_close_session(session);
+		llp_unlock_session(session);
+	}
+
+	return return_value;
 }
 /******************************************************************************/
 int verify_versions(u_char remote_major, u_char remote_minor) {
@@ -702,12 +1011,14 @@ int verify_versions(u_char remote_major, u_char remote_minor) {
 	return LLP_OK;
 }
 /******************************************************************************/
-int send_connection_request(int session) {
+int send_connection_request(int session, u_char *cookie) {
 	int local_port;
-	u_char packet[LLP_CONNECTION_REQUEST_MAX_LENGTH];
+	int offset;
+	u_char packet[LLP_COOKIE_ECHO_MAX_LENGTH];
 	char cipher_string[LLP_FUNCTION_LIST_MAX_LENGTH];
 	char hash_string[LLP_FUNCTION_LIST_MAX_LENGTH];
 	char mac_string[LLP_FUNCTION_LIST_MAX_LENGTH];
+	char kex_string[LLP_FUNCTION_LIST_MAX_LENGTH];
 		
 	/* Getting local port. */
 	local_port = llp_get_port();
@@ -715,20 +1026,32 @@ int send_connection_request(int session) {
 	llp_get_cipher_string(cipher_string, LLP_FUNCTION_LIST_MAX_LENGTH);
 	llp_get_hash_string(hash_string, LLP_FUNCTION_LIST_MAX_LENGTH);
 	llp_get_mac_string(mac_string, LLP_FUNCTION_LIST_MAX_LENGTH);
+	llp_get_kex_string(kex_string, LLP_FUNCTION_LIST_MAX_LENGTH);
+
+	/* An echoed cookie precedes the whole request. */
+	offset = 0;
+	if (cookie != NULL) {
+		packet[0] = LLP_COOKIE_ECHO;
+		memcpy(&packet[1], cookie, LLP_COOKIE_LENGTH);
+		offset = 1 + LLP_COOKIE_LENGTH;
+	}
 
 	/* Constructing connection request packet */
-	UTIL_WRITE_START(packet)
+	UTIL_WRITE_START(&packet[offset])
 	UTIL_WRITE_BYTE  (LLP_CONNECTION_REQUEST)
 	UTIL_WRITE_BYTE  (LLP_MAJOR_VERSION)
 	UTIL_WRITE_BYTE  (LLP_MINOR_VERSION)
-	UTIL_WRITE_BYTE  (session)
+	UTIL_WRITE_UINT16(session)
 	UTIL_WRITE_STRING(cipher_string)
 	UTIL_WRITE_STRING(hash_string)
 	UTIL_WRITE_STRING(mac_string)
+	UTIL_WRITE_STRING(kex_string)
+	UTIL_WRITE_BYTE  (llp_get_padding_policy())
 	UTIL_WRITE_BYTES (llp_sessions[session].h_out, LLP_H_LENGTH)
 	
 	/* Sending packet. */
-	if (llp_send_session_packet(session, packet, UTIL_WRITE_END) == LLP_ERROR) {
+	if (llp_send_session_packet(session, packet, offset + UTIL_WRITE_END)
+			== LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error sending packet.");
 		llp_close_session(session);
 		return LLP_ERROR;
@@ -744,11 +1067,13 @@ int send_connection_ok(int session) {
 	/* Constructing connection acknowledgement packet. */
 	UTIL_WRITE_START (packet)
 	UTIL_WRITE_BYTE  (LLP_CONNECTION_OK)
-	UTIL_WRITE_BYTE  (llp_sessions[session].foreign_session)
-	UTIL_WRITE_BYTE  (session)
+	UTIL_WRITE_UINT16(llp_sessions[session].foreign_session)
+	UTIL_WRITE_UINT16(session)
 	UTIL_WRITE_STRING(llp_sessions[session].cipher->name)
 	UTIL_WRITE_STRING(llp_sessions[session].hash->name)
 	UTIL_WRITE_STRING(llp_sessions[session].mac->name)
+	UTIL_WRITE_STRING(llp_sessions[session].kex->name)
+	UTIL_WRITE_BYTE  (llp_sessions[session].padding)
 	UTIL_WRITE_BYTES (llp_sessions[session].h_out, LLP_H_LENGTH)
 	UTIL_WRITE_MPINT (llp_sessions[session].y_out)
 	
@@ -768,7 +1093,7 @@ int send_key_exchange(int session) {
 	/* Constructing key exchange packet. */
 	UTIL_WRITE_START (packet)
 	UTIL_WRITE_BYTE  (LLP_KEY_EXCHANGE)
-	UTIL_WRITE_BYTE  (llp_sessions[session].foreign_session)
+	UTIL_WRITE_UINT16(llp_sessions[session].foreign_session)
 	UTIL_WRITE_MPINT (llp_sessions[session].y_out)
 	
 	/* Sending packet. */
@@ -782,6 +1107,31 @@ int send_key_exchange(int session) {
 	return LLP_OK;
 }
 /******************************************************************************/
+int send_cookie(struct sockaddr_in *peer, u_short session) {
+	u_char packet[LLP_COOKIE_PACKET_LENGTH];
+	u_char cookie[LLP_COOKIE_LENGTH];
+
+	if (llp_create_cookie(peer, session, cookie) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error creating cookie.");
+		return LLP_ERROR;
+	}
+
+	/* Constructing cookie packet. */
+	UTIL_WRITE_START (packet)
+	UTIL_WRITE_BYTE  (LLP_COOKIE)
+	UTIL_WRITE_UINT16(session)
+	UTIL_WRITE_BYTES (cookie, LLP_COOKIE_LENGTH)
+
+	/* Sending packet. */
+	if (llp_send_direct_packet(peer, packet, UTIL_WRITE_END) == LLP_ERROR) {
+		liblog_debug(LAYER_LINK, "error sending packet.");
+		return LLP_ERROR;
+	}
+	liblog_debug(LAYER_LINK, "packet sent.");
+
+	return LLP_OK;
+}
+/******************************************************************************/
 int parse_connection_request(llp_packet_p *packet, u_char *packet_data, 
 		int packet_size) {
 	
@@ -789,10 +1139,12 @@ int parse_connection_request(llp_packet_p *packet, u_char *packet_data,
 	UTIL_READ_BYTE(packet->type)
 	UTIL_READ_BYTE(packet->llp_connection_request.major_version)
 	UTIL_READ_BYTE(packet->llp_connection_request.minor_version)
-	UTIL_READ_BYTE(packet->llp_connection_request.session)
+	UTIL_READ_UINT16(packet->llp_connection_request.session)
 	UTIL_READ_STRING(packet->llp_connection_request.ciphers)
 	UTIL_READ_STRING(packet->llp_connection_request.hashes)
 	UTIL_READ_STRING(packet->llp_connection_request.macs)
+	UTIL_READ_STRING(packet->llp_connection_request.kexes)
+	UTIL_READ_BYTE(packet->llp_connection_request.padding)
 	UTIL_READ_BYTES(packet->llp_connection_request.h, LLP_H_LENGTH)
 	UTIL_READ_END
 }	
@@ -802,11 +1154,13 @@ int parse_connection_ok(llp_packet_p *packet, u_char *packet_data,
 	
 	UTIL_READ_START(packet_data, packet_length, LLP_OK, LLP_ERROR)
 	UTIL_READ_BYTE(packet->type)
-	UTIL_READ_BYTE(packet->llp_connection_ok.session_dst)
-	UTIL_READ_BYTE(packet->llp_connection_ok.session_src)
+	UTIL_READ_UINT16(packet->llp_connection_ok.session_dst)
+	UTIL_READ_UINT16(packet->llp_connection_ok.session_src)
 	UTIL_READ_STRING(packet->llp_connection_ok.cipher)
 	UTIL_READ_STRING(packet->llp_connection_ok.hash)
 	UTIL_READ_STRING(packet->llp_connection_ok.mac)
+	UTIL_READ_STRING(packet->llp_connection_ok.kex)
+	UTIL_READ_BYTE(packet->llp_connection_ok.padding)
 	UTIL_READ_BYTES(packet->llp_connection_ok.h, LLP_H_LENGTH)
 	UTIL_READ_MPINT(packet->llp_connection_ok.y)
 	UTIL_READ_END
@@ -816,8 +1170,16 @@ int parse_key_exchange(llp_packet_p *packet, u_char *packet_data,
 		int packet_length) {
 	UTIL_READ_START(packet_data, packet_length, LLP_OK, LLP_ERROR)
 	UTIL_READ_BYTE(packet->type)
-	UTIL_READ_BYTE(packet->llp_key_exchange.session)
+	UTIL_READ_UINT16(packet->llp_key_exchange.session)
 	UTIL_READ_MPINT(packet->llp_key_exchange.y)
 	UTIL_READ_END
 }
 /******************************************************************************/
+int parse_cookie(llp_packet_p *packet, u_char *packet_data, int packet_length) {
+	UTIL_READ_START(packet_data, packet_length, LLP_OK, LLP_ERROR)
+	UTIL_READ_BYTE(packet->type)
+	UTIL_READ_UINT16(packet->llp_cookie.session)
+	UTIL_READ_BYTES(packet->llp_cookie.cookie, LLP_COOKIE_LENGTH)
+	UTIL_READ_END
+}
+/******************************************************************************/
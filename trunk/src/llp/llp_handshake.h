@@ -59,6 +59,30 @@ int llp_handle_connection_ok(u_char *packet_data, int packet_length);
  */
 int llp_handle_key_exchange(u_char *packet_data, int packet_length);
 
+/**
+ * Handles the event of receiving a LLP_COOKIE packet, sending the connection
+ * request again with the cookie echoed.
+ * 
+ * @param packet_data - packet data.
+ * @param packet_length - packet length in bytes;
+ * @param peer - peer that sent the cookie.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_handle_cookie(u_char *packet_data, int packet_length,
+		struct sockaddr_in *peer);
+
+/**
+ * Handles the event of receiving a LLP_COOKIE_ECHO packet. The connection
+ * request carried is only handled if the cookie is valid.
+ * 
+ * @param packet_data - packet data.
+ * @param packet_length - packet length in bytes;
+ * @param peer - peer trying to connect.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_handle_cookie_echo(u_char *packet_data, int packet_length,
+		struct sockaddr_in *peer);
+
 /**
  * Connects to the given host and tries to insert it on cache.
  * 
@@ -43,6 +43,10 @@
  */
 typedef struct {
 	int active_sessions_counter;	/**< Number of active sessions. */
+	long receive_calls;				/**< Number of receive socket calls. */
+	long packets_received;			/**< Number of packets received. */
+	long send_calls;				/**< Number of send socket calls. */
+	long packets_sent;				/**< Number of packets sent. */
 } llp_info_t;
 
 /*
@@ -70,6 +74,8 @@ int llp_info_initialize() {
 	liblog_debug(LAYER_LINK, "mutex initialized.");
 	
 	info.active_sessions_counter = 0;
+	info.receive_calls = info.packets_received = 0;
+	info.send_calls = info.packets_sent = 0;
 	
 	return LLP_OK;
 }
@@ -97,3 +103,39 @@ void llp_add_active_sessions_counter(int increment) {
 	pthread_mutex_unlock(&info_mutex);
 }
 /******************************************************************************/
+void llp_add_receive_batch(int packets) {
+	pthread_mutex_lock(&info_mutex);
+	info.receive_calls++;
+	info.packets_received += packets;
+	pthread_mutex_unlock(&info_mutex);
+}
+/******************************************************************************/
+void llp_add_send_batch(int packets) {
+	pthread_mutex_lock(&info_mutex);
+	info.send_calls++;
+	info.packets_sent += packets;
+	pthread_mutex_unlock(&info_mutex);
+}
+/******************************************************************************/
+float llp_get_receive_batch_average() {
+	float return_value;
+	
+	pthread_mutex_lock(&info_mutex);
+	return_value = (info.receive_calls == 0 ? 0 :
+			(float)info.packets_received / info.receive_calls);
+	pthread_mutex_unlock(&info_mutex);
+	
+	return return_value;
+}
+/******************************************************************************/
+float llp_get_send_batch_average() {
+	float return_value;
+	
+	pthread_mutex_lock(&info_mutex);
+	return_value = (info.send_calls == 0 ? 0 :
+			(float)info.packets_sent / info.send_calls);
+	pthread_mutex_unlock(&info_mutex);
+	
+	return return_value;
+}
+/******************************************************************************/
@@ -53,4 +53,32 @@ int llp_get_active_sessions_counter();
  */
 void llp_add_active_sessions_counter(int increment);
 
+/**
+ * Accounts a receive socket call that returned the given number of packets.
+ * 
+ * @param packets number of packets received by the call.
+ */
+void llp_add_receive_batch(int packets);
+
+/**
+ * Accounts a send socket call that transmitted the given number of packets.
+ * 
+ * @param packets number of packets sent by the call.
+ */
+void llp_add_send_batch(int packets);
+
+/**
+ * Returns the average number of packets received by each socket call.
+ * 
+ * @returns packets received per socket call.
+ */
+float llp_get_receive_batch_average();
+
+/**
+ * Returns the average number of packets sent by each socket call.
+ * 
+ * @returns packets sent per socket call.
+ */
+float llp_get_send_batch_average();
+
 #endif /* _LLP_INFO_H_ */
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_limits.c Implementation of the per-source rate limits applied to
+ * 		the packets received, before they are dispatched.
+ * @ingroup llp
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <libfreedom/layers.h>
+#include <libfreedom/liblog.h>
+
+#include "llp.h"
+#include "llp_config.h"
+#include "llp_socket.h"
+#include "llp_limits.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Bits used to pick the set of a source.
+ */
+#define LIMIT_SET_BITS	8
+
+/*
+ * Number of sets in the table of each listener.
+ */
+#define LIMIT_SETS		(1 << LIMIT_SET_BITS)
+
+/*
+ * Number of sources kept in each set.
+ */
+#define LIMIT_WAYS		4
+
+/*
+ * Tokens are kept in thousandths, so a bucket gains its rate in thousandths
+ * every millisecond.
+ */
+#define TOKEN			1000
+
+/*
+ * Token buckets of a source address.
+ */
+typedef struct {
+	/** Source address, in network byte order. */
+	in_addr_t address;
+	/** Last instant the buckets were refilled, zero if the entry is free. */
+	long refill_time;
+	/** Tokens left for each class of packets, in thousandths. */
+	long tokens[LLP_LIMIT_CLASSES];
+} source_t;
+
+/*
+ * Rate limit table of a listener. Sources are kept in small sets, and the
+ * least recently seen source of a set is replaced by a new one.
+ */
+typedef struct {
+	/** Sources, LIMIT_WAYS for each set. */
+	source_t sources[LIMIT_SETS * LIMIT_WAYS];
+	/** Packets dropped by the listener, for each reason. */
+	long drops[LLP_DROP_REASONS];
+} table_t;
+
+/*
+ * Tables of the listeners.
+ */
+static table_t *tables = NULL;
+
+/*
+ * Names of the reasons packets are dropped.
+ */
+static const char *drop_reason_names[LLP_DROP_REASONS] = {
+	"short",
+	"long",
+	"unknown",
+	"handshake rate",
+	"data rate"
+};
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Finds the entry of a source in a table, replacing the least recently seen
+ * source of its set if it is not there. New sources start with full buckets.
+ * 
+ * @param table - the table of the listener.
+ * @param address - the source address.
+ * @param now - current clock, in milliseconds.
+ * @return the entry of the source.
+ */
+static source_t *find_source(table_t *table, in_addr_t address, long now);
+
+/*
+ * Returns the rate of a class of packets in each listener.
+ * 
+ * @param class - one of the LLP_LIMIT_* classes.
+ * @return the rate in packets per second, zero if unlimited.
+ */
+static int get_rate(int class);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+int llp_limits_initialize() {
+
+	tables = (table_t *)calloc(LLP_MAX_LISTENERS, sizeof(table_t));
+	if (tables == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+
+	liblog_debug(LAYER_LINK, "rate limit tables initialized.");
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_limits_finalize() {
+
+	free(tables);
+	tables = NULL;
+
+	liblog_debug(LAYER_LINK, "rate limit tables finalized.");
+}
+/******************************************************************************/
+int llp_limit_packet(int listener, struct sockaddr_in *peer, int class,
+		long now) {
+	source_t *source;
+	long elapsed;
+	long burst;
+	int rate;
+	int i;
+
+	rate = get_rate(class);
+	if (rate == 0) {
+		return LLP_OK;
+	}
+
+	source = find_source(&tables[listener], peer->sin_addr.s_addr, now);
+
+	/* Every bucket refills at its own rate, up to one second of packets. */
+	elapsed = now - source->refill_time;
+	if (elapsed > 0) {
+		for (i = 0; i < LLP_LIMIT_CLASSES; i++) {
+			burst = (long)get_rate(i) * TOKEN;
+			source->tokens[i] += elapsed * get_rate(i);
+			if (source->tokens[i] > burst) {
+				source->tokens[i] = burst;
+			}
+		}
+		source->refill_time = now;
+	}
+
+	if (source->tokens[class] < TOKEN) {
+		llp_count_drop(listener, class == LLP_LIMIT_HANDSHAKE ?
+				LLP_DROP_HANDSHAKE_RATE : LLP_DROP_DATA_RATE);
+		return LLP_ERROR;
+	}
+	source->tokens[class] -= TOKEN;
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_count_drop(int listener, int reason) {
+	__sync_fetch_and_add(&tables[listener].drops[reason], 1);
+}
+/******************************************************************************/
+long llp_get_drops(int reason) {
+	long drops;
+	int i;
+
+	drops = 0;
+	for (i = 0; i < LLP_MAX_LISTENERS; i++) {
+		drops += __sync_add_and_fetch(&tables[i].drops[reason], 0);
+	}
+
+	return drops;
+}
+/******************************************************************************/
+const char *llp_get_drop_reason_name(int reason) {
+	return drop_reason_names[reason];
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+source_t *find_source(table_t *table, in_addr_t address, long now) {
+	source_t *set;
+	source_t *oldest;
+	int i;
+
+	/* Fibonacci hashing spreads neighbouring addresses over the sets. */
+	set = &table->sources[(((uint32_t)address * 2654435761u) >>
+			(32 - LIMIT_SET_BITS)) * LIMIT_WAYS];
+
+	oldest = &set[0];
+	for (i = 0; i < LIMIT_WAYS; i++) {
+		if (set[i].refill_time != 0 && set[i].address == address) {
+			return &set[i];
+		}
+		if (set[i].refill_time < oldest->refill_time) {
+			oldest = &set[i];
+		}
+	}
+
+	oldest->address = address;
+	oldest->refill_time = now;
+	for (i = 0; i < LLP_LIMIT_CLASSES; i++) {
+		oldest->tokens[i] = (long)get_rate(i) * TOKEN;
+	}
+
+	return oldest;
+}
+/******************************************************************************/
+int get_rate(int class) {
+	int rate;
+
+	if (class == LLP_LIMIT_HANDSHAKE) {
+		rate = llp_get_handshake_rate_limit();
+	} else {
+		rate = llp_get_data_rate_limit();
+	}
+
+	/* Without steering, the ports of a host are hashed to any listener and
+	 * each one holds a bucket for the same address. */
+	if (!llp_sockets_steered && llp_sockets_count > 1 && rate > 0) {
+		rate /= llp_sockets_count;
+		if (rate == 0) {
+			rate = 1;
+		}
+	}
+	return rate;
+}
+/******************************************************************************/
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_limits.h Headers of the per-source rate limits applied to the
+ * 		packets received, before they are dispatched.
+ * @ingroup llp
+ */
+
+#ifndef _LLP_LIMITS_H_
+#define _LLP_LIMITS_H_
+
+#include <netinet/in.h>
+
+/**
+ * Maximum rate configurable for a class of packets, in packets per second.
+ */
+#define LLP_MAX_RATE_LIMIT	1000000
+
+/**
+ * Enumeration of the classes of packets limited separately.
+ */
+enum llp_limit_classes {
+	LLP_LIMIT_HANDSHAKE,		/**< Packets used to establish sessions. */
+	LLP_LIMIT_DATA,				/**< Packets of established sessions. */
+	LLP_LIMIT_CLASSES			/**< Number of classes. */
+};
+
+/**
+ * Enumeration of the reasons a received packet is dropped before dispatch.
+ */
+enum llp_drop_reasons {
+	LLP_DROP_SHORT,				/**< Packet too small to be valid. */
+	LLP_DROP_LONG,				/**< Packet larger than any LLP frame. */
+	LLP_DROP_UNKNOWN,			/**< Packet type unknown. */
+	LLP_DROP_HANDSHAKE_RATE,	/**< Source exceeded the handshake rate. */
+	LLP_DROP_DATA_RATE,			/**< Source exceeded the data rate. */
+	LLP_DROP_REASONS			/**< Number of reasons. */
+};
+
+/**
+ * Allocates the rate limit tables of the listeners.
+ * 
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_limits_initialize();
+
+/**
+ * Frees the rate limit tables of the listeners.
+ */
+void llp_limits_finalize();
+
+/**
+ * Takes a token from the bucket kept for the source of a packet. Each
+ * listener has its own table and must be the only one calling this function
+ * with its index. Sources are keyed by address, so a host gets the configured
+ * rate whatever ports it uses when the listeners are steered by address.
+ * Otherwise the rate is divided among the listeners, which a host using
+ * several ports may reach at once.
+ * 
+ * @param listener index of the listener that received the packet.
+ * @param peer address of the host that sent the packet.
+ * @param class one of the LLP_LIMIT_* classes.
+ * @param now current clock, in milliseconds.
+ * @return LLP_OK if the packet may be dispatched, LLP_ERROR if the source
+ * 		exceeded its rate and the packet must be dropped.
+ */
+int llp_limit_packet(int listener, struct sockaddr_in *peer, int class,
+		long now);
+
+/**
+ * Accounts a packet dropped by a listener before dispatch.
+ * 
+ * @param listener index of the listener that received the packet.
+ * @param reason one of the LLP_DROP_* reasons.
+ */
+void llp_count_drop(int listener, int reason);
+
+/**
+ * Returns the number of packets dropped before dispatch for a reason, summed
+ * over all listeners.
+ * 
+ * @param reason one of the LLP_DROP_* reasons.
+ * @return number of packets dropped.
+ */
+long llp_get_drops(int reason);
+
+/**
+ * Returns the name of a reason packets are dropped.
+ * 
+ * @param reason one of the LLP_DROP_* reasons.
+ * @return the name of the reason.
+ */
+const char *llp_get_drop_reason_name(int reason);
+
+#endif /* !_LLP_LIMITS_H_ */
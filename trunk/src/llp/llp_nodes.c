@@ -28,16 +28,26 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include <pthread.h>
+
 #include <libfreedom/liblog.h>
 #include <util/util_crypto.h>
 
 #include "llp.h"
+#include "llp_nodes.h"
 #include "llp_sessions.h"
 #include "llp_data.h"
 #include "llp_config.h"
@@ -81,12 +91,101 @@
  */
 #define MAX_ACTIVE_NODES	LLP_MAX_SESSIONS
 
+/*
+ * Value of an empty slot in the nodes index.
+ */
+#define INDEX_EMPTY		(-1)
+
+/*
+ * Minimum number of slots in the nodes index.
+ */
+#define INDEX_MIN_SIZE	16
+
+/*
+ * Number of threads resolving the hostnames of a node file concurrently.
+ */
+#define RESOLVER_THREADS	8
+
+/*
+ * Identifier ("LLPS") and version of the nodes cache snapshot format.
+ */
+#define SNAPSHOT_MAGIC		0x4c4c5053
+#define SNAPSHOT_VERSION	2
+
+/*
+ * Round trip time assumed for nodes never measured, and used as the scale of
+ * the latency score, in milliseconds.
+ */
+#define DEFAULT_RTT		200
+
+/*
+ * Uptime used as the scale of the stability score, in seconds.
+ */
+#define UPTIME_SCALE	3600
+
+/*
+ * Number of random inactive nodes compared when a node is selected by score.
+ */
+#define SELECTION_CANDIDATES	8
+
+/*
+ * Header of a nodes cache snapshot, followed by the nodes.
+ */
+typedef struct {
+	uint32_t magic;			/* Always SNAPSHOT_MAGIC. */
+	uint32_t version;		/* Always SNAPSHOT_VERSION. */
+	uint32_t count;			/* Number of nodes in the snapshot. */
+	uint32_t reserved;		/* Always zero. */
+} snapshot_header_t;
+
+/*
+ * Node stored in a nodes cache snapshot. Addresses and ports are in network
+ * byte order, the other fields in host byte order.
+ */
+typedef struct {
+	uint32_t address;		/* IPv4 address of the node. */
+	uint16_t port;			/* UDP port of the node. */
+	uint16_t reserved;		/* Always zero. */
+	uint32_t successes;		/* Sessions established with the node. */
+	uint32_t failures;		/* Handshakes with the node that failed. */
+	int64_t last_seen;		/* Last time a session with the node was up. */
+	uint32_t handshake_rtt;	/* Smoothed handshake round trip time. */
+	uint32_t keep_alive_rtt;/* Smoothed keep-alive round trip time. */
+	uint32_t uptime;		/* Seconds that sessions with the node were up. */
+	uint32_t reserved2;		/* Always zero. */
+} snapshot_node_t;
+
+/*
+ * Entry of a node file waiting for resolution.
+ */
+typedef struct {
+	char hostname[HOSTNAME_MAX_LENGTH];	/* Name or address of the node. */
+	int port;				/* UDP port of the node. */
+} node_entry_t;
+
+/*
+ * Entries of a node file shared by the resolver threads.
+ */
+typedef struct {
+	node_entry_t *entries;	/* Entries read from the file. */
+	int count;				/* Number of entries. */
+	int next;				/* Next entry to be resolved. */
+} resolution_t;
+
 /**
  * Data type that represents the information associated with a node.
  */
 typedef struct {
 	int session;				/**< Session used to connect with this node. */
 	int state;					/**< This node is active. */
+	int position;				/**< Position in the active list, if active. */
+	unsigned int successes;		/**< Sessions established with this node. */
+	unsigned int failures;		/**< Handshakes with this node that failed. */
+	time_t last_seen;			/**< Last time a session was up, or zero. */
+	time_t since;				/**< Time when the current session came up. */
+	long uptime;				/**< Seconds that sessions were up. */
+	long handshake_rtt;			/**< Smoothed handshake RTT, zero if unknown. */
+	long keep_alive_rtt;		/**< Smoothed keep-alive RTT, zero if unknown. */
 	struct sockaddr_in address;	/**< Address of this node. */
 } node_t;
 
@@ -104,6 +203,16 @@ typedef struct {
 	int cached;
 	/** List of stored nodes. */
 	node_t *cache_list;					
+	/** Open addressing index of cache_list, keyed by address and port. */
+	int *index;
+	/** Number of slots in the index minus one, the size is a power of two. */
+	unsigned int index_mask;
+	/** Cache slot of the node connected by each session, or INDEX_EMPTY. */
+	int *session_nodes;
+	/** Next cache slot examined when a node must be replaced. */
+	int victim;
+	/** Odd while the cache is being changed, readers retry if it changes. */
+	volatile unsigned int sequence;
 } nodes_t;
 
 /*
@@ -117,15 +226,96 @@ static nodes_t nodes;
  */
 static pthread_mutex_t nodes_mutex;
 
+/*
+ * Thread that resolves the node files after initialization.
+ */
+static pthread_t loader_thread;
+
+/*
+ * Flag that tells the loader thread to stop resolving nodes.
+ */
+static volatile int stop_loading = 0;
+
 /*============================================================================*/
 /* Private functions prototypes.                                              */
 /*============================================================================*/
 
 /*
- * Fills up the nodes cache with the contents of the given file.
+ * Computes the position of an address in the nodes index.
+ */
+static inline unsigned int hash_address(struct sockaddr_in *address);
+
+/*
+ * Returns the cache slot of the node with the given address, or LLP_ERROR if
+ * the node is not cached. Does not lock, readers must use read_begin().
+ */
+static int find_node(struct sockaddr_in *address);
+
+/*
+ * Puts a cache slot in the nodes index.
+ */
+static void index_node(int node);
+
+/*
+ * Removes a cache slot from the nodes index, shifting back the slots that
+ * follow it so no probe sequence is broken.
+ */
+static void unindex_node(int node);
+
+/*
+ * Marks a cached node as active or connecting through a session.
+ */
+static int set_node_state(struct sockaddr_in *address, int session,
+		int state);
+
+/*
+ * Computes the score of a node, higher for reliable, fast and stable nodes.
+ */
+static double score_node(node_t *node);
+
+/*
+ * Opens and closes a change of the nodes cache. Must be called with
+ * nodes_mutex locked.
+ */
+static inline void write_begin();
+static inline void write_end();
+
+/*
+ * Opens a lock-free read of the nodes cache and checks if it must be
+ * repeated because the cache changed meanwhile.
+ */
+static inline unsigned int read_begin();
+static inline int read_retry(unsigned int sequence);
+
+/*
+ * Fills up the nodes cache with the contents of the given file, resolving the
+ * hostnames concurrently.
  */
 static int fill_cache(char *filename);
 
+/*
+ * Function to be executed by loader_thread, filling the cache with the static
+ * and recent node files.
+ */
+static void *load_node_files();
+
+/*
+ * Function to be executed by the resolver threads, resolving entries of a node
+ * file until none is left.
+ */
+static void *resolve_entries(void *resolution);
+
+/*
+ * Fills up the nodes cache with the contents of a snapshot, mapping the file
+ * in memory.
+ */
+static int load_snapshot(char *filename);
+
+/*
+ * Writes a snapshot of the nodes cache, replacing the file atomically.
+ */
+static int save_snapshot(char *filename);
+
 /*
  * Fills up a file with the information associated with the current nodes stored
  * on cache.
@@ -137,6 +327,8 @@ static int fill_file(char *filename);
 /*============================================================================*/
 
 int llp_nodes_initialize() {
+	unsigned int size;
+	int i;
 
 	nodes.cache_size = llp_get_cache_size();
 	
@@ -149,6 +341,24 @@ int llp_nodes_initialize() {
 	}
 	nodes.cached = 0;
 	nodes.active = 0;
+	nodes.victim = 0;
+	nodes.sequence = 0;
+
+	/* The index is kept at most half full, so probes stay short. */
+	for (size = INDEX_MIN_SIZE; size < 2 * nodes.cache_size; size <<= 1);
+	nodes.index = (int *)malloc(size * sizeof(int));
+	nodes.session_nodes = (int *)malloc(LLP_MAX_SESSIONS * sizeof(int));
+	if (nodes.index == NULL || nodes.session_nodes == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+	nodes.index_mask = size - 1;
+	for (i = 0; i < size; i++) {
+		nodes.index[i] = INDEX_EMPTY;
+	}
+	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+		nodes.session_nodes[i] = INDEX_EMPTY;
+	}
 	
 	/* Initializing mutexes. */
 	if (pthread_mutex_init(&nodes_mutex, NULL) > 0) {
@@ -159,19 +369,19 @@ int llp_nodes_initialize() {
 	
 	liblog_debug(LAYER_LINK, "mutex initialized.");
 	
-	/* Fill the cache. */
-	if (fill_cache(llp_get_static_nodes_file()) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error getting nodes from static nodes file.");
-	}
-	if (fill_cache(llp_get_recent_nodes_file()) == LLP_ERROR) {
-		liblog_error(LAYER_LINK, "error getting nodes from recent nodes file.");
-	}
-	if (nodes.cached == 0) {
-		liblog_error(LAYER_LINK, "error filling nodes cache, cache empty.");
-	}
-
 	/* Clearing active hosts table. */
 	memset(nodes.active_list, 0, sizeof(nodes.active_list));
+
+	/* The snapshot is ready to be used, the node files are resolved in the
+	 * background. */
+	if (load_snapshot(llp_get_nodes_snapshot_file()) == LLP_ERROR) {
+		liblog_warn(LAYER_LINK, "nodes snapshot not loaded.");
+	}
+	stop_loading = 0;
+	if (pthread_create(&loader_thread, NULL, load_node_files, NULL)) {
+		liblog_error(LAYER_LINK, "error creating thread: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
 	
 	liblog_debug(LAYER_LINK, "nodes module initialized.");
 	
@@ -179,11 +389,18 @@ int llp_nodes_initialize() {
 }
 /******************************************************************************/
 void llp_nodes_finalize() {
-	/* Writing file. */
+	/* Resolutions already started still finish. */
+	stop_loading = 1;
+	pthread_join(loader_thread, NULL);
+
+	/* Writing files. */
 	fill_file(llp_get_recent_nodes_file());
+	save_snapshot(llp_get_nodes_snapshot_file());
 	
 	/* Freeing memory allocated to hosts cache. */
 	free(nodes.cache_list);
+	free(nodes.index);
+	free(nodes.session_nodes);
 	
 	/* Freeing mutexes. */
 	pthread_mutex_destroy(&nodes_mutex);
@@ -194,27 +411,27 @@ void llp_nodes_finalize() {
 }
 /******************************************************************************/
 int llp_get_session_by_address(struct sockaddr_in *address) {
-	int i;
+	unsigned int sequence;
+	int node;
 	int session;
 
-	pthread_mutex_lock(&nodes_mutex);
-	
-	/* Searching node in active nodes. */
-	for (i = 0; i < nodes.active; i++) {
-		if (SAME_NODE_ADDRESS(&nodes.cache_list[nodes.active_list[i]].address,
-				address)) {
-			/* This node is connected. */
-			session = nodes.cache_list[nodes.active_list[i]].session;
-			liblog_debug(LAYER_LINK, "session %d found.", session);
-			pthread_mutex_unlock(&nodes_mutex);
-			return session;
+	/* Lookups do not take the nodes mutex, they are repeated if the cache
+	 * changed while they were running. */
+	do {
+		sequence = read_begin();
+		session = LLP_ERROR;
+		node = find_node(address);
+		if (node != LLP_ERROR && nodes.cache_list[node].state != NODE_INACTIVE) {
+			session = nodes.cache_list[node].session;
 		}
+	} while (read_retry(sequence));
+
+	if (session != LLP_ERROR) {
+		liblog_debug(LAYER_LINK, "session %d found.", session);
 	}
-	
-	pthread_mutex_unlock(&nodes_mutex);
 
-	/* There is no connection to this node. */
-	return LLP_ERROR;
+	/* There is no connection to this node if LLP_ERROR. */
+	return session;
 }
 /******************************************************************************/
 int llp_get_nodes_from_cache(int number, struct sockaddr_in *addresses) {
@@ -254,33 +471,47 @@ int llp_get_nodes_from_cache(int number, struct sockaddr_in *addresses) {
 /******************************************************************************/
 int llp_add_node_to_cache(struct sockaddr_in *address) {
 	int i;
+	int node;
 
 	pthread_mutex_lock(&nodes_mutex);
 	
-	for (i = 0; i < nodes.cached; i++) {
-		if (SAME_NODE_ADDRESS(&nodes.cache_list[i].address,
-				address)) {
-			/* Node is already cached. */
-			/*liblog_error(LAYER_LINK, "node already on cache.");*/
-			pthread_mutex_unlock(&nodes_mutex);
-			return LLP_ERROR;
-		}
+	if (find_node(address) != LLP_ERROR) {
+		/* Node is already cached. */
+		pthread_mutex_unlock(&nodes_mutex);
+		return LLP_ERROR;
 	}
+
+	node = LLP_ERROR;
+	write_begin();
 	if (nodes.cached < nodes.cache_size) {
 		liblog_debug(LAYER_LINK, "node %s:%d added to cache.",
 				inet_ntoa(address->sin_addr), ntohs(address->sin_port));
-		memcpy(&nodes.cache_list[nodes.cached++].address, address,
-				sizeof(struct sockaddr_in));
-		nodes.cache_list[nodes.cached].state = NODE_INACTIVE;
+		node = nodes.cached++;
 	} else {
 		liblog_debug(LAYER_LINK, "cache full.");
+		/* Replacing the next inactive node, round robin. */
 		for (i = 0; i < nodes.cached; i++) {
-			if (nodes.cache_list[i].state == NODE_INACTIVE) {
-				memcpy(&nodes.cache_list[i].address, address, 
-						sizeof(struct sockaddr_in));
+			nodes.victim = (nodes.victim + 1) % nodes.cached;
+			if (nodes.cache_list[nodes.victim].state == NODE_INACTIVE) {
+				node = nodes.victim;
+				unindex_node(node);
+				break;
 			}
 		}
 	}
+	if (node != LLP_ERROR) {
+		memcpy(&nodes.cache_list[node].address, address,
+				sizeof(struct sockaddr_in));
+		nodes.cache_list[node].state = NODE_INACTIVE;
+		nodes.cache_list[node].successes = 0;
+		nodes.cache_list[node].failures = 0;
+		nodes.cache_list[node].last_seen = 0;
+		nodes.cache_list[node].uptime = 0;
+		nodes.cache_list[node].handshake_rtt = 0;
+		nodes.cache_list[node].keep_alive_rtt = 0;
+		index_node(node);
+	}
+	write_end();
 	
 	pthread_mutex_unlock(&nodes_mutex);
 	
@@ -289,123 +520,128 @@ int llp_add_node_to_cache(struct sockaddr_in *address) {
 }
 /******************************************************************************/
 int llp_set_node_active(struct sockaddr_in *address, int session) {
-	int i;
-
-	pthread_mutex_lock(&nodes_mutex);
-
-	/* There's room for this node. */
-	if (nodes.active < MAX_ACTIVE_NODES)  {
-		for (i = 0; i < nodes.active; i++) {
-			if (SAME_NODE_ADDRESS(
-					&nodes.cache_list[nodes.active_list[i]].address, address)) {
-				liblog_error(LAYER_LINK, "node already active.");
-				pthread_mutex_unlock(&nodes_mutex);
-				return LLP_OK;
-			}
-		}
-		for (i = 0; i < nodes.cached; i++) {
-			if (SAME_NODE_ADDRESS(&nodes.cache_list[i].address, address)) {
-				nodes.active_list[nodes.active++] = i;
-				nodes.cache_list[i].state = NODE_ACTIVE;
-				nodes.cache_list[i].session = session;
-				liblog_debug(LAYER_LINK, "node activated.");
-				pthread_mutex_unlock(&nodes_mutex);
-				return LLP_OK;
-			}
-		}
-	}
-	
-	pthread_mutex_unlock(&nodes_mutex);
-
-	liblog_error(LAYER_LINK, "node not found.");
-	return LLP_ERROR;
+	return set_node_state(address, session, NODE_ACTIVE);
 }
 /******************************************************************************/
 int llp_set_node_connecting(struct sockaddr_in *address, int session) {
-	int i;
-
-	pthread_mutex_lock(&nodes_mutex);
-
-	/* There's room for this node. */
-	if (nodes.active < MAX_ACTIVE_NODES)  {
-		for (i = 0; i < nodes.active; i++) {
-			if (SAME_NODE_ADDRESS(
-					&nodes.cache_list[nodes.active_list[i]].address, address)) {
-				liblog_error(LAYER_LINK, "node already active.");
-				pthread_mutex_unlock(&nodes_mutex);
-				return LLP_OK;
-			}
-		}
-		for (i = 0; i < nodes.cached; i++) {
-			if (SAME_NODE_ADDRESS(&nodes.cache_list[i].address, address)) {
-				nodes.active_list[nodes.active++] = i;
-				nodes.cache_list[i].state = NODE_CONNECTING;
-				nodes.cache_list[i].session = session;
-				liblog_debug(LAYER_LINK, "node connecting.");
-				pthread_mutex_unlock(&nodes_mutex);
-				return LLP_OK;
-			}
-		}
-	}
-	
-	pthread_mutex_unlock(&nodes_mutex);
-
-	liblog_error(LAYER_LINK, "node not found.");
-	return LLP_ERROR;
+	return set_node_state(address, session, NODE_CONNECTING);
 }
 /******************************************************************************/
 int llp_set_node_inactive(int session) {
-	int i;
+	int node;
+	int last;
 	
 	pthread_mutex_lock(&nodes_mutex);
 
+	node = nodes.session_nodes[session];
+	if (node == INDEX_EMPTY || nodes.cache_list[node].state == NODE_INACTIVE ||
+			nodes.cache_list[node].session != session) {
+		pthread_mutex_unlock(&nodes_mutex);
+		liblog_error(LAYER_LINK, "no active node found with this session.");
+		return LLP_ERROR;
+	}
+
 	/* Substituting node with the last active and freeing a slot. */
-	for (i = 0; i < nodes.active; i++) {
-		if (nodes.cache_list[nodes.active_list[i]].session == session) {
-			nodes.active_list[i] = nodes.active_list[--nodes.active];
-			nodes.cache_list[nodes.active_list[i]].state = NODE_INACTIVE;
-			liblog_debug(LAYER_LINK, "node deactivated.");
-			pthread_mutex_unlock(&nodes_mutex);
-			return LLP_OK;
-		}
+	write_begin();
+	last = nodes.active_list[--nodes.active];
+	nodes.active_list[nodes.cache_list[node].position] = last;
+	nodes.cache_list[last].position = nodes.cache_list[node].position;
+	if (nodes.cache_list[node].state == NODE_CONNECTING) {
+		nodes.cache_list[node].failures++;
+	} else {
+		nodes.cache_list[node].last_seen = time(NULL);
+		nodes.cache_list[node].uptime += 
+				nodes.cache_list[node].last_seen - nodes.cache_list[node].since;
 	}
+	nodes.cache_list[node].state = NODE_INACTIVE;
+	nodes.session_nodes[session] = INDEX_EMPTY;
+	write_end();
+	liblog_debug(LAYER_LINK, "node deactivated.");
 
 	pthread_mutex_unlock(&nodes_mutex);
-	liblog_error(LAYER_LINK, "no active node found with this session.");
-	return LLP_ERROR;
+	return LLP_OK;
 }
 /******************************************************************************/
 int llp_get_inactive_node(struct sockaddr_in *address) {
-	unsigned int position = 0;
+	unsigned int random[SELECTION_CANDIDATES + 2];
+	double score;
+	double best_score;
+	int best;
+	int node;
 	int i;
 
-	if (util_rand_bytes(&position, sizeof(unsigned int)) == LLP_ERROR) {
+	if (util_rand_bytes((u_char *)random, sizeof(random)) == LLP_ERROR) {
 		liblog_error(LAYER_LINK, "error generating random node index.");
 		return LLP_ERROR;	
 	}
 
 	pthread_mutex_lock(&nodes_mutex);
 
-	/* Reducing position magnitude. */
-	position = (int)((float)(nodes.cached)) * (((float)position)/MAX_INT);
-	
-	/* Looking for a node after position. */
-	i = position;
-	while (i < position) {
-		if (nodes.cache_list[i].state == NODE_INACTIVE) {
-			liblog_debug(LAYER_LINK, "inactive node found.");
-			memcpy(address, &nodes.cache_list[i].address,
-					sizeof(struct sockaddr_in));
-			pthread_mutex_unlock(&nodes_mutex);			
-			return LLP_OK;
+	if (nodes.cached == 0) {
+		pthread_mutex_unlock(&nodes_mutex);
+		return LLP_ERROR;
+	}
+
+	/* The best of a few random inactive nodes is taken, except when exploring
+	 * other nodes. */
+	best = LLP_ERROR;
+	best_score = 0;
+	if (random[0] % 100 >= llp_get_node_exploration()) {
+		for (i = 0; i < SELECTION_CANDIDATES; i++) {
+			node = random[i + 2] % nodes.cached;
+			if (nodes.cache_list[node].state != NODE_INACTIVE) {
+				continue;
+			}
+			score = score_node(&nodes.cache_list[node]);
+			if (best == LLP_ERROR || score > best_score) {
+				best = node;
+				best_score = score;
+			}
+		}
+	}
+
+	/* Looking for any inactive node after a random position. */
+	node = random[1] % nodes.cached;
+	for (i = 0; i < nodes.cached && best == LLP_ERROR; i++) {
+		if (nodes.cache_list[node].state == NODE_INACTIVE) {
+			best = node;
 		}
-		i++;
-		i %= (nodes.cached);
+		node = (node + 1) % nodes.cached;
+	}
+
+	if (best != LLP_ERROR) {
+		liblog_debug(LAYER_LINK, "inactive node found.");
+		memcpy(address, &nodes.cache_list[best].address,
+				sizeof(struct sockaddr_in));
 	}
 	
 	pthread_mutex_unlock(&nodes_mutex);
 	
-	return LLP_ERROR;
+	return (best == LLP_ERROR ? LLP_ERROR : LLP_OK);
+}
+/******************************************************************************/
+void llp_set_node_rtt(int session, int type, long rtt) {
+	int node;
+	long *smoothed;
+
+	pthread_mutex_lock(&nodes_mutex);
+
+	node = nodes.session_nodes[session];
+	if (node != INDEX_EMPTY && nodes.cache_list[node].session == session &&
+			nodes.cache_list[node].state != NODE_INACTIVE) {
+		smoothed = (type == LLP_RTT_HANDSHAKE ? 
+				&nodes.cache_list[node].handshake_rtt :
+				&nodes.cache_list[node].keep_alive_rtt);
+		/* Smoothed like TCP does, with a gain of 1/8. */
+		if (*smoothed == 0) {
+			*smoothed = (rtt > 0 ? rtt : 1);
+		} else {
+			*smoothed += (rtt - *smoothed) / 8;
+		}
+		liblog_debug(LAYER_LINK, "node rtt is %ld ms.", *smoothed);
+	}
+
+	pthread_mutex_unlock(&nodes_mutex);
 }
 /******************************************************************************/
 void llp_handle_nodes() {
@@ -445,15 +681,175 @@ void llp_handle_nodes() {
 /* Private functions implementations.                                         */
 /*============================================================================*/
 
+unsigned int hash_address(struct sockaddr_in *address) {
+	uint64_t key;
+
+	/* Fibonacci hashing of the address and port together. */
+	key = ((uint64_t)address->sin_addr.s_addr << 16) | address->sin_port;
+	key *= 0x9E3779B97F4A7C15ULL;
+
+	return (unsigned int)(key >> 32) & nodes.index_mask;
+}
+/******************************************************************************/
+int find_node(struct sockaddr_in *address) {
+	unsigned int position;
+	unsigned int probes;
+	int node;
+
+	position = hash_address(address);
+	/* Probes are bounded, a concurrent change may hide the empty slots. */
+	for (probes = 0; probes <= nodes.index_mask; probes++) {
+		node = nodes.index[position];
+		if (node == INDEX_EMPTY) {
+			break;
+		}
+		if (SAME_NODE_ADDRESS(&nodes.cache_list[node].address, address)) {
+			return node;
+		}
+		position = (position + 1) & nodes.index_mask;
+	}
+
+	return LLP_ERROR;
+}
+/******************************************************************************/
+void index_node(int node) {
+	unsigned int position;
+
+	position = hash_address(&nodes.cache_list[node].address);
+	while (nodes.index[position] != INDEX_EMPTY) {
+		position = (position + 1) & nodes.index_mask;
+	}
+	nodes.index[position] = node;
+}
+/******************************************************************************/
+void unindex_node(int node) {
+	unsigned int hole;
+	unsigned int position;
+	unsigned int home;
+
+	hole = hash_address(&nodes.cache_list[node].address);
+	while (nodes.index[hole] != node) {
+		hole = (hole + 1) & nodes.index_mask;
+	}
+
+	/* Slots after the hole move back if the hole is on their probe path. */
+	position = hole;
+	while (1) {
+		position = (position + 1) & nodes.index_mask;
+		if (nodes.index[position] == INDEX_EMPTY) {
+			break;
+		}
+		home = hash_address(&nodes.cache_list[nodes.index[position]].address);
+		if (((position - home) & nodes.index_mask) >=
+				((position - hole) & nodes.index_mask)) {
+			nodes.index[hole] = nodes.index[position];
+			hole = position;
+		}
+	}
+	nodes.index[hole] = INDEX_EMPTY;
+}
+/******************************************************************************/
+int set_node_state(struct sockaddr_in *address, int session, int state) {
+	int node;
+
+	pthread_mutex_lock(&nodes_mutex);
+
+	node = find_node(address);
+	if (node == LLP_ERROR || nodes.active >= MAX_ACTIVE_NODES) {
+		pthread_mutex_unlock(&nodes_mutex);
+		liblog_error(LAYER_LINK, "node not found.");
+		return LLP_ERROR;
+	}
+
+	if (nodes.cache_list[node].state != NODE_INACTIVE) {
+		/* The handshake of the session connecting to the node finished. */
+		if (nodes.cache_list[node].state == NODE_CONNECTING &&
+				nodes.cache_list[node].session == session &&
+				state == NODE_ACTIVE) {
+			write_begin();
+			nodes.cache_list[node].state = NODE_ACTIVE;
+			nodes.cache_list[node].successes++;
+			nodes.cache_list[node].last_seen = time(NULL);
+			nodes.cache_list[node].since = time(NULL);
+			write_end();
+			liblog_debug(LAYER_LINK, "node activated.");
+		} else {
+			liblog_error(LAYER_LINK, "node already active.");
+		}
+		pthread_mutex_unlock(&nodes_mutex);
+		return LLP_OK;
+	}
+
+	write_begin();
+	if (state == NODE_ACTIVE) {
+		nodes.cache_list[node].successes++;
+		nodes.cache_list[node].last_seen = time(NULL);
+		nodes.cache_list[node].since = time(NULL);
+	}
+	nodes.cache_list[node].position = nodes.active;
+	nodes.active_list[nodes.active++] = node;
+	nodes.cache_list[node].state = state;
+	nodes.cache_list[node].session = session;
+	nodes.session_nodes[session] = node;
+	write_end();
+	liblog_debug(LAYER_LINK, (state == NODE_ACTIVE ? "node activated." :
+			"node connecting."));
+
+	pthread_mutex_unlock(&nodes_mutex);
+	return LLP_OK;
+}
+/******************************************************************************/
+double score_node(node_t *node) {
+	double reliability;
+	double latency;
+	double stability;
+	long rtt;
+
+	/* Success ratio with one success and one failure assumed, so unknown
+	 * nodes score in the middle. */
+	reliability = (node->successes + 1.0) /
+			(node->successes + node->failures + 2.0);
+
+	/* Keep-alive samples are preferred, they do not include key agreement. */
+	rtt = (node->keep_alive_rtt > 0 ? node->keep_alive_rtt : 
+			(node->handshake_rtt > 0 ? node->handshake_rtt : DEFAULT_RTT));
+	latency = 1.0 / (1.0 + (double)rtt / DEFAULT_RTT);
+
+	/* Long lived sessions score up to twice as much. */
+	stability = 1.0 + (double)node->uptime / (node->uptime + UPTIME_SCALE);
+
+	return reliability * latency * stability;
+}
+/******************************************************************************/
+void write_begin() {
+	nodes.sequence++;
+	__sync_synchronize();
+}
+/******************************************************************************/
+void write_end() {
+	__sync_synchronize();
+	nodes.sequence++;
+}
+/******************************************************************************/
+unsigned int read_begin() {
+	unsigned int sequence;
+
+	while ((sequence = nodes.sequence) & 1);
+	__sync_synchronize();
+
+	return sequence;
+}
+/******************************************************************************/
+int read_retry(unsigned int sequence) {
+	__sync_synchronize();
+	return (nodes.sequence != sequence);
+}
+/******************************************************************************/
 int fill_cache(char *filename) {
 	FILE *file;
 	int i;
-	int port;
-	int error;
-	int end;
-	char hostname[HOSTNAME_MAX_LENGTH];
-	struct addrinfo *result;
-	struct addrinfo hints;
+	resolution_t resolution;
+	pthread_t resolvers[RESOLVER_THREADS];
 	
 	file = fopen(filename, "r");
 	if (file == NULL) {
@@ -461,38 +857,241 @@ int fill_cache(char *filename) {
 				strerror(errno));
 		return LLP_ERROR;
 	}
+
+	resolution.entries = (node_entry_t *)malloc(nodes.cache_size *
+			sizeof(node_entry_t));
+	if (resolution.entries == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		fclose(file);
+		return LLP_ERROR;
+	}
 	
+	/* Reading hosts, the file is never bigger than the cache. */
+	resolution.count = 0;
+	resolution.next = 0;
+	while (resolution.count < nodes.cache_size && fscanf(file, "%255[^:]:%d\n", 
+			resolution.entries[resolution.count].hostname,
+			&resolution.entries[resolution.count].port) == 2) {
+		liblog_debug(LAYER_LINK, "node found: %s %d", 
+				resolution.entries[resolution.count].hostname,
+				resolution.entries[resolution.count].port);
+		resolution.count++;
+	}
+	fclose(file);
+
+	/* Hostnames are resolved concurrently, each thread takes the next entry
+	 * not taken yet. */
+	for (i = 0; i < RESOLVER_THREADS && i < resolution.count; i++) {
+		if (pthread_create(&resolvers[i], NULL, resolve_entries, &resolution)) {
+			liblog_error(LAYER_LINK, "error creating thread: %s.",
+					strerror(errno));
+			break;
+		}
+	}
+	if (i == 0) {
+		resolve_entries(&resolution);
+	}
+	while (i-- > 0) {
+		pthread_join(resolvers[i], NULL);
+	}
+
+	free(resolution.entries);
+	
+	return resolution.count;
+}
+/******************************************************************************/
+void *load_node_files() {
+
+	if (fill_cache(llp_get_static_nodes_file()) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error getting nodes from static nodes file.");
+	}
+	if (!stop_loading &&
+			fill_cache(llp_get_recent_nodes_file()) == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error getting nodes from recent nodes file.");
+	}
+	if (nodes.cached == 0) {
+		liblog_error(LAYER_LINK, "error filling nodes cache, cache empty.");
+	}
+	liblog_debug(LAYER_LINK, "node files loaded.");
+
+	return NULL;
+}
+/******************************************************************************/
+void *resolve_entries(void *resolution) {
+	resolution_t *shared;
+	node_entry_t *entry;
+	struct addrinfo *result;
+	struct addrinfo hints;
+	int error;
+	int i;
+
+	shared = (resolution_t *)resolution;
+
 	/* Only IPv4 addresses supported. */
 	memset(&hints, 0, sizeof(struct addrinfo));
 	hints.ai_family = PF_INET;
-	
-	/* Reading hosts. */
-	end = 0;
-	for (i = nodes.cached; i < nodes.cache_size && !end; i++) {
-		if (fscanf(file, "%255[^:]:%d\n", hostname, &port) == 2) {
-			liblog_debug(LAYER_LINK, "node found: %s %d", hostname, port);
-			error = getaddrinfo(hostname, NULL, &hints, &result);
-			if (error) {
-				liblog_debug(LAYER_LINK, "error in getaddrinfo: %s.",
-						gai_strerror(error));
-			} else {
-				if (result->ai_addrlen == sizeof(struct sockaddr_in)) {
-					((struct sockaddr_in *)result->ai_addr)->sin_port =
-							htons(port);
-					llp_add_node_to_cache(
-							(struct sockaddr_in *)result->ai_addr);
-				}
-			}
-			freeaddrinfo(result);
-		} else {
-			liblog_debug(LAYER_LINK, "end of file reached.");
-			end = 1;
+
+	while (!stop_loading) {
+		i = __sync_fetch_and_add(&shared->next, 1);
+		if (i >= shared->count) {
+			break;
+		}
+		entry = &shared->entries[i];
+		error = getaddrinfo(entry->hostname, NULL, &hints, &result);
+		if (error) {
+			liblog_debug(LAYER_LINK, "error in getaddrinfo: %s.",
+					gai_strerror(error));
+			continue;
 		}
+		if (result->ai_addrlen == sizeof(struct sockaddr_in)) {
+			((struct sockaddr_in *)result->ai_addr)->sin_port =
+					htons(entry->port);
+			llp_add_node_to_cache((struct sockaddr_in *)result->ai_addr);
+		}
+		freeaddrinfo(result);
 	}
 
-	fclose(file);
-	
-	return (i-1);
+	return NULL;
+}
+/******************************************************************************/
+int load_snapshot(char *filename) {
+	int fd;
+	int i;
+	int node;
+	void *map;
+	struct stat status;
+	struct sockaddr_in address;
+	snapshot_header_t *header;
+	snapshot_node_t *records;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		liblog_debug(LAYER_LINK, "error opening file %s: %s.", filename,
+				strerror(errno));
+		return LLP_ERROR;
+	}
+	if (fstat(fd, &status) == -1 || 
+			status.st_size < sizeof(snapshot_header_t)) {
+		close(fd);
+		return LLP_ERROR;
+	}
+
+	map = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		liblog_error(LAYER_LINK, "error in mmap: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+
+	header = (snapshot_header_t *)map;
+	records = (snapshot_node_t *)(header + 1);
+	if (header->magic != SNAPSHOT_MAGIC || 
+			header->version != SNAPSHOT_VERSION ||
+			header->count > (status.st_size - sizeof(snapshot_header_t)) 
+			/ sizeof(snapshot_node_t)) {
+		liblog_error(LAYER_LINK, "invalid nodes snapshot: %s.", filename);
+		munmap(map, status.st_size);
+		return LLP_ERROR;
+	}
+
+	memset(&address, 0, sizeof(struct sockaddr_in));
+	address.sin_family = AF_INET;
+	for (i = 0; i < header->count && nodes.cached < nodes.cache_size; i++) {
+		address.sin_addr.s_addr = records[i].address;
+		address.sin_port = records[i].port;
+		if (llp_add_node_to_cache(&address) == LLP_ERROR) {
+			continue;
+		}
+		pthread_mutex_lock(&nodes_mutex);
+		node = find_node(&address);
+		if (node != LLP_ERROR) {
+			nodes.cache_list[node].successes = records[i].successes;
+			nodes.cache_list[node].failures = records[i].failures;
+			nodes.cache_list[node].last_seen = (time_t)records[i].last_seen;
+			nodes.cache_list[node].handshake_rtt = records[i].handshake_rtt;
+			nodes.cache_list[node].keep_alive_rtt = records[i].keep_alive_rtt;
+			nodes.cache_list[node].uptime = records[i].uptime;
+		}
+		pthread_mutex_unlock(&nodes_mutex);
+	}
+	munmap(map, status.st_size);
+
+	liblog_debug(LAYER_LINK, "%d nodes loaded from snapshot.", nodes.cached);
+
+	return nodes.cached;
+}
+/******************************************************************************/
+int save_snapshot(char *filename) {
+	FILE *file;
+	char *temporary;
+	int i;
+	int return_value;
+	snapshot_header_t header;
+	snapshot_node_t record;
+
+	temporary = (char *)malloc(strlen(filename) + sizeof(".tmp"));
+	if (temporary == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+	sprintf(temporary, "%s.tmp", filename);
+
+	file = fopen(temporary, "wb");
+	if (file == NULL) {
+		liblog_error(LAYER_LINK, "error creating file: %s", strerror(errno));
+		free(temporary);
+		return LLP_ERROR;
+	}
+
+	pthread_mutex_lock(&nodes_mutex);
+
+	memset(&header, 0, sizeof(header));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.count = nodes.cached;
+	return_value = LLP_OK;
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		return_value = LLP_ERROR;
+	}
+
+	memset(&record, 0, sizeof(record));
+	for (i = 0; i < nodes.cached && return_value == LLP_OK; i++) {
+		record.address = nodes.cache_list[i].address.sin_addr.s_addr;
+		record.port = nodes.cache_list[i].address.sin_port;
+		record.successes = nodes.cache_list[i].successes;
+		record.failures = nodes.cache_list[i].failures;
+		record.last_seen = nodes.cache_list[i].last_seen;
+		record.handshake_rtt = nodes.cache_list[i].handshake_rtt;
+		record.keep_alive_rtt = nodes.cache_list[i].keep_alive_rtt;
+		record.uptime = nodes.cache_list[i].uptime;
+		/* Nodes connected now were seen now. */
+		if (nodes.cache_list[i].state == NODE_ACTIVE) {
+			record.last_seen = time(NULL);
+			record.uptime += record.last_seen - nodes.cache_list[i].since;
+		}
+		if (fwrite(&record, sizeof(record), 1, file) != 1) {
+			return_value = LLP_ERROR;
+		}
+	}
+
+	pthread_mutex_unlock(&nodes_mutex);
+
+	if (fclose(file) != 0 || return_value == LLP_ERROR) {
+		liblog_error(LAYER_LINK, "error writing file: %s", strerror(errno));
+		unlink(temporary);
+		free(temporary);
+		return LLP_ERROR;
+	}
+
+	/* Readers never see a partial snapshot. */
+	if (rename(temporary, filename) == -1) {
+		liblog_error(LAYER_LINK, "error renaming file: %s", strerror(errno));
+		unlink(temporary);
+		return_value = LLP_ERROR;
+	}
+	free(temporary);
+
+	return return_value;
 }
 /******************************************************************************/
 int fill_file(char *filename) {
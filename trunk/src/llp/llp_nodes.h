@@ -30,6 +30,14 @@
 
 #include <netinet/in.h>
 
+/**
+ * Enumeration of the round trip times measured for each node.
+ */
+enum llp_rtt_types {
+	LLP_RTT_HANDSHAKE,		/**< From LLP_CONNECTION_REQUEST to LLP_CONNECTION_OK. */
+	LLP_RTT_KEEP_ALIVE		/**< From LLP_KEEP_ALIVE to its echo. */
+};
+
 /**
  * Initializes the module, allocating needed memory and clearing data
  * structures.
@@ -65,8 +73,8 @@ int llp_get_nodes_from_cache(int number, struct sockaddr_in *addresses);
 
 /**
  * Adds a node to the node pool. If there's no room to store this node, it will
- * substitute the first inactive node found. If the node is already there,
- * LLP_ERROR is returned.
+ * substitute an inactive node, chosen in round robin. If the node is already
+ * there, LLP_ERROR is returned.
  * 
  * @param address node address and port.
  * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
@@ -101,13 +109,24 @@ int llp_set_node_connecting(struct sockaddr_in *address, int session);
 
 /**
  * Copies the address of an inactive node on cache to address. If there's no
- * inactive node on cache, LLP_ERROR is returned.
+ * inactive node on cache, LLP_ERROR is returned. Nodes with low round trip
+ * times, high success ratios and long uptimes are preferred, but a
+ * configurable share of the selections ignores the scores.
  * 
  * @param address address that will receive the node address.
  * @return LLP_OK if there was a inactive onde on cache, LLP_ERROR otherwise.
  */
 int llp_get_inactive_node(struct sockaddr_in *address);
 
+/**
+ * Records a round trip time measured in the session connected to a node.
+ * 
+ * @param session session identifier.
+ * @param type one of the LLP_RTT_* types.
+ * @param rtt round trip time in milliseconds.
+ */
+void llp_set_node_rtt(int session, int type, long rtt);
+
 /**
  * Monitor the percent of the cache that is filled, and sends LLP_NODE_HUUNT
  * packets if needed.
@@ -24,8 +24,13 @@
  * @ingroup llp
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <sys/socket.h>
 
+#include <pthread.h>
+
 #include <libfreedom/types.h>
 #include <libfreedom/layers.h>
 #include <libfreedom/liblog.h>
@@ -33,23 +38,146 @@
 #include "llp_packets.h"
 #include "llp_sessions.h"
 #include "llp_socket.h"
+#include "llp_config.h"
+#include "llp_info.h"
 #include "llp.h"
 
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Number of bytes that can be queued in a send batch. Every packet fits in an
+ * empty batch.
+ */
+#define SEND_BATCH_ARENA_LENGTH		65536
+
+/**
+ * Data type that stores the packets queued by a thread while it is inside a
+ * send batch.
+ */
+typedef struct {
+	/** Flag that indicates if the thread is inside a send batch. */
+	int active;
+	/** Number of packets queued. */
+	int size;
+	/** Number of arena bytes used by the queued packets. */
+	int used;
+	/** Message headers passed to sendmmsg. */
+	struct mmsghdr headers[LLP_MAX_BATCH_SIZE];
+	/** Packet data vectors. */
+	struct iovec vectors[LLP_MAX_BATCH_SIZE];
+	/** Destination addresses. */
+	struct sockaddr_in addresses[LLP_MAX_BATCH_SIZE];
+	/** Storage for the queued packets. */
+	u_char arena[SEND_BATCH_ARENA_LENGTH];
+} send_batch_t;
+
+/*
+ * Key used to find the send batch owned by the calling thread.
+ */
+static pthread_key_t send_batch_key;
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/**
+ * Sends all packets queued in a send batch, using as few system calls as
+ * possible.
+ * 
+ * @param[in] batch     - the send batch.
+ * @retval LLP_OK       - if all packets were sent
+ * @retval LLP_ERROR    - otherwise.
+ */
+static int flush_send_batch(send_batch_t *batch);
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/	   
 
+int llp_packets_initialize() {
+
+	if (pthread_key_create(&send_batch_key, free)) {
+		liblog_error(LAYER_LINK, "error creating thread key: %s.",
+				strerror(errno));
+		return LLP_ERROR;
+	}
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_packets_finalize() {
+	send_batch_t *batch;
+
+	/* The destructor only runs for exiting threads, so the batch of the
+	 * calling thread is released here. */
+	batch = (send_batch_t *)pthread_getspecific(send_batch_key);
+	free(batch);
+	pthread_setspecific(send_batch_key, NULL);
+
+	pthread_key_delete(send_batch_key);
+}
+/******************************************************************************/
+void llp_begin_send_batch() {
+	send_batch_t *batch;
+
+	batch = (send_batch_t *)pthread_getspecific(send_batch_key);
+	if (batch == NULL) {
+		batch = (send_batch_t *)malloc(sizeof(send_batch_t));
+		if (batch == NULL) {
+			/* Without a batch, packets are simply sent one by one. */
+			liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+			return;
+		}
+		batch->size = batch->used = 0;
+		pthread_setspecific(send_batch_key, batch);
+	}
+	batch->active = 1;
+}
+/******************************************************************************/
+int llp_end_send_batch() {
+	send_batch_t *batch;
+
+	batch = (send_batch_t *)pthread_getspecific(send_batch_key);
+	if (batch == NULL) {
+		return LLP_OK;
+	}
+	batch->active = 0;
+
+	return flush_send_batch(batch);
+}
+/******************************************************************************/
 int llp_send_direct_packet(struct sockaddr_in *address, u_char *packet,
 		int length) {
 	int return_value;
+	send_batch_t *batch;
 
 	if (llp_socket == LLP_CLOSED_SOCKET) {
 		liblog_error(LAYER_LINK, "llp module not initialized.");
 		return LLP_ERROR;
 	}
 
+	batch = (send_batch_t *)pthread_getspecific(send_batch_key);
+	if (batch != NULL && batch->active && length <= SEND_BATCH_ARENA_LENGTH) {
+		if (batch->size == llp_get_batch_size() ||
+				batch->used + length > SEND_BATCH_ARENA_LENGTH) {
+			flush_send_batch(batch);
+		}
+		/* The packet is copied, so the caller may release it right away. */
+		memcpy(&batch->arena[batch->used], packet, length);
+		memcpy(&batch->addresses[batch->size], address,
+				sizeof(struct sockaddr_in));
+		batch->vectors[batch->size].iov_base = &batch->arena[batch->used];
+		batch->vectors[batch->size].iov_len = length;
+		batch->used += length;
+		batch->size++;
+		return LLP_OK;
+	}
+
 	return_value = sendto(llp_socket, packet, length, 0,
 			(struct sockaddr *)address,	sizeof(struct sockaddr_in));	
+	llp_add_send_batch(1);
 	
 	return (return_value < length ? LLP_ERROR : LLP_OK);
 }
@@ -59,4 +187,45 @@ int llp_send_session_packet(int session, u_char *packet, int length) {
 	return llp_send_direct_packet(&llp_sessions[session].address, packet,
 			length);
 }
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+int flush_send_batch(send_batch_t *batch) {
+	int i;
+	int sent;
+	int return_value;
+
+	for (i = 0; i < batch->size; i++) {
+		memset(&batch->headers[i], 0, sizeof(struct mmsghdr));
+		batch->headers[i].msg_hdr.msg_name = &batch->addresses[i];
+		batch->headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		batch->headers[i].msg_hdr.msg_iov = &batch->vectors[i];
+		batch->headers[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return_value = LLP_OK;
+	i = 0;
+	while (i < batch->size) {
+		sent = sendmmsg(llp_socket, &batch->headers[i], batch->size - i, 0);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* The first packet was refused, skip it and keep going. */
+			liblog_error(LAYER_LINK, "error sending packet: %s.",
+					strerror(errno));
+			return_value = LLP_ERROR;
+			sent = 1;
+		} else {
+			llp_add_send_batch(sent);
+		}
+		i += sent;
+	}
+
+	batch->size = batch->used = 0;
+
+	return return_value;
+}
 /******************************************************************************/
@@ -46,13 +46,19 @@
  * agreement.
  */
 #define LLP_H_LENGTH	16
+/**
+ * Defines the size in bytes of the cookies sent to peers trying to connect
+ * when the node is under load.
+ */
+#define LLP_COOKIE_LENGTH	16
 /**
  * Defines the size in bytes of a Diffie-Hellman exponent (including the 5 mpint
  * representation bytes).
  */
 #define LLP_X_LENGTH	(32 + MPINT_SIZE_LENGTH + MPINT_SIGNAL_LENGTH)
 /**
- * Defines the size in bytes of a (g^x mod p) computation result.
+ * Defines the maximum size in bytes of a key agreement public value, like the
+ * (g^x mod p) computation result.
  */
 #define LLP_Y_LENGTH	(256 + MPINT_SIZE_LENGTH + MPINT_SIGNAL_LENGTH)
 /**
@@ -64,6 +70,17 @@
  */
 #define LLP_MIN_PADDING_LENGTH	4
 
+/**
+ * Enumeration of the padding policies applied to LLP_DATA packets, ordered
+ * from the least to the most padding. A session uses the policy with more
+ * padding between the ones chosen by each peer.
+ */
+enum llp_padding_policies {
+	LLP_PADDING_BUCKETS = 1,	/**< Pads to the next of a few fixed sizes. */
+	LLP_PADDING_JITTER,			/**< Pads to a fixed size plus random blocks. */
+	LLP_PADDING_FTU				/**< Pads every packet to the FTU. */
+};
+
 /**
  * Enumeration that defines the types of packets used by LLP.
  */
@@ -77,7 +94,18 @@ enum llp_packet_ids {
 	LLP_NODE_HUNT,				/**< requests a list of hosts to connect. */
 	LLP_HUNT_RESULT,			/**< transports a list of hosts to connect. */
 	LLP_KEEP_ALIVE,				/**< detects if connected peers are alive. */
+	LLP_COOKIE,					/**< asks for a request that echoes a cookie. */
+	LLP_COOKIE_ECHO,			/**< carries a cookie and a connection request. */
 	LLP_DATAGRAM = 15,			/**< generic data sent by upper layers. */
+	LLP_DATAGRAMS,				/**< several datagrams packed together. */
+};
+
+/**
+ * Enumeration that defines the kinds of LLP_KEEP_ALIVE packets.
+ */
+enum llp_keep_alive_flags {
+	LLP_KEEP_ALIVE_PROBE,		/**< must be echoed by the peer. */
+	LLP_KEEP_ALIVE_ECHO			/**< answers a probe. */
 };
 
 /**
@@ -91,20 +119,41 @@ enum llp_address_types {
  * Defines the max length in bytes of a LLP_CONNECTION_REQUEST packet.
  */ 
 #define LLP_CONNECTION_REQUEST_MAX_LENGTH							\
-		(3 * sizeof(u_char) + sizeof(u_short) + 3 *					\
+		(4 * sizeof(u_char) + sizeof(u_short) + 4 *					\
 		LLP_FUNCTION_LIST_MAX_LENGTH + LLP_H_LENGTH)
 
 /**
  * Defines the max length in bytes of a LLP_CONNECTION_OK packet.
  */
 #define LLP_CONNECTION_OK_MAX_LENGTH								\
-		(2 * sizeof(u_char) + 3 * LLP_FUNCTION_LIST_MAX_LENGTH +	\
+		(2 * sizeof(u_char) + 2 * sizeof(u_short) +				\
+		4 * LLP_FUNCTION_LIST_MAX_LENGTH +							\
 		LLP_H_LENGTH + LLP_Y_LENGTH)
 		
 /**
  * Defines the max length in bytes of a LLP_KEY_EXCHANGE packet.
  */
-#define LLP_KEY_EXCHANGE_MAX_LENGTH (sizeof(u_char) + LLP_Y_LENGTH)
+#define LLP_KEY_EXCHANGE_MAX_LENGTH										\
+		(sizeof(u_char) + sizeof(u_short) + LLP_Y_LENGTH)
+
+/**
+ * Defines the length in bytes of a LLP_COOKIE packet.
+ */
+#define LLP_COOKIE_PACKET_LENGTH										\
+		(sizeof(u_char) + sizeof(u_short) + LLP_COOKIE_LENGTH)
+
+/**
+ * Defines the max length in bytes of a LLP_COOKIE_ECHO packet, which carries
+ * a whole LLP_CONNECTION_REQUEST packet after the cookie.
+ */
+#define LLP_COOKIE_ECHO_MAX_LENGTH										\
+		(sizeof(u_char) + LLP_COOKIE_LENGTH +							\
+		LLP_CONNECTION_REQUEST_MAX_LENGTH)
+
+/**
+ * Defines the length in bytes of the unencrypted header of a LLP_DATA packet.
+ */
+#define LLP_DATA_HEADER_LENGTH	(sizeof(u_char) + sizeof(u_short))
 
 /**
  * Defines the type os addresses returned in node hunt responses.
@@ -126,13 +175,17 @@ typedef struct {
 	/** Minor version of LLP protocol. */
 	u_char minor_version;
 	/** Session number in host sending this packet. */
-	u_char session; 		
+	u_short session; 		
 	/** List of ciphers supported. */
 	char ciphers[LLP_FUNCTION_LIST_MAX_LENGTH];	
 	/** List of hash functions supported. */
 	char hashes[LLP_FUNCTION_LIST_MAX_LENGTH];
 	/** List of MAC algorithms supported. */
 	char macs[LLP_FUNCTION_LIST_MAX_LENGTH];
+	/** List of key agreement algorithms supported. */
+	char kexes[LLP_FUNCTION_LIST_MAX_LENGTH];
+	/** Padding policy of the host sending this packet. */
+	u_char padding;
 	/** Equals h_out to this host and h_in to remote.*/
 	u_char h[LLP_H_LENGTH];
 } llp_connection_request_p;
@@ -142,15 +195,19 @@ typedef struct {
  */
 typedef struct {
 	/** Session number in initiator node. */
-	u_char session_dst;
+	u_short session_dst;
 	/** Session number in receiver node (this host). */
-	u_char session_src;
+	u_short session_src;
 	/** Chosen cipher algorithm identifier. */
 	char cipher[LLP_FUNCTION_NAME_MAX_LENGTH];
 	/** Chosen hash function identifier. */
 	char hash[LLP_FUNCTION_NAME_MAX_LENGTH];
 	/** Chosen MAC algorithm identifier. */
 	char mac[LLP_FUNCTION_NAME_MAX_LENGTH];
+	/** Chosen key agreement algorithm identifier. */
+	char kex[LLP_FUNCTION_NAME_MAX_LENGTH];
+	/** Padding policy used by the session. */
+	u_char padding;
 	/** Equals h_out to this host and h_in to remote. */
 	u_char h[LLP_H_LENGTH];
 	/** Equals y_out to this host and y_in to remote. */
@@ -162,10 +219,21 @@ typedef struct {
  * of parameters needed by the peers involved generate their keys.
  */
 typedef struct {
-	u_char session;			/**< Session number in remote node (peer). */
+	u_short session;		/**< Session number in remote node (peer). */
 	u_char y[LLP_Y_LENGTH];	/**< Equals y_out to this host and y_in to remote.*/
 } llp_key_exchange_p;
 
+/**
+ * Packet LLP_COOKIE, used by a node under load to ask the initiator to prove
+ * it receives packets at its address before any session is reserved.
+ */
+typedef struct {
+	/** Session number in initiator node. */
+	u_short session;
+	/** Cookie to be echoed with the connection request. */
+	u_char cookie[LLP_COOKIE_LENGTH];
+} llp_cookie_p;
+
 /**
  * Packet LLP_CLOSE_REQUEST, used to request a session close.
  */
@@ -233,7 +301,7 @@ typedef union {
  */
 typedef struct {
 	/** Session number in remote peer (the one that will receive this packet).*/
-	u_char session;
+	u_short session;
 	/** Length of padding added for cipher block size alignment purposes. */
 	u_short padding_length;
 	/** The padding. */
@@ -273,6 +341,8 @@ typedef union {
 	llp_connection_ok_packet_p connection_ok;
 	/** This packet carries a LLP_KEY_EXCHANGE packet. */
 	llp_key_exchange_p key_exchange;
+	/** This packet carries a LLP_COOKIE packet. */
+	llp_cookie_p cookie;
 	/** This packet carries a LLP_DATA packet. */
 	llp_data_p data;
 } llp_packet_content_p;
@@ -299,13 +369,45 @@ typedef union {
  * Macro to simplify packet treatment.
  */
 #define llp_key_exchange		content.key_exchange
+/**
+ * Macro to simplify packet treatment.
+ */
+#define llp_cookie				content.cookie
 /**
  * Macro to simplify packet treatment.
  */
 #define llp_data				content.data
 
 /**
- * Sends a packet to a given host.
+ * Initializes the resources used to send packets.
+ * 
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_packets_initialize();
+
+/**
+ * Frees the resources used to send packets.
+ */
+void llp_packets_finalize();
+
+/**
+ * Starts a send batch in the calling thread. Until llp_end_send_batch() is
+ * called, packets sent by this thread are queued and then transmitted
+ * together, with as few system calls as possible.
+ */
+void llp_begin_send_batch();
+
+/**
+ * Finishes the send batch of the calling thread, transmitting all packets
+ * queued since llp_begin_send_batch().
+ * 
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_end_send_batch();
+
+/**
+ * Sends a packet to a given host. If the calling thread is inside a send
+ * batch, the packet is only queued.
  * 
  * @param address host identifier.
  * @param packet packet data.
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_pool.c Implementations of routines used to manage the pool of
+ * 		packet buffers.
+ * @ingroup llp
+ */
+ 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include <libfreedom/liblog.h>
+#include <libfreedom/layers.h>
+
+#include "llp_pool.h"
+#include "llp.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Number of buffers kept by each thread.
+ */
+#define POOL_CACHE_SIZE		16
+
+/**
+ * Data type that stores the buffers cached by a thread.
+ */
+typedef struct {
+	/** Number of buffers cached. */
+	int size;
+	/** Buffers cached. */
+	u_char *list[POOL_CACHE_SIZE];
+} pool_cache_t;
+
+/*
+ * Memory region holding every preallocated buffer.
+ */
+static u_char *slab = NULL;
+
+/*
+ * Number of preallocated buffers.
+ */
+static int slab_size = 0;
+
+/*
+ * Stack of preallocated buffers not cached by any thread.
+ */
+static u_char **free_list = NULL;
+
+/*
+ * Number of buffers in free_list.
+ */
+static int free_count = 0;
+
+/*
+ * Lock used to access free_list.
+ */
+static pthread_mutex_t pool_mutex;
+
+/*
+ * Key used to find the cache of the calling thread.
+ */
+static pthread_key_t cache_key;
+
+/*@{ */
+/**
+ * Pool counters, updated with atomic operations.
+ */
+static long hits = 0;
+static long misses = 0;
+static int in_use = 0;
+static int high_water = 0;
+/*@} */
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/**
+ * Returns the cache of the calling thread, creating it if needed.
+ * 
+ * @retval NULL         - if the cache could not be created
+ * @return the cache of the calling thread.
+ */
+static pool_cache_t *get_cache();
+
+/**
+ * Moves buffers from the shared stack to a thread cache.
+ * 
+ * @param[in] cache     - the thread cache.
+ * @param[in] number    - number of buffers to be moved.
+ */
+static void fill_cache(pool_cache_t *cache, int number);
+
+/**
+ * Moves buffers from a thread cache to the shared stack.
+ * 
+ * @param[in] cache     - the thread cache.
+ * @param[in] number    - number of buffers to be moved.
+ */
+static void drain_cache(pool_cache_t *cache, int number);
+
+/**
+ * Returns the cached buffers of an exiting thread to the shared stack.
+ * 
+ * @param[in] cache     - the cache of the thread.
+ */
+static void destroy_cache(void *cache);
+
+/**
+ * Updates the number of buffers in use and the high-water mark.
+ * 
+ * @param[in] increment - value to be added to the number of buffers in use.
+ */
+static void add_in_use(int increment);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+int llp_pool_initialize(int size) {
+	int i;
+
+	if (pthread_mutex_init(&pool_mutex, NULL)) {
+		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+
+	if (pthread_key_create(&cache_key, destroy_cache)) {
+		liblog_error(LAYER_LINK, "error creating thread key: %s.",
+				strerror(errno));
+		pthread_mutex_destroy(&pool_mutex);
+		return LLP_ERROR;
+	}
+
+	slab = (u_char *)malloc(size * LLP_BUFFER_LENGTH);
+	free_list = (u_char **)malloc(size * sizeof(u_char *));
+	if (slab == NULL || free_list == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		free(slab);
+		free(free_list);
+		slab = NULL;
+		free_list = NULL;
+		pthread_key_delete(cache_key);
+		pthread_mutex_destroy(&pool_mutex);
+		return LLP_ERROR;
+	}
+
+	for (i = 0; i < size; i++) {
+		free_list[i] = &slab[i * LLP_BUFFER_LENGTH];
+	}
+	slab_size = free_count = size;
+	hits = misses = 0;
+	in_use = high_water = 0;
+
+	liblog_debug(LAYER_LINK, "pool with %d buffers initialized.", size);
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_pool_finalize() {
+	pool_cache_t *cache;
+
+	/* The destructor only runs for exiting threads, so the cache of the
+	 * calling thread is released here. */
+	cache = (pool_cache_t *)pthread_getspecific(cache_key);
+	if (cache != NULL) {
+		destroy_cache(cache);
+		pthread_setspecific(cache_key, NULL);
+	}
+	pthread_key_delete(cache_key);
+
+	pthread_mutex_lock(&pool_mutex);
+	free(slab);
+	free(free_list);
+	slab = NULL;
+	free_list = NULL;
+	slab_size = free_count = 0;
+	pthread_mutex_unlock(&pool_mutex);
+
+	pthread_mutex_destroy(&pool_mutex);
+
+	liblog_debug(LAYER_LINK, "pool finalized.");
+}
+/******************************************************************************/
+u_char *llp_get_buffer() {
+	u_char *buffer = NULL;
+	pool_cache_t *cache;
+
+	cache = get_cache();
+	if (cache != NULL) {
+		if (cache->size == 0) {
+			fill_cache(cache, POOL_CACHE_SIZE / 2);
+		}
+		if (cache->size > 0) {
+			buffer = cache->list[--cache->size];
+		}
+	} else {
+		pthread_mutex_lock(&pool_mutex);
+		if (free_count > 0) {
+			buffer = free_list[--free_count];
+		}
+		pthread_mutex_unlock(&pool_mutex);
+	}
+
+	if (buffer != NULL) {
+		__sync_fetch_and_add(&hits, 1);
+	} else {
+		buffer = (u_char *)malloc(LLP_BUFFER_LENGTH);
+		if (buffer == NULL) {
+			liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+			return NULL;
+		}
+		__sync_fetch_and_add(&misses, 1);
+	}
+	add_in_use(1);
+
+	return buffer;
+}
+/******************************************************************************/
+void llp_free_buffer(u_char *buffer) {
+	pool_cache_t *cache;
+
+	if (buffer == NULL) {
+		return;
+	}
+	add_in_use(-1);
+
+	/* Buffers allocated when the pool was empty are not kept. */
+	if (buffer < slab || buffer >= slab + slab_size * LLP_BUFFER_LENGTH) {
+		free(buffer);
+		return;
+	}
+
+	cache = get_cache();
+	if (cache != NULL) {
+		if (cache->size == POOL_CACHE_SIZE) {
+			drain_cache(cache, POOL_CACHE_SIZE / 2);
+		}
+		cache->list[cache->size++] = buffer;
+	} else {
+		pthread_mutex_lock(&pool_mutex);
+		free_list[free_count++] = buffer;
+		pthread_mutex_unlock(&pool_mutex);
+	}
+}
+/******************************************************************************/
+long llp_get_pool_hits() {
+	return hits;
+}
+/******************************************************************************/
+long llp_get_pool_misses() {
+	return misses;
+}
+/******************************************************************************/
+int llp_get_pool_high_water() {
+	return high_water;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+pool_cache_t *get_cache() {
+	pool_cache_t *cache;
+
+	cache = (pool_cache_t *)pthread_getspecific(cache_key);
+	if (cache == NULL) {
+		cache = (pool_cache_t *)malloc(sizeof(pool_cache_t));
+		if (cache == NULL) {
+			/* The shared stack is used directly. */
+			liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+			return NULL;
+		}
+		cache->size = 0;
+		pthread_setspecific(cache_key, cache);
+	}
+
+	return cache;
+}
+/******************************************************************************/
+void fill_cache(pool_cache_t *cache, int number) {
+
+	pthread_mutex_lock(&pool_mutex);
+	while (number-- > 0 && free_count > 0) {
+		cache->list[cache->size++] = free_list[--free_count];
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+/******************************************************************************/
+void drain_cache(pool_cache_t *cache, int number) {
+
+	pthread_mutex_lock(&pool_mutex);
+	while (number-- > 0 && cache->size > 0) {
+		free_list[free_count++] = cache->list[--cache->size];
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+/******************************************************************************/
+void destroy_cache(void *cache) {
+
+	/* Buffers of a finalized pool don't exist anymore. */
+	if (slab != NULL) {
+		drain_cache((pool_cache_t *)cache, POOL_CACHE_SIZE);
+	}
+	free(cache);
+}
+/******************************************************************************/
+void add_in_use(int increment) {
+	int current;
+	int mark;
+
+	current = __sync_add_and_fetch(&in_use, increment);
+	mark = high_water;
+	while (current > mark) {
+		if (__sync_bool_compare_and_swap(&high_water, mark, current)) {
+			break;
+		}
+		mark = high_water;
+	}
+}
+/******************************************************************************/
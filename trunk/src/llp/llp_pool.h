@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_pool.h Headers of routines used to manage the pool of packet
+ * 		buffers.
+ * @ingroup llp
+ */
+ 
+#ifndef _LLP_POOL_H_
+#define _LLP_POOL_H_
+
+#include <libfreedom/types.h>
+#include <libfreedom/liblog.h>
+
+/**
+ * Length in bytes of a packet buffer. Holds a full LLP_DATA packet: one FTU
+ * of data plus framing, padding alignment and MAC.
+ */
+#define LLP_BUFFER_LENGTH	(LIBFREEDOM_FTU + 256)
+
+/**
+ * Allocates the buffers of the pool.
+ * 
+ * @param size number of buffers preallocated.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_pool_initialize(int size);
+
+/**
+ * Frees the buffers of the pool.
+ */
+void llp_pool_finalize();
+
+/**
+ * Takes a buffer of LLP_BUFFER_LENGTH bytes from the pool. The buffers
+ * recently released by the calling thread are reused first; if the pool is
+ * empty, a new buffer is allocated.
+ * 
+ * @return the buffer, or NULL if no memory is available.
+ */
+u_char *llp_get_buffer();
+
+/**
+ * Returns a buffer to the pool. NULL is ignored.
+ * 
+ * @param buffer buffer obtained with llp_get_buffer().
+ */
+void llp_free_buffer(u_char *buffer);
+
+/**
+ * Returns the number of buffers served without allocating memory.
+ * 
+ * @return number of pool hits.
+ */
+long llp_get_pool_hits();
+
+/**
+ * Returns the number of buffers that had to be allocated because the pool
+ * was empty.
+ * 
+ * @return number of pool misses.
+ */
+long llp_get_pool_misses();
+
+/**
+ * Returns the maximum number of buffers in use at the same time.
+ * 
+ * @return the pool high-water mark.
+ */
+int llp_get_pool_high_water();
+
+#endif /* !_LLP_POOL_H_ */
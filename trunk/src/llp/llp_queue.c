@@ -25,10 +25,20 @@
  * @ingroup llp
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <libfreedom/liblog.h>
 #include <util/util.h>
-#include <util/util_queue.h>
 
 #include "llp_queue.h"
+#include "llp_sessions.h"
+#include "llp_config.h"
+#include "llp_pool.h"
 #include "llp.h"
 
 /*============================================================================*/
@@ -36,51 +46,433 @@
 /*============================================================================*/
 
 /*
- * Size of the queue used to store received datagrams.
+ * Number of bits in each word of the readiness bitmap.
+ */
+#define WORD_BITS		(8 * sizeof(unsigned long))
+
+/*
+ * Number of words in the readiness bitmap.
+ */
+#define READY_WORDS		(LLP_MAX_SESSIONS / WORD_BITS)
+
+/*
+ * Datagram stored in a receive ring.
+ */
+typedef struct {
+	u_char *data;			/* Pool buffer holding the datagram. */
+	int length;				/* Length in bytes of the datagram. */
+} slot_t;
+
+/*
+ * Single producer, single consumer ring holding the datagrams received by a
+ * session. The producer is the thread handling the session packets, which
+ * holds the session lock, and the consumer is whoever holds ready_mutex.
+ */
+typedef struct {
+	slot_t *slots;			/* Slots, allocated with the first datagram. */
+	unsigned capacity;		/* Number of slots, a power of two. */
+	int depth;				/* Number of slots that can be used. */
+	volatile unsigned head;	/* Datagrams taken, written by the consumer. */
+	volatile unsigned tail;	/* Datagrams stored, written by the producer. */
+	long enqueued;			/* Datagrams stored, for statistics. */
+	long dequeued;			/* Datagrams read, for statistics. */
+	long dropped;			/* Datagrams dropped, for statistics. */
+	int high_water;			/* Largest number of datagrams held. */
+} ring_t;
+
+/*
+ * Receive rings, one for each session.
  */
-#define LLP_QUEUE_SIZE	64
+static ring_t *rings;
 
 /*
- * Queue used to store received datagrams
+ * Readiness bitmap, with the bits of sessions whose ring has datagrams set.
  */
-static util_queue_t queue;
+static volatile unsigned long ready[READY_WORDS];
+
+/*
+ * Last session read, the search for the next ready session starts after it.
+ */
+static int cursor;
+
+/*
+ * Mutex serializing the readers of the rings.
+ */
+static pthread_mutex_t ready_mutex;
+
+/*
+ * Condition signaled when a session becomes ready.
+ */
+static pthread_cond_t ready_condition;
+
+/*
+ * Condition signaled when a datagram is read, for receivers waiting for room.
+ */
+static pthread_cond_t room_condition;
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Marks a session as having datagrams to be read, waking a blocked reader if
+ * the session was not ready.
+ * 
+ * @param session - the session identifier.
+ */
+static void set_ready(int session);
+
+/*
+ * Finds the first ready session after the last session read, wrapping around
+ * the bitmap.
+ * 
+ * @return the session identifier, or LLP_ERROR if no session is ready.
+ */
+static int next_ready();
+
+/*
+ * Makes room in the full ring of a session following the receive policy.
+ * 
+ * @param session - the session identifier.
+ * @return LLP_OK if the ring has room now, LLP_ERROR otherwise.
+ */
+static int make_room(int session);
+
+/*
+ * Takes the oldest datagram from the ring of the next ready session. Must be
+ * called with ready_mutex locked.
+ * 
+ * @param session - pointer to store the session that received the datagram.
+ * @param datagram - array that will receive the data, or NULL to discard it.
+ * @param max - size of datagram.
+ * @param block - wait for a datagram if no session is ready or not.
+ * @return the length in bytes of the datagram copied, or LLP_ERROR if no 
+ * datagram was available.
+ */
+static int take_datagram(int *session, u_char *datagram, int max, int block);
 
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/
 
 int llp_queue_initialize() {
-	int return_value;
-	
-	return_value = util_initialize_queue(&queue, LLP_QUEUE_SIZE);
-	return (return_value == UTIL_OK ? LLP_OK : LLP_ERROR);
+	int i;
+
+	rings = (ring_t *)calloc(LLP_MAX_SESSIONS, sizeof(ring_t));
+	if (rings == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+
+	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+		rings[i].depth = llp_get_receive_queue_depth();
+	}
+	memset((void *)ready, 0, sizeof(ready));
+	cursor = LLP_MAX_SESSIONS - 1;
+
+	if (pthread_mutex_init(&ready_mutex, NULL)) {
+		liblog_fatal(LAYER_LINK, "error initializing mutex.");
+		free(rings);
+		return LLP_ERROR;
+	}
+	if (pthread_cond_init(&ready_condition, NULL)) {
+		liblog_fatal(LAYER_LINK, "error initializing condition.");
+		pthread_mutex_destroy(&ready_mutex);
+		free(rings);
+		return LLP_ERROR;
+	}
+	if (pthread_cond_init(&room_condition, NULL)) {
+		liblog_fatal(LAYER_LINK, "error initializing condition.");
+		pthread_cond_destroy(&ready_condition);
+		pthread_mutex_destroy(&ready_mutex);
+		free(rings);
+		return LLP_ERROR;
+	}
+
+	return LLP_OK;
 }
 /******************************************************************************/
 void llp_queue_finalize() {
-	util_finalize_queue(&queue);
+	int i;
+
+	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+		if (rings[i].slots == NULL) {
+			continue;
+		}
+		while (rings[i].head != rings[i].tail) {
+			llp_free_buffer(
+					rings[i].slots[rings[i].head & (rings[i].capacity - 1)].data);
+			rings[i].head++;
+		}
+		free(rings[i].slots);
+	}
+	free(rings);
+	rings = NULL;
+
+	pthread_cond_destroy(&room_condition);
+	pthread_cond_destroy(&ready_condition);
+	pthread_mutex_destroy(&ready_mutex);
 }
 /******************************************************************************/ 
 int llp_enqueue_datagram(int session, u_char *datagram, int length) {
-	int return_value;
-	
-	/* We are using the tag pointer to store the session number. */
-	return_value = util_enqueue(&queue, (void *)session, datagram, length);
-	return (return_value == UTIL_OK ? LLP_OK : LLP_ERROR);
+	ring_t *ring;
+	slot_t *slot;
+
+	ring = &rings[session];
+
+	if (length > LLP_BUFFER_LENGTH) {
+		liblog_error(LAYER_LINK, "datagram too big, packet dropped.");
+		return LLP_ERROR;
+	}
+
+	/* Slots are only allocated for sessions that receive datagrams. */
+	if (ring->slots == NULL) {
+		ring->capacity = 1;
+		while (ring->capacity < LLP_MAX_RECEIVE_QUEUE_DEPTH &&
+				ring->capacity < llp_get_receive_queue_depth()) {
+			ring->capacity <<= 1;
+		}
+		ring->slots = (slot_t *)malloc(ring->capacity * sizeof(slot_t));
+		if (ring->slots == NULL) {
+			liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+			return LLP_ERROR;
+		}
+	}
+
+	if (ring->tail - ring->head >= (unsigned)ring->depth &&
+			make_room(session) == LLP_ERROR) {
+		ring->dropped++;
+		liblog_debug(LAYER_LINK, "receive ring full, datagram dropped.");
+		return LLP_ERROR;
+	}
+
+	slot = &ring->slots[ring->tail & (ring->capacity - 1)];
+	slot->data = llp_get_buffer();
+	if (slot->data == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+	memcpy(slot->data, datagram, length);
+	slot->length = length;
+
+	/* The slot must be complete before the consumer can see it. */
+	__sync_synchronize();
+	ring->tail++;
+
+	ring->enqueued++;
+	if (ring->tail - ring->head > (unsigned)ring->high_water) {
+		ring->high_water = ring->tail - ring->head;
+	}
+
+	set_ready(session);
+
+	return LLP_OK;
 }
 /******************************************************************************/
 int llp_dequeue_datagram(int *session, u_char *datagram, int max) {
 	int return_value;
-	
-	/* We are using the tag pointer to store the session number. */
-	return_value = util_dequeue(&queue, (void **)session, datagram, max);
-	return (return_value == UTIL_ERROR ? LLP_ERROR : return_value);
+
+	pthread_mutex_lock(&ready_mutex);
+	return_value = take_datagram(session, datagram, max, 1);
+	pthread_mutex_unlock(&ready_mutex);
+
+	return return_value;
 }
 /******************************************************************************/
 int llp_try_dequeue_datagram(int *session, u_char *datagram, int max) {
 	int return_value;
-	
-	/* We are using the tag pointer to store the session number. */
-	return_value = util_try_dequeue(&queue, (void **)session, datagram, max);
-	return (return_value == UTIL_ERROR ? LLP_ERROR : return_value);
+
+	pthread_mutex_lock(&ready_mutex);
+	return_value = take_datagram(session, datagram, max, 0);
+	pthread_mutex_unlock(&ready_mutex);
+
+	return return_value;
+}
+/******************************************************************************/
+int llp_set_queue_depth(int session, int depth) {
+	if (depth < 1 || depth > llp_get_receive_queue_depth()) {
+		liblog_error(LAYER_LINK, "receive ring depth must be between 1 and %d.",
+				llp_get_receive_queue_depth());
+		return LLP_ERROR;
+	}
+
+	rings[session].depth = depth;
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_reset_queue(int session) {
+	ring_t *ring;
+
+	ring = &rings[session];
+
+	/* Datagrams left by the closed session must not reach the new peer.
+	 * Readers are locked out while the ring is drained. */
+	pthread_mutex_lock(&ready_mutex);
+	if (ring->slots != NULL) {
+		while (ring->head != ring->tail) {
+			llp_free_buffer(ring->slots[ring->head &
+					(ring->capacity - 1)].data);
+			ring->head++;
+		}
+	}
+	__sync_fetch_and_and(&ready[session / WORD_BITS],
+			~(1UL << (session % WORD_BITS)));
+	pthread_mutex_unlock(&ready_mutex);
+
+	rings[session].depth = llp_get_receive_queue_depth();
+	rings[session].enqueued = 0;
+	rings[session].dequeued = 0;
+	rings[session].dropped = 0;
+	rings[session].high_water = 0;
+}
+/******************************************************************************/
+void llp_get_queue_stats(int session, llp_queue_stats_t *stats) {
+	stats->enqueued = rings[session].enqueued;
+	stats->dequeued = rings[session].dequeued;
+	stats->dropped = rings[session].dropped;
+	stats->high_water = rings[session].high_water;
+	stats->length = rings[session].tail - rings[session].head;
+	stats->depth = rings[session].depth;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+void set_ready(int session) {
+	unsigned long bit;
+	unsigned long old;
+
+	bit = 1UL << (session % WORD_BITS);
+	old = __sync_fetch_and_or(&ready[session / WORD_BITS], bit);
+
+	/* Readers only wait when no bit is set, so only new bits wake them. */
+	if (!(old & bit)) {
+		pthread_mutex_lock(&ready_mutex);
+		pthread_cond_signal(&ready_condition);
+		pthread_mutex_unlock(&ready_mutex);
+	}
+}
+/******************************************************************************/
+int next_ready() {
+	int first;
+	int word;
+	int i;
+	unsigned long bits;
+
+	first = (cursor + 1) % LLP_MAX_SESSIONS;
+	word = first / WORD_BITS;
+	bits = ready[word] & (~0UL << (first % WORD_BITS));
+
+	/* The first word is visited twice, for the bits before the cursor. */
+	for (i = 0; i <= READY_WORDS; i++) {
+		if (bits != 0) {
+			return word * WORD_BITS + __builtin_ctzl(bits);
+		}
+		word = (word + 1) % READY_WORDS;
+		bits = ready[word];
+	}
+
+	return LLP_ERROR;
+}
+/******************************************************************************/
+int make_room(int session) {
+	ring_t *ring;
+	struct timespec deadline;
+	int return_value;
+
+	ring = &rings[session];
+
+	/* Readers are locked out, so the producer can move the head too. */
+	pthread_mutex_lock(&ready_mutex);
+
+	switch (llp_get_receive_queue_policy()) {
+		case LLP_RECEIVE_DROP_OLDEST:
+			if (ring->tail - ring->head >= (unsigned)ring->depth) {
+				llp_free_buffer(ring->slots[ring->head &
+						(ring->capacity - 1)].data);
+				ring->head++;
+				ring->dropped++;
+			}
+			return_value = LLP_OK;
+			break;
+		case LLP_RECEIVE_BLOCK:
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += llp_get_receive_queue_timeout() / 1000;
+			deadline.tv_nsec += 
+					(llp_get_receive_queue_timeout() % 1000) * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			return_value = LLP_OK;
+			while (ring->tail - ring->head >= (unsigned)ring->depth) {
+				if (pthread_cond_timedwait(&room_condition, &ready_mutex, 
+						&deadline) == ETIMEDOUT) {
+					return_value = (ring->tail - ring->head < 
+							(unsigned)ring->depth ? LLP_OK : LLP_ERROR);
+					break;
+				}
+			}
+			break;
+		default:
+			return_value = LLP_ERROR;
+	}
+
+	pthread_mutex_unlock(&ready_mutex);
+
+	return return_value;
+}
+/******************************************************************************/
+int take_datagram(int *session, u_char *datagram, int max, int block) {
+	ring_t *ring;
+	slot_t *slot;
+	int length;
+	int ready_session;
+
+	while ((ready_session = next_ready()) == LLP_ERROR) {
+		if (!block) {
+			return LLP_ERROR;
+		}
+		pthread_cond_wait(&ready_condition, &ready_mutex);
+	}
+
+	ring = &rings[ready_session];
+
+	/* The slot is read only after its position was published. */
+	__sync_synchronize();
+	slot = &ring->slots[ring->head & (ring->capacity - 1)];
+	length = slot->length;
+	if (datagram != NULL) {
+		if (length > max) {
+			length = max;
+		}
+		memcpy(datagram, slot->data, length);
+	}
+	llp_free_buffer(slot->data);
+	__sync_synchronize();
+	ring->head++;
+	ring->dequeued++;
+
+	if (llp_get_receive_queue_policy() == LLP_RECEIVE_BLOCK) {
+		pthread_cond_broadcast(&room_condition);
+	}
+
+	/* The bit is set again if the producer stored a datagram meanwhile. */
+	if (ring->head == ring->tail) {
+		__sync_fetch_and_and(&ready[ready_session / WORD_BITS],
+				~(1UL << (ready_session % WORD_BITS)));
+		__sync_synchronize();
+		if (ring->head != ring->tail) {
+			__sync_fetch_and_or(&ready[ready_session / WORD_BITS],
+					1UL << (ready_session % WORD_BITS));
+		}
+	}
+
+	/* The next read starts after this session, for fairness. */
+	cursor = ready_session;
+	*session = ready_session;
+
+	return length;
 }
 /******************************************************************************/
@@ -29,7 +29,48 @@
 #define _LLP_QUEUE_H_
 
 /**
- * Initializes the queue, allocating needed memory.
+ * Maximum number of datagrams held by the receive ring of a session.
+ */
+#define LLP_MAX_RECEIVE_QUEUE_DEPTH	1024
+
+/**
+ * Maximum time a receiver waits for room in a receive ring, in milliseconds.
+ */
+#define LLP_MAX_RECEIVE_QUEUE_TIMEOUT	10000
+
+/**
+ * Enumeration of the behaviours of the receivers when the receive ring of the
+ * session is full.
+ */
+enum llp_receive_policies {
+	LLP_RECEIVE_DROP_NEWEST = 1,	/**< The new datagram is dropped. */
+	LLP_RECEIVE_DROP_OLDEST,		/**< The oldest datagram is dropped. */
+	LLP_RECEIVE_BLOCK				/**< The receiver waits for room, until a 
+										timeout. */
+};
+
+/**
+ * Counters of a session receive ring.
+ */
+typedef struct {
+	/** Number of datagrams stored in the ring. */
+	long enqueued;
+	/** Number of datagrams read from the ring. */
+	long dequeued;
+	/** Number of datagrams dropped because the ring was full. */
+	long dropped;
+	/** Largest number of datagrams held by the ring. */
+	int high_water;
+	/** Number of datagrams held by the ring now. */
+	int length;
+	/** Number of datagrams the ring can hold. */
+	int depth;
+} llp_queue_stats_t;
+
+/**
+ * Initializes the receive rings of the sessions, allocating needed memory.
+ * Each session stores its datagrams in its own ring, and readers take them
+ * from the sessions with datagrams in round robin order.
  */
 int llp_queue_initialize();
 
@@ -75,4 +116,31 @@ int llp_dequeue_datagram(int *session, u_char *datagram, int max);
  */
 int llp_try_dequeue_datagram(int *session, u_char *datagram, int max);
 
+/**
+ * Sets the number of received datagrams the given session can hold until they
+ * are read. The depth can't be larger than the configured receive ring depth.
+ * 
+ * @param session session identifier.
+ * @param depth new depth of the session receive ring.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_set_queue_depth(int session, int depth);
+
+/**
+ * Drops the datagrams left in the given session receive ring, restores its
+ * configured depth and clears its counters. Used when the session identifier
+ * is reused, with the session locked.
+ * 
+ * @param session session identifier.
+ */
+void llp_reset_queue(int session);
+
+/**
+ * Copies the counters of the given session receive ring to stats.
+ * 
+ * @param session session identifier.
+ * @param stats structure that will receive the counters.
+ */
+void llp_get_queue_stats(int session, llp_queue_stats_t *stats);
+
 #endif /* !_LLP_QUEUE_H_ */
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/mman.h>
 
 #include <pthread.h>
 #include <openssl/bn.h>
@@ -43,6 +44,9 @@
 #include "llp_handshake.h"
 #include "llp_nodes.h"
 #include "llp_info.h"
+#include "llp_pool.h"
+#include "llp_config.h"
+#include "llp_queue.h"
 
 /*============================================================================*/
 /* Private data definitions.                                                  */
@@ -53,6 +57,63 @@
  */
 static void (*close_handler)(int session) = NULL;
 
+/*
+ * Number of sessions initialized at once when more sessions are needed.
+ */
+#define SESSIONS_SLAB	256
+
+/*
+ * Stack of closed sessions without pending jobs, ready to be reused.
+ */
+static int *free_sessions = NULL;
+
+/*
+ * Number of sessions in the free sessions stack.
+ */
+static int free_sessions_count = 0;
+
+/*
+ * Number of sessions already initialized.
+ */
+static int sessions_count = 0;
+
+/*
+ * Lock used to access the free sessions stack and to initialize new slabs.
+ */
+static pthread_mutex_t free_sessions_mutex;
+
+/*
+ * First and last sessions of each session list.
+ */
+static int list_heads[LLP_SESSION_LISTS];
+static int list_tails[LLP_SESSION_LISTS];
+
+/*
+ * Lock used to access the session lists.
+ */
+static pthread_mutex_t lists_mutex;
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Initializes a new slab of sessions and pushes them onto the free sessions
+ * stack. Must be called with free_sessions_mutex locked.
+ * 
+ * @retval LLP_OK       - if no errors occurred.
+ * @retval LLP_ERROR    - if no more sessions can be initialized.
+ */
+static int grow_sessions();
+
+/*
+ * Pushes a closed session onto the free sessions stack, unless it is already
+ * there.
+ * 
+ * @param[in] session   - the session released.
+ */
+static void release_session(int session);
+
 /*============================================================================*/
 /* Public data definitions.                                                   */
 /*============================================================================*/
@@ -66,9 +127,9 @@ char *llp_states[] = {
 		"TIME WAIT"
 };
 
-llp_session_t llp_sessions[LLP_MAX_SESSIONS];
+llp_session_t *llp_sessions = NULL;
 
-pthread_mutex_t llp_sessions_mutexes[LLP_MAX_SESSIONS];
+pthread_mutex_t *llp_sessions_mutexes = NULL;
 
 /*============================================================================*/
 /* Public functions implementations.                                          */
@@ -76,23 +137,43 @@ pthread_mutex_t llp_sessions_mutexes[LLP_MAX_SESSIONS];
 
 int llp_sessions_initialize() {
 	int i;
-	
-	/* Initializing session information. */
-	memset(llp_sessions, 0, sizeof(llp_sessions));
-	
-	liblog_debug(LAYER_LINK, "session information initialized.");
 
-	/* Creating mutexes. */
+	/* Address space is reserved for all sessions, but memory is only used by
+	 * the slabs initialized. Anonymous mappings are already zeroed. */
+	llp_sessions = (llp_session_t *)mmap(NULL,
+			LLP_MAX_SESSIONS * sizeof(llp_session_t), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	llp_sessions_mutexes = (pthread_mutex_t *)mmap(NULL,
+			LLP_MAX_SESSIONS * sizeof(pthread_mutex_t), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (llp_sessions == MAP_FAILED || llp_sessions_mutexes == MAP_FAILED) {
+		liblog_fatal(LAYER_LINK, "error in mmap: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
 
-	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
-		if (pthread_mutex_init(&llp_sessions_mutexes[i], NULL) > 0) {
-			liblog_error(LAYER_LINK, "error allocating mutex: %s.",
-					strerror(errno));
-			return LLP_ERROR;
-		}
+	free_sessions = (int *)malloc(LLP_MAX_SESSIONS * sizeof(int));
+	if (free_sessions == NULL) {
+		liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+	free_sessions_count = 0;
+	sessions_count = 0;
+
+	if (pthread_mutex_init(&free_sessions_mutex, NULL) ||
+			pthread_mutex_init(&lists_mutex, NULL)) {
+		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+	for (i = 0; i < LLP_SESSION_LISTS; i++) {
+		list_heads[i] = list_tails[i] = LLP_ERROR;
+	}
+
+	/* The first slab is always there. */
+	if (grow_sessions() == LLP_ERROR) {
+		return LLP_ERROR;
 	}
 	
-	liblog_debug(LAYER_LINK, "mutex initialized.");
+	liblog_debug(LAYER_LINK, "session information initialized.");
 	
 	return LLP_OK;
 }
@@ -100,7 +181,7 @@ int llp_sessions_initialize() {
 void llp_sessions_finalize() {
 	int i;
 	
-	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+	for (i = 0; i < sessions_count; i++) {
 		pthread_mutex_lock(&llp_sessions_mutexes[i]);
 		llp_close_session(i);
 		pthread_mutex_unlock(&llp_sessions_mutexes[i]);		
@@ -108,9 +189,19 @@ void llp_sessions_finalize() {
 	
 	liblog_debug(LAYER_LINK, "session information resources freed.");
 	
-	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
+	for (i = 0; i < sessions_count; i++) {
 		pthread_mutex_destroy(&llp_sessions_mutexes[i]);
 	}
+	pthread_mutex_destroy(&free_sessions_mutex);
+	pthread_mutex_destroy(&lists_mutex);
+
+	munmap(llp_sessions, LLP_MAX_SESSIONS * sizeof(llp_session_t));
+	munmap(llp_sessions_mutexes, LLP_MAX_SESSIONS * sizeof(pthread_mutex_t));
+	free(free_sessions);
+	llp_sessions = NULL;
+	llp_sessions_mutexes = NULL;
+	free_sessions = NULL;
+	sessions_count = free_sessions_count = 0;
 	
 	liblog_debug(LAYER_LINK, "resources freed.");
 	
@@ -348,6 +439,10 @@ int llp_set_verifier(int session, u_char *verifier) {
 }
 /******************************************************************************/
 void llp_close_session(int session) {
+	int was_open;
+	int i;
+
+	was_open = (llp_sessions[session].state != LLP_STATE_CLOSED);
 	
 	if (llp_sessions[session].cipher_in_key != NULL) {
 		liblog_debug(LAYER_LINK,
@@ -391,6 +486,18 @@ void llp_close_session(int session) {
 		llp_sessions[session].mac_out_key = NULL;
 	}
 	
+	if (llp_sessions[session].crypto_in != NULL) {
+		liblog_debug(LAYER_LINK, "freeing crypto context of incoming traffic.");
+		llp_destroy_crypto(llp_sessions[session].crypto_in);
+		llp_sessions[session].crypto_in = NULL;
+	}
+
+	if (llp_sessions[session].crypto_out != NULL) {
+		liblog_debug(LAYER_LINK, "freeing crypto context of outgoing traffic.");
+		llp_destroy_crypto(llp_sessions[session].crypto_out);
+		llp_sessions[session].crypto_out = NULL;
+	}
+	
 	if (llp_sessions[session].verifier != NULL) {
 		liblog_debug(LAYER_LINK,
 				"freeing memory allocated to verifier.");
@@ -398,9 +505,32 @@ void llp_close_session(int session) {
 		llp_sessions[session].verifier = NULL;
 	}
 	
+	/* Datagrams not sent yet are lost with the session. */
+	if (llp_sessions[session].coalesced != NULL) {
+		llp_free_buffer(llp_sessions[session].coalesced);
+		llp_sessions[session].coalesced = NULL;
+	}
+	if (llp_sessions[session].send_ring != NULL) {
+		for (i = 0; i < llp_sessions[session].send_count; i++) {
+			llp_free_buffer(llp_sessions[session].send_ring[
+					(llp_sessions[session].send_head + i)
+					% llp_get_send_queue_depth()].data);
+		}
+		free(llp_sessions[session].send_ring);
+		llp_sessions[session].send_ring = NULL;
+		llp_sessions[session].send_count = 0;
+	}
+
 	llp_sessions[session].state = LLP_STATE_CLOSED;
+	llp_stop_timers(session);
 	llp_set_node_inactive(session);	
 
+	/* A pending job still refers to the session, it releases the session when
+	 * it finishes. */
+	if (was_open && !llp_sessions[session].job_pending) {
+		release_session(session);
+	}
+
 	/* Calling the registered callback function. */
 	if (close_handler != NULL) {
 		close_handler(session);
@@ -410,23 +540,101 @@ void llp_close_session(int session) {
 }
 /******************************************************************************/
 int llp_get_free_session(int next_state) {
-	int i;
-	int found = 0;
-
-	for (i = 0; i < LLP_MAX_SESSIONS && !found; i++) {
-		if (pthread_mutex_trylock(&llp_sessions_mutexes[i]) != EBUSY) {
-			if (llp_sessions[i].state == LLP_STATE_CLOSED) {
-				liblog_debug(LAYER_LINK, "free session %d found.", i);
-				llp_sessions[i].state = next_state;
-				llp_sessions[i].hunt_time = 0;
-				llp_sessions[i].silence = 0;				
-				found = 1;
-			}
-			pthread_mutex_unlock(&llp_sessions_mutexes[i]);
+	int session;
+
+	pthread_mutex_lock(&free_sessions_mutex);
+	if (free_sessions_count == 0 && grow_sessions() == LLP_ERROR) {
+		pthread_mutex_unlock(&free_sessions_mutex);
+		return LLP_ERROR;
+	}
+	session = free_sessions[--free_sessions_count];
+	llp_sessions[session].released = 0;
+	pthread_mutex_unlock(&free_sessions_mutex);
+
+	/* The session lock is never requested with the stack locked. */
+	pthread_mutex_lock(&llp_sessions_mutexes[session]);
+	liblog_debug(LAYER_LINK, "free session %d found.", session);
+	llp_sessions[session].state = next_state;
+	llp_sessions[session].hunt_time = 0;
+	llp_sessions[session].packets_sent = 0;
+	llp_sessions[session].packets_received = 0;
+	llp_sessions[session].payload_bytes = 0;
+	llp_sessions[session].padding_bytes = 0;
+	llp_sessions[session].send_dropped = 0;
+	llp_reset_queue(session);
+	llp_sessions[session].probe_time = 0;
+	llp_sessions[session].cookie_echoed = 0;
+	pthread_mutex_unlock(&llp_sessions_mutexes[session]);
+	
+	return session;
+}
+/******************************************************************************/
+void llp_finish_job(int session) {
+
+	llp_sessions[session].job_pending = 0;
+
+	/* The session was closed while the job was pending. */
+	if (llp_sessions[session].state == LLP_STATE_CLOSED) {
+		release_session(session);
+	}
+}
+/******************************************************************************/
+int llp_get_sessions_count() {
+	return __sync_add_and_fetch(&sessions_count, 0);
+}
+/******************************************************************************/
+int llp_get_used_sessions_count() {
+	int used;
+
+	pthread_mutex_lock(&free_sessions_mutex);
+	used = sessions_count - free_sessions_count;
+	pthread_mutex_unlock(&free_sessions_mutex);
+
+	return used;
+}
+/******************************************************************************/
+int llp_add_to_list(int list, int session) {
+	int was_empty;
+
+	pthread_mutex_lock(&lists_mutex);
+	was_empty = (list_heads[list] == LLP_ERROR);
+	if (!llp_sessions[session].listed[list]) {
+		llp_sessions[session].listed[list] = 1;
+		llp_sessions[session].next_listed[list] = LLP_ERROR;
+		if (was_empty) {
+			list_heads[list] = session;
+		} else {
+			llp_sessions[list_tails[list]].next_listed[list] = session;
 		}
+		list_tails[list] = session;
 	}
-	
-	return (found ? (i - 1) : LLP_ERROR);
+	pthread_mutex_unlock(&lists_mutex);
+
+	return was_empty;
+}
+/******************************************************************************/
+int llp_take_from_list(int list) {
+	int session;
+
+	pthread_mutex_lock(&lists_mutex);
+	session = list_heads[list];
+	if (session != LLP_ERROR) {
+		list_heads[list] = llp_sessions[session].next_listed[list];
+		llp_sessions[session].listed[list] = 0;
+	}
+	pthread_mutex_unlock(&lists_mutex);
+
+	return session;
+}
+/******************************************************************************/
+int llp_is_list_empty(int list) {
+	int empty;
+
+	pthread_mutex_lock(&lists_mutex);
+	empty = (list_heads[list] == LLP_ERROR);
+	pthread_mutex_unlock(&lists_mutex);
+
+	return empty;
 }
 /******************************************************************************/
 int llp_get_last_error(int session) {
@@ -440,51 +648,46 @@ int llp_get_last_error(int session) {
 }
 /******************************************************************************/
 void llp_handle_timeouts() {
-	int i;
+	int session;
+	int timer;
+	int (*action)(int session);
 	
-	for (i = 0; i < LLP_MAX_SESSIONS; i++) {
-		/* If timeout is zero, the timeout is disabled. */
-		if (pthread_mutex_trylock(&llp_sessions_mutexes[i]) == 0) {
-			if (llp_sessions[i].state == LLP_STATE_CLOSED) {
-				pthread_mutex_unlock(&llp_sessions_mutexes[i]);
-				continue;
-			}
-			if (llp_sessions[i].timeout > 0) {
-				llp_sessions[i].timeout--;
-				if (llp_sessions[i].timeout == 0) {
-					liblog_debug(LAYER_LINK, "session %d timed out.", i);
-					llp_close_session(i);
+	llp_advance_timers();
+
+	/* Each session is returned locked. */
+	while (llp_get_expired_timer(&session, &timer) == LLP_OK) {
+		action = NULL;
+		switch (timer) {
+			case LLP_TIMER_TIMEOUT:
+				if (llp_sessions[session].state != LLP_STATE_CLOSED) {
+					liblog_debug(LAYER_LINK, "session %d timed out.", session);
+					llp_close_session(session);
 				}
-			}
-			/* Seeing if this session is expired. */
-			llp_sessions[i].alive++;
-			if (llp_sessions[i].alive >= (llp_get_expiration_time() *
-					LLP_TIME_TICKS_PER_SECOND)) {
-				liblog_debug(LAYER_LINK, "session %d expired out.", i);
-				llp_disconnect(i);
-			}				
-			pthread_mutex_unlock(&llp_sessions_mutexes[i]);
-		}
-	}
-}
-/******************************************************************************/
-void llp_handle_silence() {
-	int i;
-	
-	for (i = LLP_MAX_SESSIONS-1; i >= 0; i--) {
-		/* If timeout is zero, the timeout is disabled. */
-		if (pthread_mutex_trylock(&llp_sessions_mutexes[i]) == 0) {
-			llp_sessions[i].silence++;
-			if (llp_sessions[i].silence >= LLP_T_SILENT) {
-				if (llp_sessions[i].state == LLP_STATE_ESTABLISHED) {
-					llp_keep_session_alive(i);	
-				} else {
-					if (llp_sessions[i].state == LLP_STATE_CLOSE_WAIT) {
-						llp_disconnect(i);
-					}
+				break;
+			case LLP_TIMER_SILENCE:
+				if (llp_sessions[session].state == LLP_STATE_ESTABLISHED) {
+					action = llp_keep_session_alive;
+				} else if (llp_sessions[session].state == LLP_STATE_CLOSE_WAIT) {
+					action = llp_disconnect;
 				}
-			}
-			pthread_mutex_unlock(&llp_sessions_mutexes[i]);
+				/* Sending a packet pushes the timer back, if it fails the
+				 * packet is sent again in the next tick. */
+				if (action != NULL) {
+					llp_set_timer(session, LLP_TIMER_SILENCE, 1);
+				}
+				break;
+			case LLP_TIMER_EXPIRATION:
+				if (llp_sessions[session].state == LLP_STATE_ESTABLISHED) {
+					liblog_debug(LAYER_LINK, "session %d expired out.", session);
+					action = llp_disconnect;
+				}
+				break;
+		}
+		llp_unlock_session(session);
+
+		/* These functions lock the session again. */
+		if (action != NULL) {
+			action(session);
 		}
 	}
 }
@@ -525,3 +728,55 @@ int llp_unregister_close() {
 	return LINK_OK;
 }
 /******************************************************************************/
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+int grow_sessions() {
+	int i;
+
+	if (sessions_count + SESSIONS_SLAB > LLP_MAX_SESSIONS) {
+		liblog_warn(LAYER_LINK, "all %d sessions are in use.", LLP_MAX_SESSIONS);
+		return LLP_ERROR;
+	}
+
+	for (i = sessions_count; i < sessions_count + SESSIONS_SLAB; i++) {
+		if (pthread_mutex_init(&llp_sessions_mutexes[i], NULL)) {
+			liblog_error(LAYER_LINK, "error allocating mutex: %s.",
+					strerror(errno));
+			while (--i >= sessions_count) {
+				pthread_mutex_destroy(&llp_sessions_mutexes[i]);
+			}
+			return LLP_ERROR;
+		}
+	}
+
+	/* Lower sessions are handed out first. */
+	for (i = sessions_count + SESSIONS_SLAB - 1; i >= sessions_count; i--) {
+		llp_sessions[i].released = 1;
+		free_sessions[free_sessions_count++] = i;
+	}
+
+	/* The sweeps only see the new slab after it is initialized. */
+	__sync_add_and_fetch(&sessions_count, SESSIONS_SLAB);
+
+	liblog_debug(LAYER_LINK, "%d sessions initialized.", sessions_count);
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void release_session(int session) {
+
+	/* Releasing twice would hand the same identifier to two peers. */
+	pthread_mutex_lock(&free_sessions_mutex);
+	if (llp_sessions[session].released) {
+		pthread_mutex_unlock(&free_sessions_mutex);
+		liblog_error(LAYER_LINK, "session %d was already released.", session);
+		return;
+	}
+	llp_sessions[session].released = 1;
+	free_sessions[free_sessions_count++] = session;
+	pthread_mutex_unlock(&free_sessions_mutex);
+}
+/******************************************************************************/
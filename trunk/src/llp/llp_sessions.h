@@ -36,11 +36,15 @@
 #include <util/util_crypto.h>
 
 #include "llp_packets.h"
+#include "llp_dh.h"
+#include "llp_timers.h"
+#include "llp_crypto.h"
 
 /**
- * Maximum number of sessions supported.
+ * Maximum number of sessions supported. Session identifiers are transmitted as
+ * 16-bit integers.
  */
-#define LLP_MAX_SESSIONS	256
+#define LLP_MAX_SESSIONS	65536
 
 /**
  * Enumeration of the possible states that a session can be in.
@@ -86,6 +90,44 @@ extern char *llp_states[];
  */
 #define LLP_T_SILENT	(LLP_T_TIMEOUT/2 - LLP_TIME_TICKS_PER_SECOND)
 
+/**
+ * Enumeration of the lists that link sessions with pending work.
+ */
+enum llp_session_lists {
+	LLP_LIST_COALESCING,	/**< Sessions holding coalesced datagrams. */
+	LLP_LIST_SENDING		/**< Sessions holding datagrams in the send ring. */
+};
+
+/**
+ * Number of session lists.
+ */
+#define LLP_SESSION_LISTS	2
+
+/**
+ * Maximum number of datagrams held by a session send ring.
+ */
+#define LLP_MAX_SEND_QUEUE_DEPTH	1024
+
+/**
+ * Enumeration of the behaviours of llp_write() when the send ring of the
+ * session is full.
+ */
+enum llp_send_policies {
+	LLP_SEND_BLOCK = 1,		/**< The writer sends the datagrams itself. */
+	LLP_SEND_DROP,			/**< The oldest datagram is dropped. */
+	LLP_SEND_ERROR			/**< The new datagram is refused. */
+};
+
+/**
+ * Data type that stores a datagram waiting in a session send ring.
+ */
+typedef struct {
+	/** Copy of the datagram, in a buffer from the pool. */
+	u_char *data;
+	/** Length of the datagram in bytes. */
+	int length;
+} llp_send_slot_t;
+
 /**
  * Data type that stores the information associated with a session.
  */
@@ -98,16 +140,38 @@ typedef struct {
 	int packets_sent;
 	/** Number of packets received in session. */
 	int packets_received;
+	/** Bytes of content sent in session. */
+	long payload_bytes;
+	/** Bytes of padding sent in session. */
+	long padding_bytes;
+	/** Padding policy used by the session. */
+	int padding;
+	/** Content of a LLP_DATAGRAMS packet being filled, or NULL. */
+	u_char *coalesced;
+	/** Bytes used in the coalesced content, including its type. */
+	int coalesced_length;
+	/** Number of datagrams in the coalesced content. */
+	int coalesced_count;
+	/** Datagrams written but not sent yet, or NULL. */
+	llp_send_slot_t *send_ring;
+	/** Position of the oldest datagram in the send ring. */
+	int send_head;
+	/** Number of datagrams in the send ring. */
+	int send_count;
+	/** Number of datagrams dropped because the send ring was full. */
+	long send_dropped;
+	/** The session is in each of the session lists. */
+	int listed[LLP_SESSION_LISTS];
+	/** Next session in each of the session lists. */
+	int next_listed[LLP_SESSION_LISTS];
 	/** Session traffic is encrypted or no. */
 	int encrypted;
-	/** Current timeout in number of LLP_TIME_TICKs (depends on state). */
-	int timeout;
-	/** Time that this is in silence (in LLP_TIME_TICKs). */
-	int silence;
+	/** Timeout, keep-alive and expiration timers. */
+	llp_timer_t timers[LLP_TIMERS];
 	/** System time when the last LLP_NODE_HUNT packet was sent. */
 	long hunt_time;
-	/** Time that this session is alive (in LLP_TIME_TICKs). */
-	int alive;
+	/** Clock time when the pending handshake or keep-alive probe was sent. */
+	long probe_time;
 	/** Code of the last error occurred in session. */
 	int error;
 	/** Connected peer's session. */
@@ -118,6 +182,8 @@ typedef struct {
 	util_hash_function_t *hash;
 	/** MAC function used. */
 	util_mac_function_t *mac;
+	/** Key agreement algorithm used. */
+	llp_kex_function_t *kex;
 	/** Key to decrypt incoming traffic. */
 	u_char *cipher_in_key;
 	/** Initialization vector of decryption. */
@@ -130,32 +196,43 @@ typedef struct {
 	u_char *mac_in_key;
 	/** Key to generate MAC of outgoing traffic. */
 	u_char *mac_out_key;
+	/** Expanded keys of incoming traffic. */
+	llp_crypto_t *crypto_in;
+	/** Expanded keys of outgoing traffic. */
+	llp_crypto_t *crypto_out;
 	/** Entropy enforcer received (used to generate decryption key). */
 	u_char h_in[LLP_H_LENGTH];
 	/** Entropy enforced sent (used to generate encryption key). */
 	u_char h_out[LLP_H_LENGTH];
-	/** Diffie & Hellman (g^x mod p) received. */
+	/** Key agreement public value (g^x mod p) received. */
 	u_char y_in[LLP_Y_LENGTH];
-	/** Diffie & Hellman (g^x mod p) sent. */
+	/** Key agreement public value (g^x mod p) sent. */
 	u_char y_out[LLP_Y_LENGTH];
-	/** Diffie & Hellman random exponent. */
+	/** Key agreement random exponent. */
 	u_char x[LLP_X_LENGTH];
 	/** Shared secret generated by Diffie & Hellman key agreement. */
 	u_char z[LLP_Z_LENGTH];
 	/** HASH(z), used to closing control. */
 	u_char *verifier;
+	/** A worker job referring to this session is pending. */
+	int job_pending;
+	/** The connection request was already sent again echoing a cookie. */
+	int cookie_echoed;
+	/** The identifier is in the free sessions stack. Guarded by the stack
+	 * mutex, not by the session lock. */
+	int released;
 } llp_session_t;
 
 /**
  * Array that stores the session information for each session present on the
  * link layer. Access to this structure must be governed my mutexes.
  */
-extern llp_session_t llp_sessions[LLP_MAX_SESSIONS];
+extern llp_session_t *llp_sessions;
 
 /**
  * Lock used to access the llp_sessions vector.
  */
-extern pthread_mutex_t llp_sessions_mutexes[LLP_MAX_SESSIONS];
+extern pthread_mutex_t *llp_sessions_mutexes;
 
 /**
  * Initializes the data structures that store session information and access
@@ -255,7 +332,9 @@ int llp_set_verifier(int session, u_char *verifier);
 void llp_close_session(int session);
 
 /**
- * Returns the first free session (a session in closed state.)
+ * Returns a free session (a session in closed state, without worker jobs
+ * pending.) Sessions are taken from a free list, more sessions are initialized
+ * when the list is empty.
  * 
  * @param next_state state that the session must be put int, so that subsequent
  * 		calls won't return the same session.
@@ -264,19 +343,63 @@ void llp_close_session(int session);
 int llp_get_free_session(int next_state);
 
 /**
- * Returns the last error occurred in session.
+ * Marks the worker job pending on the session as finished. If the session was
+ * closed while the job was pending, the session is made free again. Must be
+ * called with the session locked.
+ * 
+ * @param session session identifier.
  */
-int llp_get_last_error(int session);
+void llp_finish_job(int session);
 
 /**
- * Controls the timeouts and expiration time associated with each session.
+ * Returns the number of sessions initialized. Only sessions with identifiers
+ * below this number are valid.
  */
-void llp_handle_timeouts();
+int llp_get_sessions_count();
 
 /**
- * Keep-alive management.
+ * Returns the number of sessions currently reserved, in any state other than
+ * closed.
  */
-void llp_handle_silence();
+int llp_get_used_sessions_count();
+
+/**
+ * Appends the session to one of the session lists, if it is not there yet.
+ * 
+ * @param list one of the LLP_LIST_* lists.
+ * @param session session identifier.
+ * @return 1 if the list was empty, 0 otherwise.
+ */
+int llp_add_to_list(int list, int session);
+
+/**
+ * Takes the first session from one of the session lists. The session is not
+ * locked, and the work that put it in the list may have been done already.
+ * 
+ * @param list one of the LLP_LIST_* lists.
+ * @return the session identifier, LLP_ERROR if the list is empty.
+ */
+int llp_take_from_list(int list);
+
+/**
+ * Checks if one of the session lists is empty.
+ * 
+ * @param list one of the LLP_LIST_* lists.
+ * @return 1 if the list is empty, 0 otherwise.
+ */
+int llp_is_list_empty(int list);
+
+/**
+ * Returns the last error occurred in session.
+ */
+int llp_get_last_error(int session);
+
+/**
+ * Advances the session timers by one LLP_TIME_TICK, handling the timeouts,
+ * keep-alives and expiration due. Sessions without timers due are not
+ * touched.
+ */
+void llp_handle_timeouts();
 
 /**
  * Management of number of established connections.
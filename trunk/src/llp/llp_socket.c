@@ -25,11 +25,13 @@
  * @ingroup llp
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <linux/filter.h>
 
 #include <libfreedom/liblog.h>
 #include <libfreedom/layers.h>
@@ -38,6 +40,11 @@
 #include "llp_packets.h"
 #include "llp_handshake.h"
 #include "llp_data.h"
+#include "llp_config.h"
+#include "llp_info.h"
+#include "llp_timers.h"
+#include "llp_limits.h"
+#include "llp_pool.h"
 #include "llp.h"
  
 /*============================================================================*/
@@ -46,31 +53,195 @@
 
 int llp_socket = LLP_CLOSED_SOCKET;
 
+int llp_sockets[LLP_MAX_LISTENERS];
+
+int llp_sockets_count = 0;
+
+int llp_sockets_steered = 0;
+
 /*
- * Max length of a UDP packet in bytes.
+ * Length of each receive buffer. One byte more than the largest LLP frame, so
+ * longer packets are detected instead of silently cut.
  */
-#define UDP_PACKET_MAX_LENGTH	65536
+#define RECEIVE_LENGTH			(LLP_BUFFER_LENGTH + 1)
 
 /*
  * Min length of a LLP packet in bytes.
  */
 #define MIN_PACKET_LENGTH		5
 
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/**
+ * Data type that stores the buffers used by a listener to receive a batch.
+ */
+typedef struct {
+	/** Headers passed to recvmmsg(). */
+	struct mmsghdr headers[LLP_MAX_BATCH_SIZE];
+	/** One vector for each packet of a batch. */
+	struct iovec vectors[LLP_MAX_BATCH_SIZE];
+	/** Addresses of the hosts that sent the packets. */
+	struct sockaddr_in peers[LLP_MAX_BATCH_SIZE];
+	/** Ring with one receive buffer for each packet of a batch. */
+	u_char *ring;
+	/** Number of buffers in the ring. */
+	int slots;
+} receiver_t;
+
+/*
+ * Receive buffers of each listener.
+ */
+static receiver_t receivers[LLP_MAX_LISTENERS];
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/**
+ * Creates a UDP socket bound to the given port.
+ * 
+ * @param[in] port      - port to be used in socket binding.
+ * @param[in] shared    - if the port is shared with other listeners.
+ * @retval LLP_CLOSED_SOCKET - if an error occurred
+ * @return the socket descriptor.
+ */
+static int create_socket(int port, int shared);
+
+/**
+ * Attaches to the listener sockets a program that steers every packet sent
+ * by a host to the same listener, preserving the order of packets inside a
+ * session.
+ * 
+ * @param[in] listeners - number of listener sockets bound to the port.
+ */
+static void steer_sockets(int listeners);
+
+/**
+ * Allocates the receive buffers of a listener.
+ * 
+ * @param[in] listener  - index of the listener socket.
+ * @retval LLP_OK       - if no errors occurred.
+ * @retval LLP_ERROR    - if the buffers could not be allocated.
+ */
+static int create_receiver(int listener);
+
+/**
+ * Receives a batch of packets on the socket of a listener and handles them.
+ * 
+ * @param[in] listener  - index of the listener socket.
+ * @param[in] flags     - flags passed to recvmmsg().
+ * @retval LLP_ERROR    - if the socket can't be read.
+ * @return the number of packets received, zero if none was pending.
+ */
+static int receive_batch(int listener, int flags);
+
+/**
+ * Delivers a received packet to the handler responsible for its type, unless
+ * its source exceeded the rate of packets of that type.
+ * 
+ * @param[in] listener  - index of the listener that received the packet.
+ * @param[in] packet    - the packet received.
+ * @param[in] length    - length of the packet in bytes.
+ * @param[in] peer      - address of the host that sent the packet.
+ * @param[in] now       - clock when the packet was received, in milliseconds.
+ */
+static void dispatch_packet(int listener, u_char *packet, int length,
+		struct sockaddr_in *peer, long now);
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/
 
-int llp_create_socket(int port) {
+int llp_create_socket(int port, int listeners) {
+	int i;
+
+	for (i = 0; i < listeners; i++) {
+		llp_sockets[i] = create_socket(port, listeners > 1);
+		if (llp_sockets[i] == LLP_CLOSED_SOCKET) {
+			llp_close_socket();
+			return LLP_ERROR;
+		}
+		llp_sockets_count++;
+		if (create_receiver(i) == LLP_ERROR) {
+			llp_close_socket();
+			return LLP_ERROR;
+		}
+	}
+
+	llp_sockets_steered = 1;
+	if (listeners > 1) {
+		steer_sockets(listeners);
+	}
+
+	/* Packets are always sent through the first socket. */
+	llp_socket = llp_sockets[0];
+	
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_close_socket() {
+	int i;
+
+	for (i = 0; i < llp_sockets_count; i++) {
+		close(llp_sockets[i]);
+	}
+	/* Listeners stop when their sockets are closed. The receive buffers are
+	 * kept, since a listener may still be using them, and reused if the
+	 * sockets are created again. */
+	llp_sockets_count = 0;
+	llp_sockets_steered = 0;
+	llp_socket = LLP_CLOSED_SOCKET;
+}
+/******************************************************************************/
+void llp_listen_socket(int listener) {
+	int received;
+
+	/* Blocks until a packet arrives, then takes whatever is pending. */
+	do {
+		liblog_debug(LAYER_LINK, "listening in socket.");
+		received = receive_batch(listener, MSG_WAITFORONE);
+	} while (received != LLP_ERROR);
+}
+/******************************************************************************/
+int llp_read_socket(int listener) {
+	int received;
+
+	/* A full batch may leave packets behind. */
+	do {
+		received = receive_batch(listener, MSG_DONTWAIT);
+	} while (received == llp_get_batch_size());
+
+	return (received == LLP_ERROR ? LLP_ERROR : LLP_OK);
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+int create_socket(int port, int shared) {
 	struct sockaddr_in server;
+	int new_socket;
+	int option;
 	
 	/* Creating the socket. */
-	llp_socket = socket(AF_INET, SOCK_DGRAM, 0);
-	if(llp_socket == LLP_CLOSED_SOCKET) {
+	new_socket = socket(AF_INET, SOCK_DGRAM, 0);
+	if(new_socket == LLP_CLOSED_SOCKET) {
 		liblog_error(LAYER_LINK, "error creating socket: %s.", strerror(errno));
-		return LLP_ERROR;
+		return LLP_CLOSED_SOCKET;
 	}
 	
 	liblog_info(LAYER_LINK, "socket created");
+
+	/* Every listener binds to the same port. */
+	option = 1;
+	if (shared && setsockopt(new_socket, SOL_SOCKET, SO_REUSEPORT, &option,
+			sizeof(option))) {
+		liblog_error(LAYER_LINK, "error sharing port: %s.", strerror(errno));
+		close(new_socket);
+		return LLP_CLOSED_SOCKET;
+	}
 	
 	/* Settting up the server. */
 	server.sin_family = AF_INET;
@@ -78,60 +249,174 @@ int llp_create_socket(int port) {
 	server.sin_addr.s_addr = INADDR_ANY;
 
 	/* Binding the socket. */
-	if (bind(llp_socket, (struct sockaddr *)&server, sizeof(server))) {
+	if (bind(new_socket, (struct sockaddr *)&server, sizeof(server))) {
 		liblog_error(LAYER_LINK, "error binding socket: %s.", strerror(errno));
-		return LLP_ERROR;
+		close(new_socket);
+		return LLP_CLOSED_SOCKET;
 	}
 
 	liblog_info(LAYER_LINK, "socket binded.");
 	
-	return LLP_OK;
+	return new_socket;
 }
 /******************************************************************************/
-void llp_close_socket() {
-	if (llp_socket != LLP_CLOSED_SOCKET) {
-		close(llp_socket);
+void steer_sockets(int listeners) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	/* The listener is chosen by source address % listeners, the port is
+	 * left out so every socket of a host shares one listener and one rate
+	 * limit. The address sits at a fixed offset of the IPv4 header. The
+	 * kernel returns to its own hash if the program can't be used. */
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, listeners),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog program;
+
+	program.len = sizeof(code) / sizeof(struct sock_filter);
+	program.filter = code;
+
+	if (setsockopt(llp_sockets[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+			&program, sizeof(program)) == 0) {
+		return;
 	}
+	liblog_warn(LAYER_LINK, "error attaching steering program: %s.",
+			strerror(errno));
+#endif
+	/* Without the program the kernel hashes the address and port of both
+	 * ends, so each session still stays on one listener, but a host using
+	 * several ports may be spread over several. */
+	llp_sockets_steered = 0;
 }
 /******************************************************************************/
-void llp_listen_socket() {
-	struct sockaddr_in peer;
-	u_int peer_address_size;
-	static u_char packet[UDP_PACKET_MAX_LENGTH];
-	int packet_length;
-	
-	peer_address_size = sizeof(struct sockaddr_in);
-	
-	while (1) {
-		liblog_debug(LAYER_LINK, "listening in socket.");
-		packet_length = recvfrom(llp_socket, packet, UDP_PACKET_MAX_LENGTH, 0, 
-				(struct sockaddr *)&peer, &peer_address_size);
-		liblog_debug(LAYER_LINK, "packet with %d bytes received.",
-				packet_length);
-		if (packet_length < 0) {
-			liblog_error(LAYER_LINK, "error receiving data.");
+
+void dispatch_packet(int listener, u_char *packet, int length,
+		struct sockaddr_in *peer, long now) {
+	int class;
+
+	liblog_debug(LAYER_LINK, "packet with %d bytes received.", length);
+	if (length < MIN_PACKET_LENGTH) {
+		liblog_error(LAYER_LINK, "packet is too small to be valid.");
+		llp_count_drop(listener, LLP_DROP_SHORT);
+		return;
+	}
+
+	switch(packet[0]) {
+		case LLP_CONNECTION_REQUEST:
+		case LLP_CONNECTION_OK:
+		case LLP_KEY_EXCHANGE:
+		case LLP_COOKIE:
+		case LLP_COOKIE_ECHO:
+			class = LLP_LIMIT_HANDSHAKE;
+			break;
+		case LLP_DATA:
+			class = LLP_LIMIT_DATA;
+			break;
+		default:
+			llp_count_drop(listener, LLP_DROP_UNKNOWN);
 			return;
+	}
+
+	/* A flooding source is dropped before any handler work. */
+	if (llp_limit_packet(listener, peer, class, now) == LLP_ERROR) {
+		liblog_debug(LAYER_LINK, "source rate exceeded, packet dropped.");
+		return;
+	}
+
+	switch(packet[0]) {
+		case LLP_CONNECTION_REQUEST:
+			llp_handle_connection_request(packet, length, peer);
+			break;
+		case LLP_CONNECTION_OK:
+			llp_handle_connection_ok(packet, length);
+			break;
+		case LLP_KEY_EXCHANGE:
+			llp_handle_key_exchange(packet, length);
+			break;
+		case LLP_COOKIE:
+			llp_handle_cookie(packet, length, peer);
+			break;
+		case LLP_COOKIE_ECHO:
+			llp_handle_cookie_echo(packet, length, peer);
+			break;
+		case LLP_DATA:
+			llp_handle_data(packet, length);
+			break;
+	}
+}
+/******************************************************************************/
+int create_receiver(int listener) {
+	receiver_t *receiver;
+	int i;
+
+	/* The ring is kept between runs, and only grows with the batch size.
+	 * The listeners of the previous run were already stopped. */
+	receiver = &receivers[listener];
+	if (receiver->slots < llp_get_batch_size()) {
+		free(receiver->ring);
+		receiver->slots = 0;
+		receiver->ring = (u_char *)malloc(llp_get_batch_size() *
+				RECEIVE_LENGTH);
+		if (receiver->ring == NULL) {
+			liblog_fatal(LAYER_LINK, "error in malloc: %s.", strerror(errno));
+			return LLP_ERROR;
 		}
-		if (packet_length < MIN_PACKET_LENGTH) {
-			liblog_error(LAYER_LINK, "packet is too small to be valid.");
-			continue;
+		receiver->slots = llp_get_batch_size();
+	}
+
+	memset(receiver->headers, 0, sizeof(receiver->headers));
+	for (i = 0; i < receiver->slots; i++) {
+		receiver->vectors[i].iov_base = &receiver->ring[i * RECEIVE_LENGTH];
+		receiver->vectors[i].iov_len = RECEIVE_LENGTH;
+		receiver->headers[i].msg_hdr.msg_name = &receiver->peers[i];
+		receiver->headers[i].msg_hdr.msg_iov = &receiver->vectors[i];
+		receiver->headers[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return LLP_OK;
+}
+/******************************************************************************/
+int receive_batch(int listener, int flags) {
+	receiver_t *receiver;
+	int batch_size;
+	int received;
+	long now;
+	int i;
+
+	receiver = &receivers[listener];
+	batch_size = llp_get_batch_size();
+
+	for (i = 0; i < batch_size; i++) {
+		receiver->headers[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	}
+	received = recvmmsg(llp_sockets[listener], receiver->headers, batch_size,
+			flags, NULL);
+	if (received < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
 		}
-		/*liblog_debug(LAYER_LINK, "packet received.");*/
-		switch(packet[0]) {
-			case LLP_CONNECTION_REQUEST:
-				llp_handle_connection_request(packet, packet_length, &peer);
-				break;
-			case LLP_CONNECTION_OK:
-				llp_handle_connection_ok(packet, packet_length);
-				break;
-			case LLP_KEY_EXCHANGE:
-				llp_handle_key_exchange(packet, packet_length);
-				break;
-			case LLP_DATA:
-				llp_handle_data(packet, packet_length);
-				break;
+		liblog_error(LAYER_LINK, "error receiving data.");
+		return LLP_ERROR;
+	}
+	liblog_debug(LAYER_LINK, "%d packets received.", received);
+	llp_add_receive_batch(received);
+	now = llp_get_clock();
+
+	/* Replies generated by the handlers leave together. */
+	llp_begin_send_batch();
+	for (i = 0; i < received; i++) {
+		/* No valid frame is longer than a pool buffer. */
+		if ((receiver->headers[i].msg_hdr.msg_flags & MSG_TRUNC) ||
+				receiver->headers[i].msg_len > LLP_BUFFER_LENGTH) {
+			liblog_debug(LAYER_LINK, "packet is too long, dropped.");
+			llp_count_drop(listener, LLP_DROP_LONG);
+			continue;
 		}
+		dispatch_packet(listener, receiver->vectors[i].iov_base,
+				receiver->headers[i].msg_len, &receiver->peers[i], now);
 	}
-	return;
+	llp_end_send_batch();
+
+	return received;
 }
 /******************************************************************************/
@@ -33,25 +33,67 @@
 #define LLP_CLOSED_SOCKET	(-1)
 
 /**
-* Socket used to send and receive packets.
+ * Maximum number of packets received or sent by a single socket call.
+ */
+#define LLP_MAX_BATCH_SIZE	64
+
+/**
+ * Maximum number of listener sockets bound to the LLP port.
+ */
+#define LLP_MAX_LISTENERS	16
+
+/**
+* Socket used to send packets.
 */
 extern int llp_socket;
+
+/**
+ * Sockets used to receive packets, one for each listener.
+ */
+extern int llp_sockets[LLP_MAX_LISTENERS];
+
+/**
+ * Number of listener sockets opened.
+ */
+extern int llp_sockets_count;
+
+/**
+ * 1 if every packet sent by a host reaches the same listener, whatever its
+ * source port, 0 otherwise.
+ */
+extern int llp_sockets_steered;
  
 /**
- * Creates a UDP socket to handle traffic.
+ * Creates the UDP sockets to handle traffic. When more than one listener is
+ * requested, all sockets share the port and the packets of each peer are
+ * always delivered to the same socket.
  * 
  * @param port port to be used in socket binding.
+ * @param listeners number of sockets bound to the port.
  * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
  */
-int llp_create_socket(int port);
+int llp_create_socket(int port, int listeners);
+
+/**
+ * Listens on the socket of the given listener. Up to llp_get_batch_size()
+ * packets are received by each socket call and the replies generated while
+ * handling them are sent together.
+ * 
+ * @param listener index of the listener socket.
+ */
+void llp_listen_socket(int listener);
 
 /**
- * Listens on the provided socket.
+ * Handles the packets pending on the socket of the given listener, without
+ * blocking. Used by the event loop when the socket is readable.
+ * 
+ * @param listener index of the listener socket.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
  */
-void llp_listen_socket();
+int llp_read_socket(int listener);
 
 /*
- * Closes the socket being used;
+ * Closes the sockets being used;
  */
 void llp_close_socket();
 
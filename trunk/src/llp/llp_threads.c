@@ -28,9 +28,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
 #include <netinet/in.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
 #include <pthread.h>
 
@@ -45,46 +49,71 @@
 #include "llp_handshake.h"
 #include "llp_data.h"
 #include "llp_socket.h"
+#include "llp_packets.h"
+#include "llp_timers.h"
+#include "llp_threads.h"
  
 /*============================================================================*/
 /* Private data definitions.                                                  */
 /*============================================================================*/
 
-/*
- * Initial delay between the timeout_thread and silence_thread
- * (in LLP_TIME_TICKs).
- */
-#define TIMEOUT_THREAD_DELAY	(0.5)
-
 /* 
  * Time that the timeout thread will sleep (in LLP_TIME_TICKs).
  */
 #define TIMEOUT_THREAD_SLEEP	(1)
 
-/* 
- * Time that the silence thread will sleep (in LLP_TIME_TICKs).
- */
-#define SILENCE_THREAD_SLEEP	(1)
-
 /* 
  * Time that the monitor thread will sleep (in LLP_TIME_TICKS).
  */
 #define MONITOR_THREAD_SLEEP	(10)
 
 /*
- * Thread that will listen in UDP socket.
+ * Maximum number of events handled by each epoll_wait() call.
  */
-static pthread_t listen_thread;
+#define LOOP_EVENTS				8
 
 /*
- * Thread that will do session timeout and expiration management
+ * Sources of the events watched by an event loop.
  */
-static pthread_t timeout_thread;
+enum loop_sources {
+	SOCKET_EVENT,		/* The listener socket is readable. */
+	WAKEUP_EVENT,		/* The loop must stop or look at the timers again. */
+	TIMERS_EVENT,		/* A timer is due. */
+	MONITOR_EVENT,		/* The node monitor must run. */
+	COALESCE_EVENT		/* The coalesced datagrams must be sent. */
+};
+
+/*
+ * Number of event loops running, zero if each task has its own thread.
+ */
+static int loops = 0;
+
+/*
+ * Event file descriptors used to wake up each event loop.
+ */
+static int wakeup_fds[LLP_MAX_LISTENERS];
+
+/*
+ * Timer descriptor that wakes up the first event loop at the end of a
+ * coalescing window, -1 if not in event loop mode. It is armed once when a
+ * session starts coalescing, and stays disarmed while none is.
+ */
+static int coalesce_fd = -1;
+
+/*
+ * Threads that will listen in UDP sockets, one for each socket.
+ */
+static pthread_t listen_threads[LLP_MAX_LISTENERS];
+
+/*
+ * Index of the socket used by each listen thread.
+ */
+static int listeners[LLP_MAX_LISTENERS];
 
 /*
- * Thread that will do keep-alive management.
+ * Thread that will do session timeout, keep-alive and expiration management.
  */
-static pthread_t silence_thread;
+static pthread_t timeout_thread;
 
 /*
  * Thread that will monitor cache rate and number of active sessions.
@@ -92,14 +121,19 @@ static pthread_t silence_thread;
 static pthread_t monitor_thread;
 
 /*
- * Mutex used by condition variable timeout_condition.
+ * Thread that will send the datagrams coalesced by the sessions.
  */
-static pthread_mutex_t timeout_mutex;
+static pthread_t coalesce_thread;
+
+/*
+ * Thread that will send the datagrams in the session send rings.
+ */
+static pthread_t sender_thread;
 
 /*
- * Mutex used by condition variable silence_condition.
+ * Mutex used by condition variable timeout_condition.
  */
-static pthread_mutex_t silence_mutex;
+static pthread_mutex_t timeout_mutex;
 
 /*
  * Mutex used by condition variable monitor_condition.
@@ -107,20 +141,37 @@ static pthread_mutex_t silence_mutex;
 static pthread_mutex_t monitor_mutex;
 
 /*
- * Contidion variable used by timeout_thread
+ * Mutex used by condition variable coalesce_condition.
  */
-static pthread_cond_t timeout_condition;
+static pthread_mutex_t coalesce_mutex;
 
 /*
- * Condition variable used by silence_thread.
+ * Mutex used by condition variable sender_condition.
  */
-static pthread_cond_t silence_condition;
+static pthread_mutex_t sender_mutex;
+
+/*
+ * Contidion variable used by timeout_thread
+ */
+static pthread_cond_t timeout_condition;
 
 /*
  * Condition variable used by monitor_thread.
  */
 static pthread_cond_t monitor_condition;
 
+/*
+ * Condition variable used by coalesce_thread, signaled when a session starts
+ * coalescing datagrams.
+ */
+static pthread_cond_t coalesce_condition;
+
+/*
+ * Condition variable used by sender_thread, signaled when a session send ring
+ * receives datagrams.
+ */
+static pthread_cond_t sender_condition;
+
 static int finish_execution = 0;
 
 /*============================================================================*/
@@ -128,9 +179,9 @@ static int finish_execution = 0;
 /*============================================================================*/
 
 /*
- * Function to be executed by the listen_thread.
+ * Function to be executed by the listen_threads.
  */
-static void *run_listen_socket();
+static void *run_listen_socket(void *listener);
 
 /*
  * Function to be executed by timeout_thread.
@@ -138,14 +189,36 @@ static void *run_listen_socket();
 static void *timer_handle_timeouts();
 
 /*
- * Function to be executed by silence_thread.
+ * Function to be executed by monitor_thread.
  */
-static void *timer_handle_silence();
+static void *timer_monitor();
 
 /*
- * Function to be executed by monitor_thread.
+ * Function to be executed by coalesce_thread.
  */
-static void *timer_monitor();
+static void *timer_send_coalesced();
+
+/*
+ * Function to be executed by sender_thread.
+ */
+static void *run_sender();
+
+/*
+ * Function to be executed by the listen_threads in event loop mode. The loop
+ * of the first listener also handles the timers and the node monitor.
+ */
+static void *run_event_loop(void *listener);
+
+/*
+ * Adds a file descriptor to the set watched by an event loop.
+ */
+static int watch_descriptor(int epoll_fd, int fd, int source);
+
+/*
+ * Brings the timing wheel up to the clock and programs the timer descriptor
+ * for the next timer due. The descriptor is disarmed if no timer is pending.
+ */
+static void advance_timers(int timers_fd);
 
 /*
  * Computes the time that a thread must sleep.
@@ -158,17 +231,13 @@ static inline void thread_sleep(float sleep, pthread_cond_t *condition,
 /*============================================================================*/
 
 int llp_create_threads() {
+	int i;
 
 	if (pthread_mutex_init(&timeout_mutex, NULL)) {
 		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
 		return LLP_ERROR;
 	}
 	
-	if (pthread_mutex_init(&silence_mutex, NULL)) {
-		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
-		return LLP_ERROR;
-	}
-	
 	if (pthread_mutex_init(&monitor_mutex, NULL)) {
 		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
 		return LLP_ERROR;
@@ -180,32 +249,92 @@ int llp_create_threads() {
 		return LLP_ERROR;
 	}
 
-	if (pthread_cond_init(&silence_condition, NULL)) {
+	if (pthread_cond_init(&monitor_condition, NULL)) {
 		liblog_error(LAYER_LINK, "error creating condition variable: %s.",
 				strerror(errno));
 		return LLP_ERROR;
 	}
-	
-	if (pthread_cond_init(&monitor_condition, NULL)) {
+
+	if (pthread_mutex_init(&coalesce_mutex, NULL)) {
+		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+
+	if (pthread_cond_init(&coalesce_condition, NULL)) {
 		liblog_error(LAYER_LINK, "error creating condition variable: %s.",
 				strerror(errno));
 		return LLP_ERROR;
 	}
 
-	/* Thread to listen packets. */
-	if (pthread_create(&listen_thread, NULL, run_listen_socket, NULL)) {
-		liblog_error(LAYER_LINK, "error creating thread: %s.", strerror(errno));
+	if (pthread_mutex_init(&sender_mutex, NULL)) {
+		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
 		return LLP_ERROR;
 	}
 
-	/* Thread to handle session timeout and expiration. */
-	if (pthread_create(&timeout_thread, NULL, timer_handle_timeouts, NULL)) {
+	if (pthread_cond_init(&sender_condition, NULL)) {
+		liblog_error(LAYER_LINK, "error creating condition variable: %s.",
+				strerror(errno));
+		return LLP_ERROR;
+	}
+
+	finish_execution = 0;
+
+	/* Thread to send the datagrams written to the send rings, in both
+	 * threading models. */
+	if (llp_get_send_queue_depth() > 0 &&
+			pthread_create(&sender_thread, NULL, run_sender, NULL)) {
 		liblog_error(LAYER_LINK, "error creating thread: %s.", strerror(errno));
 		return LLP_ERROR;
 	}
-	
-	/* Thread to handle session keep-alive. */
-	if (pthread_create(&silence_thread, NULL, timer_handle_silence, NULL)) {
+
+	/* Each listener runs an event loop that sleeps until it has work. */
+	if (llp_get_event_loop()) {
+		for (i = 0; i < llp_sockets_count; i++) {
+			wakeup_fds[i] = eventfd(0, 0);
+			if (wakeup_fds[i] == -1) {
+				liblog_error(LAYER_LINK, "error creating eventfd: %s.",
+						strerror(errno));
+				return LLP_ERROR;
+			}
+			loops++;
+		}
+		llp_start_timers_clock(wakeup_fds[0]);
+
+		/* The first loop sends the coalesced datagrams. */
+		if (llp_get_coalesce_window() > 0) {
+			coalesce_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+			if (coalesce_fd == -1) {
+				liblog_error(LAYER_LINK, "error creating timerfd: %s.",
+						strerror(errno));
+				return LLP_ERROR;
+			}
+		}
+
+		for (i = 0; i < loops; i++) {
+			listeners[i] = i;
+			if (pthread_create(&listen_threads[i], NULL, run_event_loop,
+					&listeners[i])) {
+				liblog_error(LAYER_LINK, "error creating thread: %s.",
+						strerror(errno));
+				return LLP_ERROR;
+			}
+		}
+		return LLP_OK;
+	}
+
+	/* Threads to listen packets. */
+	for (i = 0; i < llp_sockets_count; i++) {
+		listeners[i] = i;
+		if (pthread_create(&listen_threads[i], NULL, run_listen_socket,
+				&listeners[i])) {
+			liblog_error(LAYER_LINK, "error creating thread: %s.",
+					strerror(errno));
+			return LLP_ERROR;
+		}
+	}
+
+	/* Thread to handle session timeout, keep-alive and expiration. */
+	if (pthread_create(&timeout_thread, NULL, timer_handle_timeouts, NULL)) {
 		liblog_error(LAYER_LINK, "error creating thread: %s.", strerror(errno));
 		return LLP_ERROR;
 	}
@@ -215,6 +344,13 @@ int llp_create_threads() {
 		liblog_error(LAYER_LINK, "error creating thread: %s.", strerror(errno));
 		return LLP_ERROR;
 	}
+
+	/* Thread to send coalesced datagrams at the end of each window. */
+	if (llp_get_coalesce_window() > 0 && pthread_create(&coalesce_thread,
+			NULL, timer_send_coalesced, NULL)) {
+		liblog_error(LAYER_LINK, "error creating thread: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
 	
 	finish_execution = 0;
 	
@@ -222,32 +358,86 @@ int llp_create_threads() {
 }
 /******************************************************************************/
 void llp_destroy_threads() {
+	uint64_t value;
+	int i;
 	
 	finish_execution = 1;
-	
-	pthread_cond_broadcast(&silence_condition);
-	pthread_cond_broadcast(&timeout_condition);
-	pthread_cond_broadcast(&monitor_condition);
 
-	pthread_join(silence_thread, NULL);
-	pthread_join(timeout_thread, NULL);
-	pthread_join(monitor_thread, NULL);
+	if (llp_get_send_queue_depth() > 0) {
+		llp_wake_sender();
+		pthread_join(sender_thread, NULL);
+	}
+	
+	if (loops > 0) {
+		value = 1;
+		for (i = 0; i < loops; i++) {
+			if (write(wakeup_fds[i], &value, sizeof(value)) < 0) {
+				liblog_error(LAYER_LINK, "error stopping event loop: %s.",
+						strerror(errno));
+			}
+		}
+		for (i = 0; i < loops; i++) {
+			pthread_join(listen_threads[i], NULL);
+			close(wakeup_fds[i]);
+		}
+		if (coalesce_fd != -1) {
+			close(coalesce_fd);
+			coalesce_fd = -1;
+		}
+		loops = 0;
+	} else {
+		pthread_cond_broadcast(&timeout_condition);
+		pthread_cond_broadcast(&monitor_condition);
+		pthread_cond_broadcast(&coalesce_condition);
+
+		pthread_join(timeout_thread, NULL);
+		pthread_join(monitor_thread, NULL);
+		if (llp_get_coalesce_window() > 0) {
+			pthread_join(coalesce_thread, NULL);
+		}
+	}
 
-	pthread_mutex_destroy(&silence_mutex);
 	pthread_mutex_destroy(&timeout_mutex);
 	pthread_mutex_destroy(&monitor_mutex);
-	pthread_cond_destroy(&silence_condition);
 	pthread_cond_destroy(&timeout_condition);
 	pthread_cond_destroy(&monitor_condition);
+	pthread_mutex_destroy(&coalesce_mutex);
+	pthread_cond_destroy(&coalesce_condition);
+	pthread_mutex_destroy(&sender_mutex);
+	pthread_cond_destroy(&sender_condition);
+}
+/******************************************************************************/
+void llp_wake_sender() {
+
+	pthread_mutex_lock(&sender_mutex);
+	pthread_cond_signal(&sender_condition);
+	pthread_mutex_unlock(&sender_mutex);
+}
+/******************************************************************************/
+void llp_wake_coalescer() {
+	struct itimerspec time;
+
+	/* One shot, the loop does not wake up again until the next session
+	 * starts coalescing. */
+	if (coalesce_fd != -1) {
+		memset(&time, 0, sizeof(time));
+		time.it_value.tv_nsec = llp_get_coalesce_window() * 1000L * 1000L;
+		timerfd_settime(coalesce_fd, 0, &time, NULL);
+		return;
+	}
+
+	pthread_mutex_lock(&coalesce_mutex);
+	pthread_cond_signal(&coalesce_condition);
+	pthread_mutex_unlock(&coalesce_mutex);
 }
 
 /*============================================================================*/
 /* Private functions prototypes.                                              */
 /*============================================================================*/
 
-void *run_listen_socket() {
+void *run_listen_socket(void *listener) {
 
-	llp_listen_socket();
+	llp_listen_socket(*(int *)listener);
 	pthread_exit(NULL);
 		
 	return LLP_OK;
@@ -255,7 +445,7 @@ void *run_listen_socket() {
 /******************************************************************************/
 void *timer_handle_timeouts() {
 	
-	/* Initial delay between threads. */
+	/* The first tick is one LLP_TIME_TICK away. */
 	pthread_mutex_lock(&timeout_mutex);
 	thread_sleep(TIMEOUT_THREAD_SLEEP, &timeout_condition, &timeout_mutex);
 
@@ -263,7 +453,9 @@ void *timer_handle_timeouts() {
 		if (finish_execution == 1) {
 			pthread_exit(NULL);
 		}
+		llp_begin_send_batch();
 		llp_handle_timeouts();
+		llp_end_send_batch();
 		thread_sleep(TIMEOUT_THREAD_SLEEP, &timeout_condition,
 				&timeout_mutex);
     }
@@ -271,21 +463,6 @@ void *timer_handle_timeouts() {
 	return LLP_OK;
 }
 /******************************************************************************/
-void *timer_handle_silence() {
-	
-	pthread_mutex_lock(&silence_mutex);
-	while (1) {
-		if (finish_execution == 1) {
-			pthread_exit(NULL);
-		}
-		llp_handle_silence();
-		thread_sleep(SILENCE_THREAD_SLEEP, &silence_condition, 
-				&silence_mutex);
-    }
-    
-    return LLP_OK;
-}
-/******************************************************************************/
 void *timer_monitor() {
 	
 	pthread_mutex_lock(&monitor_mutex);
@@ -302,6 +479,212 @@ void *timer_monitor() {
     return LLP_OK;
 }
 /******************************************************************************/
+void *timer_send_coalesced() {
+	float window;
+
+	window = (float)llp_get_coalesce_window() / LLP_TIME_TICK;
+
+	pthread_mutex_lock(&coalesce_mutex);
+	while (1) {
+		/* The window starts when the first session starts coalescing. */
+		while (!finish_execution &&
+				llp_is_list_empty(LLP_LIST_COALESCING)) {
+			pthread_cond_wait(&coalesce_condition, &coalesce_mutex);
+		}
+		if (finish_execution == 1) {
+			pthread_mutex_unlock(&coalesce_mutex);
+			pthread_exit(NULL);
+		}
+		thread_sleep(window, &coalesce_condition, &coalesce_mutex);
+		pthread_mutex_unlock(&coalesce_mutex);
+
+		llp_begin_send_batch();
+		llp_send_coalesced();
+		llp_end_send_batch();
+
+		pthread_mutex_lock(&coalesce_mutex);
+	}
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void *run_sender() {
+
+	pthread_mutex_lock(&sender_mutex);
+	while (1) {
+		/* The list is checked with the mutex locked, so a wake up sent after
+		 * the check is not lost. */
+		while (!finish_execution && llp_is_list_empty(LLP_LIST_SENDING)) {
+			pthread_cond_wait(&sender_condition, &sender_mutex);
+		}
+		if (finish_execution == 1) {
+			pthread_mutex_unlock(&sender_mutex);
+			pthread_exit(NULL);
+		}
+		pthread_mutex_unlock(&sender_mutex);
+
+		llp_begin_send_batch();
+		llp_send_queued();
+		llp_end_send_batch();
+
+		pthread_mutex_lock(&sender_mutex);
+	}
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void *run_event_loop(void *listener) {
+	struct epoll_event events[LOOP_EVENTS];
+	struct itimerspec monitor_time;
+	uint64_t value;
+	int shard;
+	int epoll_fd;
+	int timers_fd;
+	int monitor_fd;
+	int ready;
+	int i;
+
+	shard = *(int *)listener;
+	timers_fd = -1;
+	monitor_fd = -1;
+
+	epoll_fd = epoll_create1(0);
+	if (epoll_fd == -1) {
+		liblog_error(LAYER_LINK, "error creating event loop: %s.",
+				strerror(errno));
+		pthread_exit(NULL);
+	}
+
+	if (watch_descriptor(epoll_fd, llp_sockets[shard], SOCKET_EVENT)
+			== LLP_ERROR ||
+			watch_descriptor(epoll_fd, wakeup_fds[shard], WAKEUP_EVENT)
+			== LLP_ERROR) {
+		goto return_label;
+	}
+
+	/* The first loop owns the timing wheel and the node monitor. */
+	if (shard == 0) {
+		timers_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+		monitor_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+		if (timers_fd == -1 || monitor_fd == -1) {
+			liblog_error(LAYER_LINK, "error creating timerfd: %s.",
+					strerror(errno));
+			goto return_label;
+		}
+
+		memset(&monitor_time, 0, sizeof(monitor_time));
+		monitor_time.it_value.tv_sec =
+				(MONITOR_THREAD_SLEEP * LLP_TIME_TICK) / 1000;
+		monitor_time.it_interval = monitor_time.it_value;
+		timerfd_settime(monitor_fd, 0, &monitor_time, NULL);
+
+		if (watch_descriptor(epoll_fd, timers_fd, TIMERS_EVENT)
+				== LLP_ERROR ||
+				watch_descriptor(epoll_fd, monitor_fd, MONITOR_EVENT)
+				== LLP_ERROR) {
+			goto return_label;
+		}
+	}
+
+	/* The first loop also sends coalesced datagrams at the end of each
+	 * window, armed by llp_wake_coalescer(). */
+	if (shard == 0 && coalesce_fd != -1 &&
+			watch_descriptor(epoll_fd, coalesce_fd, COALESCE_EVENT)
+			== LLP_ERROR) {
+		goto return_label;
+	}
+
+	while (!finish_execution) {
+		if (shard == 0) {
+			advance_timers(timers_fd);
+		}
+
+		ready = epoll_wait(epoll_fd, events, LOOP_EVENTS, -1);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			liblog_error(LAYER_LINK, "error waiting for events: %s.",
+					strerror(errno));
+			break;
+		}
+
+		for (i = 0; i < ready; i++) {
+			switch (events[i].data.u32) {
+				case SOCKET_EVENT:
+					llp_read_socket(shard);
+					break;
+				case WAKEUP_EVENT:
+					read(wakeup_fds[shard], &value, sizeof(value));
+					break;
+				case TIMERS_EVENT:
+					/* The wheel is advanced before sleeping again. */
+					read(timers_fd, &value, sizeof(value));
+					break;
+				case MONITOR_EVENT:
+					read(monitor_fd, &value, sizeof(value));
+					llp_handle_nodes();
+					llp_handle_connections();
+					break;
+				case COALESCE_EVENT:
+					read(coalesce_fd, &value, sizeof(value));
+					llp_begin_send_batch();
+					llp_send_coalesced();
+					llp_end_send_batch();
+					break;
+			}
+		}
+	}
+
+return_label:
+	if (timers_fd != -1) {
+		close(timers_fd);
+	}
+	if (monitor_fd != -1) {
+		close(monitor_fd);
+	}
+	close(epoll_fd);
+	pthread_exit(NULL);
+
+	return LLP_OK;
+}
+/******************************************************************************/
+int watch_descriptor(int epoll_fd, int fd, int source) {
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u32 = source;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+		liblog_error(LAYER_LINK, "error watching descriptor: %s.",
+				strerror(errno));
+		return LLP_ERROR;
+	}
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void advance_timers(int timers_fd) {
+	struct itimerspec time;
+	int lag;
+
+	/* Ticks passed while sleeping are skipped at once if no timer is in the
+	 * wheel. */
+	lag = llp_get_timers_lag();
+	if (lag > 0 && llp_skip_timers(lag) == LLP_ERROR) {
+		llp_begin_send_batch();
+		while (lag-- > 0) {
+			llp_handle_timeouts();
+		}
+		llp_end_send_batch();
+	}
+
+	/* With an empty wheel the descriptor is disarmed and the loop is idle. */
+	memset(&time, 0, sizeof(time));
+	llp_get_next_timer(&time.it_value);
+	timerfd_settime(timers_fd, TFD_TIMER_ABSTIME, &time, NULL);
+}
+/******************************************************************************/
 void thread_sleep(float sleep, pthread_cond_t *condition,
 		pthread_mutex_t *mutex) {
 	struct timeval time;
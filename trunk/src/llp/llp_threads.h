@@ -40,4 +40,16 @@ int llp_create_threads();
  */
 void llp_destroy_threads();
 
+/**
+ * Wakes up the sender thread, which sleeps while no session send ring holds
+ * datagrams.
+ */
+void llp_wake_sender();
+
+/**
+ * Starts the coalescing window of the thread that sends the coalesced
+ * datagrams, which sleeps while no session is coalescing.
+ */
+void llp_wake_coalescer();
+
 #endif /* !_LLP_THREADS_H_ */
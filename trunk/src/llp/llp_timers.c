@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_timers.c Implementations of the timing wheel used to schedule
+ * 		session timeouts, keep-alives and expiration.
+ * @ingroup llp
+ */
+ 
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include <libfreedom/liblog.h>
+#include <libfreedom/layers.h>
+
+#include "llp_timers.h"
+#include "llp_sessions.h"
+#include "llp.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Each level of the wheel has 2^WHEEL_BITS slots. A slot in level n covers
+ * 2^(WHEEL_BITS * n) ticks.
+ */
+#define WHEEL_BITS		8
+#define WHEEL_SLOTS		(1 << WHEEL_BITS)
+#define WHEEL_MASK		(WHEEL_SLOTS - 1)
+
+/*
+ * Number of levels of the wheel. Three levels cover 2^24 ticks (about 97 days),
+ * timers further away are placed in the last slot and placed again when
+ * cascaded.
+ */
+#define WHEEL_LEVELS	3
+
+/*
+ * Longest interval that the wheel can hold (in LLP_TIME_TICKs).
+ */
+#define WHEEL_RANGE		(1L << (WHEEL_BITS * WHEEL_LEVELS))
+
+/*
+ * Slots of the wheel. Each slot is the head of a circular list of timers.
+ */
+static llp_timer_t wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/*
+ * List of timers collected by the last tick.
+ */
+static llp_timer_t expired;
+
+/*
+ * Number of ticks processed since the wheel was initialized.
+ */
+static long current_tick = 0;
+
+/*
+ * Number of timers linked in the wheel or in the expired list.
+ */
+static int timers_linked = 0;
+
+/*
+ * File descriptor written when a timer is armed before wakeup_tick, -1 if the
+ * wheel is advanced at a fixed rate.
+ */
+static int wakeup_fd = -1;
+
+/*
+ * Tick when the wheel will be advanced again, if it follows the clock.
+ */
+static long wakeup_tick = LONG_MAX;
+
+/*
+ * Time of tick zero in milliseconds of the monotonic clock, if the wheel
+ * follows the clock.
+ */
+static long start_time = 0;
+
+/*
+ * Lock used to access the wheel.
+ */
+static pthread_mutex_t wheel_mutex;
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Makes a list head empty.
+ * 
+ * @param[out] head		- the list head.
+ */
+static void clear_list(llp_timer_t *head);
+
+/*
+ * Removes a timer from the list where it is. Must be called with wheel_mutex
+ * locked.
+ * 
+ * @param[in] timer		- the timer removed.
+ */
+static void unlink_timer(llp_timer_t *timer);
+
+/*
+ * Adds a timer to the end of a list. Must be called with wheel_mutex locked.
+ * 
+ * @param[in] head		- the list head.
+ * @param[in] timer		- the timer added.
+ */
+static void append_timer(llp_timer_t *head, llp_timer_t *timer);
+
+/*
+ * Places a timer in the slot that matches its deadline. Must be called with
+ * wheel_mutex locked.
+ * 
+ * @param[in] timer		- the timer placed.
+ */
+static void place_timer(llp_timer_t *timer);
+
+/*
+ * Places again the timers of a slot from an upper level, moving them to the
+ * lower levels. Must be called with wheel_mutex locked.
+ * 
+ * @param[in] level		- the level of the slot.
+ * @param[in] slot		- the slot cascaded.
+ */
+static void cascade(int level, int slot);
+
+/*
+ * Returns the current tick, without locking the wheel. If the wheel follows
+ * the clock, the tick is read from the clock, otherwise it is the number of
+ * ticks processed.
+ * 
+ * @return the current tick.
+ */
+static long get_current_tick();
+
+/*
+ * Wakes up the event loop if it sleeps past the deadline of a timer just
+ * placed. Must be called with wheel_mutex locked.
+ * 
+ * @param[in] deadline	- the deadline of the timer.
+ */
+static void wake_up(long deadline);
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+int llp_timers_initialize() {
+	int i;
+	int j;
+
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) {
+			clear_list(&wheel[i][j]);
+		}
+	}
+	clear_list(&expired);
+	current_tick = 0;
+	timers_linked = 0;
+	wakeup_fd = -1;
+	wakeup_tick = LONG_MAX;
+
+	if (pthread_mutex_init(&wheel_mutex, NULL)) {
+		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+
+	liblog_debug(LAYER_LINK, "timing wheel initialized.");
+
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_timers_finalize() {
+
+	/* The timers live inside the session information, nothing to free. */
+	pthread_mutex_destroy(&wheel_mutex);
+
+	liblog_debug(LAYER_LINK, "timing wheel finalized.");
+}
+/******************************************************************************/
+void llp_set_timer(int session, int type, int ticks) {
+	llp_timer_t *timer;
+
+	timer = &llp_sessions[session].timers[type];
+	timer->expires = get_current_tick() + ticks;
+
+	/* Common case: the timer is pushed back, it will be placed again when its
+	 * old deadline is reached. */
+	if (timer->armed && timer->deadline <= timer->expires) {
+		return;
+	}
+
+	pthread_mutex_lock(&wheel_mutex);
+	if (!timer->armed) {
+		timer->session = session;
+		timer->type = type;
+		timer->armed = 1;
+		timer->deadline = timer->expires;
+		place_timer(timer);
+		wake_up(timer->deadline);
+	} else {
+		/* The timer must fire sooner. If it is not linked, it was already
+		 * collected and will be placed again when taken. */
+		if (timer->next != NULL) {
+			unlink_timer(timer);
+			timer->deadline = timer->expires;
+			place_timer(timer);
+			wake_up(timer->deadline);
+		}
+	}
+	pthread_mutex_unlock(&wheel_mutex);
+}
+/******************************************************************************/
+void llp_stop_timers(int session) {
+	int i;
+
+	/* Stopped timers are left in the wheel and discarded when they are due. */
+	for (i = 0; i < LLP_TIMERS; i++) {
+		llp_sessions[session].timers[i].expires = 0;
+	}
+}
+/******************************************************************************/
+int llp_get_timer(int session, int type) {
+	long left;
+
+	if (llp_sessions[session].timers[type].expires == 0) {
+		return 0;
+	}
+
+	left = llp_sessions[session].timers[type].expires - get_current_tick();
+
+	return (left > 0 ? left : 0);
+}
+/******************************************************************************/
+void llp_advance_timers() {
+	int level;
+	int slot;
+	llp_timer_t *head;
+
+	pthread_mutex_lock(&wheel_mutex);
+
+	__sync_add_and_fetch(&current_tick, 1);
+
+	/* Each time a level wraps around, a slot of the level above is moved down.
+	 */
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		if (current_tick & ((1L << (WHEEL_BITS * level)) - 1)) {
+			break;
+		}
+		cascade(level, (current_tick >> (WHEEL_BITS * level)) & WHEEL_MASK);
+	}
+
+	/* Every timer in the current slot is due. */
+	slot = current_tick & WHEEL_MASK;
+	head = &wheel[0][slot];
+	if (head->next != head) {
+		head->next->prev = expired.prev;
+		expired.prev->next = head->next;
+		head->prev->next = &expired;
+		expired.prev = head->prev;
+		clear_list(head);
+	}
+
+	pthread_mutex_unlock(&wheel_mutex);
+}
+/******************************************************************************/
+int llp_get_expired_timer(int *session, int *type) {
+	llp_timer_t *timer;
+
+	while (1) {
+		pthread_mutex_lock(&wheel_mutex);
+		if (expired.next == &expired) {
+			pthread_mutex_unlock(&wheel_mutex);
+			return LLP_ERROR;
+		}
+		timer = expired.next;
+		unlink_timer(timer);
+		*session = timer->session;
+		*type = timer->type;
+		pthread_mutex_unlock(&wheel_mutex);
+
+		/* Only the session lock protects the expiration tick. */
+		llp_lock_session(*session);
+
+		if (timer->expires == 0) {
+			/* The timer was stopped. */
+			timer->armed = 0;
+		} else if (timer->expires > get_current_tick()) {
+			/* The timer was pushed back. */
+			pthread_mutex_lock(&wheel_mutex);
+			timer->deadline = timer->expires;
+			place_timer(timer);
+			pthread_mutex_unlock(&wheel_mutex);
+		} else {
+			timer->armed = 0;
+			timer->expires = 0;
+			return LLP_OK;
+		}
+
+		llp_unlock_session(*session);
+	}
+}
+
+/******************************************************************************/
+void llp_start_timers_clock(int fd) {
+
+	pthread_mutex_lock(&wheel_mutex);
+	start_time = llp_get_clock() - current_tick * LLP_TIME_TICK;
+	wakeup_fd = fd;
+	pthread_mutex_unlock(&wheel_mutex);
+}
+/******************************************************************************/
+long llp_get_clock() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000L + now.tv_nsec / 1000000L;
+}
+/******************************************************************************/
+int llp_get_timers_lag() {
+	long lag;
+
+	lag = get_current_tick() - __sync_add_and_fetch(&current_tick, 0);
+
+	return (lag > 0 ? lag : 0);
+}
+/******************************************************************************/
+int llp_skip_timers(int ticks) {
+	int return_value;
+
+	pthread_mutex_lock(&wheel_mutex);
+	if (timers_linked == 0) {
+		__sync_add_and_fetch(&current_tick, ticks);
+		return_value = LLP_OK;
+	} else {
+		return_value = LLP_ERROR;
+	}
+	pthread_mutex_unlock(&wheel_mutex);
+
+	return return_value;
+}
+/******************************************************************************/
+int llp_get_next_timer(struct timespec *when) {
+	int i;
+	long tick;
+
+	pthread_mutex_lock(&wheel_mutex);
+	if (timers_linked == 0) {
+		wakeup_tick = LONG_MAX;
+		pthread_mutex_unlock(&wheel_mutex);
+		return LLP_ERROR;
+	}
+
+	/* The next non-empty slot, but the wheel must also be advanced to cascade
+	 * the upper levels. */
+	for (i = 1; i < WHEEL_SLOTS; i++) {
+		tick = current_tick + i;
+		if ((tick & WHEEL_MASK) == 0 || wheel[0][tick & WHEEL_MASK].next !=
+				&wheel[0][tick & WHEEL_MASK]) {
+			break;
+		}
+	}
+	if (expired.next != &expired) {
+		i = 0;
+	}
+	wakeup_tick = current_tick + i;
+
+	when->tv_sec = (start_time + wakeup_tick * LLP_TIME_TICK) / 1000;
+	when->tv_nsec = ((start_time + wakeup_tick * LLP_TIME_TICK) % 1000) *
+			1000000L;
+	pthread_mutex_unlock(&wheel_mutex);
+
+	return LLP_OK;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+void clear_list(llp_timer_t *head) {
+	head->next = head;
+	head->prev = head;
+}
+/******************************************************************************/
+void append_timer(llp_timer_t *head, llp_timer_t *timer) {
+	timers_linked++;
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+/******************************************************************************/
+void unlink_timer(llp_timer_t *timer) {
+	timers_linked--;
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+/******************************************************************************/
+void place_timer(llp_timer_t *timer) {
+	int level;
+	long deadline;
+	llp_timer_t *head;
+
+	deadline = timer->deadline;
+	if (deadline <= current_tick) {
+		/* The current slot was already processed. */
+		deadline = current_tick + 1;
+	} else if (deadline - current_tick >= WHEEL_RANGE) {
+		deadline = current_tick + WHEEL_RANGE - 1;
+	}
+
+	/* The level is the first one whose slots reach the deadline. */
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (deadline - current_tick < (1L << (WHEEL_BITS * (level + 1)))) {
+			break;
+		}
+	}
+
+	head = &wheel[level][(deadline >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	append_timer(head, timer);
+}
+/******************************************************************************/
+void cascade(int level, int slot) {
+	llp_timer_t *head;
+	llp_timer_t *timer;
+
+	head = &wheel[level][slot];
+	while (head->next != head) {
+		timer = head->next;
+		unlink_timer(timer);
+		/* The current slot was not processed yet. */
+		if (timer->deadline <= current_tick) {
+			append_timer(&expired, timer);
+		} else {
+			place_timer(timer);
+		}
+	}
+}
+/******************************************************************************/
+long get_current_tick() {
+
+	if (wakeup_fd == -1) {
+		return __sync_add_and_fetch(&current_tick, 0);
+	}
+
+	return (llp_get_clock() - start_time) / LLP_TIME_TICK;
+}
+/******************************************************************************/
+void wake_up(long deadline) {
+	uint64_t value;
+
+	/* The event loop is sleeping past the deadline. */
+	if (wakeup_fd != -1 && deadline < wakeup_tick) {
+		wakeup_tick = deadline;
+		value = 1;
+		if (write(wakeup_fd, &value, sizeof(value)) < 0) {
+			liblog_error(LAYER_LINK, "error waking up event loop: %s.",
+					strerror(errno));
+		}
+	}
+}
+/******************************************************************************/
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_timers.h Headers of the timing wheel used to schedule session
+ * 		timeouts, keep-alives and expiration.
+ * @ingroup llp
+ */
+ 
+#ifndef _LLP_TIMERS_H_
+#define _LLP_TIMERS_H_
+
+#include <time.h>
+
+/**
+ * Enumeration of the timers associated with each session.
+ */
+enum llp_timer_types {
+	LLP_TIMER_TIMEOUT,		/**< Closes a session without traffic. */
+	LLP_TIMER_SILENCE,		/**< Sends a keep-alive after a silent period. */
+	LLP_TIMER_EXPIRATION	/**< Disconnects a session that lived too long. */
+};
+
+/**
+ * Number of timers associated with each session.
+ */
+#define LLP_TIMERS	3
+
+/**
+ * Data type that represents a session timer. Timers are kept inside the
+ * session information, so arming them never allocates memory.
+ */
+typedef struct llp_timer_s {
+	/** Links in the wheel slot, protected by the wheel lock. */
+	struct llp_timer_s *next;
+	struct llp_timer_s *prev;
+	/** Tick used to place the timer in the wheel. */
+	long deadline;
+	/** Tick when the timer expires, zero if the timer is stopped. */
+	long expires;
+	/** The timer is somewhere in the wheel. */
+	int armed;
+	/** Session that owns this timer. */
+	int session;
+	/** Type of this timer. */
+	int type;
+} llp_timer_t;
+
+/**
+ * Initializes the timing wheel.
+ * 
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_timers_initialize();
+
+/**
+ * Frees the resources used by the timing wheel.
+ */
+void llp_timers_finalize();
+
+/**
+ * Arms a session timer. A timer that is already armed to fire sooner is only
+ * pushed back when it fires, so re-arming a timer on every packet doesn't
+ * touch the wheel. Must be called with the session locked.
+ * 
+ * @param session session identifier.
+ * @param type type of the timer.
+ * @param ticks number of LLP_TIME_TICKs until the timer expires.
+ */
+void llp_set_timer(int session, int type, int ticks);
+
+/**
+ * Stops all timers of a session. Must be called with the session locked.
+ * 
+ * @param session session identifier.
+ */
+void llp_stop_timers(int session);
+
+/**
+ * Returns the time left before a session timer expires. Must be called with
+ * the session locked.
+ * 
+ * @param session session identifier.
+ * @param type type of the timer.
+ * @return the number of LLP_TIME_TICKs left, zero if the timer is stopped.
+ */
+int llp_get_timer(int session, int type);
+
+/**
+ * Advances the wheel by one LLP_TIME_TICK, collecting the timers due. Only the
+ * timers due in this tick are touched.
+ */
+void llp_advance_timers();
+
+/**
+ * Takes the next timer collected by llp_advance_timers() that really expired.
+ * Timers pushed back or stopped since they were armed are handled here
+ * without being returned. The session is returned locked.
+ * 
+ * @param session returns the session identifier.
+ * @param type returns the type of the timer.
+ * @return LLP_OK if a timer expired, LLP_ERROR if no more timers are due.
+ */
+int llp_get_expired_timer(int *session, int *type);
+
+/**
+ * Makes the wheel follow the monotonic clock, so that it can be advanced in
+ * bursts by an event loop that sleeps while no timer is due. From now on,
+ * arming a timer that expires before the loop wakes up writes to the given
+ * file descriptor.
+ * 
+ * @param fd descriptor of an eventfd watched by the event loop.
+ */
+void llp_start_timers_clock(int fd);
+
+/**
+ * Returns the number of ticks that the wheel must be advanced to reach the
+ * clock.
+ * 
+ * @return the number of LLP_TIME_TICKs late.
+ */
+int llp_get_timers_lag();
+
+/**
+ * Advances the wheel at once, if no timers are in it.
+ * 
+ * @param ticks number of LLP_TIME_TICKs skipped.
+ * @return LLP_OK if the ticks were skipped, LLP_ERROR if the wheel must be
+ * 		advanced one tick at a time.
+ */
+int llp_skip_timers(int ticks);
+
+/**
+ * Returns when the wheel must be advanced again, if it follows the clock.
+ * 
+ * @param when returns the time in the monotonic clock.
+ * @return LLP_OK if a timer is pending, LLP_ERROR if the wheel is empty.
+ */
+int llp_get_next_timer(struct timespec *when);
+
+/**
+ * Reads the monotonic clock.
+ * 
+ * @return the time in milliseconds.
+ */
+long llp_get_clock();
+
+#endif /* !_LLP_TIMERS_H_ */
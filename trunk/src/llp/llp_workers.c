@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_workers.c Implementations of routines used to run expensive
+ * 		session work, like handshake cryptography, outside the listener threads.
+ * @ingroup llp
+ */
+ 
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include <libfreedom/liblog.h>
+#include <libfreedom/layers.h>
+
+#include "llp_workers.h"
+#include "llp_sessions.h"
+#include "llp.h"
+
+/*============================================================================*/
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Capacity of the job queue. A session never has more than one job pending,
+ * so the queue can't overflow.
+ */
+#define QUEUE_SIZE	LLP_MAX_SESSIONS
+
+/**
+ * Data type that represents a job waiting for a worker.
+ */
+typedef struct {
+	/** Function that executes the job. */
+	void (*function)(int session);
+	/** Session the job refers to. */
+	int session;
+} job_t;
+
+/*
+ * Circular queue of jobs.
+ */
+static job_t queue[QUEUE_SIZE];
+
+/*@{ */
+/**
+ * Position of the first job and number of jobs in the queue.
+ */
+static int queue_head = 0;
+static int queue_size = 0;
+/*@} */
+
+/*
+ * Lock used to access the queue.
+ */
+static pthread_mutex_t queue_mutex;
+
+/*
+ * Condition variable signaled when a job is queued.
+ */
+static pthread_cond_t queue_condition;
+
+/*
+ * Worker threads.
+ */
+static pthread_t workers[LLP_MAX_WORKERS];
+
+/*
+ * Number of worker threads running.
+ */
+static int workers_count = 0;
+
+static int finish_execution = 0;
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
+/*============================================================================*/
+
+/*
+ * Function to be executed by the worker threads.
+ */
+static void *run_worker();
+
+/*============================================================================*/
+/* Public functions implementations.                                          */
+/*============================================================================*/
+
+int llp_workers_initialize(int count) {
+
+	if (pthread_mutex_init(&queue_mutex, NULL)) {
+		liblog_error(LAYER_LINK, "error creating mutex: %s.", strerror(errno));
+		return LLP_ERROR;
+	}
+
+	if (pthread_cond_init(&queue_condition, NULL)) {
+		liblog_error(LAYER_LINK, "error creating condition variable: %s.",
+				strerror(errno));
+		return LLP_ERROR;
+	}
+
+	queue_head = queue_size = 0;
+	finish_execution = 0;
+
+	for (workers_count = 0; workers_count < count; workers_count++) {
+		if (pthread_create(&workers[workers_count], NULL, run_worker, NULL)) {
+			liblog_error(LAYER_LINK, "error creating thread: %s.",
+					strerror(errno));
+			return LLP_ERROR;
+		}
+	}
+
+	liblog_debug(LAYER_LINK, "%d crypto workers created.", workers_count);
+	
+	return LLP_OK;
+}
+/******************************************************************************/
+void llp_workers_finalize() {
+	int i;
+
+	pthread_mutex_lock(&queue_mutex);
+	finish_execution = 1;
+	pthread_cond_broadcast(&queue_condition);
+	pthread_mutex_unlock(&queue_mutex);
+
+	for (i = 0; i < workers_count; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	workers_count = 0;
+
+	pthread_mutex_destroy(&queue_mutex);
+	pthread_cond_destroy(&queue_condition);
+}
+/******************************************************************************/
+int llp_submit_job(void (*job)(int session), int session) {
+
+	/* Without workers, the job is executed right away. */
+	if (workers_count == 0) {
+		job(session);
+		return LLP_OK;
+	}
+
+	pthread_mutex_lock(&queue_mutex);
+	if (queue_size == QUEUE_SIZE) {
+		pthread_mutex_unlock(&queue_mutex);
+		liblog_error(LAYER_LINK, "job queue is full.");
+		return LLP_ERROR;
+	}
+	queue[(queue_head + queue_size) % QUEUE_SIZE].function = job;
+	queue[(queue_head + queue_size) % QUEUE_SIZE].session = session;
+	queue_size++;
+	pthread_cond_signal(&queue_condition);
+	pthread_mutex_unlock(&queue_mutex);
+
+	return LLP_OK;
+}
+/******************************************************************************/
+int llp_get_pending_jobs() {
+	int return_value;
+
+	pthread_mutex_lock(&queue_mutex);
+	return_value = queue_size;
+	pthread_mutex_unlock(&queue_mutex);
+
+	return return_value;
+}
+
+/*============================================================================*/
+/* Private functions implementations.                                         */
+/*============================================================================*/
+
+void *run_worker() {
+	job_t job;
+
+	pthread_mutex_lock(&queue_mutex);
+	while (1) {
+		while (queue_size == 0 && !finish_execution) {
+			pthread_cond_wait(&queue_condition, &queue_mutex);
+		}
+		if (finish_execution) {
+			break;
+		}
+		job = queue[queue_head];
+		queue_head = (queue_head + 1) % QUEUE_SIZE;
+		queue_size--;
+		pthread_mutex_unlock(&queue_mutex);
+
+		job.function(job.session);
+
+		pthread_mutex_lock(&queue_mutex);
+	}
+	pthread_mutex_unlock(&queue_mutex);
+
+	pthread_exit(NULL);
+	
+	return LLP_OK;
+}
+/******************************************************************************/
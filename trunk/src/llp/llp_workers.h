@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2004 by
+ * - Diego "iamscared" Aranha <iamscared[at]users.sourceforge.net> &
+ * - Edans "snade" Flavius <snade[at]users.sourceforge.net>
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+ 
+/**
+ * @file llp_workers.h Headers of routines used to run expensive session work,
+ * 		like handshake cryptography, outside the listener threads.
+ * @ingroup llp
+ */
+ 
+#ifndef _LLP_WORKERS_H_
+#define _LLP_WORKERS_H_
+
+/**
+ * Maximum number of crypto workers.
+ */
+#define LLP_MAX_WORKERS		16
+
+/**
+ * Creates the worker threads and the job queue.
+ * 
+ * @param workers number of worker threads. If zero, jobs are executed by the
+ * 		thread that submits them.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_workers_initialize(int workers);
+
+/**
+ * Stops the worker threads, discarding the jobs not yet executed.
+ */
+void llp_workers_finalize();
+
+/**
+ * Schedules a job to be executed by a worker thread. The session must not be
+ * locked by the caller, and the job must lock it before use. The caller should
+ * mark the session with job_pending, so that the session is not reused, and
+ * the job should clear the mark.
+ * 
+ * @param job function that executes the job.
+ * @param session session the job refers to.
+ * @return LLP_OK if no errors occurred, LLP_ERROR otherwise.
+ */
+int llp_submit_job(void (*job)(int session), int session);
+
+/**
+ * Returns the number of jobs waiting for a worker.
+ * 
+ * @return the number of jobs queued.
+ */
+int llp_get_pending_jobs();
+
+#endif /* !_LLP_WORKERS_H_ */
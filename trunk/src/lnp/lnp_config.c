@@ -35,6 +35,7 @@
 #include <util/util_crypto.h>
 
 #include "lnp_config.h"
+#include "lnp_queue.h"
 #include "lnp.h"
 
 /*============================================================================*/
@@ -81,6 +82,31 @@ static void set_public_key_file(char *filename);
  */
 static void set_private_key_file(char *filename);
 
+/**
+ * Configures the number of datagrams held by the reliable protocol queue.
+ */
+static void set_reliable_queue_size(int reliable_queue_size);
+
+/**
+ * Configures the number of datagrams held by the unreliable protocol queue.
+ */
+static void set_unreliable_queue_size(int unreliable_queue_size);
+
+/**
+ * Configures the behaviour of the receivers when a queue is full.
+ */
+static void set_queue_policy(int queue_policy);
+
+/**
+ * Configures the time a receiver waits for room in a full queue, in ms.
+ */
+static void set_queue_timeout(int queue_timeout);
+
+/**
+ * Configures if encrypt-then-MAC framing is proposed in key exchanges.
+ */
+static void set_encrypt_then_mac(int encrypt_then_mac);
+
 /* 
  * Handles an integer parameter found on the configuration file parsing process.
  */
@@ -91,6 +117,11 @@ static DOTCONF_CB(handle_int);
  */
 static DOTCONF_CB(handle_file);
 
+/* 
+ * Handles the queue policy found on the configuration file parsing process.
+ */
+static DOTCONF_CB(handle_queue_policy);
+
 /*
  * Handles an list of ciphers found on the configuration file parsing.
  */
@@ -161,6 +192,22 @@ static int file_exists(const char *filename);
  * Default name of file containing the node private key.
  */
 #define DEFAULT_PRIVATE_KEY		"private.key"
+/*
+ * Default number of datagrams held by each queue.
+ */
+#define DEFAULT_QUEUE_SIZE		64
+/*
+ * Default queue policy (the new datagram is dropped).
+ */
+#define DEFAULT_QUEUE_POLICY	LNP_QUEUE_DROP_NEWEST
+/*
+ * Default time a receiver waits for room in a full queue, in ms.
+ */
+#define DEFAULT_QUEUE_TIMEOUT	100
+/*
+ * Default framing proposal (encrypt-then-MAC).
+ */
+#define DEFAULT_ENCRYPT_THEN_MAC	1
 /*
  * Default list of encryption algorithms.
  */
@@ -192,6 +239,26 @@ static int file_exists(const char *filename);
  * file.
  */
 #define PRIVATE_KEY_FILE_KEYWORD "private_key_file"
+/*
+ * Keyword used in configuration file to set the size of the reliable queue.
+ */
+#define RELIABLE_QUEUE_SIZE_KEYWORD		"reliable_queue_size"
+/*
+ * Keyword used in configuration file to set the size of the unreliable queue.
+ */
+#define UNRELIABLE_QUEUE_SIZE_KEYWORD	"unreliable_queue_size"
+/*
+ * Keyword used in configuration file to set the queue policy.
+ */
+#define QUEUE_POLICY_KEYWORD	"queue_policy"
+/*
+ * Keyword used in configuration file to set the queue timeout.
+ */
+#define QUEUE_TIMEOUT_KEYWORD	"queue_timeout"
+/*
+ * Keyword used in configuration file to propose encrypt-then-MAC framing.
+ */
+#define ENCRYPT_THEN_MAC_KEYWORD	"encrypt_then_mac"
 /*
  * Keyword used in configuration file to set the list of encryption algorithms.
  */
@@ -234,6 +301,16 @@ typedef struct {
 	char *public_key;
 	/** File used to obtain the private key (in PEM format). */
 	char *private_key;
+	/** Capacity of the reliable protocol queue (in datagrams). */
+	int reliable_queue_size;
+	/** Capacity of the unreliable protocol queue (in datagrams). */
+	int unreliable_queue_size;
+	/** Behaviour of the receivers when a queue is full. */
+	int queue_policy;
+	/** Time a receiver waits for room in a full queue (in ms). */
+	int queue_timeout;
+	/** 1 if encrypt-then-MAC framing is proposed, 0 otherwise. */
+	int encrypt_then_mac;
 	/** Cipher algorithms list. */
 	lnp_function_list_t cipher_list;
 	/** Hash functions list. */
@@ -249,6 +326,11 @@ static const configoption_t options[] = {
 	{KEY_STORE_SIZE_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
 	{PUBLIC_KEY_FILE_KEYWORD, ARG_STR, handle_file, NULL, CTX_ALL},
 	{PRIVATE_KEY_FILE_KEYWORD, ARG_STR, handle_file, NULL, CTX_ALL},
+	{RELIABLE_QUEUE_SIZE_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{UNRELIABLE_QUEUE_SIZE_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{QUEUE_POLICY_KEYWORD, ARG_STR, handle_queue_policy, NULL, CTX_ALL},
+	{QUEUE_TIMEOUT_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
+	{ENCRYPT_THEN_MAC_KEYWORD, ARG_INT, handle_int, NULL, CTX_ALL},
 	{CIPHER_LIST_KEYWORD, ARG_LIST, handle_ciphers, NULL, CTX_ALL},
 	{HASH_LIST_KEYWORD, ARG_LIST, handle_hashes, NULL, CTX_ALL},
 	{MAC_LIST_KEYWORD, ARG_LIST, handle_macs, NULL, CTX_ALL},
@@ -262,6 +344,11 @@ static const configoption_t options[] = {
 	DEFAULT_KEY_STORE_SIZE,		\
 	DEFAULT_PUBLIC_KEY,			\
 	DEFAULT_PRIVATE_KEY,		\
+	DEFAULT_QUEUE_SIZE,			\
+	DEFAULT_QUEUE_SIZE,			\
+	DEFAULT_QUEUE_POLICY,		\
+	DEFAULT_QUEUE_TIMEOUT,		\
+	DEFAULT_ENCRYPT_THEN_MAC,	\
 	DEFAULT_CIPHER_LIST,		\
 	DEFAULT_HASH_LIST,			\
 	DEFAULT_MAC_LIST			\
@@ -284,6 +371,12 @@ static char *cipher_string = NULL;
 static char *hash_string = NULL;
 static char *mac_string = NULL;
 
+/*
+ * Names of the queue policies, indexed by policy.
+ */
+static char *queue_policy_names[] = 
+		{NULL, "drop-newest", "drop-oldest", "block"};
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/
@@ -458,6 +551,33 @@ char *lnp_get_private_key_file() {
 	return current_config.private_key;
 }
 /******************************************************************************/
+int lnp_get_reliable_queue_size() {
+	return current_config.reliable_queue_size;
+}
+/******************************************************************************/
+int lnp_get_unreliable_queue_size() {
+	return current_config.unreliable_queue_size;
+}
+/******************************************************************************/
+int lnp_get_queue_policy() {
+	return current_config.queue_policy;
+}
+/******************************************************************************/
+char *lnp_get_queue_policy_name(int policy) {
+	if (policy < LNP_QUEUE_DROP_NEWEST || policy > LNP_QUEUE_BLOCK) {
+		return NULL;
+	}
+	return queue_policy_names[policy];
+}
+/******************************************************************************/
+int lnp_get_queue_timeout() {
+	return current_config.queue_timeout;
+}
+/******************************************************************************/
+int lnp_get_encrypt_then_mac() {
+	return current_config.encrypt_then_mac;
+}
+/******************************************************************************/
 int lnp_get_cipher_string(char *string, int max) {
 	return copy_function_string(string, max, cipher_string);
 }
@@ -494,6 +614,26 @@ void set_private_key_file(char *filename) {
 	}
 }
 /******************************************************************************/
+void set_reliable_queue_size(int reliable_queue_size) {
+	current_config.reliable_queue_size = reliable_queue_size;
+}
+/******************************************************************************/
+void set_unreliable_queue_size(int unreliable_queue_size) {
+	current_config.unreliable_queue_size = unreliable_queue_size;
+}
+/******************************************************************************/
+void set_queue_policy(int queue_policy) {
+	current_config.queue_policy = queue_policy;
+}
+/******************************************************************************/
+void set_queue_timeout(int queue_timeout) {
+	current_config.queue_timeout = queue_timeout;
+}
+/******************************************************************************/
+void set_encrypt_then_mac(int encrypt_then_mac) {
+	current_config.encrypt_then_mac = encrypt_then_mac;
+}
+/******************************************************************************/
 void set_cipher_list(lnp_function_list_t *cipher_list) {
 	remove_duplicates(&(current_config.cipher_list), cipher_list);		
 }
@@ -513,6 +653,30 @@ DOTCONF_CB(handle_int) {
 		set_key_store_size(cmd->data.value);
 		return NULL;
 	}
+
+	if (strcmp(cmd->name, RELIABLE_QUEUE_SIZE_KEYWORD) == 0) {
+		liblog_debug(LAYER_NET, "reliable_queue_size parameter found.");
+		set_reliable_queue_size(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, UNRELIABLE_QUEUE_SIZE_KEYWORD) == 0) {
+		liblog_debug(LAYER_NET, "unreliable_queue_size parameter found.");
+		set_unreliable_queue_size(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, QUEUE_TIMEOUT_KEYWORD) == 0) {
+		liblog_debug(LAYER_NET, "queue_timeout parameter found.");
+		set_queue_timeout(cmd->data.value);
+		return NULL;
+	}
+
+	if (strcmp(cmd->name, ENCRYPT_THEN_MAC_KEYWORD) == 0) {
+		liblog_debug(LAYER_NET, "encrypt_then_mac parameter found.");
+		set_encrypt_then_mac(cmd->data.value);
+		return NULL;
+	}
 	
 	return NULL;
 }
@@ -533,6 +697,21 @@ DOTCONF_CB(handle_file) {
 	return NULL;
 }
 /******************************************************************************/
+DOTCONF_CB(handle_queue_policy) {
+	int i;
+
+	for (i = LNP_QUEUE_DROP_NEWEST; i <= LNP_QUEUE_BLOCK; i++) {
+		if (strcmp(cmd->data.str, queue_policy_names[i]) == 0) {
+			liblog_debug(LAYER_NET, "queue_policy parameter found.");
+			set_queue_policy(i);
+			return NULL;
+		}
+	}
+	liblog_warn(LAYER_NET, "queue policy not supported: %s.", cmd->data.str);
+
+	return NULL;
+}
+/******************************************************************************/
 DOTCONF_CB(handle_ciphers) {
 	int i;
 	int size;
@@ -690,6 +869,45 @@ int check_sanity() {
 		current_config.private_key = DEFAULT_PRIVATE_KEY;
 		return_value = CONFIG_NOT_SANE;
 	}
+
+	if (current_config.reliable_queue_size < 1 ||
+			current_config.reliable_queue_size > LNP_MAX_QUEUE_SIZE) {
+		liblog_error(LAYER_NET, "reliable_queue_size must be between 1 and %d.",
+				LNP_MAX_QUEUE_SIZE);
+		current_config.reliable_queue_size = DEFAULT_QUEUE_SIZE;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.unreliable_queue_size < 1 ||
+			current_config.unreliable_queue_size > LNP_MAX_QUEUE_SIZE) {
+		liblog_error(LAYER_NET, 
+				"unreliable_queue_size must be between 1 and %d.",
+				LNP_MAX_QUEUE_SIZE);
+		current_config.unreliable_queue_size = DEFAULT_QUEUE_SIZE;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.queue_policy < LNP_QUEUE_DROP_NEWEST ||
+			current_config.queue_policy > LNP_QUEUE_BLOCK) {
+		liblog_error(LAYER_NET, "queue_policy is invalid.");
+		current_config.queue_policy = DEFAULT_QUEUE_POLICY;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.queue_timeout < 0 ||
+			current_config.queue_timeout > LNP_MAX_QUEUE_TIMEOUT) {
+		liblog_error(LAYER_NET, "queue_timeout must be between 0 and %d.",
+				LNP_MAX_QUEUE_TIMEOUT);
+		current_config.queue_timeout = DEFAULT_QUEUE_TIMEOUT;
+		return_value = CONFIG_NOT_SANE;
+	}
+
+	if (current_config.encrypt_then_mac != 0 &&
+			current_config.encrypt_then_mac != 1) {
+		liblog_error(LAYER_NET, "encrypt_then_mac must be 0 or 1.");
+		current_config.encrypt_then_mac = DEFAULT_ENCRYPT_THEN_MAC;
+		return_value = CONFIG_NOT_SANE;
+	}
 	
 	if (current_config.cipher_list.size <= 0) {
 		liblog_error(LAYER_NET, "cipher_list is invalid.");
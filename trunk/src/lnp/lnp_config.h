@@ -93,6 +93,51 @@ char *lnp_get_public_key_file();
  */
 char *lnp_get_private_key_file();
 
+/**
+ * Returns the capacity of the reliable protocol queue.
+ * 
+ * @return number of datagrams held by the reliable protocol queue.
+ */
+int lnp_get_reliable_queue_size();
+
+/**
+ * Returns the capacity of the unreliable protocol queue.
+ * 
+ * @return number of datagrams held by the unreliable protocol queue.
+ */
+int lnp_get_unreliable_queue_size();
+
+/**
+ * Returns the behaviour of the receivers when a queue is full.
+ * 
+ * @return one of the LNP_QUEUE_* policies.
+ */
+int lnp_get_queue_policy();
+
+/**
+ * Returns the name of the given queue policy.
+ * 
+ * @param policy one of the LNP_QUEUE_* policies.
+ * @return the name of the policy, or NULL if the policy is unknown.
+ */
+char *lnp_get_queue_policy_name(int policy);
+
+/**
+ * Returns the time a receiver waits for room in a full queue when the queue
+ * policy is block.
+ * 
+ * @return the timeout in milliseconds.
+ */
+int lnp_get_queue_timeout();
+
+/**
+ * Returns if encrypt-then-MAC framing of LNP_DATA packets is proposed in key
+ * exchanges.
+ * 
+ * @return 1 if the framing is proposed, 0 otherwise.
+ */
+int lnp_get_encrypt_then_mac();
+
 /**
  * Fills a string containing all cipher functions supported. The string must be
  * pre-allocated, and the parameter max controls the maximum number of bytes
@@ -38,6 +38,8 @@
 #include "lnp_store.h"
 #include "lnp_handshake.h"
 #include "lnp_routing_table.h"
+#include "lnp_queue.h"
+#include "lnp_config.h"
 
 /*============================================================================*/
 /* Private functions prototypes.                                              */
@@ -126,6 +128,16 @@ static void console_connect(char *out_buffer, int buffer_len, char *args);
  */
 static void console_print_keys(char *out_buffer, int buffer_len, char *args);
 
+/*
+ * Execute COMMAND_QUEUES command.
+ */
+static void console_queues(char *out_buffer, int buffer_len, char *args);
+
+/*
+ * Execute COMMAND_DATA command.
+ */
+static void console_data(char *out_buffer, int buffer_len, char *args);
+
 /*============================================================================*/
 /* Private data definitions.                                                  */
 /*============================================================================*/
@@ -149,6 +161,8 @@ static layer_console_t layer_console = {
 #define COMMAND_HISTORY			6
 #define COMMAND_CONNECT			7
 #define COMMAND_KEYS			8
+#define COMMAND_QUEUES			9
+#define COMMAND_DATA			10
 
 /*
  * All available commands to link stub module.
@@ -170,6 +184,10 @@ static command_t commands[] = {
 			". connect to some ID."},
 	{COMMAND_KEYS, "keys", "[keys <id>]"
 			". show keys negaciated with some ID."},
+	{COMMAND_QUEUES, "queues", "[queues]"
+			". output receive queues counters."},
+	{COMMAND_DATA, "data", "[data]"
+			". output LNP_DATA packets counters."},
 };
 
 /*============================================================================*/
@@ -207,6 +225,12 @@ static void lnp_console_execute_command(char *out_buffer, int buffer_len,
 		case COMMAND_KEYS:
 			console_print_keys(out_buffer, buffer_len, args);
 			break;
+		case COMMAND_QUEUES:
+			console_queues(out_buffer, buffer_len, args);
+			break;
+		case COMMAND_DATA:
+			console_data(out_buffer, buffer_len, args);
+			break;
 	}
 }
 /******************************************************************************/
@@ -378,6 +402,58 @@ void console_connections(char *out_buffer, int buffer_len, char *args) {
 	}
 }
 /******************************************************************************/
+void console_queues(char *out_buffer, int buffer_len, char *args) {
+	lnp_queue_stats_t stats;
+	int protocol;
+
+	console_printf(out_buffer, buffer_len, 
+			"Queue policy: %s, timeout %d ms\n\n",
+			lnp_get_queue_policy_name(lnp_get_queue_policy()),
+			lnp_get_queue_timeout());
+	console_printf(out_buffer, buffer_len, 
+			"%-12s %-8s %-8s %-10s %-10s %-10s %-10s\n", 
+			"Queue",
+			"Capacity",
+			"Length",
+			"Enqueued",
+			"Dequeued",
+			"Dropped",
+			"High-water");
+
+	for (protocol = LNP_PROTOCOL_RELIABLE; 
+			protocol <= LNP_PROTOCOL_UNRELIABLE; protocol++) {
+		if (lnp_get_queue_stats(protocol, &stats) == LNP_ERROR) {
+			continue;
+		}
+		console_printf(out_buffer, buffer_len, 
+				"%-12s %-8d %-8d %-10ld %-10ld %-10ld %-10d\n", 
+				protocol == LNP_PROTOCOL_RELIABLE ? "reliable" : "unreliable",
+				stats.capacity,
+				stats.length,
+				stats.enqueued,
+				stats.dequeued,
+				stats.dropped,
+				stats.high_water);
+	}
+}
+/******************************************************************************/
+void console_data(char *out_buffer, int buffer_len, char *args) {
+	lnp_data_stats_t stats;
+
+	lnp_get_data_stats(&stats);
+	console_printf(out_buffer, buffer_len, 
+			"Encrypt-then-MAC proposed: %s\n\n",
+			lnp_get_encrypt_then_mac() ? "yes" : "no");
+	console_printf(out_buffer, buffer_len, "%-10s %-15s %-15s\n", 
+			"Accepted",
+			"Rejected early",
+			"Rejected late");
+	console_printf(out_buffer, buffer_len, "%-10ld %-15ld %-15ld\n", 
+			stats.accepted,
+			stats.rejected_early,
+			stats.rejected_late);
+}
+/******************************************************************************/
 void console_flush(char *out_buffer, int buffer_len, char *args) {
 	int return_value;
 	
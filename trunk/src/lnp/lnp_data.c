@@ -36,6 +36,8 @@
 
 #include <pthread.h>
 
+#include <openssl/crypto.h>
+
 #include <libfreedom/liblog.h>
 #include <util/util_crypto.h>
 #include <util/util_data.h>
@@ -52,7 +54,22 @@
 #include "lnp_routing_table.h"
 
 /*============================================================================*/
-/* Private functions implementations.                                         */
+/* Private data definitions.                                                  */
+/*============================================================================*/
+
+/*
+ * Length of the header fields covered by encrypt-then-MAC: type, source and
+ * destination. The TTL and the flags may change on the way.
+ */
+#define AUTHENTICATED_HEADER_LENGTH	(sizeof(u_char) + 2 * NET_ID_LENGTH)
+
+/*
+ * Counters of the LNP_DATA packets received.
+ */
+static lnp_data_stats_t data_stats;
+
+/*============================================================================*/
+/* Private functions prototypes.                                              */
 /*============================================================================*/
 
 /*
@@ -60,11 +77,23 @@
  */
 static int send_data(net_id_t id_to, u_char *data, int length, u_char protocol);
 
+/*
+ * Writes the header fields covered by encrypt-then-MAC.
+ * 
+ * @param header - buffer with AUTHENTICATED_HEADER_LENGTH bytes.
+ * @param type - the packet type.
+ * @param source - the source ID address.
+ * @param destination - the destination ID address.
+ */
+static void build_authenticated_header(u_char *header, u_char type, 
+		net_id_t source, net_id_t destination);
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/
 
 int lnp_handle_data(lnp_packet_p *packet, int content_length) {
+	u_char header[AUTHENTICATED_HEADER_LENGTH];
 	int return_value;
 	int mac_length;
 	u_short padding_length;
@@ -101,50 +130,91 @@ int lnp_handle_data(lnp_packet_p *packet, int content_length) {
 	}
 	content_length = content_length - mac_length;
 	mac = &packet->content[content_length];
+
+	/* Packets without keys or too small to be valid are dropped early. */
+	if (lnp_key_store[store_entry_index].crypto_in == NULL ||
+			content_length < (int)(sizeof(u_char) + 2 * sizeof(u_short))) {
+		__sync_fetch_and_add(&data_stats.rejected_early, 1);
+		liblog_error(LAYER_NET, "invalid packet dropped.");
+		return_value = LNP_ERROR;
+		goto return_label;
+	}
 	
 	/* Allocating memory for packet. */
-	plain_content = (u_char *)malloc(content_length);
 	real_mac = (u_char *)malloc(mac_length);
 	if (real_mac == NULL) {
 		liblog_fatal(LAYER_NET, "error in malloc: %s.", strerror(errno));
 		return_value = LNP_ERROR;
 		goto return_label;
 	}
+
+	/* With encrypt-then-MAC, forged packets are dropped before decryption. */
+	if (lnp_key_store[store_entry_index].framing == 
+			LNP_FRAMING_ENCRYPT_THEN_MAC) {
+		build_authenticated_header(header, packet->type, packet->source,
+				packet->destination);
+		if (libkeys_mac_header(lnp_key_store[store_entry_index].crypto_in,
+				real_mac, header, AUTHENTICATED_HEADER_LENGTH, 
+				packet->content, content_length) == LIBKEYS_ERROR ||
+				CRYPTO_memcmp(mac, real_mac, mac_length) != 0) {
+			__sync_fetch_and_add(&data_stats.rejected_early, 1);
+			liblog_error(LAYER_NET, "MAC mismatch. packet dropped.");
+			return_value = LNP_ERROR;
+			goto return_label;
+		}
+		liblog_debug(LAYER_NET, "MAC verified.");
+	}
+
+	plain_content = (u_char *)malloc(content_length);
+	if (plain_content == NULL) {
+		liblog_fatal(LAYER_NET, "error in malloc: %s.", strerror(errno));
+		return_value = LNP_ERROR;
+		goto return_label;
+	}
 	
 	/* Decrypting content. */
-	lnp_key_store[store_entry_index].cipher->function(plain_content,
-			packet->content, 
-			lnp_key_store[store_entry_index].cipher_in_key,
-			lnp_key_store[store_entry_index].cipher_in_iv, 
-			content_length,
-			UTIL_WAY_DECRYPTION);
-	
+	libkeys_cipher(lnp_key_store[store_entry_index].crypto_in, 
+			plain_content, packet->content, content_length);
 	
 	liblog_debug(LAYER_NET, "packet decrypted.");
 
+	/* Generation MAC of the plain content. */
+	if (lnp_key_store[store_entry_index].framing == 
+			LNP_FRAMING_MAC_THEN_ENCRYPT) {
+		if (lnp_key_store[store_entry_index].mac != NULL) {
+			/* TODO: retirar esse if == NULL*/
+			libkeys_mac(lnp_key_store[store_entry_index].crypto_in, 
+					real_mac, plain_content, content_length);
+		}
+
+		if (CRYPTO_memcmp(mac, real_mac, mac_length) != 0) {
+			/* Drop packet. */
+			__sync_fetch_and_add(&data_stats.rejected_late, 1);
+			liblog_error(LAYER_NET, "MAC mismatch. packet dropped.");
+			return_value = LNP_ERROR;
+			goto return_label;
+		}
+		liblog_debug(LAYER_NET, "MAC verified.");
+	}
+
 	/* Read the data after decrypted. */
 	offset = content_length - sizeof(u_short);
 	util_read_uint16(&padding_length, &offset, plain_content);
-	
-	offset = padding_length;
-	util_read_byte  (&protocol, &offset, plain_content);
-	util_read_uint16(&timestamp, &offset, plain_content);
-
-	/* Generation MAC of the plain content. */
-	if (lnp_key_store[store_entry_index].mac != NULL) {
-		/* TODO: retirar esse if == NULL*/
-		lnp_key_store[store_entry_index].mac->function(real_mac, plain_content,
-				lnp_key_store[store_entry_index].mac_in_key, content_length);
-	}
 
-	if (memcmp(mac, real_mac, mac_length) != 0) {
-		/* Drop packet. */
-		liblog_error(LAYER_NET, "MAC mismatch. packet dropped.");
+	/* The padding length comes from the peer, it must be checked. */
+	if (padding_length > content_length 
+			- (sizeof(u_char) + 2 * sizeof(u_short))) {
+		__sync_fetch_and_add(&data_stats.rejected_late, 1);
+		liblog_error(LAYER_NET, "invalid padding length. packet dropped.");
 		return_value = LNP_ERROR;
 		goto return_label;
 	}
 	
-	liblog_debug(LAYER_NET, "MAC verified.");
+	offset = padding_length;
+	util_read_byte  (&protocol, &offset, plain_content);
+	util_read_uint16(&timestamp, &offset, plain_content);
+
+	__sync_fetch_and_add(&data_stats.accepted, 1);
 	
 	return_value = lnp_enqueue_datagram(packet->source,
 			&plain_content[padding_length + (sizeof(u_char) + sizeof(u_short))], 
@@ -164,6 +234,12 @@ return_label:
 	return return_value;
 }
 /******************************************************************************/
+void lnp_get_data_stats(lnp_data_stats_t *stats) {
+	stats->accepted = data_stats.accepted;
+	stats->rejected_early = data_stats.rejected_early;
+	stats->rejected_late = data_stats.rejected_late;
+}
+/******************************************************************************/
 int lnp_read(net_id_t from, u_char *data, int max, u_char protocol) {
 	int return_value = lnp_dequeue_datagram(from, data, max, protocol);
 	return (return_value == LNP_ERROR ? NET_ERROR : return_value);
@@ -213,6 +289,7 @@ int send_data(net_id_t id_to, u_char *data, int length, u_char protocol) {
 	u_char *packet = NULL;
 	u_char *content = NULL;
 	u_char *plain_content = NULL;
+	u_char header[AUTHENTICATED_HEADER_LENGTH];
 	u_char ttl = 0;
 	u_char flags = 0;
 	int routing_entry_index;
@@ -306,10 +383,12 @@ int send_data(net_id_t id_to, u_char *data, int length, u_char protocol) {
 	util_join_uint16(plain_content, &offset, padding_length);
 	
 	/* Generating MAC of the plaintext content. */
-	if (lnp_key_store[store_entry_index].mac != NULL) {
+	if (lnp_key_store[store_entry_index].mac != NULL &&
+			lnp_key_store[store_entry_index].framing == 
+			LNP_FRAMING_MAC_THEN_ENCRYPT) {
 		/* TODO: tirar todos os mac==NULL) */
-		lnp_key_store[store_entry_index].mac->function(mac, plain_content,
-				lnp_key_store[store_entry_index].mac_out_key, content_length);
+		libkeys_mac(lnp_key_store[store_entry_index].crypto_out, mac,
+				plain_content, content_length);
 	}
 	
 	/* Constructing LNP_DATA packet. */
@@ -324,14 +403,24 @@ int send_data(net_id_t id_to, u_char *data, int length, u_char protocol) {
 	content = &packet[offset]; /* address to content be placed */
 	offset += content_length;  /* skipping the content field */
 
+	/* Encrypting content */
+	libkeys_cipher(lnp_key_store[store_entry_index].crypto_out, content,
+			plain_content, content_length);
+
+	/* Generating MAC of the header and the ciphertext. */
+	if (lnp_key_store[store_entry_index].framing == 
+			LNP_FRAMING_ENCRYPT_THEN_MAC) {
+		build_authenticated_header(header, LNP_DATA, my_id, id_to);
+		if (libkeys_mac_header(lnp_key_store[store_entry_index].crypto_out,
+				mac, header, AUTHENTICATED_HEADER_LENGTH, content, 
+				content_length) == LIBKEYS_ERROR) {
+			return_value = LNP_ERROR;
+			goto return_label;
+		}
+	}
+	
 	/* Writing MAC on packet. */
 	util_join_bytes (packet, &offset, mac, mac_length);
-	
-	/* Encrypting content */
-	lnp_key_store[store_entry_index].cipher->function(content, plain_content, 
-			lnp_key_store[store_entry_index].cipher_out_key,
-			lnp_key_store[store_entry_index].cipher_out_iv, content_length,
-			UTIL_WAY_ENCRYPTION);
 			
 	return_value = LNP_OK;
 	
@@ -357,3 +446,13 @@ return_label:
 	return return_value;
 }
 /******************************************************************************/
+void build_authenticated_header(u_char *header, u_char type, 
+		net_id_t source, net_id_t destination) {
+	int offset;
+
+	offset = 0;
+	util_join_byte  (header, &offset, type);
+	util_join_bytes	(header, &offset, source, NET_ID_LENGTH);
+	util_join_bytes	(header, &offset, destination, NET_ID_LENGTH);
+}
+/******************************************************************************/
@@ -31,6 +31,18 @@
 
 #include "lnp_packets.h"
 
+/**
+ * Counters of the LNP_DATA packets received.
+ */
+typedef struct {
+	/** Number of packets accepted. */
+	long accepted;
+	/** Number of packets dropped before decryption, forged or malformed. */
+	long rejected_early;
+	/** Number of packets dropped after decryption. */
+	long rejected_late;
+} lnp_data_stats_t;
+
 /**
  * Handle a received LLP_DATA packet.
  * 
@@ -70,4 +82,11 @@ int lnp_write(net_id_t id_to, u_char *data, int length, u_char protocol);
  */
 int lnp_flush(u_char protocol);
 
+/**
+ * Copies the counters of the LNP_DATA packets received to stats.
+ * 
+ * @param stats structure that will receive the counters.
+ */
+void lnp_get_data_stats(lnp_data_stats_t *stats);
+
 #endif /* !_LLP_DATA_H_ */
@@ -292,6 +292,12 @@ int lnp_handle_key_exchange(lnp_packet_p *packet, int content_length) {
 	memcpy(lnp_key_store[store_entry_index].k_in,
 			key_exchange.encrypted_k_2, LNP_K_LENGTH);
 
+	/* Encrypt-then-MAC is used only if both sides propose it. */
+	lnp_key_store[store_entry_index].framing = (
+			(packet->flags & LNP_FLAG_ENCRYPT_THEN_MAC) && 
+			lnp_get_encrypt_then_mac() ?
+			LNP_FRAMING_ENCRYPT_THEN_MAC : LNP_FRAMING_MAC_THEN_ENCRYPT);
+
 	/* Create all the keys. */
 	if (create_keys(store_entry_index) == LNP_ERROR) {
 		liblog_error(LAYER_NET, "error generating session keys.");
@@ -369,6 +375,12 @@ int lnp_handle_key_exchange_ok(lnp_packet_p *packet, int content_length) {
 		lnp_routing_entry_unlock(routing_entry_index);
 		return LNP_ERROR;
 	}
+
+	/* The flag is only set by peers that accepted our proposal. */
+	lnp_key_store[store_entry_index].framing = (
+			(packet->flags & LNP_FLAG_ENCRYPT_THEN_MAC) && 
+			lnp_get_encrypt_then_mac() ?
+			LNP_FRAMING_ENCRYPT_THEN_MAC : LNP_FRAMING_MAC_THEN_ENCRYPT);
 	
 	/* Create all the keys. */
 	if (create_keys(store_entry_index) == LNP_ERROR) {
@@ -569,6 +581,26 @@ int create_keys(int index) {
 		free(mac_key);
 		return LNP_ERROR;
 	}
+
+	/* Keys are expanded once, and reused by every packet. */
+	libkeys_destroy(lnp_key_store[index].crypto_in);
+	libkeys_destroy(lnp_key_store[index].crypto_out);
+	lnp_key_store[index].crypto_in = libkeys_create(LAYER_NET,
+			lnp_key_store[index].cipher, lnp_key_store[index].cipher_in_key,
+			lnp_key_store[index].cipher_in_iv, lnp_key_store[index].mac,
+			lnp_key_store[index].mac_in_key, UTIL_WAY_DECRYPTION);
+	lnp_key_store[index].crypto_out = libkeys_create(LAYER_NET,
+			lnp_key_store[index].cipher, lnp_key_store[index].cipher_out_key,
+			lnp_key_store[index].cipher_out_iv, lnp_key_store[index].mac,
+			lnp_key_store[index].mac_out_key, UTIL_WAY_ENCRYPTION);
+	if (lnp_key_store[index].crypto_in == NULL ||
+			lnp_key_store[index].crypto_out == NULL) {
+		liblog_error(LAYER_NET, "error creating crypto contexts.");
+		free(cipher_key);
+		free(cipher_iv);
+		free(mac_key);
+		return LNP_ERROR;
+	}
 	
 	liblog_error(LAYER_NET, "keys generated.");
 
@@ -690,6 +722,10 @@ int send_key_exchange(net_id_t id, int store_entry_index) {
 	lnp_get_hash_string(hash_string, LNP_FUNCTION_LIST_MAX_LENGTH);
 	lnp_get_mac_string(mac_string, LNP_FUNCTION_LIST_MAX_LENGTH);
 	
+	if (lnp_get_encrypt_then_mac()) {
+		flags |= LNP_FLAG_ENCRYPT_THEN_MAC;
+	}
+	
 	/* Constructing key exchange packet. */
 	offset = 0;
 	util_join_byte  (packet, &offset, LNP_KEY_EXCHANGE);
@@ -723,6 +759,11 @@ int send_key_exchange_ok(net_id_t id, int store_entry_index) {
 	u_char flags = 0;
 	u_char packet[LNP_KEY_EXCHANGE_OK_MAX_LENGTH];
 	
+	if (lnp_key_store[store_entry_index].framing == 
+			LNP_FRAMING_ENCRYPT_THEN_MAC) {
+		flags |= LNP_FLAG_ENCRYPT_THEN_MAC;
+	}
+	
 	/* Constructing key exchange acknowledgment packet. */
 	offset = 0;
 	util_join_byte	(packet, &offset, LNP_KEY_EXCHANGE_OK);
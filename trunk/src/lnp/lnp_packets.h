@@ -100,6 +100,12 @@ enum llp_packet_ids {
 /** */
 #define LNP_UNICAST		0
 
+/**
+ * Flag of the LNP_KEY_EXCHANGE and LNP_KEY_EXCHANGE_OK packets that proposes,
+ * or accepts, encrypt-then-MAC framing for LNP_DATA packets.
+ */
+#define LNP_FLAG_ENCRYPT_THEN_MAC	0x80
+
 /**
  * Packet LLP_PUBLIC_KEY_REQUEST, used to establish new connections.
  */
@@ -27,14 +27,20 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
 #include <util/util.h>
-#include <util/util_queue.h>
 
 #include <libfreedom/layer_net.h>
 #include <libfreedom/liblog.h>
 
 #include "lnp_queue.h"
+#include "lnp_config.h"
 #include "lnp.h"
 
 /*============================================================================*/
@@ -42,15 +48,45 @@
 /*============================================================================*/
 
 /*
- * Size of the queue used to store received datagrams.
+ * Number of bytes of datagram stored inline in each slot.
  */
-#define LNP_QUEUE_RELIABLE_SIZE		64
-#define LNP_QUEUE_UNRELIABLE_SIZE	64
+#define SLOT_DATA_LENGTH	LIBFREEDOM_FTU
 
 /*
- * Queue used to store received datagrams
+ * Datagram stored in a queue. The sequence tells producers and consumers whose
+ * turn it is to use the slot.
  */
-static util_queue_t queues[2];
+typedef struct {
+	volatile unsigned sequence;		/* Position the slot is ready for. */
+	int length;						/* Length in bytes of the datagram. */
+	net_id_t from;					/* Source ID address. */
+	u_char data[SLOT_DATA_LENGTH];	/* The datagram. */
+} slot_t;
+
+/*
+ * Bounded lock-free queue used to store received datagrams, with any number of
+ * producers and consumers. Threads only sleep on the eventfds when the queue
+ * is empty or full.
+ */
+typedef struct {
+	slot_t *slots;					/* Circular array of slots. */
+	unsigned mask;					/* Number of slots minus one. */
+	volatile unsigned enqueue_position;	/* Next position to be written. */
+	volatile unsigned dequeue_position;	/* Next position to be read. */
+	volatile int readers_sleeping;	/* Readers waiting on readable_fd. */
+	volatile int writers_sleeping;	/* Writers waiting on writable_fd. */
+	int readable_fd;				/* Written when a datagram is stored. */
+	int writable_fd;				/* Written when a datagram is taken. */
+	volatile long enqueued;			/* Datagrams stored, for statistics. */
+	volatile long dequeued;			/* Datagrams read, for statistics. */
+	volatile long dropped;			/* Datagrams dropped, for statistics. */
+	volatile int high_water;		/* Largest number of datagrams held. */
+} queue_t;
+
+/*
+ * Queues used to store received datagrams
+ */
+static queue_t queues[2];
 
 /*
  * 
@@ -64,91 +100,212 @@ static util_queue_t queues[2];
 
 inline int get_queue_index(u_char protocol);
 
+/*
+ * Initializes a queue with room for at least size datagrams.
+ */
+static int initialize_queue(queue_t *queue, int size);
+
+/*
+ * Frees the resources used by a queue.
+ */
+static void finalize_queue(queue_t *queue);
+
+/*
+ * Stores a datagram in the queue, failing if the queue is full.
+ */
+static int push(queue_t *queue, net_id_t from, u_char *datagram, int length);
+
+/*
+ * Takes the oldest datagram from the queue, failing if the queue is empty. If
+ * datagram is NULL, the datagram is discarded.
+ */
+static int pop(queue_t *queue, net_id_t from, u_char *datagram, int max);
+
+/*
+ * Sleeps until the eventfd is written or timeout milliseconds pass. A negative
+ * timeout waits forever.
+ */
+static void wait_event(int fd, int timeout);
+
+/*
+ * Wakes one thread sleeping on the eventfd.
+ */
+static void signal_event(int fd);
+
+/*
+ * Returns a monotonic clock in milliseconds.
+ */
+static long get_clock();
+
 /*============================================================================*/
 /* Public functions implementations.                                          */
 /*============================================================================*/
 
 int lnp_queue_initialize() {
-	int return_value;
-	
-	return_value 
-			= (util_initialize_queue(&queues[QUEUE_RELIABLE], 
-					LNP_QUEUE_RELIABLE_SIZE) == UTIL_OK)
-			&& (util_initialize_queue(&queues[QUEUE_UNRELIABLE], 
-					LNP_QUEUE_UNRELIABLE_SIZE) == UTIL_OK);
+	if (initialize_queue(&queues[QUEUE_RELIABLE], 
+			lnp_get_reliable_queue_size()) == LNP_ERROR) {
+		return LNP_ERROR;
+	}
+	if (initialize_queue(&queues[QUEUE_UNRELIABLE], 
+			lnp_get_unreliable_queue_size()) == LNP_ERROR) {
+		finalize_queue(&queues[QUEUE_RELIABLE]);
+		return LNP_ERROR;
+	}
 					
-	return (return_value ? LNP_OK : LNP_ERROR);
+	return LNP_OK;
 }
 /******************************************************************************/
 void lnp_queue_finalize() {
-	util_finalize_queue(&queues[QUEUE_RELIABLE]);
-	util_finalize_queue(&queues[QUEUE_UNRELIABLE]);
+	finalize_queue(&queues[QUEUE_RELIABLE]);
+	finalize_queue(&queues[QUEUE_UNRELIABLE]);
 }
 /******************************************************************************/ 
 int lnp_enqueue_datagram(net_id_t from, u_char *datagram, int length, 
 		u_char protocol) {
-	int return_value;
-	u_char *id = NULL;
+	queue_t *queue;
+	long deadline;
+	long remaining;
+	int held;
+	int high_water;
 	
 	int queue_index = get_queue_index(protocol);
 	if (queue_index == LNP_ERROR) {
 		return LNP_ERROR;
 	}
+	queue = &queues[queue_index];
 	
-	id = (u_char *)malloc(sizeof(net_id_t));
-	if (id == NULL) {
+	if (length > SLOT_DATA_LENGTH) {
+		liblog_error(LAYER_NET, "datagram too big, packet dropped.");
 		return LNP_ERROR;
 	}
 	
-	memcpy(id, from, sizeof(net_id_t));
+	deadline = 0;
+	while (push(queue, from, datagram, length) == LNP_ERROR) {
+		switch (lnp_get_queue_policy()) {
+			case LNP_QUEUE_DROP_OLDEST:
+				if (pop(queue, NULL, NULL, 0) != LNP_ERROR) {
+					__sync_fetch_and_add(&queue->dropped, 1);
+				}
+				continue;
+			case LNP_QUEUE_BLOCK:
+				if (deadline == 0) {
+					deadline = get_clock() + lnp_get_queue_timeout();
+				}
+				remaining = deadline - get_clock();
+				if (remaining > 0) {
+					/* Announcing the sleep before the last try, so a reader
+					 * taking a datagram meanwhile wakes us. */
+					__sync_fetch_and_add(&queue->writers_sleeping, 1);
+					if (push(queue, from, datagram, length) == LNP_OK) {
+						__sync_fetch_and_sub(&queue->writers_sleeping, 1);
+						goto stored_label;
+					}
+					wait_event(queue->writable_fd, remaining);
+					__sync_fetch_and_sub(&queue->writers_sleeping, 1);
+					continue;
+				}
+				break;
+			default:
+				break;
+		}
+		__sync_fetch_and_add(&queue->dropped, 1);
+		liblog_debug(LAYER_NET, "queue full, datagram dropped.");
+		return LNP_ERROR;
+	}
+	
+stored_label:
+	
+	__sync_fetch_and_add(&queue->enqueued, 1);
+	held = queue->enqueue_position - queue->dequeue_position;
+	high_water = queue->high_water;
+	while (held > high_water && !__sync_bool_compare_and_swap(
+			&queue->high_water, high_water, held)) {
+		high_water = queue->high_water;
+	}
+	
+	__sync_synchronize();
+	if (queue->readers_sleeping > 0) {
+		signal_event(queue->readable_fd);
+	}
 	
-	/* We are using the tag pointer to store the id. */
-	return_value = util_enqueue(&queues[queue_index], 
-			(void *)id, datagram, length);
-	return (return_value == UTIL_OK ? LNP_OK : LNP_ERROR);
+	return LNP_OK;
 }
 /******************************************************************************/
 int lnp_dequeue_datagram(net_id_t from, u_char *datagram, int max, 
 		u_char protocol) {
+	queue_t *queue;
 	int return_value;
-	u_char *id = NULL;
-
+	
 	int queue_index = get_queue_index(protocol);
 	if (queue_index == LNP_ERROR) {
 		return LNP_ERROR;
 	}
+	queue = &queues[queue_index];
 	
-	return_value = util_dequeue(&queues[queue_index], (void **)&id, 
-			datagram, max);
-	/* We are using the tag pointer to store the id. */
-	if (return_value != UTIL_ERROR) {
-		memcpy(from, id, sizeof(net_id_t));
-		free(id);
-		return return_value;
+	while ((return_value = pop(queue, from, datagram, max)) == LNP_ERROR) {
+		/* Announcing the sleep before the last try, so a writer storing a
+		 * datagram meanwhile wakes us. */
+		__sync_fetch_and_add(&queue->readers_sleeping, 1);
+		return_value = pop(queue, from, datagram, max);
+		if (return_value != LNP_ERROR) {
+			__sync_fetch_and_sub(&queue->readers_sleeping, 1);
+			break;
+		}
+		wait_event(queue->readable_fd, -1);
+		__sync_fetch_and_sub(&queue->readers_sleeping, 1);
 	}
 	
-	return LNP_ERROR;
+	__sync_fetch_and_add(&queue->dequeued, 1);
+	__sync_synchronize();
+	if (queue->writers_sleeping > 0) {
+		signal_event(queue->writable_fd);
+	}
+	
+	return return_value;
 }
 /******************************************************************************/
 int lnp_try_dequeue_datagram(net_id_t from, u_char *datagram, int max,
 		u_char protocol) {
+	queue_t *queue;
 	int return_value;
-	u_char *id = NULL;
-
+	
 	int queue_index = get_queue_index(protocol);
 	if (queue_index == LNP_ERROR) {
 		return LNP_ERROR;
 	}
-	return_value = util_try_dequeue(&queues[queue_index], (void **)&id, 
-			datagram, max);
-	/* We are using the tag pointer to store the id. */
-	if (return_value != UTIL_ERROR) {
-		memcpy(from, id, sizeof(net_id_t));
-		free(id);
-		return return_value;
+	queue = &queues[queue_index];
+	
+	return_value = pop(queue, from, datagram, max);
+	if (return_value == LNP_ERROR) {
+		return LNP_ERROR;
+	}
+	
+	__sync_fetch_and_add(&queue->dequeued, 1);
+	__sync_synchronize();
+	if (queue->writers_sleeping > 0) {
+		signal_event(queue->writable_fd);
 	}
 	
-	return LNP_ERROR;
+	return return_value;
+}
+/******************************************************************************/
+int lnp_get_queue_stats(u_char protocol, lnp_queue_stats_t *stats) {
+	queue_t *queue;
+	
+	int queue_index = get_queue_index(protocol);
+	if (queue_index == LNP_ERROR) {
+		return LNP_ERROR;
+	}
+	queue = &queues[queue_index];
+	
+	stats->enqueued = queue->enqueued;
+	stats->dequeued = queue->dequeued;
+	stats->dropped = queue->dropped;
+	stats->high_water = queue->high_water;
+	stats->length = queue->enqueue_position - queue->dequeue_position;
+	stats->capacity = queue->mask + 1;
+	
+	return LNP_OK;
 }
 
 /*============================================================================*/
@@ -165,3 +322,153 @@ int get_queue_index(u_char protocol) {
 	}
 }
 /******************************************************************************/
+int initialize_queue(queue_t *queue, int size) {
+	unsigned capacity;
+	unsigned i;
+	
+	memset(queue, 0, sizeof(queue_t));
+	queue->readable_fd = -1;
+	queue->writable_fd = -1;
+	
+	/* Positions are mapped to slots with a mask. */
+	capacity = 1;
+	while (capacity < (unsigned)size) {
+		capacity <<= 1;
+	}
+	
+	queue->slots = (slot_t *)malloc(capacity * sizeof(slot_t));
+	if (queue->slots == NULL) {
+		liblog_fatal(LAYER_NET, "error in malloc: %s.", strerror(errno));
+		return LNP_ERROR;
+	}
+	for (i = 0; i < capacity; i++) {
+		queue->slots[i].sequence = i;
+	}
+	queue->mask = capacity - 1;
+	
+	queue->readable_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+	queue->writable_fd = eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK);
+	if (queue->readable_fd == -1 || queue->writable_fd == -1) {
+		liblog_fatal(LAYER_NET, "error creating eventfd: %s.", strerror(errno));
+		finalize_queue(queue);
+		return LNP_ERROR;
+	}
+	
+	return LNP_OK;
+}
+/******************************************************************************/
+void finalize_queue(queue_t *queue) {
+	if (queue->readable_fd != -1) {
+		close(queue->readable_fd);
+	}
+	if (queue->writable_fd != -1) {
+		close(queue->writable_fd);
+	}
+	free(queue->slots);
+	queue->slots = NULL;
+}
+/******************************************************************************/
+int push(queue_t *queue, net_id_t from, u_char *datagram, int length) {
+	slot_t *slot;
+	unsigned position;
+	int difference;
+	
+	position = queue->enqueue_position;
+	for (;;) {
+		slot = &queue->slots[position & queue->mask];
+		difference = (int)(slot->sequence - position);
+		if (difference == 0) {
+			if (__sync_bool_compare_and_swap(&queue->enqueue_position, 
+					position, position + 1)) {
+				break;
+			}
+		} else if (difference < 0) {
+			/* The slot still holds the datagram of the previous lap. */
+			return LNP_ERROR;
+		}
+		position = queue->enqueue_position;
+	}
+	
+	memcpy(slot->from, from, sizeof(net_id_t));
+	memcpy(slot->data, datagram, length);
+	slot->length = length;
+	
+	/* The slot must be complete before consumers can see it. */
+	__sync_synchronize();
+	slot->sequence = position + 1;
+	
+	return LNP_OK;
+}
+/******************************************************************************/
+int pop(queue_t *queue, net_id_t from, u_char *datagram, int max) {
+	slot_t *slot;
+	unsigned position;
+	int difference;
+	int length;
+	
+	position = queue->dequeue_position;
+	for (;;) {
+		slot = &queue->slots[position & queue->mask];
+		difference = (int)(slot->sequence - (position + 1));
+		if (difference == 0) {
+			if (__sync_bool_compare_and_swap(&queue->dequeue_position, 
+					position, position + 1)) {
+				break;
+			}
+		} else if (difference < 0) {
+			/* No datagram was published in the slot yet. */
+			return LNP_ERROR;
+		}
+		position = queue->dequeue_position;
+	}
+	
+	__sync_synchronize();
+	length = slot->length;
+	if (from != NULL) {
+		memcpy(from, slot->from, sizeof(net_id_t));
+	}
+	if (datagram != NULL) {
+		if (length > max) {
+			length = max;
+		}
+		memcpy(datagram, slot->data, length);
+	}
+	
+	/* The slot is released for the producer of the next lap. */
+	__sync_synchronize();
+	slot->sequence = position + queue->mask + 1;
+	
+	return length;
+}
+/******************************************************************************/
+void wait_event(int fd, int timeout) {
+	struct pollfd descriptor;
+	uint64_t value;
+	
+	descriptor.fd = fd;
+	descriptor.events = POLLIN;
+	
+	/* Another thread may take the event first, the caller tries again. */
+	if (poll(&descriptor, 1, timeout) > 0) {
+		if (read(fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+			liblog_error(LAYER_NET, "error reading eventfd: %s.", 
+					strerror(errno));
+		}
+	}
+}
+/******************************************************************************/
+void signal_event(int fd) {
+	uint64_t value = 1;
+	
+	if (write(fd, &value, sizeof(value)) == -1) {
+		liblog_error(LAYER_NET, "error writing eventfd: %s.", strerror(errno));
+	}
+}
+/******************************************************************************/
+long get_clock() {
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+/******************************************************************************/
@@ -29,7 +29,48 @@
 #define _LNP_QUEUE_H_
 
 /**
- * Initializes the queue, allocating needed memory.
+ * Maximum number of datagrams held by a queue.
+ */
+#define LNP_MAX_QUEUE_SIZE		4096
+
+/**
+ * Maximum time a receiver waits for room in a queue, in milliseconds.
+ */
+#define LNP_MAX_QUEUE_TIMEOUT	10000
+
+/**
+ * Enumeration of the behaviours of the receivers when a queue is full.
+ */
+enum lnp_queue_policies {
+	LNP_QUEUE_DROP_NEWEST = 1,	/**< The new datagram is dropped. */
+	LNP_QUEUE_DROP_OLDEST,		/**< The oldest datagram is dropped. */
+	LNP_QUEUE_BLOCK				/**< The receiver waits for room, until a 
+									timeout. */
+};
+
+/**
+ * Counters of a queue.
+ */
+typedef struct {
+	/** Number of datagrams stored in the queue. */
+	long enqueued;
+	/** Number of datagrams read from the queue. */
+	long dequeued;
+	/** Number of datagrams dropped because the queue was full. */
+	long dropped;
+	/** Largest number of datagrams held by the queue. */
+	int high_water;
+	/** Number of datagrams held by the queue now. */
+	int length;
+	/** Number of datagrams the queue can hold. */
+	int capacity;
+} lnp_queue_stats_t;
+
+/**
+ * Initializes the queues, allocating needed memory. Each queue is a lock-free
+ * ring of slots holding up to LIBFREEDOM_FTU bytes, with its configured size
+ * rounded up to a power of two. When a queue is full, the configured queue
+ * policy decides which datagram is lost.
  */
 int lnp_queue_initialize();
 
@@ -81,4 +122,13 @@ int lnp_dequeue_datagram(net_id_t from, u_char *datagram, int max,
 int lnp_try_dequeue_datagram(net_id_t from, u_char *datagram, int max,
 		u_char protocol);
 
+/**
+ * Copies the counters of the queue used by the given protocol to stats.
+ * 
+ * @param protocol LNP_PROTOCOL_RELIABLE or LNP_PROTOCOL_UNRELIABLE.
+ * @param stats structure that will receive the counters.
+ * @return LNP_OK if no errors occurred, LNP_ERROR otherwise.
+ */
+int lnp_get_queue_stats(u_char protocol, lnp_queue_stats_t *stats);
+
 #endif /* !_LLP_QUEUE_H_ */
@@ -85,7 +85,16 @@ int lnp_key_store_initialize() {
 }
 /******************************************************************************/
 void lnp_key_store_finalize() {
-	/*int i;
+	int i;
+
+	for (i = 0; i < KEY_TABLE_SIZE; i++) {
+		libkeys_destroy(lnp_key_store[i].crypto_in);
+		libkeys_destroy(lnp_key_store[i].crypto_out);
+		lnp_key_store[i].crypto_in = NULL;
+		lnp_key_store[i].crypto_out = NULL;
+	}
+
+	/*
 	
 	for (i=0; i<KEY_TABLE_SIZE-1; i++) {
 		pthread_mutex_destroy(&lnp_key_store[i].handshake_mutex);
@@ -116,6 +125,10 @@ void lnp_key_store_delete(int key_entry_index) {
 	if (lnp_key_store[key_entry_index].next_free_slot == USED_SLOT) {
 		lnp_key_store[key_entry_index].next_free_slot = first_free_slot;
 		first_free_slot = key_entry_index;
+		libkeys_destroy(lnp_key_store[key_entry_index].crypto_in);
+		libkeys_destroy(lnp_key_store[key_entry_index].crypto_out);
+		lnp_key_store[key_entry_index].crypto_in = NULL;
+		lnp_key_store[key_entry_index].crypto_out = NULL;
 	}
 	pthread_mutex_unlock(&lnp_key_store_mutex);
 }
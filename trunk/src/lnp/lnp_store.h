@@ -34,6 +34,8 @@
 #include <libfreedom/layer_net.h>
 #include <util/util_crypto.h>
 
+#include <libkeys.h>
+
 #include "lnp_packets.h"
 
 /**
@@ -77,6 +79,17 @@ enum lnp_handshake_states {
 	LNP_HANDSHAKE_CONNECTED
 };
 
+/**
+ * Framings of the LNP_DATA packets, negotiated in the key exchange.
+ */
+enum lnp_framings {
+	/** The MAC covers the plaintext and is checked after decryption. */
+	LNP_FRAMING_MAC_THEN_ENCRYPT,
+	/** The MAC covers the header and the ciphertext, and is checked before
+	 * decryption. */
+	LNP_FRAMING_ENCRYPT_THEN_MAC
+};
+
 /**
  * Data type that stores the information associated with a key store entry.
  */
@@ -100,6 +113,8 @@ typedef struct {
 	util_hash_function_t *hash;
 	/** MAC function used. */
 	util_mac_function_t *mac;
+	/** Framing of LNP_DATA packets, one of the LNP_FRAMING_* constants. */
+	int framing;
 	/** Key to decrypt incoming traffic. */
 	u_char *cipher_in_key;
 	/** Initialization vector of decryption. */
@@ -112,6 +127,10 @@ typedef struct {
 	u_char *mac_in_key;
 	/** Key to generate MAC of outgoing traffic. */
 	u_char *mac_out_key;
+	/** Expanded keys used to decrypt and verify incoming traffic. */
+	libkeys_t *crypto_in;
+	/** Expanded keys used to encrypt and authenticate outgoing traffic. */
+	libkeys_t *crypto_out;
 	/** Next free slot. */
 	int next_free_slot;
 	/** */